@@ -0,0 +1,53 @@
+# Training workload of the profile-guided optimization (SFT_PGO), run with cmake -P by the instrumented build:
+#   - the Laramie standalone run (3 years of hourly forcing), compared against the golden test
+#   - the unit-test configs (tests/configs), driven by the Laramie forcing
+# Variables: SFT_SOURCE_DIR, SFT_BINARY_DIR (instrumented build), SFT_PROFILE_DIR (profiles written by the
+# instrumented binaries). The workload runs again only if the instrumented binaries were rebuilt since the
+# profiles were collected (stamp file), so an unchanged tree does not recompile the optimized build.
+
+set(standalone ${SFT_BINARY_DIR}/sft_standalone)
+set(stamp ${SFT_PROFILE_DIR}/training.stamp)
+
+file(GLOB instrumented ${standalone} ${SFT_BINARY_DIR}/libsftbmi.so* ${SFT_BINARY_DIR}/libsftbmi.dylib)
+set(outdated FALSE)
+if(NOT EXISTS ${stamp})
+  set(outdated TRUE)
+endif()
+foreach(binary ${instrumented})
+  if(${binary} IS_NEWER_THAN ${stamp})
+    set(outdated TRUE)
+  endif()
+endforeach()
+
+if(NOT outdated)
+  message(STATUS "PGO training: profiles are up to date")
+  return()
+endif()
+
+# profiles of a previous build do not match the instrumented code
+file(REMOVE_RECURSE ${SFT_PROFILE_DIR})
+file(MAKE_DIRECTORY ${SFT_PROFILE_DIR})
+
+message(STATUS "PGO training: Laramie standalone run")
+execute_process(COMMAND ${standalone} ./configs/laramie_config_standalone.txt
+                WORKING_DIRECTORY ${SFT_SOURCE_DIR} RESULT_VARIABLE status OUTPUT_VARIABLE output ERROR_VARIABLE output)
+if(NOT status EQUAL 0)
+  message(FATAL_ERROR "PGO training: the instrumented Laramie run failed (${status}):\n${output}")
+endif()
+
+file(GLOB configs ${SFT_SOURCE_DIR}/tests/configs/*.txt)
+foreach(config ${configs})
+  get_filename_component(name ${config} NAME)
+  message(STATUS "PGO training: ${name}")
+  # the forcing file comes first, the driver reads the first forcing_file of the config
+  file(READ ${config} contents)
+  set(training_config ${SFT_BINARY_DIR}/pgo_${name})
+  file(WRITE ${training_config} "forcing_file=${SFT_SOURCE_DIR}/forcings/Laramie_14Jun09_to_15Apr12.csv\n${contents}")
+  execute_process(COMMAND ${standalone} ${training_config} none
+                  WORKING_DIRECTORY ${SFT_SOURCE_DIR} RESULT_VARIABLE status OUTPUT_VARIABLE output ERROR_VARIABLE output)
+  if(NOT status EQUAL 0)
+    message(FATAL_ERROR "PGO training: the instrumented run of ${name} failed (${status}):\n${output}")
+  endif()
+endforeach()
+
+file(WRITE ${stamp} "")
@@ -32,6 +32,7 @@ class BmiSoilFreezeThaw : public bmixx::Bmi {
       this->calib_var_names[1]  = "b";
       this->calib_var_names[2]  = "satpsi";
 
+      this->forcing_step = 0;
     };
 
     void Initialize(std::string config_file);
@@ -85,6 +86,37 @@ class BmiSoilFreezeThaw : public bmixx::Bmi {
     void GetGridFaceEdges(const int grid, int *face_edges);
     void GetGridFaceNodes(const int grid, int *face_nodes);
     void GetGridNodesPerFace(const int grid, int *nodes_per_face);
+
+    /* Extensions (not part of BMI) */
+    // prints the counters of the timestep optimizations, e.g. factorization reuse rate
+    void PrintStatistics(std::ostream &os);
+
+    // variable handles: GetVarHandle resolves a name once (throws if the variable does not exist), the
+    // functions taking the handle then access the variable without string work. A handle is the same for
+    // every instance of the class; the gather/scatter copy the items as int or double (see GetVarType)
+    int GetVarHandle(const std::string &name);
+    void *GetValuePtrByHandle(int handle);
+    void GetValueByHandle(int handle, void *dest);
+    void SetValueByHandle(int handle, const void *src);
+    void GetValueAtIndicesByHandle(int handle, void *dest, const int *inds, int count);
+    void SetValueAtIndicesByHandle(int handle, const int *inds, int count, const void *src);
+
+    // bulk forcing: the ground temperature [K] of nsteps consecutive timesteps and optionally the soil moisture
+    // profiles (nsteps x num_cells, step-major) are copied; each following timestep of Update/UpdateUntil (not
+    // the fractional step of UpdateUntil) sets the forcing of the next step, overriding SetValue, until the
+    // series is exhausted. The outputs ice_fraction_schaake, ice_fraction_xinanjiang, soil_ice_fraction,
+    // ground_heat_flux and soil_temperature_profile of each forced step are recorded in contiguous arrays
+    // (GetOutputSeries: GetSeriesStepCount() items per step of the variable, step-major); a new series resets them
+    void SetForcingSeries(const double *ground_temperature, int nsteps, const double *soil_moisture = NULL);
+    int GetSeriesStepCount();
+    const double *GetOutputSeries(const std::string &name);
+
+    // binary checkpoint of the model state (see SoilFreezeThaw::SaveCheckpoint): a model initialized from the
+    // same config and restored continues bitwise identically to the saved one; the bulk forcing is not saved
+    void SaveCheckpoint(std::ostream &os);
+    void SaveCheckpoint(const std::string &file);
+    void RestoreCheckpoint(std::istream &is);
+    void RestoreCheckpoint(const std::string &file);
   private:
     soilfreezethaw::SoilFreezeThaw* state;
     static const int input_var_name_count  = 2;
@@ -95,6 +127,17 @@ class BmiSoilFreezeThaw : public bmixx::Bmi {
     std::string output_var_names[output_var_name_count];
     std::string calib_var_names[calib_var_name_count];
     std::string verbosity;
+
+    // bulk forcing (SetForcingSeries) and the recorded outputs
+    static const int series_output_count = 5;
+    std::vector<double> forcing_ground_temperature;
+    std::vector<double> forcing_soil_moisture;
+    int forcing_step;                                   // next step of the series, number of recorded steps
+    int series_output_handle[series_output_count];
+    std::vector<double> series_outputs[series_output_count];
+
+    // one timestep: the forcing of the series (if any left), Advance, the recorded outputs
+    void AdvanceStep();
 };
 
 #ifdef NGEN
@@ -124,4 +167,23 @@ extern "C"
 }
 #endif
 
+/*
+  C interface of the variable handles (BmiSoilFreezeThaw::GetVarHandle) and of the checkpoints, for coupling
+  layers that hold the model created by bmi_model_create. The functions return 0 (BMI_SUCCESS) or 1 (BMI_FAILURE:
+  NULL model or pointer argument, unknown name, invalid handle, checkpoint not written or not matching the model),
+  no exception crosses the interface.
+*/
+extern "C"
+{
+  int bmi_sft_get_var_handle(BmiSoilFreezeThaw *model, const char *name, int *handle);
+  int bmi_sft_get_value_ptr(BmiSoilFreezeThaw *model, int handle, void **ptr);
+  int bmi_sft_get_value(BmiSoilFreezeThaw *model, int handle, void *dest);
+  int bmi_sft_set_value(BmiSoilFreezeThaw *model, int handle, const void *src);
+  int bmi_sft_get_value_at_indices(BmiSoilFreezeThaw *model, int handle, void *dest, const int *inds, int count);
+  int bmi_sft_set_value_at_indices(BmiSoilFreezeThaw *model, int handle, const int *inds, int count,
+				   const void *src);
+  int bmi_sft_save_checkpoint(BmiSoilFreezeThaw *model, const char *file);
+  int bmi_sft_restore_checkpoint(BmiSoilFreezeThaw *model, const char *file);
+}
+
 #endif
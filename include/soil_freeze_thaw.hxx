@@ -45,8 +45,34 @@
   @param is_soil_moisture_bmi_set   [-]    : if not standalone, soil moisture is set through SoilMoistureProfiles bmi
   @param quartz                     [-]    : quartz content used in the thermal conductivity model
   @param verbosity                  [-]    : flag for screen outputs for debugging, options = none, high
+  @param phase_change_scheme        [-]    : split = diffusion followed by the freezing-point depression correction (PhaseChange),
+                                             enthalpy = latent heat solved implicitly with the diffusion (SolveEnthalpyEquation)
+  @param adaptive_timestep          [-]    : if true, Advance() covers dt with adaptive sub-steps (step rejection instead of
+                                             large local errors), see AdvanceAdaptive
+  @param adaptive_temperature_tolerance [K] : tolerance of the local error (temperature change) of a sub-step
+  @param adaptive_dt_min            [s]    : smallest sub-step
+  @param constitutive_tables        [-]    : if true, the supercooled water (split phase change) and the thermal conductivity
+                                             are interpolated from tables shared by the models of a soil type (ConstitutiveTables)
+  @param constitutive_table_resolution [-] : nodes per octave of the tables, a power of two in [8, 4096]
+  @param partitioned_solver_cells   [-]    : columns of at least this many cells solve the diffusion equation with the
+                                             partitioned tridiagonal solver (PartitionedTridiagonal) instead of the
+                                             Thomas algorithm, 0 = never
+  @param partitioned_solver_threads [-]    : threads of the partitioned tridiagonal solver
+  @param simd_path                  [-]    : instruction set of the per-cell kernels and the partitioned solver: auto (widest
+                                             supported by the CPU), scalar, sse2, avx2 or avx512; the environment
+                                             variable SFT_SIMD_PATH takes precedence, see soil_freeze_thaw_simd.hxx
+  @param spinup_forcing_file        [-]    : spin-up forcing, ground temperature (TMP_ground_surface) of a forcing file, see Spinup
+  @param spinup_steps               [-]    : timesteps of the spin-up window (first rows of the file), 0 = the whole file
+  @param spinup_cycles              [-]    : number of times the spin-up window is run (the largest number with spinup_tolerance)
+  @param spinup_tolerance           [K]    : if > 0, the window is cycled to periodic equilibrium: until the soil temperatures at
+                                             the end of a cycle change less than spinup_tolerance and the ice contents less than
+                                             spinup_ice_tolerance over the cycle, see SpinupToEquilibrium
+  @param spinup_ice_tolerance       [-]    : tolerance of the ice contents of the periodic equilibrium
+  @param spinup_anderson_depth      [-]    : cycles kept by the Anderson mixing of the end-of-cycle states, 0 = plain cycling
+  @param spinup_cache_dir           [-]    : directory of the cached spun-up states, empty = no cache
 
-  @param energy_balance             [W/m2] : global (cumulative) energy balance
+  @param energy_balance             [W/m2] : global (cumulative) energy balance, compensated (Neumaier) sum of the
+                                             local errors
   @param energy_consumed            [W/m2] : energy consumed (loss/gain) during the phase change
 */
 
@@ -60,17 +86,140 @@
 #include <fstream>
 #include <sstream>
 #include <cassert>
+#include <cstdint>
+#include "soil_freeze_thaw_tables.hxx"
+#include "soil_freeze_thaw_tridiagonal.hxx"
 
 using namespace std;
 
+// model version (CMake: the project version), part of the spin-up cache fingerprint
+#ifndef SFT_VERSION
+#define SFT_VERSION "1.0.0"
+#endif
+
 class Properties;
 
 namespace soilfreezethaw {
+
+  const double energy_balance_tolerance = 1.0E-4; // [W/m2] tolerance of the global (cumulative) energy balance
+  const int partitioned_solver_cells_default = 256; // [-] crossover of the Thomas algorithm and the partitioned
+                                                    // solver, see tests/main_benchmark_tridiagonal.cxx
+  const int checkpoint_version = 2;                 // [-] layout of the binary checkpoint, see SaveCheckpoint
+
+  /* ground temperature [K] of a forcing file (csv, TMP_ground_surface column as the standalone driver) */
+  std::vector<double> ReadGroundTemperatureForcing(const std::string &forcing_file);
+
+  /* adds value to sum with compensated (Neumaier) summation: sum is the rounded total and compensation
+     carries the rounding errors, so long accumulations (e.g. the cumulative energy balance) do not drift */
+  inline void CompensatedSum(double &sum, double &compensation, double value)
+  {
+    double t = sum + value;
+    if ((sum < 0 ? -sum : sum) >= (value < 0 ? -value : value))
+      compensation += (sum - t) + value;
+    else
+      compensation += (value - t) + sum;
+    sum = t + compensation;
+    compensation = compensation - (sum - t);
+  }
   
   class SoilFreezeThaw {
   private:
     std::string config_file;
     void InitializeArrays(void);
+
+    /* scratch arrays of the timestep (diffusion equation, TDMA and phase change); sized once in
+       InitializeArrays and reused by every timestep, so Advance() does not allocate */
+    struct Workspace {
+      std::vector<double> thermal_flux;
+      std::vector<double> AI;
+      std::vector<double> BI;
+      std::vector<double> CI;
+      std::vector<double> RHS;
+      std::vector<double> lambda;
+      std::vector<double> X;
+      std::vector<double> dsoilT_dz;
+      std::vector<double> P;                 // TDMA forward-pass coefficients
+      std::vector<double> Q;
+      std::vector<double> pivot;             // TDMA pivots (b_i + a_i P_i-1), see FactorTDMA
+      std::vector<double> HeatEnergy_L;      // phase change energies of the cells, see PhaseChange()
+      std::vector<double> HeatResidual_L;
+      std::vector<double> T_star;            // enthalpy solver: temperature below which the cell starts to freeze
+      std::vector<double> liquid_iter;       // enthalpy solver: liquid content at the Newton iterate
+      std::vector<double> dliquid_dT;        // enthalpy solver: derivative of the liquid content [1/K]
+      std::vector<double> soil_temperature_s;      // state at the beginning of a sub-step, restored if
+      std::vector<double> soil_moisture_content_s; // the sub-step is rejected (see AdvanceAdaptive)
+      std::vector<double> soil_liquid_content_s;
+      std::vector<double> soil_ice_content_s;
+      void Resize(int n);
+    };
+    Workspace work;
+
+    /* constants derived from the grid and the soil parameters only; built at initialization and
+       rebuilt by UpdateInvariants() when any of the inputs (soil_z, dt, smcmax, b, satpsi, quartz) changes */
+    struct Invariants {
+      bool   valid;
+      unsigned long generation;              // incremented on every rebuild
+      double dt, smcmax, b, satpsi, quartz;  // inputs the block was built from
+      std::vector<double> h1;                // cell thickness used in lambda = dt/(h1 * heat_capacity)
+      std::vector<double> h2;                // distance between the neighbouring cells
+      std::vector<double> denominator;       // 2/h2
+      double tc_solid;                       // thermal conductivity of soil solids
+      double tc_solid_sat;                   // pow(tc_solid, 1-smcmax), solids part of the saturated conductivity
+      double tc_dry;                         // dry thermal conductivity
+      double hc_solid;                       // (1-smcmax) * hcsoil, solids part of the heat capacity
+      double lam;                            // -1/b, exponent of the supercooled liquid water function
+      int    table_resolution;               // resolution of tables, 0 without constitutive tables
+      std::shared_ptr<const ConstitutiveTables> tables; // shared tables of the soil type (constitutive_tables)
+    };
+    Invariants invariants;
+
+    /* inputs of the diffusion coefficients at the last factorization of the diffusion matrix,
+       see BeginTimestep */
+    struct CoefficientCache {
+      bool factorized;                       // workspace holds the factorization of the diffusion matrix
+      bool factorization_ok;                 // false if the matrix was singular
+      unsigned long invariants_generation;
+      std::vector<double> soil_moisture_content;
+      std::vector<double> soil_liquid_content;
+    };
+    CoefficientCache coefficients;
+
+    /* factorization of the diffusion matrix of long columns, see SelectKernels */
+    PartitionedTridiagonal tridiagonal;
+
+    bool BeginTimestep();
+    bool IsThawedColumn();
+    void ThawedColumnUpdate();
+    void SolveDiffusionEquation(bool reuse_factorization);
+    bool FactorTDMA(const vector<double> &a, const vector<double> &b, const vector<double> &c);
+    void SubstituteTDMA(const vector<double> &a, const vector<double> &d, vector<double> &X);
+
+    double adaptive_substep;                 // [s] sub-step size carried over to the next timestep
+    double energy_balance_substeps;          // [W/m2] local energy balance error averaged over the sub-steps
+    bool   AdvanceSolution();
+    void   SolveEnthalpyEquation();
+    void   RepartitionEnthalpy();            // moves a temperature change onto the freezing curve, see SpinupToEquilibrium
+
+    /* kernels specialized for a fixed number of cells N (loops with constant bounds, boundary cells peeled,
+       stack-resident scratch), bitwise identical to SolveDiffusionEquation(bool) and PhaseChange();
+       selected once by SelectKernels */
+    template <int N> void SolveDiffusionEquationN(bool reuse_factorization);
+    template <int N> void PhaseChangeN();
+
+    /* generic diffusion kernel with the coefficient assembly fused into one sweep over the cells (thermal
+       conductivity, heat capacity, fluxes, A, B, C, RHS and the forward elimination), bitwise identical to
+       ThermalConductivity(), SoilHeatCapacity() and SolveDiffusionEquation(bool); Partitioned = true solves
+       the system with the partitioned tridiagonal solver */
+    template <bool Partitioned> void SolveDiffusionEquationFused(bool reuse_factorization);
+    void (SoilFreezeThaw::*diffusion_kernel)(bool);
+    void (SoilFreezeThaw::*phase_change_kernel)();
+    bool   AdvanceAdaptive();
+    double SubstepError(double energy_balance_substep, bool thawed);
+    double EnergyBalanceTimestep(double &energy_previous, double &energy_current);
+
+    /* spin-up: one cycle of the forcing window, and the cycles to periodic equilibrium (spinup_tolerance) */
+    void RunSpinupCycle(const std::vector<double> &forcing);
+    void SpinupToEquilibrium(const std::vector<double> &forcing);
     
   public:
     int    shape[3];
@@ -109,9 +258,52 @@ namespace soilfreezethaw {
     bool   is_soil_moisture_bmi_set;
     double energy_consumed;
     double energy_balance;
+    double energy_balance_compensation; // rounding error carried by the compensated sum of energy_balance
     
     std::string ice_fraction_scheme;
     std::string verbosity;
+    std::string phase_change_scheme;
+
+    bool   adaptive_timestep;
+    double adaptive_temperature_tolerance;
+    double adaptive_dt_min;
+
+    bool   constitutive_tables;
+    int    constitutive_table_resolution;
+
+    int    partitioned_solver_cells;
+    int    partitioned_solver_threads;
+
+    std::string spinup_forcing_file;
+    int    spinup_steps;
+    int    spinup_cycles;
+    double spinup_tolerance;
+    double spinup_ice_tolerance;
+    int    spinup_anderson_depth;
+    std::string spinup_cache_dir;
+    int    spinup_cycles_used;               // cycles run by the last Spinup (0 if restored from the cache)
+    bool   spinup_converged;                 // the last Spinup reached the tolerances (spinup_tolerance > 0)
+    double spinup_temperature_change;        // [K] largest change of the soil temperatures over the last cycle
+    double spinup_ice_change;                // [-] largest change of the ice contents over the last cycle
+    std::string spinup_cache_result;         // result of the last Spinup: off (no cache), hit or miss
+    std::string spinup_cache_file;           // cached state of the last Spinup
+
+    std::string simd_path_option;            // requested instruction set (config key simd_path), see SelectKernels
+    SimdPath    simd_path;                   // selected instruction set of the kernels
+
+    /* counters of the timestep optimizations, see PrintStatistics */
+    struct Statistics {
+      long steps;
+      long factorizations;                   // diffusion matrix factorized
+      long factorization_reuses;             // coefficients unchanged, factorization reused
+      long thawed_steps;                     // phase change bypassed, column fully thawed
+      long substeps;                         // accepted sub-steps (adaptive_timestep)
+      long rejected_substeps;                // sub-steps rejected and retried with a smaller size
+      long newton_iterations;                // enthalpy solver (phase_change_scheme = enthalpy)
+      Statistics() : steps(0), factorizations(0), factorization_reuses(0), thawed_steps(0),
+		     substeps(0), rejected_substeps(0), newton_iterations(0) {}
+    };
+    Statistics stats;
     enum SurfaceRunoffScheme{Schaake=1, Xinanjiang=2}; // surface runoff schemes
     
     SoilFreezeThaw();
@@ -146,6 +338,50 @@ namespace soilfreezethaw {
 
     /* computes energy balance locally and globally */
     void EnergyBalanceCheck();
+
+    /* rebuilds the invariant block if the grid, dt or soil parameters changed */
+    void UpdateInvariants();
+
+    /* forces a rebuild of the invariant block before the next timestep (e.g., soil parameters set through BMI) */
+    void InvalidateInvariants();
+
+    /* returns the constitutive tables used by the model, NULL if constitutive_tables is false */
+    const ConstitutiveTables *GetConstitutiveTables();
+
+    /* selects the timestep kernels for ncells: specialized kernels for 4 cells, generic
+       otherwise or if specialized is false; the generic kernel uses the fused assembly unless fused is false,
+       or the partitioned tridiagonal solver for at least partitioned_solver_cells cells; selects the instruction
+       set of the kernels (simd_path_option, SFT_SIMD_PATH); returns the number of cells of the specialized kernel (0 = generic).
+       Called by the config file constructor, a default constructed model has the generic kernels and the scalar path */
+    int SelectKernels(bool specialized = true, bool fused = true);
+    int kernel_cells;
+    bool fused_assembly;
+    bool partitioned_solver;
+
+    /* prints the counters of the timestep optimizations (e.g., factorization reuse rate) */
+    void PrintStatistics(std::ostream &os);
+
+    /* writes the state of the model (time, temperatures, water contents, energy balance, adaptive sub-step,
+       soil parameters) as a versioned binary checkpoint; RestoreCheckpoint reads it into a model of the same
+       configuration (grid, dt, phase change scheme, adaptive timestep, constitutive tables), so the resumed
+       run is bitwise identical to the uninterrupted one, and throws if the checkpoint does not match (version 1
+       checkpoints are migrated) */
+    void SaveCheckpoint(std::ostream &os);
+    void SaveCheckpoint(const std::string &file);
+    void RestoreCheckpoint(std::istream &is);
+    void RestoreCheckpoint(const std::string &file);
+
+    /* spin-up (config keys spinup_*, run by BmiSoilFreezeThaw::Initialize): runs the first spinup_steps timesteps
+       of the ground temperature of spinup_forcing_file spinup_cycles times from the initial state, then restarts
+       the clock (time and the cumulative energy balance are zero). With spinup_cache_dir, the spun-up state is
+       stored as a checkpoint named by SpinupFingerprint, and a later spin-up with the same fingerprint restores
+       it instead of running the window */
+    void Spinup();
+
+    /* fingerprint of the spin-up: model version, compiler and math functions, the configuration parsed by
+       InitFromConfigFile (grid, dt, soil parameters, initial profiles, boundary conditions, numerics) and the
+       bits of the forcing window */
+    uint64_t SpinupFingerprint(const std::vector<double> &forcing, const std::string &version = SFT_VERSION);
     
     // method retuns dynamically allocated input variable names
     std::vector<std::string>* InputVarNamesModel();
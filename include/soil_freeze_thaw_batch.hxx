@@ -0,0 +1,176 @@
+/*
+  Batched (multi-column) soil freeze-thaw engine.
+
+  SoilFreezeThawBatch advances many independent soil columns with a single call. It follows
+  the same physics as SoilFreezeThaw (ThermalConductivity, SoilHeatCapacity,
+  SolveDiffusionEquation, PhaseChange, ComputeIceFraction and EnergyBalanceCheck), but the
+  state of all columns is stored in structure-of-arrays layout, cell-major and column-minor:
+  the value of cell `i` in column `c` is stored at index [i * ncolumns + c]. Every inner loop
+  runs over columns, so a cell of all columns is processed with contiguous (SIMD-friendly)
+  memory accesses and the tridiagonal solves of all columns are interleaved.
+
+  All columns must share the same vertical discretization (soil_z) and timestep (dt); soil
+  parameters, boundary conditions and the runoff scheme can differ from column to column.
+
+  Precision: the engine is a template on the type of the per-cell arrays,
+  - Real  : heat capacity, thermal conductivity and the tridiagonal systems (AI, BI, CI, TDMA workspace)
+  - State : soil moisture, liquid and ice contents
+  SoilFreezeThawBatch (double, double) is bitwise identical to SoilFreezeThaw. SoilFreezeThawBatchMixed
+  (float, double) solves the tridiagonal systems in single precision with iterative refinement in double
+  (see SolverRefined); SoilFreezeThawBatchSingle (float, float) also stores the moisture states in single
+  precision. Soil temperatures stay double in all modes: in single precision the resolution at ~280 K is
+  1.5e-5 K and the hourly increments of the deep cells would be lost (a systematic energy balance drift).
+  Per-column quantities (fluxes, phase change energy, ice fractions) are double, and the cumulative energy
+  balance is a compensated double sum (see CompensatedSum).
+
+  Timestep optimizations of SoilFreezeThaw: the thermal conductivity, heat capacity and the factorization of the
+  diffusion matrices are reused while the moisture contents, the soil parameters and dt of all the columns are
+  unchanged (see BeginTimestep), and the phase change is bypassed while all the columns are thawed (see IsThawed).
+
+  @param ncolumns                   [-]    : number of columns in the batch
+  @param ncells                     [-]    : number of cells in each soil column
+  @param soil_z                     [m]    : soil discretization shared by all columns (ncells)
+  @param soil_dz                    [m]    : soil cells thickness shared by all columns (ncells)
+  @param ground_temp                [K]    : ground surface temperature (ncolumns), set before Advance()
+  @param soil_temperature           [K]    : soil temperature (ncells x ncolumns)
+  @param soil_moisture_content      [-]    : total soil moisture content (ncells x ncolumns)
+  @param soil_liquid_content        [-]    : liquid soil moisture content (ncells x ncolumns)
+  @param soil_ice_content           [-]    : ice soil moisture content (ncells x ncolumns)
+  @param ice_fraction_schaake       [m]    : ice fraction based on Schaake runoff scheme (ncolumns)
+  @param ice_fraction_xinanjiang    [-]    : ice fraction based on Xinanjiang runoff scheme (ncolumns)
+  @param soil_ice_fraction          [-]    : fraction of soil moisture that is ice (ncolumns)
+*/
+
+#ifndef SFT_BATCH_H_INCLUDED
+#define SFT_BATCH_H_INCLUDED
+
+#include <vector>
+#include "soil_freeze_thaw.hxx"
+
+namespace soilfreezethaw {
+
+  template <typename Real, typename State = Real>
+  class SoilFreezeThawBatchT {
+  private:
+    void ThermalConductivity();
+    void ThermalConductivityConstants();
+    double CellThermalConductivity(int k, int c) const;
+    void SoilHeatCapacity();
+    double CellHeatCapacity(int k, int c, const Properties &prop) const;
+    bool BeginTimestep();
+    void SolveDiffusionEquation();
+    void SolveDiffusionEquationFused(bool reuse_factorization);
+    void SolverTDMA();
+    void SolverRefined();
+    void PhaseChange();
+    void ComputeIceFraction();
+    void EnergyBalanceCheck();
+    bool IsThawed();
+    void ThawedUpdate();
+
+    // solver workspace (ncells x ncolumns)
+    std::vector<double> thermal_flux;
+    std::vector<double> dsoilT_dz;
+    std::vector<Real>   AI;
+    std::vector<Real>   BI;
+    std::vector<Real>   CI;
+    std::vector<Real>   RHS;
+    std::vector<Real>   P;
+    std::vector<Real>   Q;
+    std::vector<Real>   pivot;         // pivots of the forward elimination of the fused sweep (double precision)
+    std::vector<double> lambda;        // dt/(h1 * heat_capacity) of the fused sweep
+    std::vector<double> heat_energy;   // phase change energy of the cells [W/m2]
+    std::vector<double> heat_residual;
+    std::vector<double> rhs;           // right-hand side and temperature increments of the refined (mixed
+    std::vector<double> increment;     // precision) solver, see SolverRefined
+    std::vector<int>    tdma_failed;   // (ncolumns), 1 if the tridiagonal system of the column is singular
+    std::vector<double> column_a;      // (ncolumns) scratch
+    std::vector<double> column_b;
+    std::vector<double> column_c;
+    std::vector<double> energy_balance_compensation; // (ncolumns) low-order part of energy_balance
+
+    // column-invariant grid terms (ncells)
+    std::vector<double> h1;          // cell thickness used in lambda = dt/(h1 * heat_capacity)
+    std::vector<double> denominator; // 2/h2, h2 is the distance between the neighbouring cell centers
+
+    // per-column constants (ncolumns), rebuilt by BeginTimestep when the soil parameters change
+    std::vector<double> tc_solid;     // thermal conductivity of soil solids
+    std::vector<double> tc_solid_sat; // pow(tc_solid, 1-smcmax), solids part of the saturated conductivity
+    std::vector<double> tc_dry;       // dry thermal conductivity
+
+    /* inputs of the coefficients at their last computation, see BeginTimestep */
+    std::vector<State>  cache_moisture;  // (ncells x ncolumns)
+    std::vector<State>  cache_liquid;
+    std::vector<double> cache_smcmax;    // (ncolumns)
+    std::vector<double> cache_b;
+    std::vector<double> cache_satpsi;
+    std::vector<double> cache_quartz;
+    double cache_dt;
+    bool   coefficients_cached;          // thermal conductivity and heat capacity belong to the cached inputs
+    bool   factorized;                   // lambda and the matrices/factorization of the fused sweep belong to them
+
+  public:
+    int    ncolumns;
+    int    ncells;
+    double dt;
+    double time;
+    long   thawed_steps; // timesteps with all columns thawed (phase change bypassed)
+    long   factorizations;       // timesteps with the diffusion matrices assembled and factorized
+    long   factorization_reuses; // timesteps with the coefficients and factorization of the previous timestep reused
+    bool   fused_assembly; // true (default): state update, coefficients and solve in one sweep, see SolveDiffusionEquationFused
+    SimdPath simd_path;    // code path of the unfused tridiagonal solves (SolverTDMA), widest supported or SFT_SIMD_PATH
+
+    std::vector<double> soil_z;
+    std::vector<double> soil_dz;
+
+    // per-cell states (ncells x ncolumns)
+    std::vector<double> soil_temperature;
+    std::vector<double> soil_temperature_prev;
+    std::vector<Real>   heat_capacity;
+    std::vector<Real>   thermal_conductivity;
+    std::vector<State>  soil_moisture_content;
+    std::vector<State>  soil_liquid_content;
+    std::vector<State>  soil_ice_content;
+
+    // per-column parameters, forcings and outputs (ncolumns)
+    std::vector<double> smcmax;
+    std::vector<double> b;
+    std::vector<double> satpsi;
+    std::vector<double> quartz;
+    std::vector<double> ground_temp;
+    std::vector<double> top_boundary_temp_const;
+    std::vector<double> bottom_boundary_temp_const;
+    std::vector<int>    option_top_boundary;
+    std::vector<int>    option_bottom_boundary;
+    std::vector<int>    ice_fraction_scheme_bmi;
+    std::vector<int>    is_soil_moisture_bmi_set;
+    std::vector<double> ground_heat_flux;
+    std::vector<double> bottom_heat_flux;
+    std::vector<double> energy_consumed;
+    std::vector<double> energy_balance;
+    std::vector<double> ice_fraction_schaake;
+    std::vector<double> ice_fraction_xinanjiang;
+    std::vector<double> soil_ice_fraction;
+    double latent_heat_fusion;
+
+    /* builds a batch from initialized models; all models must have the same soil_z and dt */
+    SoilFreezeThawBatchT(const std::vector<SoilFreezeThaw*> &columns);
+
+    /* advances all columns by one timestep */
+    void Advance();
+
+    /* copies the state of a column from/to a single-column model */
+    void SetColumnState(int column, const SoilFreezeThaw &model);
+    void GetColumnState(int column, SoilFreezeThaw &model) const;
+
+    inline int Index(int cell, int column) const { return cell * ncolumns + column; }
+
+    ~SoilFreezeThawBatchT() {}
+  };
+
+  typedef SoilFreezeThawBatchT<double,double> SoilFreezeThawBatch;       // double precision
+  typedef SoilFreezeThawBatchT<float,double>  SoilFreezeThawBatchMixed;  // single precision solver, double states
+  typedef SoilFreezeThawBatchT<float,float>   SoilFreezeThawBatchSingle; // single precision per-cell arrays
+};
+
+#endif
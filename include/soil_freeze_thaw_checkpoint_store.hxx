@@ -0,0 +1,102 @@
+/*
+  Checkpoint store: the checkpoints of many SoilFreezeThaw instances (e.g., one column per catchment) in a single
+  file, so a restart of 100k+ columns writes and opens one file instead of one per column.
+
+  Layout (native byte order, as SoilFreezeThaw::SaveCheckpoint):
+  - header: magic "SFTSTORE", byte order mark, checkpoint_store_version, number of entries, offset of the index
+  - records: the checkpoint of each instance (SaveCheckpoint), stored as is or compressed, in the order written
+  - index: for each entry sorted by id, the id, offset and size of the record, size of the checkpoint and codec
+  The header is completed by CheckpointStoreWriter::Close; a store that was not closed has no index and is
+  rejected by the reader.
+
+  Writers: Add() may be called from several threads. The checkpoint is serialized and compressed by the calling
+  thread; only the append to the file and the index entry are serialized by a mutex.
+
+  Readers: the file is memory mapped (read into memory on Windows) and the index is read once. Restore() decodes one record into the model
+  without reading the other records, so a worker restores only its shard of the ids; it may be called from
+  several threads.
+
+  Compression (optional, per store): each double of the checkpoint is XORed with the previous one (neighbouring
+  cells of a field share the exponent and the leading mantissa bits) and only the bytes below the leading zero
+  bytes of the XOR are stored, with a 4-bit count of the zero bytes. The codec is lossless: a restored model is
+  bitwise identical to the saved one. A record is stored uncompressed if the coding does not make it smaller.
+*/
+
+#ifndef SFT_CHECKPOINT_STORE_H_INCLUDED
+#define SFT_CHECKPOINT_STORE_H_INCLUDED
+
+#include <vector>
+#include <string>
+#include <fstream>
+#include <mutex>
+#include <unordered_set>
+#include <cstdint>
+#include "soil_freeze_thaw.hxx"
+
+namespace soilfreezethaw {
+
+  const int checkpoint_store_version = 1;   // [-] layout of the store file
+
+  /* entry of the index */
+  struct CheckpointStoreEntry {
+    std::string id;
+    uint64_t offset;                          // of the record in the file
+    uint64_t stored_size;                     // bytes of the record
+    uint64_t size;                            // bytes of the checkpoint (decoded record)
+    int32_t  compressed;                      // 1 if the record is compressed
+  };
+
+  class CheckpointStoreWriter {
+  public:
+    /* creates the store file (replaces an existing file), records compressed if compress is true */
+    CheckpointStoreWriter(const std::string &file, bool compress = false);
+    ~CheckpointStoreWriter();                 // closes the store, errors are ignored (call Close to get them)
+
+    /* appends the checkpoint of the model under id; thread safe, throws if id was already added */
+    void Add(const std::string &id, SoilFreezeThaw &model);
+
+    /* writes the index and completes the header; no Add after Close */
+    void Close();
+
+  private:
+    std::string file;
+    bool compress;
+    std::ofstream os;
+    std::mutex mutex;
+    uint64_t end;                             // offset of the next record
+    std::vector<CheckpointStoreEntry> entries;
+    std::unordered_set<std::string> ids;
+  };
+
+  class CheckpointStoreReader {
+  public:
+    /* maps the store file and reads its index; throws if the file is not a complete store */
+    CheckpointStoreReader(const std::string &file);
+    ~CheckpointStoreReader();
+    CheckpointStoreReader(const CheckpointStoreReader&) = delete;
+    CheckpointStoreReader &operator=(const CheckpointStoreReader&) = delete;
+
+    /* index of the store, sorted by id */
+    const std::vector<CheckpointStoreEntry> &Entries() const { return entries; }
+    bool Contains(const std::string &id) const;
+
+    /* restores the checkpoint stored under id into the model (see SoilFreezeThaw::RestoreCheckpoint);
+       throws if the id is not in the store; thread safe */
+    void Restore(const std::string &id, SoilFreezeThaw &model) const;
+
+  private:
+    const char *data;                         // mapped file
+    size_t length;
+#ifdef _WIN32
+    std::vector<char> contents;               // file read into memory (no mmap)
+#endif
+    std::vector<CheckpointStoreEntry> entries;
+    const CheckpointStoreEntry *Find(const std::string &id) const;
+  };
+
+  /* codec of the compressed records; Decode throws if the record does not decode to size bytes */
+  void EncodeCheckpoint(const std::string &checkpoint, std::string &record);
+  void DecodeCheckpoint(const char *record, size_t record_size, size_t size, std::string &checkpoint);
+}
+
+#endif
@@ -0,0 +1,214 @@
+/*
+  Vectorizable elementary functions used by the per-cell kernels (Peters-Lidard thermal conductivity and the
+  supercooled liquid water of the phase change).
+
+  The functions are inline, branch-free (special cases are handled with selects), do not use lookup tables and
+  need only SSE2 integer operations (no int64 <-> double conversions), so loops calling them are auto-vectorized
+  by the compiler, unlike calls to the scalar libm functions. GCC if-converts the selects only with
+  -fno-trapping-math (set by CMakeLists.txt), it does not change the results.
+  The algorithms are those of fdlibm (e_log.c, e_exp.c): range reduction x = 2^k (1+f) with a degree-14
+  odd polynomial in s = f/(2+f) for log, and x = k ln2 + r with a degree-10 rational approximation for exp.
+
+  Error bounds (units in the last place, measured against a long double reference by
+  tests/main_unittest_math.cxx over the model's parameter ranges):
+  - Log(x)    : < 1 ULP
+  - Log10(x)  : < 1 ULP, log(x) is carried as hi + lo and multiplied by 1/ln(10) in double-double
+  - Exp(x)    : < 1 ULP
+  - Pow(x, y) : < 1 + 0.2 |y ln(x)| ULP; exp(y log(x)) with log(x) and the product y log(x) carried as
+                hi + lo. |y ln(x)| is below 5 in the model (supercooled water), where the error is < 1.1 ULP
+  PowPositive(x, y) equals Pow(x, y) for positive normal x and finite y, and is not defined otherwise.
+  Domain: x positive and normal (subnormal x is not reduced correctly); Log and Log10 return -inf for 0 and
+  NaN for negative x, Pow(0, y) is 0 (y > 0) or inf (y < 0), Exp underflows to 0 below -745 and overflows
+  to inf above 709.78.
+
+  Build with -DSFT_LIBM_MATH to use the libm functions instead. Only that build is bitwise identical to the original
+  model and reproduces tests/file_golden.csv exactly (checked by tests/main_unittest_precision.cxx); with the
+  functions below the Laramie run drifts within the golden test tolerance (frozen fraction error of sft_standalone
+  1.2e-3, below 1e-2).
+*/
+
+#ifndef SFT_MATH_H_INCLUDED
+#define SFT_MATH_H_INCLUDED
+
+#include <cmath>
+#include <cstring>
+#include <algorithm>
+#include <cstdint>
+#include <limits>
+
+namespace soilfreezethaw {
+namespace math {
+
+#ifdef SFT_LIBM_MATH
+
+  inline double Log(double x)           { return log(x); }
+  inline double Log10(double x)         { return log10(x); }
+  inline double Exp(double x)           { return exp(x); }
+  inline double Pow(double x, double y) { return pow(x, y); }
+  inline double PowPositive(double x, double y) { return pow(x, y); }
+
+#else
+
+  inline uint64_t AsBits(double x)   { uint64_t u; std::memcpy(&u, &x, sizeof(u)); return u; }
+  inline double   AsDouble(uint64_t u) { double x; std::memcpy(&x, &u, sizeof(x)); return x; }
+
+  /* exact product a * b = p + e (Dekker), uses the fused multiply-add when it is available in hardware */
+  inline void TwoProduct(double a, double b, double &p, double &e)
+  {
+    p = a * b;
+#ifdef __FP_FAST_FMA
+    e = std::fma(a, b, -p);
+#else
+    const double split = 134217729.0; // 2^27 + 1
+    double ca = split * a, cb = split * b;
+    double a_hi = ca - (ca - a), b_hi = cb - (cb - b);
+    double a_lo = a - a_hi, b_lo = b - b_hi;
+    e = ((a_hi * b_hi - p) + a_hi * b_lo + a_lo * b_hi) + a_lo * b_lo;
+#endif
+  }
+
+  /* exact sum a + b = s + e (Knuth) */
+  inline void TwoSum(double a, double b, double &s, double &e)
+  {
+    s = a + b;
+    double bb = s - a;
+    e = (a - (s - bb)) + (b - bb);
+  }
+
+  const double ln2_hi = 6.93147180369123816490e-01; // 0x3fe62e42fee00000, k * ln2_hi is exact for |k| < 2^20
+  const double ln2_lo = 1.90821492927058770002e-10;
+
+  /* log(x) = k ln2 + log(1+f) with log(1+f) = f - f^2/2 + s (f^2/2 + R(s^2)), s = f/(2+f) */
+  inline void LogReduce(double x, double &k, double &f, double &s, double &R)
+  {
+    const double Lg1 = 6.666666666666735130e-01, Lg2 = 3.999999999940941908e-01;
+    const double Lg3 = 2.857142874366239149e-01, Lg4 = 2.222219843214978396e-01;
+    const double Lg5 = 1.818357216161805012e-01, Lg6 = 1.531383769920937332e-01;
+    const double Lg7 = 1.479819860511658591e-01;
+
+    // 1+f in [sqrt(2)/2, sqrt(2)), the exponent is converted to double through the bits of 2^52 + e
+    // (the int64 to double conversion has no SSE2/AVX2 vector instruction)
+    uint64_t ix = AsBits(x) + ((uint64_t)(0x3ff00000 - 0x3fe6a09e) << 32);
+    k  = AsDouble(0x4330000000000000ULL | (ix >> 52)) - (4503599627370496.0 + 0x3ff);
+    ix = (ix & 0x000fffffffffffffULL) + ((uint64_t)0x3fe6a09e << 32);
+    f  = AsDouble(ix) - 1.0;
+
+    s = f / (2.0 + f);
+    double z = s * s;
+    double w = z * z;
+    double t1 = w * (Lg2 + w * (Lg4 + w * Lg6));
+    double t2 = z * (Lg1 + w * (Lg3 + w * (Lg5 + w * Lg7)));
+    R = t2 + t1;
+  }
+
+  /* special values of log: -inf for 0, NaN for negative x, x for inf and NaN */
+  inline double LogSpecial(double x, double y)
+  {
+    const double inf = std::numeric_limits<double>::infinity();
+    y = x == 0.0 ? -inf : y;
+    y = x < 0.0 ? std::numeric_limits<double>::quiet_NaN() : y;
+    return (x == inf || x != x) ? x : y;
+  }
+
+  inline double Log(double x)
+  {
+    double k, f, s, R;
+    LogReduce(x, k, f, s, R);
+    double hfsq = 0.5 * f * f;
+    double y = k * ln2_hi - ((hfsq - (s * (hfsq + R) + k * ln2_lo)) - f);
+    return LogSpecial(x, y);
+  }
+
+  /* log(x) = hi + lo, the square f^2 and the leading terms are summed exactly */
+  inline void LogExtended(double x, double &hi, double &lo)
+  {
+    double k, f, s, R;
+    LogReduce(x, k, f, s, R);
+
+    double ff, ff_lo;
+    TwoProduct(f, f, ff, ff_lo);
+    double hfsq = 0.5 * ff;
+    double tail = s * (hfsq + R) + k * ln2_lo - 0.5 * ff_lo;
+
+    double s1, e1, s2, e2;
+    TwoSum(k * ln2_hi, f, s1, e1);
+    TwoSum(s1, -hfsq, s2, e2);
+    hi = s2 + (e1 + e2 + tail);
+    lo = (e1 + e2 + tail) - (hi - s2);
+  }
+
+  inline double Log10(double x)
+  {
+    const double ivln10_hi = 4.34294481903251816668e-01; // 1/ln(10) = ivln10_hi + ivln10_lo
+    const double ivln10_lo = 1.09831965021676510e-17;
+
+    double hi, lo, p, e;
+    LogExtended(x, hi, lo);
+    TwoProduct(hi, ivln10_hi, p, e);
+    double y = p + (e + lo * ivln10_hi + hi * ivln10_lo);
+    return LogSpecial(x, y);
+  }
+
+  /* exp(hi + lo), |lo| <= ulp(hi) */
+  inline double ExpExtended(double hi, double lo)
+  {
+    const double P1 =  1.66666666666666019037e-01, P2 = -2.77777777770155933842e-03;
+    const double P3 =  6.61375632143793436117e-05, P4 = -1.65339022054652515390e-06;
+    const double P5 =  4.13813679705723846039e-08;
+    const double invln2 = 1.44269504088896338700e+00;
+    const double shift  = 6755399441055744.0; // 1.5 * 2^52, rounds to the nearest integer
+
+    hi = std::min(std::max(hi, -746.0), 710.0);
+
+    // hi + lo = k ln2 + r, |r| <= ln2/2
+    double kd = hi * invln2 + shift;
+    uint64_t kb = AsBits(kd) - AsBits(shift) + 2 * 0x3ff; // k + 2 * bias, in [969, 3071]
+    kd -= shift;
+
+    double r_hi = hi - kd * ln2_hi;
+    double r_lo = kd * ln2_lo - lo;
+    double r = r_hi - r_lo;
+    double t = r * r;
+    double c = r - t * (P1 + t * (P2 + t * (P3 + t * (P4 + t * P5))));
+    double y = 1.0 - ((r_lo - (r * c) / (2.0 - c)) - r_hi);
+
+    // y * 2^k in two steps, so results near the overflow and underflow thresholds are scaled correctly
+    uint64_t e1 = kb >> 1;
+    uint64_t e2 = kb - e1;
+    return y * AsDouble(e1 << 52) * AsDouble(e2 << 52);
+  }
+
+  inline double Exp(double x)
+  {
+    return x != x ? x : ExpExtended(x, 0.0);
+  }
+
+  inline double Pow(double x, double y)
+  {
+    const double inf = std::numeric_limits<double>::infinity();
+    double hi, lo, p, e;
+    LogExtended(x, hi, lo);
+    TwoProduct(y, hi, p, e);
+    double z = ExpExtended(p, e + y * lo);
+
+    z = y == 0.0 ? 1.0 : z;
+    z = x == 0.0 && y != 0.0 ? (y > 0.0 ? 0.0 : inf) : z;
+    z = x < 0.0 || x != x || y != y ? std::numeric_limits<double>::quiet_NaN() : z;
+    return z;
+  }
+
+  /* Pow(x, y) for positive normal x and finite y, without the special cases: their selects on y make a loop
+     with a loop-invariant y (e.g., the exponent -1/b of the supercooled water) not vectorizable by GCC */
+  inline double PowPositive(double x, double y)
+  {
+    double hi, lo, p, e;
+    LogExtended(x, hi, lo);
+    TwoProduct(y, hi, p, e);
+    return ExpExtended(p, e + y * lo);
+  }
+
+#endif
+};
+};
+
+#endif
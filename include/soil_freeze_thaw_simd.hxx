@@ -0,0 +1,70 @@
+/*
+  Runtime selection of the instruction set of the hot kernels.
+
+  The library is built for the baseline instruction set of the target (SSE2 on x86-64), so one build runs on
+  every node of a cluster. The kernels that dominate a timestep are also compiled for AVX2 and AVX-512
+  (function target attributes) and the widest variant supported by the CPU is selected once per model, when
+  the kernels are selected at initialization (SoilFreezeThaw::SelectKernels, BMI Initialize):
+    - per-cell kernels: thermal conductivity, heat capacity and phase change (loops over the cells,
+      vectorized by the compiler in optimized builds)
+    - tridiagonal solvers: loops over the partitions of PartitionedTridiagonal and the batched Thomas
+      algorithm (SolveTridiagonalBatch, one system per SIMD lane)
+  Code paths:
+    - Scalar : portable code, as compiled
+    - SSE2   : x86-64 baseline (explicit 2-double vectors in SolveTridiagonalBatch, the baseline build otherwise)
+    - AVX2   : 4 doubles per vector
+    - AVX512 : 8 doubles per vector (AVX-512F)
+  The path is requested with the config key simd_path (auto = widest supported); the environment variable
+  SFT_SIMD_PATH takes precedence, e.g. to force a path for all the models of a process without editing the
+  config files. A path the CPU does not support is an error.
+  The variants are compiled without floating-point contraction (no FMA), they perform the operations of the
+  baseline code and give bitwise identical results.
+*/
+
+#ifndef SFT_SIMD_H_INCLUDED
+#define SFT_SIMD_H_INCLUDED
+
+#include <string>
+
+namespace soilfreezethaw {
+
+  /* instruction set of a kernel code path */
+  enum class SimdPath { Scalar = 0, SSE2 = 1, AVX2 = 2, AVX512 = 3 };
+
+  /* name of the code path (scalar, sse2, avx2, avx512) */
+  const char *SimdPathName(SimdPath path);
+
+  /* true if the path is compiled in and the CPU supports its instruction set */
+  bool IsSupported(SimdPath path);
+
+  /* widest supported path */
+  SimdPath BestSimdPath();
+
+  /* path of the name (scalar, sse2, avx2, avx512, or auto = BestSimdPath()); throws if the name is unknown or
+     the CPU does not support the path */
+  SimdPath ParseSimdPath(const std::string &name);
+
+  /* path of a model: SFT_SIMD_PATH if the environment variable is set, requested otherwise (see ParseSimdPath) */
+  SimdPath SelectSimdPath(const std::string &requested);
+};
+
+/*
+  Variants of a kernel: SFT_SIMD_VARIANTS(KERNEL) expands KERNEL(ISA, target) for the baseline (empty ISA and
+  target), AVX2 and AVX512, where KERNEL defines name##ISA with the target attributes; SFT_SIMD_CALL(path,
+  name, args...) calls the variant of the path (the baseline for Scalar and SSE2).
+*/
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define SFT_X86_SIMD
+#define SFT_ALWAYS_INLINE inline __attribute__((always_inline))
+#define SFT_TARGET(isa) __attribute__((target(isa), optimize("fp-contract=off")))
+#define SFT_SIMD_VARIANTS(KERNEL) KERNEL(, ) KERNEL(AVX2, SFT_TARGET("avx2")) KERNEL(AVX512, SFT_TARGET("avx512f"))
+#define SFT_SIMD_CALL(path, name, ...)							\
+  ((path) == soilfreezethaw::SimdPath::AVX512 ? name##AVX512(__VA_ARGS__)		\
+   : (path) == soilfreezethaw::SimdPath::AVX2 ? name##AVX2(__VA_ARGS__) : name(__VA_ARGS__))
+#else
+#define SFT_ALWAYS_INLINE inline
+#define SFT_SIMD_VARIANTS(KERNEL) KERNEL(, )
+#define SFT_SIMD_CALL(path, name, ...) name(__VA_ARGS__)
+#endif
+
+#endif
@@ -0,0 +1,111 @@
+/*
+  Tabulated constitutive relations of a soil type (constitutive_tables = true).
+
+  For a soil type (smcmax, b, satpsi, quartz) the supercooled liquid water limit of the phase change is a
+  function of the temperature only, and the Peters-Lidard thermal conductivity is a function of the liquid and
+  total moisture through the saturated conductivity tc_sat(xu) and the Kersten number (log10 of the saturation
+  ratio). ConstitutiveTables samples these curves once and the per-cell kernels replace pow/log10 by a lookup
+  and a linear interpolation. The interpolant of monotone samples is monotone, so the tabulated curves keep the
+  ordering (e.g., colder cells never hold more supercooled water) and the bounds of the analytic ones.
+
+  Grids, for a resolution r (a power of two):
+  - supercooled water vs the supercooling Tf - T, and log10 of the saturation ratio: r nodes per octave
+    (the index is read from the exponent and the leading log2(r) bits of the mantissa), so the relative
+    spacing is at most 1/r where the curves are steep (near the freezing point, at low saturation)
+  - saturated thermal conductivity vs the unfrozen volume xu in [0, smcmax]: r uniform intervals
+  The interpolation error is O(1/r^2); the largest error against the analytic curves is measured when the
+  tables are built, printed, and kept in the error_* members.
+
+  Tables are shared: Get() returns the tables of a parameter set from a process-wide registry and builds them
+  only for a new parameter set; the tables are released with the last model using them.
+*/
+
+#ifndef SFT_TABLES_H_INCLUDED
+#define SFT_TABLES_H_INCLUDED
+
+#include <vector>
+#include <memory>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+
+namespace soilfreezethaw {
+
+  class ConstitutiveTables {
+  public:
+    /* parameters the tables are built from */
+    struct Key {
+      double smcmax, b, satpsi, quartz;
+      double latent_heat_fusion;
+      int    resolution;
+      bool operator<(const Key &k) const;
+    };
+
+    /* piecewise linear function on nodes uniform within each octave of x, x > 0 */
+    struct OctaveTable {
+      uint64_t base;                  // bits of the first node
+      int      shift;                 // 52 - log2(resolution)
+      double   x_first, x_last;       // first node, and the largest x in the last interval
+      std::vector<double> coef;       // value and slope of interval j at [2j], [2j+1]
+
+      inline double operator()(double x) const
+      {
+	// the index is computed from x clamped to the nodes (NaN maps to the first node), values outside
+	// are extrapolated linearly from the first or the last interval
+	double xc = x > x_first ? x : x_first;
+	xc = xc < x_last ? xc : x_last;
+	uint64_t u, j;
+	std::memcpy(&u, &xc, sizeof(u));
+	j = (u - base) >> shift;
+	u = base + (j << shift);
+	double xj;
+	std::memcpy(&xj, &u, sizeof(xj));
+	return coef[2*j] + coef[2*j+1] * (x - xj);
+      }
+    };
+
+    /* piecewise linear function on uniform nodes x_first + j h */
+    struct UniformTable {
+      double x_first, x_last, h, inv_h;
+      int    n;                       // number of intervals
+      std::vector<double> coef;       // value and slope of interval j at [2j], [2j+1]
+
+      inline double operator()(double x) const
+      {
+	double xc = x > x_first ? x : x_first;
+	xc = xc < x_last ? xc : x_last;
+	int j = (int)((xc - x_first) * inv_h);
+	j = j < n ? j : n - 1;
+	return coef[2*j] + coef[2*j+1] * (x - (x_first + j * h));
+      }
+    };
+
+    Key key;
+    OctaveTable  supercool;   // supercooled liquid water content [-] vs the supercooling Tf - T [K], above
+                              // smcmax (no freezing) near the freezing point
+    UniformTable tc_sat;      // saturated thermal conductivity [W/(mK)] vs the unfrozen volume xu [-]
+    OctaveTable  log_sat;     // log10 of the saturation ratio [-], Kersten number
+
+    // largest errors against the analytic curves (math::Pow, math::Log10), sampled within every interval
+    double error_supercool;   // [-] volumetric, Tf - T up to 100 K
+    double error_tc_sat;      // [W/(mK)]
+    double error_log_sat;     // [-] Kersten number, saturation ratio in [0.05, 1]
+
+    /* returns the shared tables of the parameter set, built if no model uses them yet; the errors of new
+       tables are printed to report (if not NULL) */
+    static std::shared_ptr<const ConstitutiveTables> Get(const Key &key, std::ostream *report);
+
+    /* number of distinct parameter sets with tables in use */
+    static int RegistrySize();
+
+    /* number of tables built by Get since the start of the process */
+    static long BuildCount();
+
+    /* resolution is valid if it is a power of two in [8, 4096] */
+    static bool IsValidResolution(int resolution);
+
+    explicit ConstitutiveTables(const Key &key);
+  };
+};
+
+#endif
@@ -0,0 +1,120 @@
+/*
+  Partitioned (SPIKE-style) tridiagonal solver for long soil columns.
+
+  The Thomas algorithm (SoilFreezeThaw::FactorTDMA/SubstituteTDMA) is a chain of dependent operations over the
+  cells, one division per cell in the forward substitution; above a few hundred cells it is the largest part
+  of a timestep. PartitionedTridiagonal splits the n rows into p partitions of s rows. The last row of each
+  partition is an interface row, the other s-1 rows are its interior. With the interface unknowns z_j fixed,
+  the interior of partition j is an independent tridiagonal system:
+    x = y + z_j-1 v + z_j w,   T_j y = d_j,   T_j v = -a_first e_1,   T_j w = -c_last e_s-1
+  (v and w, the spikes, depend on the matrix only), and the interface rows form a tridiagonal system of size p
+  for the z_j (the reduced system). A solve is
+    - the forward/backward substitution of y in all partitions, independent of each other
+    - the Thomas algorithm on the reduced system
+    - x = y + z_j-1 v + z_j w in all partitions
+  The interiors are stored interleaved (row r of partition j at [r*p + j]), so the loops over the partitions
+  are contiguous and vectorized, one partition per SIMD lane; without vectorization the p independent chains
+  still overlap in the pipeline. With threads > 1 the partitions are split between a team of threads that
+  stays alive between the solves (the reduced system is solved by the calling thread).
+
+  The factorization (pivots, multipliers, spikes and the reduced system) depends on a, b and c only and is
+  reused by any number of right-hand sides, as FactorTDMA. No pivoting: the diffusion matrix is diagonally
+  dominant, the solution differs from the Thomas algorithm by rounding only (not bitwise identical).
+  The rows past n of the last partition are padded with identity rows, decoupled from the system (c_n-1 = 0).
+
+  Batched Thomas algorithm (SolveTridiagonalBatch) for many independent systems of the same size in interleaved
+  layout (row i of system c at [i*nsystems + c], as the SoilFreezeThawBatch workspace): each SIMD lane solves
+  one system. Code paths:
+    - Scalar : portable loop over the systems
+    - SSE2   : 2 doubles / 4 floats per vector (x86-64 baseline)
+    - AVX2   : 4 doubles / 8 floats
+    - AVX512 : 8 doubles / 16 floats (AVX-512F)
+  The vector paths are compiled for their instruction set (see soil_freeze_thaw_simd.hxx) and are used only if
+  the CPU supports it (IsSupported). The operations are those of the scalar loop (no FMA), so all the paths give
+  bitwise identical solutions; the remaining systems of a batch that is not a multiple of the vector width are
+  solved by the scalar loop.
+  The loops over the partitions of PartitionedTridiagonal are compiled for the baseline, AVX2 and AVX-512
+  (simd_path, vectorized by the compiler).
+*/
+
+#ifndef SFT_TRIDIAGONAL_H_INCLUDED
+#define SFT_TRIDIAGONAL_H_INCLUDED
+
+#include <vector>
+#include <memory>
+#include "soil_freeze_thaw_simd.hxx"
+
+namespace soilfreezethaw {
+
+  /* Thomas algorithm for nsystems independent systems of n rows a_i x_i-1 + b_i x_i + c_i x_i+1 = d_i, interleaved
+     ([i*nsystems + c]); P and Q are scratch arrays of n*nsystems values, X may be d. A system with a pivot
+     below 1e-20 (rows 1 to n-1, as SoilFreezeThaw::FactorTDMA) is singular: failed[c] is set to 1 (0 otherwise)
+     and its solution is zero. Returns the number of singular systems. */
+  int SolveTridiagonalBatch(int n, int nsystems, const double *a, const double *b, const double *c, const double *d,
+			    double *X, double *P, double *Q, int *failed, SimdPath path = BestSimdPath());
+  int SolveTridiagonalBatch(int n, int nsystems, const float *a, const float *b, const float *c, const float *d,
+			    float *X, float *P, float *Q, int *failed, SimdPath path = BestSimdPath());
+
+  class PartitionedTridiagonal {
+  public:
+    int n;                              // rows of the factorized system
+    int partitions;                     // p
+    int rows;                           // s, rows per partition (interior s-1 + the interface row)
+    int threads;                        // threads of the solves (1 = calling thread only)
+    SimdPath simd_path;                 // variant of the loops over the partitions (baseline, AVX2 or AVX-512)
+
+    /* factorizes the system of n rows a_i x_i-1 + b_i x_i + c_i x_i+1 (a_0 and c_n-1 are not used) into
+       partitions of min_rows to max_rows rows, about a multiple of the SIMD width when n is large enough
+       (only the last partition reaches past n); returns false if the matrix is singular (a pivot below
+       1e-20, as FactorTDMA) */
+    bool Factor(int n, const double *a, const double *b, const double *c);
+
+    /* solves for the right-hand side d with the last factorization, X may be d */
+    void Solve(const double *d, double *X);
+
+    /* number of threads of the following factorizations and solves, >= 1 */
+    void SetThreads(int threads);
+
+    /* code path of the following factorizations and solves, must be supported by the CPU */
+    void SetSimdPath(SimdPath path);
+
+    static const int lanes    = 8;      // partitions are rounded to lanes (8 doubles, one AVX-512 vector)
+    static const int min_rows = 32;     // shortest partition
+    static const int max_rows = 256;    // longest partition
+
+    PartitionedTridiagonal();
+    ~PartitionedTridiagonal();
+
+  private:
+    // interiors, interleaved [r*p + j], r < s-1
+    std::vector<double> A;              // a of the interior rows
+    std::vector<double> inv_pivot;      // 1/(b_r + a_r P_r-1)
+    std::vector<double> P;              // -c_r/pivot_r
+    std::vector<double> V;              // spike of z_j-1
+    std::vector<double> W;              // spike of z_j
+    std::vector<double> Y;              // interior solutions T_j^-1 d_j of the solves
+    std::vector<char>   pivot_ok;       // [j], false if partition j is singular
+    std::vector<double> D;              // right-hand side and solution padded to p*s rows
+    // interface rows and the reduced system, [j]
+    std::vector<double> a_z, b_z, c_z;  // coefficients of the interface rows
+    std::vector<double> ra;             // reduced system: sub-diagonal, multipliers and 1/pivots
+    std::vector<double> rP;
+    std::vector<double> r_inv_pivot;
+    std::vector<double> z;              // interface unknowns, z_j at [j+1] ([0] = 0, left of the first partition)
+
+    // loops over the partitions [j0, j1); one variant per instruction set (Path), see RunPartitions
+    template <SimdPath Path> void FactorPartitions(int j0, int j1, const double *a, const double *b, const double *c);
+    template <SimdPath Path> void SubstitutePartitions(int j0, int j1, const double *d);
+    template <SimdPath Path> void UpdatePartitions(int j0, int j1, double *X);
+    void FactorLoops(int j0, int j1, const double *a, const double *b, const double *c);
+    void SubstituteLoops(int j0, int j1, const double *d);
+    void UpdateLoops(int j0, int j1, double *X);
+
+    struct Team;
+    std::unique_ptr<Team> team;
+    template <typename Task> void Run(const Task &task);
+    template <typename Task> void RunPartitions(const Task &task);
+  };
+};
+
+#endif
@@ -10,13 +10,17 @@
 #include "../include/bmi_soil_freeze_thaw.hxx"
 #include "../include/soil_freeze_thaw.hxx"
 #include <algorithm>
+#include <sstream>
+#include <stdexcept>
 
 
 void BmiSoilFreezeThaw::
 Initialize (std::string config_file)
 {
-  if (config_file.compare("") != 0 )
+  if (config_file.compare("") != 0 ) {
     this->state = new soilfreezethaw::SoilFreezeThaw(config_file);
+    this->state->Spinup();
+  }
 
   verbosity= this->state->verbosity;
 }
@@ -24,27 +28,33 @@ Initialize (std::string config_file)
 void BmiSoilFreezeThaw::
 Update()
 {
-  this->state->Advance();
+  this->AdvanceStep();
 }
 
 
 void BmiSoilFreezeThaw::
 UpdateUntil(double t)
 {
-  double time;
-  double dt;
+  const double time = this->GetCurrentTime();
+  const double dt = this->GetTimeStep();
 
-  time = this->GetCurrentTime();
-  dt = this->GetTimeStep();
+  if (t <= time)
+    return;
 
-  {
-    double n_steps = (t - time) / dt;
-    double frac;
+  // whole timesteps, then the remaining fraction of a timestep; t a whole number of timesteps ahead (within
+  // rounding) takes no fractional step
+  const double n_steps = (t - time) / dt;
+  int n_whole = int(n_steps);
+  double frac = n_steps - n_whole;
+  if (frac > 1.0 - 1.0e-9) {
+    n_whole++;
+    frac = 0.0;
+  }
 
-    for (int n=0; n<int(n_steps); n++)
-      this->Update();
+  for (int n=0; n<n_whole; n++)
+    this->AdvanceStep();
 
-    frac = n_steps - int(n_steps);
+  if (frac > 1.0e-9) {
     this->state->dt = frac * dt;
     this->state->Advance();
     this->state->dt = dt;
@@ -59,93 +69,159 @@ Finalize()
     this->state->~SoilFreezeThaw();
 }
 
+/*
+  BMI variable registry: one entry per variable, sorted by name (checked at compile time), looked up by binary
+  search. The metadata functions and the get/set functions are served from the entry of the variable.
+  grid: 0 = int scalar, 1 = double scalar, 2 = double array of the cells (shape[0] items)
+*/
+struct BmiVariable {
+  const char *name;
+  int         grid;
+  const char *units;
+  const char *location;
+  bool        soil_parameter;  // calibratable soil parameter, setting it invalidates the model invariants
+  void *(*pointer)(soilfreezethaw::SoilFreezeThaw *state);
+};
+
+template <typename T, T soilfreezethaw::SoilFreezeThaw::*member>
+static void *ScalarPointer(soilfreezethaw::SoilFreezeThaw *state) { return &(state->*member); }
+
+template <double *soilfreezethaw::SoilFreezeThaw::*member>
+static void *ArrayPointer(soilfreezethaw::SoilFreezeThaw *state) { return state->*member; }
+
+#define SFT_SCALAR(type, member) &ScalarPointer<type, &soilfreezethaw::SoilFreezeThaw::member>
+#define SFT_ARRAY(member) &ArrayPointer<&soilfreezethaw::SoilFreezeThaw::member>
+
+static constexpr BmiVariable bmi_variables[] = {
+  {"b",                        1, "none",  "",     true,  SFT_SCALAR(double, b)},
+  {"ground_heat_flux",         1, "W m-2", "node", false, SFT_SCALAR(double, ground_heat_flux)},
+  {"ground_temperature",       1, "K",     "node", false, SFT_SCALAR(double, ground_temp)},
+  {"ice_fraction_schaake",     1, "m",     "node", false, SFT_SCALAR(double, ice_fraction_schaake)},
+  {"ice_fraction_scheme_bmi",  0, "none",  "",     false, SFT_SCALAR(int, ice_fraction_scheme_bmi)},
+  {"ice_fraction_xinanjiang",  1, "none",  "node", false, SFT_SCALAR(double, ice_fraction_xinanjiang)},
+  {"num_cells",                0, "none",  "node", false, SFT_SCALAR(int, ncells)},
+  {"satpsi",                   1, "none",  "",     true,  SFT_SCALAR(double, satpsi)},
+  {"smcmax",                   1, "none",  "",     true,  SFT_SCALAR(double, smcmax)},
+  {"soil_ice_fraction",        1, "none",  "node", false, SFT_SCALAR(double, soil_ice_fraction)},
+  {"soil_moisture_profile",    2, "none",  "node", false, SFT_ARRAY(soil_moisture_content)},
+  {"soil_temperature_profile", 2, "K",     "node", false, SFT_ARRAY(soil_temperature)}
+};
+
+#undef SFT_SCALAR
+#undef SFT_ARRAY
+
+static constexpr int bmi_variable_count = sizeof(bmi_variables) / sizeof(bmi_variables[0]);
+
+static constexpr int CompareNames(const char *a, const char *b)
+{
+  while (*a != '\0' && *a == *b) {
+    a++;
+    b++;
+  }
+  return (unsigned char)*a - (unsigned char)*b;
+}
+
+static constexpr bool SortedByName(const BmiVariable *variables, int count)
+{
+  for (int i=1; i<count; i++) {
+    if (CompareNames(variables[i-1].name, variables[i].name) >= 0)
+      return false;
+  }
+  return true;
+}
+
+static_assert(SortedByName(bmi_variables, bmi_variable_count),
+	      "the BMI variables must be sorted by name");
+
+// entry of the variable, NULL if the model has no variable of that name
+static const BmiVariable *FindVariable(const char *name)
+{
+  int lo = 0, hi = bmi_variable_count - 1;
+  while (lo <= hi) {
+    const int mid = (lo + hi) / 2;
+    const int cmp = std::strcmp(name, bmi_variables[mid].name);
+    if (cmp == 0)
+      return &bmi_variables[mid];
+    if (cmp < 0)
+      hi = mid - 1;
+    else
+      lo = mid + 1;
+  }
+  return NULL;
+}
+
+// entry of the variable, throws if the model has no variable of that name
+static const BmiVariable &GetVariable(const std::string &name)
+{
+  const BmiVariable *variable = FindVariable(name.c_str());
+  if (variable == NULL) {
+    std::stringstream errMsg;
+    errMsg << "variable "<< name << " does not exist";
+    throw std::runtime_error(errMsg.str());
+  }
+  return *variable;
+}
+
+static int ItemSize(const BmiVariable &variable)
+{
+  return variable.grid == 0 ? sizeof(int) : sizeof(double);
+}
+
+
 int BmiSoilFreezeThaw::
 GetVarGrid(std::string name)
 {
-  if (name.compare("num_cells") == 0 || name.compare("ice_fraction_scheme_bmi") == 0)
-    return 0; // int
-  else if (name.compare("ground_temperature") == 0 || name.compare("ice_fraction_schaake") == 0
-	   || name.compare("ice_fraction_xinanjiang") == 0 || name.compare("soil_ice_fraction") == 0
-	   || name.compare("ground_heat_flux") == 0 || name.compare("smcmax") == 0
-	   || name.compare("b") == 0 || name.compare("satpsi") == 0)
-    return 1; //double
-  else if (name.compare("soil_moisture_profile") == 0 || name.compare("soil_temperature_profile") == 0)
-    return 2; // arrays
-  else
-    return -1;
+  const BmiVariable *variable = FindVariable(name.c_str());
+  return variable ? variable->grid : -1;
 }
 
 
 std::string BmiSoilFreezeThaw::
 GetVarType(std::string name)
 {
-  int grid_id = GetVarGrid(name);
+  const BmiVariable *variable = FindVariable(name.c_str());
 
-  if (grid_id == 0)
-    return "int";
-  else if (grid_id == 1 || grid_id == 2)
-    return "double";
-  else
+  if (variable == NULL)
     return "";
+  return variable->grid == 0 ? "int" : "double";
 }
 
 
 int BmiSoilFreezeThaw::
 GetVarItemsize(std::string name)
 {
-  int grid_id = GetVarGrid(name);
+  const BmiVariable *variable = FindVariable(name.c_str());
 
-  if (grid_id == 0)
-    return sizeof(int);
-  else if (grid_id == 1 || grid_id == 2)
-    return sizeof(double);
-  else
+  if (variable == NULL)
     return 0;
-  
+  return ItemSize(*variable);
 }
 
 
 std::string BmiSoilFreezeThaw::
 GetVarUnits(std::string name)
 {
-  if (name.compare("ground_temperature") == 0 || name.compare("soil_temperature_profile") == 0)
-    return "K";
-  else if (name.compare("ice_fraction_schaake") == 0)
-    return "m";
-  else if (name.compare("ground_heat_flux") == 0)
-    return "W m-2";
-  else
-    return "none";
+  const BmiVariable *variable = FindVariable(name.c_str());
+  return variable ? variable->units : "none";
 }
 
 
 int BmiSoilFreezeThaw::
 GetVarNbytes(std::string name)
 {
-  int itemsize;
-  int gridsize;
+  const BmiVariable *variable = FindVariable(name.c_str());
 
-  itemsize = this->GetVarItemsize(name);
-  gridsize = this->GetGridSize(this->GetVarGrid(name));
-
-  return itemsize * gridsize;
+  if (variable == NULL)
+    return 0;
+  return ItemSize(*variable) * this->GetGridSize(variable->grid);
 }
 
 
 std::string BmiSoilFreezeThaw::
 GetVarLocation(std::string name)
 {
-  if (name.compare("ground_temperature") == 0)
-    return "node";
-  else if (name.compare("ice_fraction_xinanjiang") == 0 || name.compare("soil_ice_fraction") == 0)
-    return "node";
-  else if (name.compare("ice_fraction_schaake") == 0 ||  name.compare("num_cells") == 0
-	   || name.compare("ground_heat_flux") == 0)
-    return "node";
-  else if (name.compare("soil_moisture_profile") == 0 || name.compare("soil_temperature_profile") == 0)
-    return "node";
-  else
-    return "";
+  const BmiVariable *variable = FindVariable(name.c_str());
+  return variable ? variable->location : "";
 }
 
 
@@ -242,110 +318,129 @@ GetGridNodeCount(const int grid)
 void BmiSoilFreezeThaw::
 GetValue (std::string name, void *dest)
 {
-  void * src = NULL;
-  int nbytes = 0;
-
-  src = this->GetValuePtr(name);
-  nbytes = this->GetVarNbytes(name);
-  memcpy (dest, src, nbytes);
+  this->GetValueByHandle(this->GetVarHandle(name), dest);
 }
 
 
 void *BmiSoilFreezeThaw::
 GetValuePtr (std::string name)
 {
-  if (name.compare("soil_temperature_profile") == 0)
-    return (void*)this->state->soil_temperature;
-  if (name.compare("soil_moisture_profile") == 0)
-    return (void*)this->state->soil_moisture_content;
-  else if (name.compare("ground_temperature") == 0 )
-    return (void*)(&this->state->ground_temp);
-  else if (name.compare("ground_heat_flux") == 0)
-    return (void*)(&this->state->ground_heat_flux);
-  else if (name.compare("num_cells") == 0)
-    return (void*)(&this->state->ncells);
-  else if (name.compare("ice_fraction_schaake") == 0)
-    return (void*)(&this->state->ice_fraction_schaake);
-  else if (name.compare("ice_fraction_xinanjiang") == 0)
-    return (void*)(&this->state->ice_fraction_xinanjiang);
-  else if (name.compare("soil_ice_fraction") == 0)
-    return (void*)(&this->state->soil_ice_fraction);
-  else if (name.compare("ice_fraction_scheme_bmi") == 0)
-    return (void*)(&this->state->ice_fraction_scheme_bmi); // leaving this for now, but probably not needed/used
-  else if (name.compare("smcmax") == 0)
-    return (void*)(&this->state->smcmax);
-  else if (name.compare("b") == 0)
-    return (void*)(&this->state->b);
-    else if (name.compare("satpsi") == 0)
-    return (void*)(&this->state->satpsi);
-  else {
-    std::stringstream errMsg;
-    errMsg << "variable "<< name << " does not exist";
-    throw std::runtime_error(errMsg.str());
-    return NULL;
-  }
+  return GetVariable(name).pointer(this->state);
 }
 
 
 void BmiSoilFreezeThaw::
 GetValueAtIndices (std::string name, void *dest, int *inds, int len)
 {
-  void * src = NULL;
+  this->GetValueAtIndicesByHandle(this->GetVarHandle(name), dest, inds, len);
+}
+
+
+void BmiSoilFreezeThaw::
+SetValue (std::string name, void *src)
+{
+  this->SetValueByHandle(this->GetVarHandle(name), src);
+}
 
-  src = this->GetValuePtr(name);
 
-  if (src) {
-    int i;
-    int itemsize = 0;
-    int offset;
-    char *ptr;
+void BmiSoilFreezeThaw::
+SetValueAtIndices (std::string name, int * inds, int len, void *src)
+{
+  this->SetValueAtIndicesByHandle(this->GetVarHandle(name), inds, len, src);
+}
 
-    itemsize = this->GetVarItemsize(name);
 
-    for (i=0, ptr=(char *)dest; i<len; i++, ptr+=itemsize) {
-      offset = inds[i] * itemsize;
-      memcpy(ptr, (char *)src + offset, itemsize);
-    }
-  }
+// entry of the handle, throws if the handle is not a variable of the registry
+static const BmiVariable &VariableOfHandle(int handle)
+{
+  if (handle < 0 || handle >= bmi_variable_count)
+    throw std::runtime_error("invalid BMI variable handle " + std::to_string(handle));
+  return bmi_variables[handle];
+}
+
+template <typename T>
+static void Gather(const T *src, T *dest, const int *inds, int count)
+{
+  for (int i=0; i<count; i++)
+    dest[i] = src[inds[i]];
+}
+
+template <typename T>
+static void Scatter(const T *src, T *dest, const int *inds, int count)
+{
+  for (int i=0; i<count; i++)
+    dest[inds[i]] = src[i];
+}
+
+
+int BmiSoilFreezeThaw::
+GetVarHandle(const std::string &name)
+{
+  return &GetVariable(name) - bmi_variables;
+}
+
+
+void *BmiSoilFreezeThaw::
+GetValuePtrByHandle(int handle)
+{
+  return VariableOfHandle(handle).pointer(this->state);
 }
 
 
 void BmiSoilFreezeThaw::
-SetValue (std::string name, void *src)
+GetValueByHandle(int handle, void *dest)
 {
-  void * dest = NULL;
-  
-  dest = this->GetValuePtr(name);
-  
-  if (dest) {
-    int nbytes = 0;
-    nbytes = this->GetVarNbytes(name);
-    memcpy(dest, src, nbytes);
-  }
+  const BmiVariable &variable = VariableOfHandle(handle);
 
+  memcpy(dest, variable.pointer(this->state), ItemSize(variable) * this->GetGridSize(variable.grid));
 }
 
 
 void BmiSoilFreezeThaw::
-SetValueAtIndices (std::string name, int * inds, int len, void *src)
+SetValueByHandle(int handle, const void *src)
 {
-  void * dest = NULL;
+  const BmiVariable &variable = VariableOfHandle(handle);
+  void *dest = variable.pointer(this->state);
 
-  dest = this->GetValuePtr(name);
+  if (dest)
+    memcpy(dest, src, ItemSize(variable) * this->GetGridSize(variable.grid));
 
-  if (dest) {
-    int i;
-    int itemsize = 0;
-    int offset;
-    char *ptr;
+  // calibratable soil parameters feed the precomputed constants of the model
+  if (variable.soil_parameter)
+    this->state->InvalidateInvariants();
+}
 
-    itemsize = this->GetVarItemsize(name);
 
-    for (i=0, ptr=(char *)src; i<len; i++, ptr+=itemsize) {
-      offset = inds[i] * itemsize;
-      memcpy((char *)dest + offset, ptr, itemsize);
-    }
+void BmiSoilFreezeThaw::
+GetValueAtIndicesByHandle(int handle, void *dest, const int *inds, int count)
+{
+  const BmiVariable &variable = VariableOfHandle(handle);
+  const void *src = variable.pointer(this->state);
+
+  if (src == NULL)
+    return;
+  if (variable.grid == 0)
+    Gather((const int *)src, (int *)dest, inds, count);
+  else
+    Gather((const double *)src, (double *)dest, inds, count);
+}
+
+
+void BmiSoilFreezeThaw::
+SetValueAtIndicesByHandle(int handle, const int *inds, int count, const void *src)
+{
+  const BmiVariable &variable = VariableOfHandle(handle);
+  void *dest = variable.pointer(this->state);
+
+  if (dest) {
+    if (variable.grid == 0)
+      Scatter((const int *)src, (int *)dest, inds, count);
+    else
+      Scatter((const double *)src, (double *)dest, inds, count);
   }
+
+  if (variable.soil_parameter)
+    this->state->InvalidateInvariants();
 }
 
 
@@ -465,4 +560,251 @@ GetGridNodesPerFace(const int grid, int *nodes_per_face)
   throw NotImplemented();
 }
 
+
+void BmiSoilFreezeThaw::
+PrintStatistics(std::ostream &os)
+{
+  this->state->PrintStatistics(os);
+}
+
+
+// outputs recorded by the bulk forcing, see SetForcingSeries
+static const char *const series_output_names[] = {"ice_fraction_schaake", "ice_fraction_xinanjiang",
+						  "soil_ice_fraction", "ground_heat_flux",
+						  "soil_temperature_profile"};
+
+
+void BmiSoilFreezeThaw::
+SetForcingSeries(const double *ground_temperature, int nsteps, const double *soil_moisture)
+{
+  if (nsteps < 0)
+    throw std::runtime_error("SetForcingSeries: negative number of steps " + std::to_string(nsteps));
+
+  const int ncells = this->GetGridSize(2);
+  this->forcing_ground_temperature.assign(ground_temperature, ground_temperature + nsteps);
+  if (soil_moisture)
+    this->forcing_soil_moisture.assign(soil_moisture, soil_moisture + nsteps * ncells);
+  else
+    this->forcing_soil_moisture.clear();
+  this->forcing_step = 0;
+
+  // the outputs of all the steps are reserved, the steps do not allocate
+  for (int k=0; k<series_output_count; k++) {
+    this->series_output_handle[k] = this->GetVarHandle(series_output_names[k]);
+    this->series_outputs[k].clear();
+    this->series_outputs[k].reserve(nsteps * this->GetGridSize(bmi_variables[series_output_handle[k]].grid));
+  }
+}
+
+
+int BmiSoilFreezeThaw::
+GetSeriesStepCount()
+{
+  return this->forcing_step;
+}
+
+
+const double *BmiSoilFreezeThaw::
+GetOutputSeries(const std::string &name)
+{
+  for (int k=0; k<series_output_count; k++) {
+    if (name == series_output_names[k])
+      return this->series_outputs[k].data();
+  }
+  throw std::runtime_error("GetOutputSeries: " + name + " is not recorded (ice_fraction_schaake, "
+			   "ice_fraction_xinanjiang, soil_ice_fraction, ground_heat_flux, soil_temperature_profile)");
+}
+
+
+void BmiSoilFreezeThaw::
+AdvanceStep()
+{
+  const bool forced = this->forcing_step < int(this->forcing_ground_temperature.size());
+
+  if (forced) {
+    this->state->ground_temp = this->forcing_ground_temperature[this->forcing_step];
+    if (!this->forcing_soil_moisture.empty()) {
+      const int ncells = this->GetGridSize(2);
+      memcpy(this->state->soil_moisture_content, &this->forcing_soil_moisture[this->forcing_step * ncells],
+	     ncells * sizeof(double));
+    }
+  }
+
+  this->state->Advance();
+
+  if (forced) {
+    for (int k=0; k<series_output_count; k++) {
+      const BmiVariable &variable = bmi_variables[this->series_output_handle[k]];
+      const double *value = (const double *)variable.pointer(this->state);
+      this->series_outputs[k].insert(this->series_outputs[k].end(), value,
+				     value + this->GetGridSize(variable.grid));
+    }
+    this->forcing_step++;
+  }
+}
+
+
+void BmiSoilFreezeThaw::
+SaveCheckpoint(std::ostream &os)
+{
+  this->state->SaveCheckpoint(os);
+}
+
+
+void BmiSoilFreezeThaw::
+SaveCheckpoint(const std::string &file)
+{
+  this->state->SaveCheckpoint(file);
+}
+
+
+void BmiSoilFreezeThaw::
+RestoreCheckpoint(std::istream &is)
+{
+  this->state->RestoreCheckpoint(is);
+}
+
+
+void BmiSoilFreezeThaw::
+RestoreCheckpoint(const std::string &file)
+{
+  this->state->RestoreCheckpoint(file);
+}
+
+
+/* C interface of the variable handles and checkpoints: NULL pointers and the C++ exceptions are reported as
+   BMI_FAILURE */
+
+int bmi_sft_get_var_handle(BmiSoilFreezeThaw *model, const char *name, int *handle)
+{
+  if (model == NULL || name == NULL || handle == NULL)
+    return 1;
+  try {
+    const BmiVariable *variable = FindVariable(name);
+    if (variable == NULL)
+      return 1;
+    *handle = variable - bmi_variables;
+  }
+  catch (const std::exception &) {
+    return 1;
+  }
+  catch (...) {
+    return 1;
+  }
+  return 0;
+}
+
+int bmi_sft_get_value_ptr(BmiSoilFreezeThaw *model, int handle, void **ptr)
+{
+  if (model == NULL || ptr == NULL)
+    return 1;
+  try {
+    *ptr = model->GetValuePtrByHandle(handle);
+  }
+  catch (const std::exception &) {
+    return 1;
+  }
+  catch (...) {
+    return 1;
+  }
+  return 0;
+}
+
+int bmi_sft_get_value(BmiSoilFreezeThaw *model, int handle, void *dest)
+{
+  if (model == NULL || dest == NULL)
+    return 1;
+  try {
+    model->GetValueByHandle(handle, dest);
+  }
+  catch (const std::exception &) {
+    return 1;
+  }
+  catch (...) {
+    return 1;
+  }
+  return 0;
+}
+
+int bmi_sft_set_value(BmiSoilFreezeThaw *model, int handle, const void *src)
+{
+  if (model == NULL || src == NULL)
+    return 1;
+  try {
+    model->SetValueByHandle(handle, src);
+  }
+  catch (const std::exception &) {
+    return 1;
+  }
+  catch (...) {
+    return 1;
+  }
+  return 0;
+}
+
+int bmi_sft_get_value_at_indices(BmiSoilFreezeThaw *model, int handle, void *dest, const int *inds, int count)
+{
+  if (model == NULL || dest == NULL || inds == NULL)
+    return 1;
+  try {
+    model->GetValueAtIndicesByHandle(handle, dest, inds, count);
+  }
+  catch (const std::exception &) {
+    return 1;
+  }
+  catch (...) {
+    return 1;
+  }
+  return 0;
+}
+
+int bmi_sft_set_value_at_indices(BmiSoilFreezeThaw *model, int handle, const int *inds, int count,
+				 const void *src)
+{
+  if (model == NULL || inds == NULL || src == NULL)
+    return 1;
+  try {
+    model->SetValueAtIndicesByHandle(handle, inds, count, src);
+  }
+  catch (const std::exception &) {
+    return 1;
+  }
+  catch (...) {
+    return 1;
+  }
+  return 0;
+}
+
+int bmi_sft_save_checkpoint(BmiSoilFreezeThaw *model, const char *file)
+{
+  if (model == NULL || file == NULL)
+    return 1;
+  try {
+    model->SaveCheckpoint(std::string(file));
+  }
+  catch (const std::exception &) {
+    return 1;
+  }
+  catch (...) {
+    return 1;
+  }
+  return 0;
+}
+
+int bmi_sft_restore_checkpoint(BmiSoilFreezeThaw *model, const char *file)
+{
+  if (model == NULL || file == NULL)
+    return 1;
+  try {
+    model->RestoreCheckpoint(std::string(file));
+  }
+  catch (const std::exception &) {
+    return 1;
+  }
+  catch (...) {
+    return 1;
+  }
+  return 0;
+}
+
 #endif
@@ -8,6 +8,7 @@
 #include "../include/bmi_soil_freeze_thaw.hxx"
 #include "../include/soil_freeze_thaw.hxx"
 #include <cmath>
+#include <chrono>
 
 
 
@@ -16,6 +17,8 @@ std::vector<double> ReadForcingData(std::string config_file);
 /************************************************************************
    The code simulates a standalone run of the Soil Freeze-thaw model.
    Benchmark: Comparison of the ice fraction is made with the existing (already ran) golden test
+   Usage: sft_standalone config_file [golden_file]; golden_file defaults to ./tests/file_golden.csv, none runs
+   the config without the comparison (benchmarking and PGO training runs). Returns 1 if the comparison fails.
 ************************************************************************/
 
 
@@ -57,12 +60,12 @@ int main(int argc, const char *argv[])
   
   double *ice_fraction = new double[nsteps];
   std::vector<double> ice_fraction_golden;
-  double ice_frac_v = 0;
 
   bool golden_test = false; // if true, a new golden test results will be generated
   std::ofstream outfile;
  
-  std::string filename = "./tests/file_golden.csv";
+  std::string filename = argc > 2 ? argv[2] : "./tests/file_golden.csv";
+  bool compare = !golden_test && filename != "none";
   
   if (golden_test) {
     
@@ -73,7 +76,7 @@ int main(int argc, const char *argv[])
 
     outfile << "Time [h],ice_fraction" << "\n"; 
   }
-  else {
+  else if (compare) {
     
     std::ifstream infile;
     infile.open(filename);
@@ -96,28 +99,42 @@ int main(int argc, const char *argv[])
     infile.close();
   }
   
-  for (int i = 0; i < nsteps; i++) {
-    
-    ftm_bmi_model.SetValue("ground_temperature", &ground_temp[i]);
+  if (int(ground_temp.size()) < nsteps) {
+    std::cout<<"The forcing file provides "<<ground_temp.size()<<" timesteps, the run has "<<nsteps<<"\n";
+    return 1;
+  }
 
-    ftm_bmi_model.Update(); // Update model
+  // the ground temperature series is handed over at once, UpdateUntil runs the timesteps internally and records
+  // the outputs of each step
+  auto loop_start = std::chrono::steady_clock::now();
 
-    ftm_bmi_model.GetValue("ice_fraction_schaake",&ice_frac_v);
+  ftm_bmi_model.SetForcingSeries(ground_temp.data(), nsteps);
+  ftm_bmi_model.UpdateUntil(nsteps * timestep);
 
-    ice_fraction[i] = ice_frac_v;
+  double loop_seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - loop_start).count();
+
+  const double *ice_fraction_series = ftm_bmi_model.GetOutputSeries("ice_fraction_schaake");
+  for (int i = 0; i < nsteps; i++) {
+    ice_fraction[i] = ice_fraction_series[i];
     
     if (golden_test)
-      outfile << i+1 << "," <<ice_frac_v << "\n";
-    
+      outfile << i+1 << "," <<ice_fraction[i] << "\n";
   }
 
   outfile.close();
   
   /*********************** Comnpare against golden test ********************************/
 
-  if (!golden_test) {
-    bool test_status = true;
+  bool test_status = true;
+
+  if (compare) {
     
+    if (int(ice_fraction_golden.size()) < nsteps) {
+      std::cout<<"The golden test "<<filename<<" has "<<ice_fraction_golden.size()<<" timesteps, the run has "
+	       <<nsteps<<"\n";
+      ice_fraction_golden.resize(nsteps, -1.0);
+    }
+
     double  err_frozen_frac_mm = 0;
     for (int i=0; i<nsteps;i++) {
       err_frozen_frac_mm += round(fabs(ice_fraction_golden[i] - ice_fraction[i]) *100000.)/100000.; //truncate the error at 5 decimal places
@@ -137,10 +154,17 @@ int main(int argc, const char *argv[])
     std::cout<<"*********************************************************\n";
     std::cout<<" Test passed = "<<passed<<" \n Frozen fraction error = "<<err_frozen_frac_mm<<"\n";
     std::cout<<"*********************************************************\n";
+    ftm_bmi_model.PrintStatistics(std::cout);
+    std::cout<<"Timestep loop wall time [s] = "<<loop_seconds<<" ("<<1.0e6 * loop_seconds / nsteps<<" us/timestep)\n";
+    std::cout<<"*********************************************************\n";
   }
-  else {
+  else if (golden_test) {
     std::cout<<"Golden test created... see "<<filename<<"\n";
   }
+  else {
+    ftm_bmi_model.PrintStatistics(std::cout);
+    std::cout<<"Timestep loop wall time [s] = "<<loop_seconds<<" ("<<1.0e6 * loop_seconds / nsteps<<" us/timestep)\n";
+  }
   
   /************************************************************************
     Finalize SFT BMI model
@@ -148,7 +172,7 @@ int main(int argc, const char *argv[])
   
   ftm_bmi_model.Finalize();
   
-  return 0;
+  return test_status ? 0 : 1;
 }
 
 
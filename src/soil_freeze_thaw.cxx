@@ -9,7 +9,190 @@
 #include <cmath>
 #include <algorithm>
 #include <stdexcept>
+#include <cstdint>
+#include <cstdio>
+#include <cerrno>
+#include <atomic>
+#ifdef _WIN32
+#include <direct.h>
+#include <process.h>
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
 #include "../include/soil_freeze_thaw.hxx"
+#include "../include/soil_freeze_thaw_math.hxx"
+
+#if defined(__GNUC__)
+#define SFT_NOINLINE __attribute__((noinline))
+#else
+#define SFT_NOINLINE
+#endif
+
+namespace {
+
+  const double tcwater = 0.57;  // thermal_conductivity of water  [W/(mK)]
+  const double tcice   = 2.2;   // thermal conductiviyt of ice    [W/(mK)]
+
+  /* Peters-Lidard thermal conductivity of a cell with total and liquid moisture contents smc and slc,
+     used by ThermalConductivity() and the fused assembly (SolveDiffusionEquationFused) */
+  inline double PetersLidard(double smc, double slc, double smcmax, double tc_solid_sat, double tc_dry)
+  {
+    double sat_ratio = smc/ smcmax;
+
+    /******** SATURATED THERMAL CONDUCTIVITY *********/
+
+    //UNFROZEN VOLUME FOR SATURATION (POROSITY*XUNFROZ)
+    // (phi * Sliq) / (phi * sliq + phi * sice) = sliq/(sliq+sice), 1 prevents zero division
+    // (selects instead of branches here and for the Kersten number, so loops over cells are vectorized)
+    double x_unfrozen = slc / (smc > 0 ? smc : 1.0);
+    x_unfrozen = smc > 0 ? x_unfrozen : 1.0;
+
+    double xu = x_unfrozen * smcmax; // unfrozen volume fraction
+    double tc_sat = tc_solid_sat * soilfreezethaw::math::Pow(tcice, (smcmax - xu)) * soilfreezethaw::math::Pow(tcwater,xu);
+
+    // Kersten Number
+    double log_sat = soilfreezethaw::math::Log10(sat_ratio);
+    double KN = sat_ratio > 0.05 ? 0.7 * log_sat + 1. : 0.0;
+    KN = sat_ratio > 0.1 ? log_sat + 1. : KN;
+    KN = (slc + 0.0005) < smc ? sat_ratio : KN; // for frozen soil
+
+    // Thermal conductivity
+    return KN * (tc_sat - tc_dry) + tc_dry;
+  }
+
+  /* same scheme with tc_sat and log10(sat_ratio) interpolated from the tables of the soil type */
+  inline double PetersLidard(double smc, double slc, double smcmax, double tc_dry,
+			     const soilfreezethaw::ConstitutiveTables &tables)
+  {
+    double sat_ratio  = smc/ smcmax;
+    double x_unfrozen = slc / (smc > 0 ? smc : 1.0);
+    x_unfrozen = smc > 0 ? x_unfrozen : 1.0;
+
+    double tc_sat  = tables.tc_sat(x_unfrozen * smcmax);
+    double log_sat = tables.log_sat(sat_ratio);
+    double KN = sat_ratio > 0.05 ? 0.7 * log_sat + 1. : 0.0;
+    KN = sat_ratio > 0.1 ? log_sat + 1. : KN;
+    KN = (slc + 0.0005) < smc ? sat_ratio : KN;
+
+    return KN * (tc_sat - tc_dry) + tc_dry;
+  }
+
+  /* volumetric heat capacity of a cell, hc_solid = (1-smcmax) * hcsoil */
+  inline double HeatCapacity(double smc, double slc, double smcmax, double hc_solid, const soilfreezethaw::Properties &prop)
+  {
+    double sice = smc - slc;
+    return slc*prop.hcwater_ + sice*prop.hcice_ + hc_solid + (smcmax-smc)*prop.hcair_;
+  }
+
+  /* NoahMP phase change of one cell, used by PhaseChange() and PhaseChangeN(). The melting/freezing index
+     (IndexMelt) is replaced by masks and the branches by selects of values computed for every cell, with the
+     same operations, so loops over cells are vectorized. supercool is the volumetric supercooled liquid water
+     limit at T (used below the freezing point only, may be NaN above). Updates the state of the cell and
+     returns the energy taken to bring a melting/freezing cell to the freezing point (heat_energy) and the
+     residual after the phase change (heat_residual) [W/m2], energy_consumed is their difference. */
+  SFT_ALWAYS_INLINE void PhaseChangeCell(double &T, double &smc, double &slc, double &sice, double supercool, double hc,
+			      double dz, double dt, double latent_heat_fusion, double tfrez, double wdensity,
+			      double &heat_energy, double &heat_residual)
+  {
+    // mass of liquid/ice [kg/m2], and the supercooled water, the maximum liquid water below the freezing point
+    const double MassIce_c = (smc - slc) * dz * wdensity;
+    const double MassLiq_c = slc * dz * wdensity;
+    const double MassTotal = MassIce_c + MassLiq_c;
+    const double Supercool = T < tfrez ? supercool * dz * wdensity : 0.0;
+
+    // melting/freezing condition (IndexMelt = 1 or 2)
+    // (bitwise operators on the masks, GCC does not vectorize selects of booleans)
+    const bool melting  = (MassIce_c > 0) & (T > tfrez);
+    const bool freezing = (MassLiq_c > Supercool) & (T <= tfrez);
+
+    // excess or deficit of energy, the cell is brought to the freezing point; phase change only if the energy
+    // melts ice or freezes water (IndexMelt is reset otherwise)
+    const double energy = (T - tfrez) * (hc * dz) / dt; // q = m * c * delta_T
+    const bool change = (melting & (energy > 0)) | (freezing & (energy < 0));
+    const double HeatEnergy = melting | freezing ? energy : 0.0;
+    T = melting | freezing ? tfrez : T;
+    heat_energy = HeatEnergy;
+
+    // mass partition between ice and water: melting or freezing water MassPhaseChange [kg/m2]
+    const double MassPhaseChange = HeatEnergy * dt / latent_heat_fusion;
+    const double ice_melting = std::max(0., MassIce_c - MassPhaseChange);
+    double ice_freezing = std::min(MassTotal - Supercool, MassIce_c - MassPhaseChange);
+    ice_freezing = std::max(ice_freezing, 0.0);
+    ice_freezing = MassTotal < Supercool ? 0.0 : ice_freezing;
+
+    double MassIce = MassPhaseChange < 0 ? ice_freezing : MassIce_c;
+    MassIce = MassPhaseChange > 0 ? ice_melting : MassIce;
+    MassIce = change ? MassIce : MassIce_c;
+    double MassLiq = change ? std::max(0., MassTotal - MassIce) : MassLiq_c;
+
+    // heat residual: energy available - energy consumed by the phase change, becomes sensible heat
+    double HEATR = HeatEnergy - latent_heat_fusion * (MassIce_c - MassIce) / dt; // [W/m2]
+    HEATR = change ? HEATR : 0.0;
+    heat_residual = HEATR;
+
+    // temperature correction
+    double f = dt/(hc * dz); // [m2 K/W]
+    T = std::abs(HEATR) > 0 ? T + f * HEATR : T;
+
+    slc  = MassLiq / (wdensity * dz);             // [-]
+    smc  = (MassLiq + MassIce) / (wdensity * dz); // [-]
+    sice = std::max(smc - slc, 0.);
+  }
+
+  /* Loops of the per-cell kernels over the n cells of a column, compiled for the baseline, AVX2 and AVX-512
+     (SFT_SIMD_VARIANTS, see soil_freeze_thaw_simd.hxx) and called through SFT_SIMD_CALL with the simd_path
+     selected by SelectKernels.
+     PhaseChangeCells: PhaseChangeCell for the cells; supercool(T) returns the volumetric supercooled water
+     limit. The state arrays are separate allocations: declared not to alias, the loop is vectorized without
+     the runtime overlap checks (too many for the compiler with six arrays written). Not inlined, GCC drops the
+     restrict qualifiers of the parameters of an inlined function. The tabulated supercooled water (a gather)
+     is not vectorized with SSE2/AVX2. */
+#define SFT_CELL_KERNELS(ISA, target)							\
+  target SFT_NOINLINE void ThermalConductivityCells##ISA(int n, const double *smc, const double *slc,	\
+							  double smcmax, double tc_solid_sat, double tc_dry, \
+							  double *k)				\
+  {											\
+    for (int i=0; i<n; i++)								\
+      k[i] = PetersLidard(smc[i], slc[i], smcmax, tc_solid_sat, tc_dry);		\
+  }											\
+											\
+  target SFT_NOINLINE void ThermalConductivityCells##ISA(int n, const double *smc, const double *slc,	\
+							  double smcmax, double tc_dry,		\
+							  const soilfreezethaw::ConstitutiveTables &tables, \
+							  double *k)				\
+  {											\
+    for (int i=0; i<n; i++)								\
+      k[i] = PetersLidard(smc[i], slc[i], smcmax, tc_dry, tables);			\
+  }											\
+											\
+  target SFT_NOINLINE void HeatCapacityCells##ISA(int n, const double *smc, const double *slc, double smcmax, \
+						   double hc_solid, const soilfreezethaw::Properties &prop, \
+						   double *hc)					\
+  {											\
+    for (int i=0; i<n; i++)								\
+      hc[i] = HeatCapacity(smc[i], slc[i], smcmax, hc_solid, prop);			\
+  }											\
+											\
+  template <typename SupercoolFunction>							\
+  target SFT_NOINLINE void PhaseChangeCells##ISA(int n, double *__restrict T, double *__restrict smc,	\
+						  double *__restrict slc, double *__restrict sice,	\
+						  const double *__restrict hc, const double *__restrict dz, \
+						  double dt, double latent_heat_fusion, double tfrez,	\
+						  double wdensity, SupercoolFunction supercool,	\
+						  double *__restrict heat_energy,			\
+						  double *__restrict heat_residual)			\
+  {											\
+    for (int i=0; i<n; i++)								\
+      PhaseChangeCell(T[i], smc[i], slc[i], sice[i], supercool(T[i]), hc[i], dz[i], dt, latent_heat_fusion, \
+		      tfrez, wdensity, heat_energy[i], heat_residual[i]);			\
+  }
+
+  SFT_SIMD_VARIANTS(SFT_CELL_KERNELS)
+#undef SFT_CELL_KERNELS
+}
 
 
 soilfreezethaw::SoilFreezeThaw::
@@ -35,6 +218,42 @@ SoilFreezeThaw()
   this->ground_temp             = 273.15;
   this->soil_ice_fraction       = 0.0;
   this->bottom_boundary_temp_const = 275.15;
+  this->phase_change_scheme            = "split";
+  this->adaptive_timestep              = false;
+  this->adaptive_temperature_tolerance = 1.0;
+  this->adaptive_dt_min                = 60.0;
+  this->constitutive_tables            = false;
+  this->constitutive_table_resolution  = 64;
+  this->partitioned_solver_cells       = partitioned_solver_cells_default;
+  this->partitioned_solver_threads     = 1;
+  this->simd_path_option               = "auto";
+  this->spinup_steps                   = 0;
+  this->spinup_cycles                  = 1;
+  this->spinup_tolerance               = 0.0;
+  this->spinup_ice_tolerance           = 1.0e-4;
+  this->spinup_anderson_depth          = 5;
+  this->spinup_cache_result            = "off";
+  this->spinup_cycles_used             = 0;
+  this->spinup_converged               = false;
+  this->spinup_temperature_change      = 0.0;
+  this->spinup_ice_change              = 0.0;
+  this->adaptive_substep               = this->dt;
+  this->energy_balance_substeps        = 0.0;
+  this->energy_balance_compensation    = 0.0;
+  // no grid yet: generic kernels and the portable path, the kernels and the instruction set are selected by the
+  // config file constructor (BMI Initialize)
+  this->ncells                         = 0;
+  this->kernel_cells                   = 0;
+  this->fused_assembly                 = true;
+  this->partitioned_solver             = false;
+  this->diffusion_kernel               = &SoilFreezeThaw::SolveDiffusionEquation;
+  this->phase_change_kernel            = &SoilFreezeThaw::PhaseChange;
+  this->simd_path                      = SimdPath::Scalar;
+  this->invariants.valid = false;
+  this->invariants.generation = 0;
+  this->coefficients.factorized = false;
+  this->coefficients.factorization_ok = false;
+  this->stats = Statistics();
 }
 
 soilfreezethaw::SoilFreezeThaw::
@@ -57,12 +276,22 @@ SoilFreezeThaw(std::string config_file)
 
   this->InitializeArrays();
   SoilCellsThickness(); // get soil cells thickness
+  this->invariants.valid = false;
+  this->invariants.generation = 0;
+  this->coefficients.factorized = false;
+  this->coefficients.factorization_ok = false;
+  this->stats = Statistics();
+  this->adaptive_substep = this->dt;
+  this->energy_balance_substeps = 0.0;
+  SelectKernels();
+  UpdateInvariants();
   this->ice_fraction_schaake    = 0.0;
   this->ice_fraction_xinanjiang = 0.0;
   this->ground_temp             = 273.15;
   this->time                    = 0.0;
   this->soil_ice_fraction       = 0.0;
   this->energy_balance          = 0.0;
+  this->energy_balance_compensation = 0.0;
 }
 
 
@@ -84,6 +313,36 @@ InitializeArrays(void)
     // initialize heat capacity to zero, will be update in the advanced before updating soil T
     this->heat_capacity[i] = 0.0;
   }
+
+  // allocate the timestep scratch arrays once, reused by every call to Advance()
+  this->work.Resize(ncells);
+  this->coefficients.soil_moisture_content.assign(ncells, 0.0);
+  this->coefficients.soil_liquid_content.assign(ncells, 0.0);
+}
+
+void soilfreezethaw::SoilFreezeThaw::Workspace::
+Resize(int n)
+{
+  thermal_flux.assign(n, 0.0);
+  AI.assign(n, 0.0);
+  BI.assign(n, 0.0);
+  CI.assign(n, 0.0);
+  RHS.assign(n, 0.0);
+  lambda.assign(n, 0.0);
+  X.assign(n, 0.0);
+  dsoilT_dz.assign(n, 0.0);
+  P.assign(n, 0.0);
+  Q.assign(n, 0.0);
+  pivot.assign(n, 0.0);
+  HeatEnergy_L.assign(n, 0.0);
+  HeatResidual_L.assign(n, 0.0);
+  T_star.assign(n, 0.0);
+  liquid_iter.assign(n, 0.0);
+  dliquid_dT.assign(n, 0.0);
+  soil_temperature_s.assign(n, 0.0);
+  soil_moisture_content_s.assign(n, 0.0);
+  soil_liquid_content_s.assign(n, 0.0);
+  soil_ice_content_s.assign(n, 0.0);
 }
 
 void soilfreezethaw::SoilFreezeThaw::
@@ -99,6 +358,27 @@ InitFromConfigFile(std::string config_file)
   int n_st, n_mct, n_mcl;
 
   this->is_soil_moisture_bmi_set = false;
+  this->phase_change_scheme = "split";
+  this->adaptive_timestep = false;
+  this->adaptive_temperature_tolerance = 1.0; // [K]
+  this->adaptive_dt_min = 60.0;               // [s]
+  this->constitutive_tables = false;
+  this->constitutive_table_resolution = 64;
+  this->partitioned_solver_cells = partitioned_solver_cells_default;
+  this->partitioned_solver_threads = 1;
+  this->simd_path_option = "auto";
+  this->spinup_forcing_file = "";
+  this->spinup_steps = 0;
+  this->spinup_cycles = 1;
+  this->spinup_tolerance = 0.0;
+  this->spinup_ice_tolerance = 1.0e-4;
+  this->spinup_anderson_depth = 5;
+  this->spinup_cache_dir = "";
+  this->spinup_cache_result = "off";
+  this->spinup_cycles_used = 0;
+  this->spinup_converged = false;
+  this->spinup_temperature_change = 0.0;
+  this->spinup_ice_change = 0.0;
   bool is_endtime_set = false;
   bool is_dt_set = false;
   bool is_soil_z_set = false;
@@ -242,6 +522,99 @@ InitFromConfigFile(std::string config_file)
       is_top_boundary_temp_set = true;
       continue;
     }
+    else if (param_key == "phase_change_scheme") {
+      if (param_value != "split" && param_value != "enthalpy")
+	throw std::runtime_error("phase_change_scheme should be split or enthalpy!");
+      this->phase_change_scheme = param_value;
+      continue;
+    }
+    else if (param_key == "adaptive_timestep") {
+      this->adaptive_timestep = param_value == "true" || param_value == "1";
+      continue;
+    }
+    else if (param_key == "adaptive_temperature_tolerance") {
+      this->adaptive_temperature_tolerance = std::stod(param_value);
+      if (this->adaptive_temperature_tolerance <= 0.0)
+	throw std::runtime_error("adaptive_temperature_tolerance should be greater than zero!");
+      continue;
+    }
+    else if (param_key == "adaptive_dt_min") {
+      this->adaptive_dt_min = std::stod(param_value);
+      if (param_unit == "[d]" || param_unit == "[day]")
+	this->adaptive_dt_min *= 86400;
+      else if (param_unit == "[h]" || param_unit == "[hr]")
+	this->adaptive_dt_min *= 3600.0;
+      else if (param_unit == "[s]" || param_unit == "[sec]" || param_unit == "") // defalut unit is second
+	this->adaptive_dt_min *= 1.0;
+      if (this->adaptive_dt_min <= 0.0)
+	throw std::runtime_error("adaptive_dt_min should be greater than zero!");
+      continue;
+    }
+    else if (param_key == "constitutive_tables") {
+      this->constitutive_tables = param_value == "true" || param_value == "1";
+      continue;
+    }
+    else if (param_key == "constitutive_table_resolution") {
+      this->constitutive_table_resolution = std::stoi(param_value);
+      if (!ConstitutiveTables::IsValidResolution(this->constitutive_table_resolution))
+	throw std::runtime_error("constitutive_table_resolution should be a power of two between 8 and 4096!");
+      continue;
+    }
+    else if (param_key == "partitioned_solver_cells") {
+      this->partitioned_solver_cells = std::stoi(param_value);
+      if (this->partitioned_solver_cells < 0)
+	throw std::runtime_error("partitioned_solver_cells should be zero (never) or positive!");
+      continue;
+    }
+    else if (param_key == "partitioned_solver_threads") {
+      this->partitioned_solver_threads = std::stoi(param_value);
+      if (this->partitioned_solver_threads < 1)
+	throw std::runtime_error("partitioned_solver_threads should be at least 1!");
+      continue;
+    }
+    else if (param_key == "simd_path") {
+      this->simd_path_option = param_value;
+      ParseSimdPath(param_value); // throws if unknown or not supported by this CPU
+      continue;
+    }
+    else if (param_key == "spinup_forcing_file") {
+      this->spinup_forcing_file = param_value;
+      continue;
+    }
+    else if (param_key == "spinup_steps") {
+      this->spinup_steps = std::stoi(param_value);
+      if (this->spinup_steps < 0)
+	throw std::runtime_error("spinup_steps should be zero (the whole forcing file) or positive!");
+      continue;
+    }
+    else if (param_key == "spinup_cycles") {
+      this->spinup_cycles = std::stoi(param_value);
+      if (this->spinup_cycles < 1)
+	throw std::runtime_error("spinup_cycles should be at least 1!");
+      continue;
+    }
+    else if (param_key == "spinup_tolerance") {
+      this->spinup_tolerance = std::stod(param_value);
+      if (this->spinup_tolerance < 0.0)
+	throw std::runtime_error("spinup_tolerance should be zero (fixed number of cycles) or positive!");
+      continue;
+    }
+    else if (param_key == "spinup_ice_tolerance") {
+      this->spinup_ice_tolerance = std::stod(param_value);
+      if (this->spinup_ice_tolerance <= 0.0)
+	throw std::runtime_error("spinup_ice_tolerance should be greater than zero!");
+      continue;
+    }
+    else if (param_key == "spinup_anderson_depth") {
+      this->spinup_anderson_depth = std::stoi(param_value);
+      if (this->spinup_anderson_depth < 0)
+	throw std::runtime_error("spinup_anderson_depth should be zero (plain cycling) or positive!");
+      continue;
+    }
+    else if (param_key == "spinup_cache_dir") {
+      this->spinup_cache_dir = param_value;
+      continue;
+    }
     else if (param_key == "verbosity") {
       if (param_value == "high" || param_value == "low")
 	this->verbosity = param_value;
@@ -420,47 +793,110 @@ GetDt()
 
 
 /*
-  Advance the timestep of the soil freeze thaw model called by BMI Update
-  
+  Precomputes the terms that depend only on the grid (soil_z), dt and the soil parameters (smcmax, b, satpsi, quartz),
+  so the timestep does not recompute them per cell. The block is rebuilt when any of these inputs changes
+  (e.g., UpdateUntil changes dt, calibration parameters set through BMI); the comparison is cheap
+  compared to the transcendental functions it saves.
 */
 void soilfreezethaw::SoilFreezeThaw::
-Advance()
+UpdateInvariants()
 {
-  // before advancing the time, store the current state 
-  for (int i=0; i<this->ncells;i++) {
-      this->soil_temperature_prev[i] = this->soil_temperature[i];
-  }
-  
-  /* BMI sets (total) soil moisture content only, so we update the liquid content based
-     on the previous ice content; initially ice_content is zero; assuming we are starting
-     somewhere in the summer/fall
-  */
-  
-  if (this->is_soil_moisture_bmi_set) {
-    for (int i=0; i<this->ncells;i++) {
-      this->soil_liquid_content[i] = std::max(this->soil_moisture_content[i] - this->soil_ice_content[i], 0.0);
-      //this->soil_ice_content[i] = std::max(this->soil_ice_content[i], 0.0); // make sure ice_content is non-negative
+  Invariants &inv = this->invariants;
+
+  int table_resolution = this->constitutive_tables ? this->constitutive_table_resolution : 0;
+
+  if (inv.valid && inv.dt == this->dt && inv.smcmax == this->smcmax && inv.b == this->b
+      && inv.satpsi == this->satpsi && inv.quartz == this->quartz && inv.table_resolution == table_resolution)
+    return;
+
+  Properties prop;
+
+  // grid geometry used by the diffusion equation
+  inv.h1.assign(ncells, 0.0);
+  inv.h2.assign(ncells, 0.0);
+  inv.denominator.assign(ncells, 0.0);
+
+  for (int i=0; i<ncells; i++) {
+    if (i == 0) {
+      inv.h1[i] = soil_z[i];
+      inv.h2[i] = ncells > 1 ? soil_z[i+1] : 0.0;
+    }
+    else if (i < ncells-1) {
+      inv.h1[i] = soil_z[i] - soil_z[i-1];
+      inv.h2[i] = soil_z[i+1] - soil_z[i-1];
+    }
+    else {
+      inv.h1[i] = soil_z[i] - soil_z[i-1];
     }
+
+    if (i < ncells-1)
+      inv.denominator[i] = 2.0/inv.h2[i];
   }
-  
-  /* Update Thermal conductivities due to update in the soil moisture */
-  ThermalConductivity(); // initialize thermal conductivities
 
-  /* Update volumetric heat capacity */
-  SoilHeatCapacity();
+  // thermal conductivity of solids Eq. (10) Peters-Lidard, and dry thermal conductivity
+  double tcmineral = this->quartz > 0.2 ? 2.0 : 3.0; //thermal_conductivity of other mineral
+  double tcquartz  = 7.7;                            // thermal_conductivity of Quartz [W/(mK)]
+  double gammd     = (1. - this->smcmax)*2700.;      // dry density
+
+  inv.tc_solid     = pow(tcquartz,this->quartz) * pow(tcmineral, (1. - this->quartz));
+  inv.tc_solid_sat = pow(inv.tc_solid,(1. - this->smcmax));
+  inv.tc_dry       = (0.135* gammd+ 64.7)/ (2700. - 0.947* gammd);
+  inv.hc_solid     = (1.0-this->smcmax)*prop.hcsoil_;
+  inv.lam          = -1./(this->b);
+
+  // tables of the supercooled water and the thermal conductivity, shared by the models of the soil type; the
+  // tables in use are only replaced for another soil type, and are held until Get returns (as the last user
+  // of its tables, the model would otherwise release them and Get build them again)
+  if (table_resolution > 0) {
+    ConstitutiveTables::Key key = {this->smcmax, this->b, this->satpsi, this->quartz, this->latent_heat_fusion,
+				   table_resolution};
+    if (!inv.tables || key < inv.tables->key || inv.tables->key < key)
+      inv.tables = ConstitutiveTables::Get(key, verbosity == "none" ? NULL : &std::cout);
+  }
+  else {
+    inv.tables.reset();
+  }
+  inv.table_resolution = table_resolution;
+
+  inv.dt     = this->dt;
+  inv.smcmax = this->smcmax;
+  inv.b      = this->b;
+  inv.satpsi = this->satpsi;
+  inv.quartz = this->quartz;
+  inv.valid  = true;
+  inv.generation++;
+}
 
-  /* Solve the diffusion equation to get updated soil temperatures */
-  SolveDiffusionEquation();
+void soilfreezethaw::SoilFreezeThaw::
+InvalidateInvariants()
+{
+  this->invariants.valid = false;
+}
 
-  /* Now time to update ice content based on the new soil moisture and and
-     soil temperature profiles.
-     Call Phase Change module to partition soil moisture into water and ice.
-  */
-  PhaseChange();
+const soilfreezethaw::ConstitutiveTables* soilfreezethaw::SoilFreezeThaw::
+GetConstitutiveTables()
+{
+  UpdateInvariants();
+  return this->invariants.tables.get();
+}
+
+/*
+  Advance the timestep of the soil freeze thaw model called by BMI Update
+  
+*/
+void soilfreezethaw::SoilFreezeThaw::
+Advance()
+{
+  /* Solve the timestep in one step, or in adaptive sub-steps if enabled (see AdvanceAdaptive) */
+  bool thawed = this->adaptive_timestep ? AdvanceAdaptive() : AdvanceSolution();
 
   this->time += this->dt;
+  this->stats.steps++;
 
-  ComputeIceFraction();
+  if (thawed)
+    this->stats.thawed_steps++;
+  else
+    ComputeIceFraction();
 
   if (verbosity.compare("high") == 0) {
     for (int i=0;i<ncells;i++)
@@ -477,6 +913,219 @@ Advance()
   //assert (this->soil_temperature[0] > 200.0); 
 }
 
+/*
+  Solves one step of size dt: diffusion equation followed by the phase change. Returns true if the
+  column took the thawed column fast path (ice fractions are then already set to zero).
+*/
+bool soilfreezethaw::SoilFreezeThaw::
+AdvanceSolution()
+{
+  /* Rebuild grid and parameter dependent constants if any of their inputs changed */
+  UpdateInvariants();
+
+  /* Store the current state, update the liquid content (BMI) and check whether thermal conductivity,
+     heat capacity and the factorization of the diffusion matrix can be reused (the soil moisture/liquid
+     contents and the parameters are unchanged) */
+  bool coefficients_unchanged = BeginTimestep();
+
+  /* The fused kernel computes the thermal conductivity and the heat capacity in its sweep */
+  bool fused = this->fused_assembly && this->kernel_cells == 0 && this->phase_change_scheme != "enthalpy";
+
+  if (!coefficients_unchanged && !fused) {
+    /* Update Thermal conductivities due to update in the soil moisture */
+    ThermalConductivity(); // initialize thermal conductivities
+
+    /* Update volumetric heat capacity */
+    SoilHeatCapacity();
+  }
+
+  /* Enthalpy scheme: temperatures and the ice/liquid partitioning are solved together */
+  if (this->phase_change_scheme == "enthalpy") {
+    SolveEnthalpyEquation();
+    return false;
+  }
+
+  /* Solve the diffusion equation to get updated soil temperatures */
+  if (fused && this->partitioned_solver)
+    SolveDiffusionEquationFused<true>(coefficients_unchanged);
+  else if (fused)
+    SolveDiffusionEquationFused<false>(coefficients_unchanged);
+  else
+    (this->*diffusion_kernel)(coefficients_unchanged);
+
+  /* Now time to update ice content based on the new soil moisture and and
+     soil temperature profiles.
+     Call Phase Change module to partition soil moisture into water and ice.
+  */
+  /* A column with no ice that stays above the freezing point everywhere can neither freeze nor melt;
+     it bypasses the phase change and ice fraction computations (see IsThawedColumn) */
+  bool thawed = IsThawedColumn();
+
+  if (thawed)
+    ThawedColumnUpdate();
+  else
+    (this->*phase_change_kernel)();
+
+  return thawed;
+}
+
+/*
+  Adaptive sub-stepping (adaptive_timestep = true). The timestep dt is covered by sub-steps; a sub-step is
+  accepted if its local error estimate (SubstepError) is within the tolerance, otherwise the state is
+  restored and the sub-step is retried with a smaller size, down to adaptive_dt_min. The size of the next
+  sub-step grows with the margin of the accepted one and is carried over to the next timestep, so a quiet
+  column takes a single sub-step of size dt and the cost follows the freeze/thaw activity.
+  The ground temperature is constant over dt. Surface/bottom fluxes, the phase change energy and the local
+  energy balance are averaged over the sub-steps, the global energy balance is checked once per timestep.
+*/
+bool soilfreezethaw::SoilFreezeThaw::
+AdvanceAdaptive()
+{
+  const double dt_model = this->dt;
+  double remaining = dt_model;
+  double substep   = std::min(std::max(this->adaptive_substep, this->adaptive_dt_min), dt_model);
+
+  double ground_flux = 0.0, bottom_flux = 0.0, consumed = 0.0, balance = 0.0;
+  bool thawed = false;
+
+  while (remaining > 0.0) {
+    // end the sub-steps at the end of the timestep without leaving a sliver smaller than the minimum sub-step
+    if (substep >= remaining)
+      substep = remaining;
+    else if (remaining - substep < this->adaptive_dt_min)
+      substep = 0.5 * remaining;
+
+    std::copy(soil_temperature, soil_temperature + ncells, work.soil_temperature_s.begin());
+    std::copy(soil_moisture_content, soil_moisture_content + ncells, work.soil_moisture_content_s.begin());
+    std::copy(soil_liquid_content, soil_liquid_content + ncells, work.soil_liquid_content_s.begin());
+    std::copy(soil_ice_content, soil_ice_content + ncells, work.soil_ice_content_s.begin());
+
+    this->dt = substep;
+    thawed = AdvanceSolution();
+
+    double energy_previous, energy_current;
+    double balance_substep = EnergyBalanceTimestep(energy_previous, energy_current);
+    double error = SubstepError(balance_substep, thawed);
+
+    if (!(error <= 1.0) && substep > this->adaptive_dt_min) {
+      std::copy(work.soil_temperature_s.begin(), work.soil_temperature_s.end(), soil_temperature);
+      std::copy(work.soil_moisture_content_s.begin(), work.soil_moisture_content_s.end(), soil_moisture_content);
+      std::copy(work.soil_liquid_content_s.begin(), work.soil_liquid_content_s.end(), soil_liquid_content);
+      std::copy(work.soil_ice_content_s.begin(), work.soil_ice_content_s.end(), soil_ice_content);
+
+      substep = std::max(this->adaptive_dt_min, substep * std::max(0.1, 0.9 / error));
+      this->stats.rejected_substeps++;
+      continue;
+    }
+
+    double w = substep / dt_model; // weight of the sub-step in the timestep averages
+    ground_flux += w * this->ground_heat_flux;
+    bottom_flux += w * this->bottom_heat_flux;
+    consumed    += w * this->energy_consumed;
+    balance     += w * balance_substep;
+
+    remaining -= substep;
+    this->stats.substeps++;
+
+    // the error estimate is first order in the sub-step size
+    substep = substep * std::min(2.0, 0.9 / std::max(error, 0.9 / 2.0));
+    substep = std::min(dt_model, std::max(this->adaptive_dt_min, substep));
+    this->adaptive_substep = substep;
+  }
+
+  this->dt = dt_model;
+  this->ground_heat_flux = ground_flux;
+  this->bottom_heat_flux = bottom_flux;
+  this->energy_consumed  = consumed;
+  this->energy_balance_substeps = balance;
+
+  return thawed;
+}
+
+/*
+  Local error estimate of a sub-step relative to the tolerance (accepted if <= 1). Two temperature
+  measures are used: the largest temperature change of a cell, and the largest phase change residual,
+  i.e. the latent heat of the ice melted or frozen in the sub-step expressed as a temperature change
+  (L * rho_w * |d(ice content)| / heat capacity), which measures the splitting error between the diffusion
+  and the phase change. A local energy balance error larger than a tenth of the global tolerance also
+  rejects the sub-step.
+*/
+double soilfreezethaw::SoilFreezeThaw::
+SubstepError(double energy_balance_substep, bool thawed)
+{
+  Properties prop;
+
+  double dT_max = 0.0;
+  for (int i=0; i<ncells; i++)
+    dT_max = std::max(dT_max, fabs(soil_temperature[i] - soil_temperature_prev[i]));
+
+  if (!thawed) {
+    for (int i=0; i<ncells; i++) {
+      double dice = fabs(soil_ice_content[i] - work.soil_ice_content_s[i]);
+      dT_max = std::max(dT_max, latent_heat_fusion * prop.wdensity_ * dice / heat_capacity[i]);
+    }
+  }
+
+  double error = dT_max / this->adaptive_temperature_tolerance;
+
+  return std::max(error, fabs(energy_balance_substep) / (0.1 * energy_balance_tolerance));
+}
+
+/*
+  Classifies the column after the diffusion step: returns true if no cell holds ice (MassIce <= 0, i.e.
+  soil_moisture_content <= soil_liquid_content) and every cell is above the freezing point. For such a
+  column PhaseChange() has no melting or freezing cell, so it reduces to the
+  mass conversions of the moisture contents, and all ice fractions are zero.
+*/
+bool soilfreezethaw::SoilFreezeThaw::
+IsThawedColumn()
+{
+  Properties prop;
+
+  // an unknown runoff scheme must still be reported by ComputeIceFraction
+  if (this->ice_fraction_scheme != "Schaake" && this->ice_fraction_scheme != "Xinanjiang"
+      && this->ice_fraction_scheme_bmi != SurfaceRunoffScheme::Schaake
+      && this->ice_fraction_scheme_bmi != SurfaceRunoffScheme::Xinanjiang)
+    return false;
+
+  bool thawed = true;
+  for (int i=0; i<ncells; i++)
+    thawed &= (soil_temperature[i] > prop.tfrez_) & (soil_moisture_content[i] <= soil_liquid_content[i]);
+
+  return thawed;
+}
+
+/*
+  Phase change and ice fraction update of a thawed column (see IsThawedColumn), bitwise identical to
+  PhaseChange() followed by ComputeIceFraction(): temperatures are unchanged, no energy is consumed, and
+  the moisture contents go through the same mass conversions ([-] -> [kg/m2] -> [-]) in a single pass.
+*/
+void soilfreezethaw::SoilFreezeThaw::
+ThawedColumnUpdate()
+{
+  Properties prop;
+
+  this->energy_consumed = 0.0;
+
+  for (int i=0; i<ncells; i++) {
+    double MassIce = (soil_moisture_content[i] - soil_liquid_content[i]) * soil_dz[i] * prop.wdensity_; // [kg/m2]
+    double MassLiq = soil_liquid_content[i] * soil_dz[i] * prop.wdensity_;
+
+    soil_liquid_content[i]   = MassLiq / (prop.wdensity_ * soil_dz[i]);
+    soil_moisture_content[i] = (MassLiq + MassIce) / (prop.wdensity_ * soil_dz[i]);
+    soil_ice_content[i]      = std::max(soil_moisture_content[i] - soil_liquid_content[i],0.);
+  }
+
+  if (this->ice_fraction_scheme == "Schaake")
+    this->ice_fraction_scheme_bmi = SurfaceRunoffScheme::Schaake;
+  else if (this->ice_fraction_scheme == "Xinanjiang")
+    this->ice_fraction_scheme_bmi = SurfaceRunoffScheme::Xinanjiang;
+
+  this->ice_fraction_schaake    = 0.0;
+  this->ice_fraction_xinanjiang = 0.0;
+  this->soil_ice_fraction       = 0.0;
+}
+
 /*
   Module returns updated ground heat flux used in surface boundary condition in
   the diffusion equation
@@ -515,53 +1164,57 @@ GroundHeatFlux(double soil_temp)
 void soilfreezethaw::SoilFreezeThaw::
 SolveDiffusionEquation()
 {
-    // local 1D vectors
-    std::vector<double> thermal_flux(ncells);
-    std::vector<double> AI(ncells);
-    std::vector<double> BI(ncells);
-    std::vector<double> CI(ncells);
-    std::vector<double> RHS(ncells);
-    std::vector<double> lambda(ncells);
-    std::vector<double> denominator(ncells);
-    std::vector<double> X(ncells);
-    std::vector<double> dsoilT_dz(ncells);
+  SolveDiffusionEquation(false);
+}
+
+/*
+  reuse_factorization = true: thermal conductivity and heat capacity are unchanged since the previous call
+  (see BeginTimestep), so lambda, A, B, C and the factorization of the matrix stored in the
+  workspace are still valid; only the fluxes and the RHS are computed
+*/
+void soilfreezethaw::SoilFreezeThaw::
+SolveDiffusionEquation(bool reuse_factorization)
+{
+    // local 1D vectors (persistent workspace, no allocation per timestep)
+    std::vector<double> &thermal_flux = work.thermal_flux;
+    std::vector<double> &AI           = work.AI;
+    std::vector<double> &BI           = work.BI;
+    std::vector<double> &CI           = work.CI;
+    std::vector<double> &RHS          = work.RHS;
+    std::vector<double> &lambda       = work.lambda;
+    std::vector<double> &X            = work.X;
+    std::vector<double> &dsoilT_dz    = work.dsoilT_dz;
     double bottomflux = 0.0;
-    double h1 = 0.0, h2 = 0.0;
-    
+
+    // grid geometry (h1, h2 and 2/h2) is precomputed in the invariant block
+    UpdateInvariants();
+    const double *h1 = invariants.h1.data();
+    const double *h2 = invariants.h2.data();
+    const std::vector<double> &denominator = invariants.denominator;
+
+    reuse_factorization = reuse_factorization && coefficients.factorized;
+
     // compute matrix coefficient using Crank-Nicolson discretization scheme
     // first compute thermal fluxes and later multiplied by lambda [=dt/(heat_capacity * (h_i - h_i-1))]
     
     for (int i=0;i<ncells; i++) {
+      if (!reuse_factorization)
+	lambda[i] = dt/(h1[i] * heat_capacity[i]);
+
       if (i == 0) {
-	h1 = soil_z[i];
-	h2 = soil_z[i+1];
-	
-	lambda[i] = dt / (h1 * heat_capacity[i]);
-	denominator[i] = 2.0/h2;
-	
 	this->ground_heat_flux = this->GroundHeatFlux(soil_temperature[i]);
-	dsoilT_dz[i] = 2.0 * (soil_temperature[i+1] - soil_temperature[i])/ h2;;
+	dsoilT_dz[i] = 2.0 * (soil_temperature[i+1] - soil_temperature[i])/ h2[i];
 	
 	thermal_flux[i] = thermal_conductivity[i] * dsoilT_dz[i] + this->ground_heat_flux;
       }
       else if (i < ncells-1) {
-	h1 = soil_z[i] - soil_z[i-1];
-        h2 = soil_z[i+1] - soil_z[i-1];
-
-	lambda[i] = dt/(h1 * heat_capacity[i]);
-	denominator[i] = 2.0/h2;
-
-	dsoilT_dz[i] = 2.0 * (soil_temperature[i+1] - soil_temperature[i])/ h2;
+	dsoilT_dz[i] = 2.0 * (soil_temperature[i+1] - soil_temperature[i])/ h2[i];
 
 	thermal_flux[i] = thermal_conductivity[i] * dsoilT_dz[i] - thermal_conductivity[i-1] * dsoilT_dz[i-1];
       }
       else if (i == ncells-1) {
-	h1 = soil_z[i] - soil_z[i-1];
-	
-	lambda[i] = dt/(h1 * heat_capacity[i]);
-	
 	if (this->option_bottom_boundary == 1) {
-	  double dzdt = 2 * (soil_temperature[i] - bottom_boundary_temp_const) / h1;
+	  double dzdt = 2 * (soil_temperature[i] - bottom_boundary_temp_const) / h1[i];
 	  /* dT_dz = (T_bottom - T_i)/ (dz/2), note the next term uses `-dtdz1`
 	     just to be consistent with the definition of geothermnal flux */
 	  
@@ -580,7 +1233,10 @@ SolveDiffusionEquation()
 
     // put coefficients in the corresponding vectors A,B,C, and RHS
     for (int i=0; i<ncells;i++) {
-      if (i == 0) {
+      if (reuse_factorization) {
+	// A, B, C unchanged
+      }
+      else if (i == 0) {
 	AI[i] = 0;
 	CI[i] = -lambda[i] * thermal_conductivity[i] * denominator[i];
 	BI[i] = 1 - CI[i];
@@ -598,7 +1254,24 @@ SolveDiffusionEquation()
       RHS[i] = lambda[i] * thermal_flux[i];
     }
 
-    SolverTDMA(AI, BI, CI, RHS, X);
+    // Thomas algorithm, or the partitioned solver for long columns (see SelectKernels)
+    if (reuse_factorization) {
+      this->stats.factorization_reuses++;
+    }
+    else {
+      coefficients.factorization_ok = partitioned_solver ? tridiagonal.Factor(ncells, AI.data(), BI.data(), CI.data())
+	                                                 : FactorTDMA(AI, BI, CI);
+      coefficients.factorized = true;
+      this->stats.factorizations++;
+    }
+
+    // X is zero if the system is singular
+    if (!coefficients.factorization_ok)
+      std::fill(X.begin(), X.end(), 0.0);
+    else if (partitioned_solver)
+      tridiagonal.Solve(RHS.data(), X.data());
+    else
+      SubstituteTDMA(AI, RHS, X);
 
     // Update soil temperature
     for (int i=0;i<ncells;i++)
@@ -606,99 +1279,1204 @@ SolveDiffusionEquation()
 
 }
 
-//*****************************************************************************
-// Solve the tri-diagonal system using the Thomas Algorithm (TDMA)            *
-//     a_i X_i-1 + b_i X_i + c_i X_i+1 = d_i,     i = 0, n - 1                *
-//                                                                            *
-// Effectively, this is an n x n matrix equation.                             *
-// a[i], b[i], c[i] are non-zero diagonals of the matrix and d[i] is the rhs. *
-// a[0] and c[n-1] aren't used.                                               *
-// X is the solution of the n x n system                                      *
-//*****************************************************************************
-bool soilfreezethaw::SoilFreezeThaw::
-SolverTDMA(const vector<double> &a, const vector<double> &b, const vector<double> &c, const vector<double> &d, vector<double> &X ) {
-   int n = d.size();
-   vector<double> P( n, 0 );
-   vector<double> Q( n, 0 );
-   X = P;
-   
-   // Forward pass
-   double denominator = b[0];
-
-   P[0] = -c[0]/denominator;
-   Q[0] =  d[0]/denominator;
-
-   for (int i = 1; i < n; i++) {
-     denominator = b[i] + a[i] * P[i-1];
-
-     if ( std::abs(denominator) < 1e-20 ) return false;
-     
-     P[i] =  -c[i]/denominator;
-     Q[i] = (d[i] - a[i] * Q[i-1])/denominator;
-   }
-   
-   // Backward substiution
-   X[n-1] = Q[n-1];
-   for (int i = n - 2; i >= 0; i--)
-     X[i] = P[i] * X[i+1] + Q[i];
-   
-   return true;
-}
-
 /*
-  Computes bulk soil thermal conductivity
-  thermal conductivity model follows the parameterization of Peters-Lidars 
+  Generic kernel with the coefficient assembly fused into a single sweep over the cells. Unfused, a timestep
+  with new coefficients streams the moisture, temperature and coefficient arrays through ThermalConductivity(),
+  SoilHeatCapacity(), the flux and the A/B/C/RHS loops of SolveDiffusionEquation(bool), FactorTDMA, the two
+  substitutions and the temperature update. Here cell i computes its thermal conductivity, heat capacity, flux,
+  matrix row, pivot and forward substitution in one pass (the values of cell i-1 were just computed), and a
+  second pass does the backward substitution and updates the temperatures. The boundary cells are peeled out
+  of the loop. Only the arrays reused by the next timesteps are stored (thermal conductivity, heat capacity,
+  lambda, A and the factorization); the operations are those of the unfused kernels, so the results are bitwise
+  identical.
+  Partitioned = true (long columns, see SelectKernels): the sweep stores the rows (A, B, C, RHS) and the system is
+  solved by PartitionedTridiagonal after the sweep.
+  With the AVX2 and AVX-512 paths the thermal conductivity and heat capacity are a vectorized pass before the
+  sweep (ThermalConductivity(), SoilHeatCapacity()), same operations.
 */
+template <bool Partitioned>
 void soilfreezethaw::SoilFreezeThaw::
-ThermalConductivity() {
+SolveDiffusionEquationFused(bool reuse_factorization)
+{
   Properties prop;
-  const int nz = this->shape[0];
+  const int last = ncells-1;
+
+  UpdateInvariants();
+  const double *h1          = invariants.h1.data();
+  const double *h2          = invariants.h2.data();
+  const double *denominator = invariants.denominator.data();
+  const double tc_solid_sat = invariants.tc_solid_sat;
+  const double tc_dry       = invariants.tc_dry;
+  const double hc_solid     = invariants.hc_solid;
+  const ConstitutiveTables *tables = invariants.tables.get();
+
+  double *lambda = work.lambda.data();
+  double *AI     = work.AI.data();
+  double *BI     = work.BI.data();
+  double *CI     = work.CI.data();
+  double *RHS    = work.RHS.data();
+  double *P      = work.P.data();
+  double *pivot  = work.pivot.data();
+  double *Q      = work.Q.data();
+
+  double *T  = soil_temperature;
+  double *k  = thermal_conductivity;
+  double *hc = heat_capacity;
+  const double *smc = soil_moisture_content;
+  const double *slc = soil_liquid_content;
+
+  reuse_factorization = reuse_factorization && coefficients.factorized;
+  const bool assemble = !reuse_factorization;
+
+  // AVX2/AVX-512 (simd_path): the thermal conductivities and heat capacities are computed before the sweep by
+  // the vectorized kernels, their elementary functions cost more than the extra pass over the cells
+  const bool vector_coefficients = assemble && (simd_path == SimdPath::AVX2 || simd_path == SimdPath::AVX512);
+  if (vector_coefficients) {
+    ThermalConductivity();
+    SoilHeatCapacity();
+  }
 
-  double tcmineral = this->quartz > 0.2 ? 2.0 : 3.0; //thermal_conductivity of other mineral
-  double tcquartz = 7.7;   // thermal_conductivity of Quartz [W/(mK)] 
-  double tcwater  = 0.57;  // thermal_conductivity of water  [W/(mK)] 
-  double tcice    = 2.2;   // thermal conductiviyt of ice    [W/(mK)] 
-  
-  for (int i=0; i<nz;i++) {
-    
-    double sat_ratio = soil_moisture_content[i]/ this->smcmax;
+  // thermal conductivity, heat capacity and lambda of cell i
+  auto cell_coefficients = [&](int i) {
+    if (!vector_coefficients) {
+      k[i] = tables ? PetersLidard(smc[i], slc[i], smcmax, tc_dry, *tables)
+                    : PetersLidard(smc[i], slc[i], smcmax, tc_solid_sat, tc_dry);
+      hc[i] = HeatCapacity(smc[i], slc[i], smcmax, hc_solid, prop);
+    }
+    lambda[i] = dt/(h1[i] * hc[i]);
+  };
 
-    //thermal_conductivity of solids Eq. (10) Peters-Lidard
-    double tc_solid = pow(tcquartz,this->quartz) * pow(tcmineral, (1. - this->quartz));
+  bool ok = true;
 
-    /******** SATURATED THERMAL CONDUCTIVITY *********/
-    
-    //UNFROZEN VOLUME FOR SATURATION (POROSITY*XUNFROZ)
-    double x_unfrozen= 1.0; //prevents zero division
-    if (this->soil_moisture_content[i] > 0)
-      x_unfrozen = this->soil_liquid_content[i] / this->soil_moisture_content[i]; // (phi * Sliq) / (phi * sliq + phi * sice) = sliq/(sliq+sice) 
-    
-    double xu = x_unfrozen * this->smcmax; // unfrozen volume fraction
-    double tc_sat = pow(tc_solid,(1. - this->smcmax)) * pow(tcice, (this->smcmax - xu)) * pow(tcwater,xu);
-    
-    /******** DRY THERMAL CONDUCTIVITY ************/
-    
-    double gammd = (1. - this->smcmax)*2700.; // dry density
-    double tc_dry = (0.135* gammd+ 64.7)/ (2700. - 0.947* gammd);
-    
-    // Kersten Number
-    
-    double KN;
-    if ( (soil_liquid_content[i] + 0.0005) < soil_moisture_content[i])
-      KN = sat_ratio; // for frozen soil
-    else {
-      if (sat_ratio > 0.1)
-	KN = log10(sat_ratio) + 1.;
-      else if (sat_ratio > 0.05)
-	KN = 0.7 * log10(sat_ratio) + 1.;
-      else
-	KN = 0.0;
-    }
-    
-    // Thermal conductivity
-    thermal_conductivity[i] = KN * (tc_sat - tc_dry) + tc_dry;
-    
+  // top cell
+  if (assemble)
+    cell_coefficients(0);
+
+  this->ground_heat_flux = this->GroundHeatFlux(T[0]);
+  double dsoilT_dz = 2.0 * (T[1] - T[0])/ h2[0];
+  double thermal_flux = k[0] * dsoilT_dz + this->ground_heat_flux;
+
+  if (Partitioned) {
+    if (assemble) {
+      AI[0] = 0;
+      CI[0] = -lambda[0] * k[0] * denominator[0];
+      BI[0] = 1 - CI[0];
+    }
+    RHS[0] = lambda[0] * thermal_flux;
+  }
+  else {
+    if (assemble) {
+      double CI = -lambda[0] * k[0] * denominator[0];
+      double BI = 1 - CI;
+      AI[0]    = 0;
+      pivot[0] = BI;
+      P[0]     = -CI/BI;
+    }
+    Q[0] = lambda[0] * thermal_flux / pivot[0];
+  }
+
+  // interior cells
+  for (int i=1; i<last; i++) {
+    if (assemble)
+      cell_coefficients(i);
+
+    double dsoilT_dz_i = 2.0 * (T[i+1] - T[i])/ h2[i];
+    thermal_flux = k[i] * dsoilT_dz_i - k[i-1] * dsoilT_dz;
+    dsoilT_dz    = dsoilT_dz_i;
+
+    if (Partitioned) {
+      if (assemble) {
+	AI[i] = -lambda[i] * k[i-1] * denominator[i-1];
+	CI[i] = -lambda[i] * k[i] * denominator[i];
+	BI[i] = 1 - AI[i] - CI[i];
+      }
+      RHS[i] = lambda[i] * thermal_flux;
+      continue;
+    }
+    if (assemble) {
+      AI[i] = -lambda[i] * k[i-1] * denominator[i-1];
+      double CI  = -lambda[i] * k[i] * denominator[i];
+      double BI  = 1 - AI[i] - CI;
+      double den = BI + AI[i] * P[i-1];
+      ok &= !(std::abs(den) < 1e-20);
+      pivot[i] = den;
+      P[i]     = -CI/den;
+    }
+    Q[i] = (lambda[i] * thermal_flux - AI[i] * Q[i-1])/pivot[i];
+  }
+
+  // bottom cell
+  if (assemble)
+    cell_coefficients(last);
+
+  double bottomflux = 0.0;
+  if (this->option_bottom_boundary == 1) {
+    double dzdt = 2 * (T[last] - bottom_boundary_temp_const) / h1[last];
+    bottomflux = - k[last] * dzdt;
+  }
+  thermal_flux = bottomflux - k[last-1] * dsoilT_dz;
+  this->bottom_heat_flux = bottomflux;
+
+  if (Partitioned) {
+    if (assemble) {
+      AI[last] = -lambda[last] * k[last-1] * denominator[last-1];
+      CI[last] = 0;
+      BI[last] = 1 - AI[last];
+      coefficients.factorization_ok = tridiagonal.Factor(ncells, AI, BI, CI);
+      coefficients.factorized = true;
+      this->stats.factorizations++;
+    }
+    else {
+      this->stats.factorization_reuses++;
+    }
+    RHS[last] = lambda[last] * thermal_flux;
+
+    // temperatures are unchanged if the system is singular
+    if (coefficients.factorization_ok) {
+      double *X = work.X.data();
+      tridiagonal.Solve(RHS, X);
+      for (int i=0; i<ncells; i++)
+	T[i] += X[i];
+    }
+    return;
+  }
+
+  if (assemble) {
+    AI[last] = -lambda[last] * k[last-1] * denominator[last-1];
+    double CI  = 0;
+    double BI  = 1 - AI[last];
+    double den = BI + AI[last] * P[last-1];
+    ok &= !(std::abs(den) < 1e-20);
+    pivot[last] = den;
+    P[last]     = -CI/den;
+
+    coefficients.factorization_ok = ok;
+    coefficients.factorized = true;
+    this->stats.factorizations++;
+  }
+  else {
+    this->stats.factorization_reuses++;
+  }
+  Q[last] = (lambda[last] * thermal_flux - AI[last] * Q[last-1])/pivot[last];
+
+  // backward substitution and temperature update; temperatures are unchanged if the system is singular
+  if (coefficients.factorization_ok) {
+    double X = Q[last];
+    T[last] += X;
+    for (int i=last-1; i>=0; i--) {
+      X = P[i] * X + Q[i];
+      T[i] += X;
+    }
+  }
+}
+
+/*
+  Enthalpy formulation of the heat equation (phase_change_scheme = enthalpy). Latent heat is treated
+  implicitly instead of correcting the diffused temperatures in PhaseChange(); the enthalpy of a cell is
+    H(T) = C (T - Tf) + L * rho_w * liquid(T),
+  with C the heat capacity at the beginning of the timestep and liquid(T) the freezing-point depression
+  curve used by PhaseChange(): all the moisture is liquid above T*, below T* the liquid content is the
+  supercooled water smcmax * (smp/satpsi)^(-1/b). T* is the temperature at which the supercooled water
+  equals the total moisture content (the curve has a kink at T*).
+  The backward Euler equations, including the surface and the bottom boundary fluxes,
+    dz/dt * (H(T) - H^n) = flux(i+1/2) - flux(i-1/2)
+  are solved with Newton's method; the Jacobian has the tridiagonal structure of the diffusion matrix.
+  A Newton update that crosses T* of a cell is stopped at T* (the next iteration continues on the other
+  branch of the curve), which keeps the iteration from cycling around the kink.
+  On return, the ice/liquid contents are on the freezing curve and energy_consumed = sum L rho_w dz dliquid/dt.
+*/
+void soilfreezethaw::SoilFreezeThaw::
+SolveEnthalpyEquation()
+{
+  Properties prop;
+  std::vector<double> &AI  = work.AI;
+  std::vector<double> &BI  = work.BI;
+  std::vector<double> &CI  = work.CI;
+  std::vector<double> &RHS = work.RHS;
+  std::vector<double> &X   = work.X;
+  double *T_star      = work.T_star.data();
+  double *liquid      = work.liquid_iter.data();
+  double *dliquid_dT  = work.dliquid_dT.data();
+
+  const int    max_iterations = 100;
+  const double tolerance      = 1.0E-10; // [K] Newton update
+  const double latent_volume  = latent_heat_fusion * prop.wdensity_; // [J/m3]
+  const double tfrez          = prop.tfrez_;
+
+  UpdateInvariants();
+  const double *h1 = invariants.h1.data();
+  const std::vector<double> &denominator = invariants.denominator;
+  const double lam = invariants.lam; // -1/b
+  const int n = ncells;
+
+  // the Newton matrices overwrite the TDMA workspace
+  coefficients.factorized = false;
+
+  // freezing starts below T*: smcmax * (smp*/satpsi)^lam = total moisture
+  for (int i=0; i<n; i++) {
+    T_star[i] = 0.0; // no moisture, nothing freezes
+    if (soil_moisture_content[i] > 0.0) {
+      double smp = this->satpsi * pow(soil_moisture_content[i] / this->smcmax, 1.0/lam); // [m]
+      T_star[i] = tfrez / (1.0 + prop.grav_ * smp / latent_heat_fusion);
+    }
+  }
+
+  // boundary conductances, the fluxes are linear in the boundary cell temperatures
+  const double top_conductance    = thermal_conductivity[0] / (0.5*soil_z[0]);
+  const double bottom_conductance = option_bottom_boundary == 1 ? 2.0 * thermal_conductivity[n-1] / h1[n-1] : 0.0;
+
+  int iteration = 0;
+  bool converged = false;
+
+  while (!converged) {
+    if (iteration == max_iterations) {
+      std::stringstream errMsg;
+      errMsg << "Enthalpy solver: Newton iteration did not converge in "<< max_iterations <<" iterations (time = "<< this->time <<" s)\n";
+      throw std::runtime_error(errMsg.str());
+    }
+    iteration++;
+
+    // liquid content and its derivative at the iterate
+    for (int i=0; i<n; i++) {
+      double T = soil_temperature[i];
+      liquid[i]     = soil_moisture_content[i];
+      dliquid_dT[i] = 0.0;
+
+      // at the kink (T = T*) the derivative of the freezing branch is used, Newton then approaches the solution
+      // from the side where the enthalpy is convex and does not overshoot across T*
+      if (T <= T_star[i]) {
+	double smp    = latent_heat_fusion / (prop.grav_ * T) * (tfrez - T); // [m] soil matrix potential
+	double supercool = this->smcmax * math::Pow(smp/this->satpsi, lam);
+	liquid[i]     = std::min(supercool, soil_moisture_content[i]);
+	dliquid_dT[i] = lam * supercool / smp * (-latent_heat_fusion * tfrez / (prop.grav_ * T * T));
+      }
+    }
+
+    // residual (storage - net inflow) and Jacobian, W/m2
+    for (int i=0; i<n; i++) {
+      double storage = h1[i] / dt * (heat_capacity[i] * (soil_temperature[i] - soil_temperature_prev[i])
+				     + latent_volume * (liquid[i] - soil_liquid_content[i]));
+      double inflow  = 0.0;
+
+      AI[i] = 0.0;
+      CI[i] = 0.0;
+      BI[i] = h1[i] / dt * (heat_capacity[i] + latent_volume * dliquid_dT[i]);
+
+      if (i > 0) {
+	double g = thermal_conductivity[i-1] * denominator[i-1];
+	inflow += g * (soil_temperature[i-1] - soil_temperature[i]);
+	AI[i]   = -g;
+	BI[i]  += g;
+      }
+      if (i < n-1) {
+	double g = thermal_conductivity[i] * denominator[i];
+	inflow += g * (soil_temperature[i+1] - soil_temperature[i]);
+	CI[i]   = -g;
+	BI[i]  += g;
+      }
+      if (i == 0) {
+	inflow += GroundHeatFlux(soil_temperature[0]);
+	BI[i]  += top_conductance;
+      }
+      if (i == n-1) {
+	inflow += -bottom_conductance * (soil_temperature[i] - bottom_boundary_temp_const);
+	BI[i]  += bottom_conductance;
+      }
+
+      RHS[i] = inflow - storage;
+    }
+
+    if (!FactorTDMA(AI, BI, CI))
+      throw std::runtime_error("Enthalpy solver: singular Jacobian!");
+    SubstituteTDMA(AI, RHS, X);
+
+    converged = true;
+    for (int i=0; i<n; i++) {
+      double T     = soil_temperature[i];
+      double T_new = T + X[i];
+
+      // kink stopping: do not cross T* in a single update
+      if ((T > T_star[i] && T_new < T_star[i]) || (T < T_star[i] && T_new > T_star[i])) {
+	T_new = T_star[i];
+	converged = false;
+      }
+
+      if (std::abs(T_new - T) > tolerance)
+	converged = false;
+
+      soil_temperature[i] = T_new;
+    }
+  }
+
+  this->stats.newton_iterations += iteration;
+
+  // partitioning and energy at the solution
+  this->energy_consumed = 0.0;
+  for (int i=0; i<n; i++) {
+    double T = soil_temperature[i];
+    double liquid_new = soil_moisture_content[i];
+    if (T < T_star[i]) {
+      double smp = latent_heat_fusion / (prop.grav_ * T) * (tfrez - T);
+      liquid_new = std::min(this->smcmax * math::Pow(smp/this->satpsi, lam), soil_moisture_content[i]);
+    }
+
+    this->energy_consumed += latent_volume * soil_dz[i] * (liquid_new - soil_liquid_content[i]) / dt;
+
+    soil_liquid_content[i] = liquid_new;
+    soil_ice_content[i]    = std::max(soil_moisture_content[i] - liquid_new, 0.0);
+  }
+
+  this->ground_heat_flux = GroundHeatFlux(soil_temperature[0]);
+  this->bottom_heat_flux = -bottom_conductance * (soil_temperature[n-1] - bottom_boundary_temp_const);
+}
+
+/*
+  Puts cells whose temperature was changed with the ice content fixed back on the freezing curve of the
+  enthalpy scheme, conserving their enthalpy H = C (T - Tf) + L * rho_w * liquid: above T* all the moisture is
+  liquid and T follows from H directly, below T* the curve is monotone in T and H(T) is solved by bisection
+  between the all-liquid temperature and T*. Used by the spin-up (the split scheme uses its PhaseChange).
+*/
+void soilfreezethaw::SoilFreezeThaw::
+RepartitionEnthalpy()
+{
+  Properties prop;
+  const double latent_volume = latent_heat_fusion * prop.wdensity_; // [J/m3]
+  const double tfrez         = prop.tfrez_;
+  UpdateInvariants();
+  const double lam = invariants.lam; // -1/b
+
+  auto Liquid = [&](double T, double moisture) {
+    double smp = latent_heat_fusion / (prop.grav_ * T) * (tfrez - T); // [m] soil matrix potential
+    return std::min(this->smcmax * math::Pow(smp/this->satpsi, lam), moisture);
+  };
+
+  for (int i=0; i<ncells; i++) {
+    const double moisture = soil_moisture_content[i];
+    const double C        = heat_capacity[i];
+    const double H        = C * (soil_temperature[i] - tfrez) + latent_volume * soil_liquid_content[i];
+    double T = tfrez + (H - latent_volume * moisture) / C; // all the moisture liquid
+
+    double T_star = 0.0;
+    if (moisture > 0.0) {
+      double smp = this->satpsi * pow(moisture / this->smcmax, 1.0/lam); // [m]
+      T_star = tfrez / (1.0 + prop.grav_ * smp / latent_heat_fusion);
+    }
+    if (T < T_star) {
+      double low = T, high = T_star;
+      for (int k=0; k<100 && high - low > 1.0e-12; k++) {
+	double mid = 0.5 * (low + high);
+	if (C * (mid - tfrez) + latent_volume * Liquid(mid, moisture) > H)
+	  high = mid;
+	else
+	  low = mid;
+      }
+      T = 0.5 * (low + high);
+    }
+
+    double liquid = T < T_star ? Liquid(T, moisture) : moisture;
+    soil_temperature[i]    = T;
+    soil_liquid_content[i] = liquid;
+    soil_ice_content[i]    = std::max(moisture - liquid, 0.0);
+  }
+}
+
+//*****************************************************************************
+// Solve the tri-diagonal system using the Thomas Algorithm (TDMA)            *
+//     a_i X_i-1 + b_i X_i + c_i X_i+1 = d_i,     i = 0, n - 1                *
+//                                                                            *
+// Effectively, this is an n x n matrix equation.                             *
+// a[i], b[i], c[i] are non-zero diagonals of the matrix and d[i] is the rhs. *
+// a[0] and c[n-1] aren't used.                                               *
+// X is the solution of the n x n system                                      *
+//*****************************************************************************
+bool soilfreezethaw::SoilFreezeThaw::
+SolverTDMA(const vector<double> &a, const vector<double> &b, const vector<double> &c, const vector<double> &d, vector<double> &X ) {
+   int n = d.size();
+
+   // the workspace factorization is overwritten, it no longer belongs to the diffusion matrix
+   coefficients.factorized = false;
+
+   // X is zero if the system is singular
+   X.resize(n);
+   std::fill(X.begin(), X.end(), 0.0);
+
+   if (!FactorTDMA(a, b, c))
+     return false;
+
+   SubstituteTDMA(a, d, X);
+
+   return true;
+}
+
+/*
+  Forward elimination of the Thomas algorithm for the matrix only. The multipliers P and the pivots
+  (b_i + a_i P_i-1) are stored in the workspace, so any number of right-hand sides can be solved
+  with SubstituteTDMA without refactorizing. Returns false if the matrix is singular.
+*/
+bool soilfreezethaw::SoilFreezeThaw::
+FactorTDMA(const vector<double> &a, const vector<double> &b, const vector<double> &c)
+{
+   int n = b.size();
+
+   // forward-pass coefficients live in the workspace; only grows if called with a larger system
+   if (int(work.P.size()) < n) {
+     work.P.resize(n);
+     work.Q.resize(n);
+     work.pivot.resize(n);
+   }
+   double *P     = work.P.data();
+   double *pivot = work.pivot.data();
+
+   double denominator = b[0];
+
+   pivot[0] = denominator;
+   P[0]     = -c[0]/denominator;
+
+   for (int i = 1; i < n; i++) {
+     denominator = b[i] + a[i] * P[i-1];
+
+     if ( std::abs(denominator) < 1e-20 ) return false;
+
+     pivot[i] = denominator;
+     P[i]     = -c[i]/denominator;
+   }
+
+   return true;
+}
+
+/*
+  Forward substitution of the rhs and backward substitution with the factorization from FactorTDMA
+*/
+void soilfreezethaw::SoilFreezeThaw::
+SubstituteTDMA(const vector<double> &a, const vector<double> &d, vector<double> &X)
+{
+   int n = d.size();
+   const double *P     = work.P.data();
+   const double *pivot = work.pivot.data();
+   double *Q           = work.Q.data();
+
+   // Forward pass
+   Q[0] = d[0]/pivot[0];
+
+   for (int i = 1; i < n; i++)
+     Q[i] = (d[i] - a[i] * Q[i-1])/pivot[i];
+
+   // Backward substiution
+   X[n-1] = Q[n-1];
+   for (int i = n - 2; i >= 0; i--)
+     X[i] = P[i] * X[i+1] + Q[i];
+}
+
+/*
+  Start of the timestep, one pass over the cells:
+  - stores the current temperatures in soil_temperature_prev
+  - BMI sets (total) soil moisture content only, so the liquid content is updated based on the previous
+    ice content; initially ice_content is zero; assuming we are starting somewhere in the summer/fall
+  - dependency tracking of the diffusion coefficients: thermal conductivity, heat capacity, lambda, A, B, C
+    and their factorization depend only on the soil moisture and liquid contents, the grid, dt and the soil
+    parameters (the invariant block). Returns true if none of these changed since the last factorization,
+    otherwise records the current inputs and returns false.
+*/
+bool soilfreezethaw::SoilFreezeThaw::
+BeginTimestep()
+{
+  CoefficientCache &cc = this->coefficients;
+  const double *cache_moisture = cc.soil_moisture_content.data();
+  const double *cache_liquid   = cc.soil_liquid_content.data();
+
+  bool unchanged = cc.factorized && cc.invariants_generation == invariants.generation;
+  bool changed   = false;
+
+  if (this->is_soil_moisture_bmi_set) {
+    for (int i=0; i<ncells; i++) {
+      soil_temperature_prev[i] = soil_temperature[i];
+      soil_liquid_content[i]   = std::max(soil_moisture_content[i] - soil_ice_content[i], 0.0);
+      changed |= (cache_moisture[i] != soil_moisture_content[i]) | (cache_liquid[i] != soil_liquid_content[i]);
+    }
+  }
+  else {
+    for (int i=0; i<ncells; i++) {
+      soil_temperature_prev[i] = soil_temperature[i];
+      changed |= (cache_moisture[i] != soil_moisture_content[i]) | (cache_liquid[i] != soil_liquid_content[i]);
+    }
   }
+  unchanged = unchanged && !changed;
+
+  if (!unchanged) {
+    std::copy(soil_moisture_content, soil_moisture_content + ncells, cc.soil_moisture_content.begin());
+    std::copy(soil_liquid_content, soil_liquid_content + ncells, cc.soil_liquid_content.begin());
+    cc.invariants_generation = invariants.generation;
+    cc.factorized = false;
+  }
+
+  return unchanged;
+}
+
+/*
+  Prints the counters of the timestep optimizations
+*/
+void soilfreezethaw::SoilFreezeThaw::
+PrintStatistics(std::ostream &os)
+{
+  long solves = stats.factorizations + stats.factorization_reuses;
+  double reuse_rate = solves > 0 ? double(stats.factorization_reuses) / solves : 0.0;
+
+  os<<"Timesteps                                  = "<<stats.steps<<"\n";
+  os<<"Column kernel                              = "<<(kernel_cells > 0 ? std::to_string(kernel_cells) + " cells" : std::string("generic"))<<"\n";
+  const char *forced = getenv("SFT_SIMD_PATH");
+  os<<"Kernel instruction set (simd_path)         = "<<SimdPathName(simd_path)<<" (requested "
+    <<(forced != NULL && forced[0] != '\0' ? std::string("SFT_SIMD_PATH=") + forced : simd_path_option)
+    <<", widest supported "<<SimdPathName(BestSimdPath())<<")\n";
+  if (partitioned_solver)
+    os<<"Partitioned solver (partitions x rows)     = "<<tridiagonal.partitions<<" x "<<tridiagonal.rows
+      <<", threads = "<<tridiagonal.threads<<"\n";
+  os<<"Diffusion matrix factorizations            = "<<stats.factorizations<<"\n";
+  os<<"Diffusion matrix factorization reuses      = "<<stats.factorization_reuses<<"\n";
+  os<<"Factorization reuse rate              [%]  = "<<100.0 * reuse_rate<<"\n";
+  os<<"Thawed column fast path steps              = "<<stats.thawed_steps<<"\n";
+  if (phase_change_scheme == "enthalpy")
+    os<<"Enthalpy solver Newton iterations          = "<<stats.newton_iterations<<"\n";
+  if (adaptive_timestep) {
+    os<<"Adaptive sub-steps (accepted)              = "<<stats.substeps<<"\n";
+    os<<"Adaptive sub-steps (rejected)              = "<<stats.rejected_substeps<<"\n";
+  }
+  if (const ConstitutiveTables *tables = GetConstitutiveTables()) {
+    os<<"Constitutive tables resolution             = "<<tables->key.resolution<<"\n";
+    os<<"Tables max error, supercooled water   [-]  = "<<tables->error_supercool<<"\n";
+    os<<"Tables max error, tc saturated  [W/(mK)]   = "<<tables->error_tc_sat<<"\n";
+    os<<"Tables max error, Kersten number      [-]  = "<<tables->error_log_sat<<"\n";
+  }
+  if (spinup_cycles_used > 0) {
+    os<<"Spin-up cycles                             = "<<spinup_cycles_used
+      <<(spinup_tolerance > 0.0 ? (spinup_converged ? " (converged)" : " (not converged)") : "")<<"\n";
+    os<<"Spin-up last cycle change, T [K], ice [-]  = "<<spinup_temperature_change<<", "<<spinup_ice_change<<"\n";
+  }
+  if (spinup_cache_result != "off")
+    os<<"Spin-up cache                              = "<<spinup_cache_result<<" ("<<spinup_cache_file<<")\n";
+}
+
+namespace {
+
+  const char checkpoint_magic[8] = {'S','F','T','C','K','P','T','\0'};
+  const uint32_t checkpoint_byte_order = 0x01020304;
+
+  template <typename T> void WriteValue(std::ostream &os, const T &value)
+  {
+    os.write(reinterpret_cast<const char*>(&value), sizeof(T));
+  }
+
+  template <typename T> void WriteArray(std::ostream &os, const T *values, int n)
+  {
+    os.write(reinterpret_cast<const char*>(values), sizeof(T) * n);
+  }
+
+  // names are stored in fixed fields of checkpoint_name_size bytes (zero padded), so the doubles that follow
+  // the header are 8-byte aligned in the checkpoint (see CheckpointStore)
+  const size_t checkpoint_name_size = 16;
+
+  void WriteName(std::ostream &os, const std::string &value)
+  {
+    if (value.size() >= checkpoint_name_size)
+      throw std::runtime_error("Checkpoint: name " + value + " is too long.");
+    char field[checkpoint_name_size] = {};
+    std::memcpy(field, value.data(), value.size());
+    os.write(field, checkpoint_name_size);
+  }
+
+  template <typename T> void ReadArray(std::istream &is, T *values, int n)
+  {
+    is.read(reinterpret_cast<char*>(values), sizeof(T) * n);
+    if (!is)
+      throw std::runtime_error("Checkpoint is truncated.");
+  }
+
+  template <typename T> T ReadValue(std::istream &is)
+  {
+    T value;
+    ReadArray(is, &value, 1);
+    return value;
+  }
+
+  std::string ReadName(std::istream &is)
+  {
+    char field[checkpoint_name_size];
+    ReadArray(is, field, checkpoint_name_size);
+    return std::string(field, strnlen(field, checkpoint_name_size));
+  }
+
+  // names of version 1 checkpoints: int32 size followed by the characters
+  std::string ReadNameVersion1(std::istream &is)
+  {
+    int32_t size = ReadValue<int32_t>(is);
+    if (size < 0 || size > 256)
+      throw std::runtime_error("Checkpoint is corrupted (string of " + std::to_string(size) + " characters).");
+    std::string value(size, '\0');
+    if (size > 0)
+      ReadArray(is, &value[0], size);
+    return value;
+  }
+
+  void CheckConfiguration(bool match, const std::string &what)
+  {
+    if (!match)
+      throw std::runtime_error("Checkpoint does not match the model configuration: " + what + " differs.");
+  }
+
+}
+
+/*
+  Binary checkpoint (native byte order, doubles stored bitwise):
+  - header: magic "SFTCKPT", byte order mark, checkpoint_version, ncells
+  - configuration the state depends on, compared on restore: adaptive_timestep, constitutive_tables and their
+    resolution, phase_change_scheme, dt, soil_z
+  - state: time, boundary values and fluxes, energy balance (with its compensation), adaptive sub-step,
+    ice fractions, soil parameters (may be set through BMI) and the cell arrays
+  The derived data (invariant block, cached factorization) is rebuilt by the next timestep from the same inputs,
+  so the restored model continues bitwise identically.
+  Version 2 moved the configuration integers first and stores phase_change_scheme in a fixed field (8-byte
+  aligned doubles, see CheckpointStore). Version 1 checkpoints (dt, soil_z, length-prefixed phase_change_scheme,
+  then the integers) are migrated on restore, the state that follows is unchanged.
+*/
+void soilfreezethaw::SoilFreezeThaw::
+SaveCheckpoint(std::ostream &os)
+{
+  os.write(checkpoint_magic, sizeof(checkpoint_magic));
+  WriteValue(os, checkpoint_byte_order);
+  WriteValue(os, int32_t(checkpoint_version));
+  WriteValue(os, int32_t(ncells));
+
+  WriteValue(os, int32_t(adaptive_timestep));
+  WriteValue(os, int32_t(constitutive_tables));
+  WriteValue(os, int32_t(constitutive_table_resolution));
+  WriteName(os, phase_change_scheme);
+  WriteValue(os, dt);
+  WriteArray(os, soil_z, ncells);
+
+  const double scalars[] = {time, ground_temp, ground_heat_flux, bottom_heat_flux, energy_consumed, energy_balance,
+			    energy_balance_compensation, adaptive_substep, ice_fraction_schaake,
+			    ice_fraction_xinanjiang, soil_ice_fraction, smcmax, b, satpsi, quartz};
+  WriteArray(os, scalars, sizeof(scalars) / sizeof(double));
+  for (const double *field : {soil_temperature, soil_temperature_prev, soil_moisture_content, soil_liquid_content,
+			      soil_ice_content, heat_capacity, thermal_conductivity})
+    WriteArray(os, field, ncells);
+
+  if (!os)
+    throw std::runtime_error("Checkpoint could not be written.");
+}
+
+void soilfreezethaw::SoilFreezeThaw::
+SaveCheckpoint(const std::string &file)
+{
+  std::ofstream os(file, std::ios::binary);
+  if (!os)
+    throw std::runtime_error("Checkpoint file " + file + " could not be created.");
+  SaveCheckpoint(os);
+}
+
+void soilfreezethaw::SoilFreezeThaw::
+RestoreCheckpoint(std::istream &is)
+{
+  char magic[sizeof(checkpoint_magic)];
+  is.read(magic, sizeof(magic));
+  if (!is || std::memcmp(magic, checkpoint_magic, sizeof(magic)) != 0)
+    throw std::runtime_error("Not a SoilFreezeThaw checkpoint.");
+  if (ReadValue<uint32_t>(is) != checkpoint_byte_order)
+    throw std::runtime_error("Checkpoint was written on a machine of different byte order.");
+  int32_t version = ReadValue<int32_t>(is);
+  if (version != checkpoint_version && version != 1)
+    throw std::runtime_error("Checkpoint version " + std::to_string(version) + " is not supported (expected "
+			     + std::to_string(checkpoint_version) + " or 1).");
+
+  // the configuration is checked completely before the model is modified
+  CheckConfiguration(ReadValue<int32_t>(is) == ncells, "number of cells");
+  int32_t config[3];
+  std::string scheme;
+  double timestep;
+  std::vector<double> z(ncells);
+  if (version == 1) {
+    timestep = ReadValue<double>(is);
+    ReadArray(is, z.data(), ncells);
+    scheme = ReadNameVersion1(is);
+    ReadArray(is, config, 3);
+  }
+  else {
+    ReadArray(is, config, 3);
+    scheme = ReadName(is);
+    timestep = ReadValue<double>(is);
+    ReadArray(is, z.data(), ncells);
+  }
+  CheckConfiguration(config[0] == int32_t(adaptive_timestep), "adaptive_timestep");
+  CheckConfiguration(config[1] == int32_t(constitutive_tables), "constitutive_tables");
+  CheckConfiguration(!constitutive_tables || config[2] == constitutive_table_resolution,
+		     "constitutive_table_resolution");
+  CheckConfiguration(scheme == phase_change_scheme, "phase_change_scheme");
+  CheckConfiguration(timestep == dt, "timestep");
+  CheckConfiguration(std::equal(z.begin(), z.end(), soil_z), "soil_z");
+
+  const int nscalars = 15;
+  double scalars[nscalars];
+  std::vector<double> fields(7 * ncells);
+  ReadArray(is, scalars, nscalars);
+  ReadArray(is, fields.data(), 7 * ncells);
+
+  double *state[nscalars] = {&time, &ground_temp, &ground_heat_flux, &bottom_heat_flux, &energy_consumed,
+			     &energy_balance, &energy_balance_compensation, &adaptive_substep, &ice_fraction_schaake,
+			     &ice_fraction_xinanjiang, &soil_ice_fraction, &smcmax, &b, &satpsi, &quartz};
+  for (int k=0; k<nscalars; k++)
+    *state[k] = scalars[k];
+  int k = 0;
+  for (double *field : {soil_temperature, soil_temperature_prev, soil_moisture_content, soil_liquid_content,
+			soil_ice_content, heat_capacity, thermal_conductivity}) {
+    std::copy(fields.begin() + k * ncells, fields.begin() + (k+1) * ncells, field);
+    k++;
+  }
+
+  // the soil parameters may differ from the current ones, and the cached factorization belongs to the old state
+  InvalidateInvariants();
+  coefficients.factorized = false;
+}
+
+void soilfreezethaw::SoilFreezeThaw::
+RestoreCheckpoint(const std::string &file)
+{
+  std::ifstream is(file, std::ios::binary);
+  if (!is)
+    throw std::runtime_error("Checkpoint file " + file + " could not be opened.");
+  RestoreCheckpoint(is);
+}
+
+/*
+  Ground temperature of a forcing file: the TMP_ground_surface column, the air temperature column (7th) if the
+  file does not provide the ground temperature (as the standalone driver)
+*/
+std::vector<double> soilfreezethaw::
+ReadGroundTemperatureForcing(const std::string &forcing_file)
+{
+  std::ifstream fp(forcing_file);
+  if (!fp)
+    throw std::runtime_error("Forcing file " + forcing_file + " does not exist.");
+
+  std::string line, cell;
+  std::getline(fp, line);
+  std::stringstream header(line);
+  int column = -1;
+  for (int k=0; std::getline(header, cell, ','); k++) {
+    if (cell == "TMP_ground_surface")
+      column = k;
+  }
+  if (column < 0)
+    column = 6;
+
+  std::vector<double> ground_temp;
+  while (std::getline(fp, line)) {
+    std::stringstream values(line);
+    int k = 0;
+    while (std::getline(values, cell, ',') && k < column)
+      k++;
+    if (k == column && !cell.empty())
+      ground_temp.push_back(std::stod(cell));
+  }
+  return ground_temp;
+}
+
+namespace {
+
+  // 64-bit FNV-1a hash
+  struct Fingerprint {
+    uint64_t hash = 14695981039346656037ULL;
+
+    void Add(const void *data, size_t size)
+    {
+      const unsigned char *bytes = static_cast<const unsigned char*>(data);
+      for (size_t i=0; i<size; i++)
+	hash = (hash ^ bytes[i]) * 1099511628211ULL;
+    }
+    template <typename T> void Add(const T &value) { Add(&value, sizeof(T)); }
+    void AddArray(const double *values, size_t n) { Add(values, sizeof(double) * n); }
+    void Add(const std::string &value)
+    {
+      Add(value.size());
+      Add(value.data(), value.size());
+    }
+  };
+
+}
+
+uint64_t soilfreezethaw::SoilFreezeThaw::
+SpinupFingerprint(const std::vector<double> &forcing, const std::string &version)
+{
+  Fingerprint f;
+  f.Add(version);
+#ifdef __VERSION__
+  f.Add(std::string(__VERSION__));
+#endif
+#ifdef SFT_LIBM_MATH
+  f.Add(std::string("libm"));
+#endif
+  f.Add(checkpoint_version);
+
+  f.Add(ncells);
+  f.AddArray(soil_z, ncells);
+  f.Add(dt);
+  for (double parameter : {smcmax, b, satpsi, quartz, latent_heat_fusion})
+    f.Add(parameter);
+  for (const double *profile : {soil_temperature, soil_moisture_content, soil_liquid_content, soil_ice_content})
+    f.AddArray(profile, ncells);
+  f.Add(option_bottom_boundary);
+  f.Add(option_bottom_boundary == 1 ? bottom_boundary_temp_const : 0.0);
+  f.Add(option_top_boundary);
+  f.Add(option_top_boundary == 1 ? top_boundary_temp_const : 0.0);
+  f.Add(ice_fraction_scheme);
+  f.Add(phase_change_scheme);
+  f.Add(adaptive_timestep);
+  if (adaptive_timestep) {
+    f.Add(adaptive_temperature_tolerance);
+    f.Add(adaptive_dt_min);
+  }
+  f.Add(constitutive_tables);
+  f.Add(constitutive_tables ? constitutive_table_resolution : 0);
+  f.Add(partitioned_solver_cells);
+
+  f.Add(spinup_cycles);
+  f.Add(spinup_tolerance);
+  if (spinup_tolerance > 0.0) {
+    f.Add(spinup_ice_tolerance);
+    f.Add(spinup_anderson_depth);
+  }
+  f.Add(int(forcing.size()));
+  f.AddArray(forcing.data(), forcing.size());
+  return f.hash;
+}
+
+namespace {
+
+  /* least squares solution gamma of min |b - sum_j gamma_j A_j| by modified Gram-Schmidt; columns that are
+     (nearly) linearly dependent on the previous ones are dropped (gamma_j = 0) */
+  std::vector<double> LeastSquares(const std::vector<std::vector<double>> &A, const std::vector<double> &b)
+  {
+    const int m = A.size();
+    const int n = b.size();
+    std::vector<std::vector<double>> Q(A);
+    std::vector<std::vector<double>> R(m, std::vector<double>(m, 0.0));
+    std::vector<bool> kept(m, false);
+    std::vector<double> gamma(m, 0.0), qb(m, 0.0);
+
+    for (int j=0; j<m; j++) {
+      double norm0 = 0.0;
+      for (int i=0; i<n; i++)
+	norm0 += A[j][i] * A[j][i];
+      for (int k=0; k<j; k++) {
+	if (!kept[k])
+	  continue;
+	double r = 0.0;
+	for (int i=0; i<n; i++)
+	  r += Q[k][i] * Q[j][i];
+	R[k][j] = r;
+	for (int i=0; i<n; i++)
+	  Q[j][i] -= r * Q[k][i];
+      }
+      double norm = 0.0;
+      for (int i=0; i<n; i++)
+	norm += Q[j][i] * Q[j][i];
+      if (norm <= 1.0e-20 * norm0 || norm == 0.0)
+	continue;
+      norm = std::sqrt(norm);
+      R[j][j] = norm;
+      for (int i=0; i<n; i++)
+	Q[j][i] /= norm;
+      for (int i=0; i<n; i++)
+	qb[j] += Q[j][i] * b[i];
+      kept[j] = true;
+    }
+    for (int j=m-1; j>=0; j--) {
+      if (!kept[j])
+	continue;
+      double sum = qb[j];
+      for (int k=j+1; k<m; k++)
+	sum -= R[j][k] * gamma[k];
+      gamma[j] = sum / R[j][j];
+    }
+    return gamma;
+  }
+
+}
+
+void soilfreezethaw::SoilFreezeThaw::
+RunSpinupCycle(const std::vector<double> &forcing)
+{
+  std::vector<double> temperature(soil_temperature, soil_temperature + ncells);
+  std::vector<double> ice(soil_ice_content, soil_ice_content + ncells);
+
+  for (double ground_temperature : forcing) {
+    this->ground_temp = ground_temperature;
+    Advance();
+  }
+
+  this->spinup_temperature_change = 0.0;
+  this->spinup_ice_change = 0.0;
+  for (int i=0; i<ncells; i++) {
+    spinup_temperature_change = std::max(spinup_temperature_change, fabs(soil_temperature[i] - temperature[i]));
+    spinup_ice_change = std::max(spinup_ice_change, fabs(soil_ice_content[i] - ice[i]));
+  }
+  this->spinup_cycles_used++;
+}
+
+/*
+  Spin-up to periodic equilibrium: the state at the end of a cycle of the forcing window is a fixed point of the
+  map G (one cycle). The cycles stop when a cycle changes the soil temperatures by less than spinup_tolerance and
+  the ice contents by less than spinup_ice_tolerance, or after spinup_cycles cycles. Plain cycling (x = G(x))
+  converges as slowly as the deep cells equilibrate and their ice builds up; Anderson mixing extrapolates the
+  next start state from the last spinup_anderson_depth cycles:
+    x_k+1 = G(x_k) - sum_j gamma_j (G(x_j+1) - G(x_j)),  gamma = argmin |f_k - sum_j gamma_j (f_j+1 - f_j)|
+  with f = G(x) - x. The mixed variable is the energy of the cells, C (T - tfrez) - L rho_w ice (C the heat
+  capacity at the start of the spin-up), in units of C spinup_tolerance: at the freezing point the temperature
+  of a cell jumps between cycles while its ice content drifts, its energy is smooth. The extrapolated energy is
+  added to the end-of-cycle state as a temperature change and partitioned by the phase change scheme of the
+  model (RepartitionEnthalpy, or the selected phase change kernel of the split scheme). The history is
+  restarted when the residual grows; a mixed start state that more than doubles it is discarded (the model is
+  restored from a checkpoint of the end-of-cycle state). With the split phase change scheme a cell at the
+  freezing point keeps any ice content between the melting and the freezing limits, the cycle map is not
+  smooth and the mixing gains less than with the enthalpy scheme. The model ends in the state reached by
+  the last cycle.
+*/
+void soilfreezethaw::SoilFreezeThaw::
+SpinupToEquilibrium(const std::vector<double> &forcing)
+{
+  Properties prop;
+  const int n = ncells;
+  const double latent_volume = latent_heat_fusion * prop.wdensity_; // [J/m3]
+  SoilHeatCapacity();
+  const std::vector<double> capacity(heat_capacity, heat_capacity + n);
+  std::vector<double> x(n), g(n), f(n), g_prev(n), f_prev(n);
+  std::vector<std::vector<double>> dG, dF;
+  double residual_prev = 0.0;
+  std::string extrapolated_from;            // checkpoint of the end-of-cycle state the start state was mixed from
+  double temperature_change = 0.0, ice_change = 0.0;  // of the cycle that reached that state
+
+  // energy of the cells in units of C spinup_tolerance
+  auto Energy = [&](std::vector<double> &energy) {
+    for (int i=0; i<n; i++)
+      energy[i] = (soil_temperature[i] - prop.tfrez_ - latent_volume * soil_ice_content[i] / capacity[i])
+	/ spinup_tolerance;
+  };
+
+  Energy(x);
+  for (int cycle=0; cycle<spinup_cycles; cycle++) {
+    RunSpinupCycle(forcing);
+    if (spinup_temperature_change < spinup_tolerance && spinup_ice_change < spinup_ice_tolerance) {
+      this->spinup_converged = true;
+      return;
+    }
+    Energy(g);
+    double residual = 0.0;
+    for (int i=0; i<n; i++) {
+      f[i] = g[i] - x[i];
+      residual = std::max(residual, fabs(f[i]));
+    }
+
+    // a mixed start state that more than doubled the residual: the cycle is discarded, the cycles continue
+    // from the end-of-cycle state it was mixed from
+    if (!extrapolated_from.empty()) {
+      std::istringstream is(extrapolated_from);
+      extrapolated_from.clear();
+      if (residual > 2.0 * residual_prev) {
+	RestoreCheckpoint(is);
+	this->spinup_temperature_change = temperature_change;
+	this->spinup_ice_change = ice_change;
+	dG.clear();
+	dF.clear();
+	x = g_prev;
+	continue;
+      }
+    }
+
+    if (spinup_anderson_depth == 0 || cycle == spinup_cycles - 1) {
+      x = g;
+      continue;
+    }
+    if (cycle > 0 && residual >= residual_prev) {
+      dG.clear();
+      dF.clear();
+    }
+    else if (cycle > 0) {
+      std::vector<double> dg(n), df(n);
+      for (int i=0; i<n; i++) {
+	dg[i] = g[i] - g_prev[i];
+	df[i] = f[i] - f_prev[i];
+      }
+      dG.push_back(dg);
+      dF.push_back(df);
+      if (int(dF.size()) > spinup_anderson_depth) {
+	dG.erase(dG.begin());
+	dF.erase(dF.begin());
+      }
+    }
+    g_prev = g;
+    f_prev = f;
+    residual_prev = residual;
+    x = g;
+    if (dF.empty())
+      continue;
+
+    // next start state: the end-of-cycle state with the energy of the extrapolation
+    std::vector<double> gamma = LeastSquares(dF, f);
+    std::ostringstream os;
+    SaveCheckpoint(os);
+    extrapolated_from = os.str();
+    temperature_change = spinup_temperature_change;
+    ice_change = spinup_ice_change;
+    for (int i=0; i<n; i++) {
+      double shift = 0.0;
+      for (size_t j=0; j<gamma.size(); j++)
+	shift -= gamma[j] * dG[j][i];
+      soil_temperature[i] += shift * spinup_tolerance;
+    }
+    // partitioned by the scheme of the model (its selected kernel for the split scheme)
+    if (phase_change_scheme == "enthalpy")
+      RepartitionEnthalpy();
+    else
+      (this->*phase_change_kernel)();
+    Energy(x);
+    this->coefficients.factorized = false;
+  }
+}
+
+namespace {
+
+  // file system operations of the spin-up cache (POSIX, or the Windows runtime), errors are thrown with the reason
+
+  void MakeDirectory(const std::string &dir)
+  {
+#ifdef _WIN32
+    int status = _mkdir(dir.c_str());
+#else
+    int status = mkdir(dir.c_str(), 0755);
+#endif
+    if (status != 0 && errno != EEXIST)
+      throw std::runtime_error("Directory " + dir + " could not be created: " + std::strerror(errno) + ".");
+  }
+
+  // name of a temporary file next to file, unique to the process and to the call (models spun up by threads)
+  std::string TemporaryFile(const std::string &file)
+  {
+    static std::atomic<unsigned> count(0);
+#ifdef _WIN32
+    long pid = _getpid();
+#else
+    long pid = getpid();
+#endif
+    return file + ".tmp" + std::to_string(pid) + "_" + std::to_string(count++);
+  }
+
+  // replaces file by the temporary file in one step, so readers see the old or the new file
+  void ReplaceFile(const std::string &temporary, const std::string &file)
+  {
+#ifdef _WIN32
+    if (!MoveFileExA(temporary.c_str(), file.c_str(), MOVEFILE_REPLACE_EXISTING))
+      throw std::runtime_error("File " + file + " could not be replaced (error " + std::to_string(GetLastError())
+			       + ").");
+#else
+    if (std::rename(temporary.c_str(), file.c_str()) != 0)
+      throw std::runtime_error("File " + file + " could not be replaced: " + std::strerror(errno) + ".");
+#endif
+  }
+
+}
+
+void soilfreezethaw::SoilFreezeThaw::
+Spinup()
+{
+  this->spinup_cache_result = "off";
+  this->spinup_cache_file = "";
+  this->spinup_cycles_used = 0;
+  this->spinup_converged = false;
+  if (spinup_forcing_file.empty())
+    return;
+  if (is_soil_moisture_bmi_set)
+    throw std::runtime_error("Spin-up requires the soil moisture of the config file (soil_moisture_bmi is set)!");
+
+  std::vector<double> forcing = ReadGroundTemperatureForcing(spinup_forcing_file);
+  if (int(forcing.size()) < spinup_steps)
+    throw std::runtime_error("Spin-up forcing " + spinup_forcing_file + " provides " + std::to_string(forcing.size())
+			     + " timesteps, spinup_steps is " + std::to_string(spinup_steps) + ".");
+  if (spinup_steps > 0)
+    forcing.resize(spinup_steps);
+
+  if (!spinup_cache_dir.empty()) {
+    char name[32];
+    snprintf(name, sizeof(name), "sft_spinup_%016llx.bin", (unsigned long long)SpinupFingerprint(forcing));
+    this->spinup_cache_file = spinup_cache_dir + "/" + name;
+
+    std::ifstream is(spinup_cache_file, std::ios::binary);
+    if (is) {
+      try {
+	RestoreCheckpoint(is);
+	this->spinup_cache_result = "hit";
+	if (verbosity != "none")
+	  std::cout<<"Spin-up cache hit: "<<spinup_cache_file<<"\n";
+	return;
+      }
+      catch (const std::runtime_error &e) {
+	// unreadable or truncated cache file (the model is not modified): spin up and replace it
+	if (verbosity != "none")
+	  std::cout<<"Spin-up cache file "<<spinup_cache_file<<" ignored: "<<e.what()<<"\n";
+      }
+    }
+    this->spinup_cache_result = "miss";
+  }
+
+  if (spinup_tolerance > 0.0) {
+    SpinupToEquilibrium(forcing);
+  }
+  else {
+    for (int cycle=0; cycle<spinup_cycles; cycle++)
+      RunSpinupCycle(forcing);
+  }
+  if (verbosity != "none")
+    std::cout<<"Spin-up: "<<spinup_cycles_used<<" cycles of "<<forcing.size()<<" timesteps"
+	     <<(spinup_tolerance > 0.0 ? (spinup_converged ? ", converged" : ", not converged") : "")
+	     <<", last cycle change T [K] = "<<spinup_temperature_change<<", ice [-] = "<<spinup_ice_change<<"\n";
+  this->time = 0.0;
+  this->energy_balance = 0.0;
+  this->energy_balance_compensation = 0.0;
+
+  if (!spinup_cache_file.empty()) {
+    // written under a temporary name and renamed, so concurrent runs never read a partial file
+    std::string temporary = TemporaryFile(spinup_cache_file);
+    try {
+      MakeDirectory(spinup_cache_dir);
+      SaveCheckpoint(temporary);
+      ReplaceFile(temporary, spinup_cache_file);
+    }
+    catch (const std::runtime_error &e) {
+      remove(temporary.c_str());
+      throw std::runtime_error("Spin-up cache file " + spinup_cache_file + " could not be written: " + e.what());
+    }
+    if (verbosity != "none")
+      std::cout<<"Spin-up cache miss: state stored in "<<spinup_cache_file<<"\n";
+  }
+}
+
+/*
+  Computes bulk soil thermal conductivity
+  thermal conductivity model follows the parameterization of Peters-Lidars 
+*/
+void soilfreezethaw::SoilFreezeThaw::
+ThermalConductivity() {
+  const int nz = this->shape[0];
+
+  // thermal conductivity of solids (Eq. (10) Peters-Lidard) and dry thermal conductivity depend only on
+  // the soil parameters, see UpdateInvariants
+  UpdateInvariants();
+  const double tc_solid_sat = invariants.tc_solid_sat;
+  const double tc_dry       = invariants.tc_dry;
+
+  if (const ConstitutiveTables *tables = invariants.tables.get())
+    SFT_SIMD_CALL(simd_path, ThermalConductivityCells, nz, soil_moisture_content, soil_liquid_content, this->smcmax,
+		  tc_dry, *tables, thermal_conductivity);
+  else
+    SFT_SIMD_CALL(simd_path, ThermalConductivityCells, nz, soil_moisture_content, soil_liquid_content, this->smcmax,
+		  tc_solid_sat, tc_dry, thermal_conductivity);
 }
 
 /*
@@ -708,12 +2486,12 @@ void soilfreezethaw::SoilFreezeThaw::
 SoilHeatCapacity() {
   Properties prop;
   const int nz = this->shape[0];
-  
-  for (int i=0; i<nz;i++) {
-    double sice = soil_moisture_content[i] - soil_liquid_content[i];
-    heat_capacity[i] = soil_liquid_content[i]*prop.hcwater_ + sice*prop.hcice_ + (1.0-this->smcmax)*prop.hcsoil_ + (this->smcmax-soil_moisture_content[i])*prop.hcair_;
-  }
 
+  UpdateInvariants();
+  const double hc_solid = invariants.hc_solid; // (1-smcmax) * hcsoil
+
+  SFT_SIMD_CALL(simd_path, HeatCapacityCells, nz, soil_moisture_content, soil_liquid_content, this->smcmax, hc_solid,
+		prop, heat_capacity);
 }
 
 void soilfreezethaw::SoilFreezeThaw::
@@ -738,130 +2516,248 @@ PhaseChange() {
   
   Properties prop;
   const int nz = this->shape[0];
-  double *Supercool = new double[nz];    // supercooled water in soil [kg/m2]
-  double *MassIce_L = new double[nz];    // soil ice mass [kg/m2]
-  double *MassLiq_L = new double[nz];    // snow/soil liquid mass [kg/m2]
-  double *HeatEnergy_L = new double[nz]();      // energy residual [w/m2] HM = HeatEnergy_L
-  double *MassPhaseChange_L = new double[nz];        // melting or freezing water [kg/m2] XM_L = mass of phase change
+  double *HeatEnergy_L   = work.HeatEnergy_L.data();   // energy to bring the cells to the freezing point [W/m2]
+  double *HeatResidual_L = work.HeatResidual_L.data(); // energy residual after the phase change [W/m2]
+
+  // SUPERCOOL is the maximum liquid water that can exist below (T - TFRZ) freezing point, computed from the
+  // soil water potential (Clapp-Hornberger) or interpolated from the tables of the soil type
+  UpdateInvariants();
+  double lam = invariants.lam; // -1/b
+  const ConstitutiveTables *tables = invariants.tables.get();
+
+  // one pass over the cells, see PhaseChangeCell
+  const double tfrez  = prop.tfrez_;
+  const double grav   = prop.grav_;
+  const double lhf    = this->latent_heat_fusion;
+  const double smcmax = this->smcmax;
+  const double satpsi = this->satpsi;
+
+  if (tables) {
+    auto supercool = [tables, tfrez](double T) { return tables->supercool(tfrez - T); };
+    SFT_SIMD_CALL(simd_path, PhaseChangeCells, nz, soil_temperature, soil_moisture_content, soil_liquid_content,
+		  soil_ice_content, heat_capacity, soil_dz, dt, lhf, tfrez, prop.wdensity_, supercool, HeatEnergy_L,
+		  HeatResidual_L);
+  }
+  else {
+    auto supercool = [=](double T) {
+      double smp = lhf /(grav*T) * (tfrez - T); // [m] Soil Matrix potential
+      return smcmax* math::PowPositive((smp/satpsi), lam); // SMCMAX = porsity
+    };
+    SFT_SIMD_CALL(simd_path, PhaseChangeCells, nz, soil_temperature, soil_moisture_content, soil_liquid_content,
+		  soil_ice_content, heat_capacity, soil_dz, dt, lhf, tfrez, prop.wdensity_, supercool, HeatEnergy_L,
+		  HeatResidual_L);
+  }
 
-  // arrays keep local copies of the data at the previous timestep
-  double *soil_moisture_content_c = new double[nz];
-  double *MassLiq_c = new double[nz]; 
-  double *MassIce_c = new double[nz];
+  // track total energy used/lost during the phase change (for energy balance check), same order of the
+  // sums as the cell by cell update
+  this->energy_consumed = 0.0;
+  for (int i=0; i<nz;i++)
+    this->energy_consumed += HeatEnergy_L[i];
+  for (int i=0; i<nz;i++)
+    this->energy_consumed -= HeatResidual_L[i];
+}
 
-  int *IndexMelt = new int[nz]; // tracking melting/freezing index of layers
 
-  this->energy_consumed = 0.0;
-  //compute mass of liquid/ice in soil layers in mm
-  for (int i=0; i<nz;i++) {
-      MassIce_L[i] = (soil_moisture_content[i] - soil_liquid_content[i]) * soil_dz[i] * prop.wdensity_; // [kg/m2]
-      MassLiq_L[i] = soil_liquid_content[i] * soil_dz[i] * prop.wdensity_;
+/*
+  Selects the diffusion and phase change kernels once per model (ncells does not change after
+  initialization). Most configurations use a few cells (e.g., soil_z=0.1,0.4,1.0,2.0), the specialized
+  kernels avoid the per cell boundary branches and the runtime loop bounds of the generic kernels. Only the
+  4-cell kernels are dispatched: from 8 cells on the fused generic kernel is as fast or faster (see
+  tests/main_benchmark_kernels.cxx, which reports the speedup of the dispatched specialization).
+  Columns of partitioned_solver_cells cells or more (permafrost columns resolving the frost front) solve the
+  diffusion equation with PartitionedTridiagonal: the serial Thomas algorithm is then the largest part of a
+  timestep. The default threshold is the crossover measured by tests/main_benchmark_tridiagonal.cxx.
+  The variant (baseline, AVX2, AVX-512) of the per-cell kernels and of the partitioned solver is selected here
+  once, see soil_freeze_thaw_simd.hxx.
+*/
+int soilfreezethaw::SoilFreezeThaw::
+SelectKernels(bool specialized, bool fused)
+{
+  this->kernel_cells   = specialized ? this->ncells : 0;
+  this->fused_assembly = fused;
+
+  switch (this->kernel_cells) {
+  case 4:
+    diffusion_kernel    = &SoilFreezeThaw::SolveDiffusionEquationN<4>;
+    phase_change_kernel = &SoilFreezeThaw::PhaseChangeN<4>;
+    break;
+  default:
+    diffusion_kernel    = &SoilFreezeThaw::SolveDiffusionEquation;
+    phase_change_kernel = &SoilFreezeThaw::PhaseChange;
+    this->kernel_cells  = 0;
   }
-  //set local variables
-  
-  //create copies of the current Mice and MLiq
-  memcpy(MassLiq_c, MassLiq_L, sizeof (double) * nz);
-  memcpy(MassIce_c, MassIce_L, sizeof (double) * nz);
 
-  //Phase change between ice and liquid water
-  for (int i=0; i<nz;i++) {
-    IndexMelt[i] = 0;
-    soil_moisture_content_c[i] = MassIce_L[i] + MassLiq_L[i];
-  }
+  // instruction set of the per-cell kernels and the partitioned solver: simd_path_option or SFT_SIMD_PATH
+  this->simd_path = SelectSimdPath(this->simd_path_option);
+  tridiagonal.SetSimdPath(this->simd_path);
 
-  /*------------------------------------------------------------------- */
-  //Soil water potential
-  // SUPERCOOL is the maximum liquid water that can exist below (T - TFRZ) freezing point
-  double lam = -1./(this->b);
-  for (int i=0; i<nz;i++) {
-    if (soil_temperature[i] < prop.tfrez_) {
-      double smp = latent_heat_fusion /(prop.grav_*soil_temperature[i]) * (prop.tfrez_ - soil_temperature[i]);     // [m] Soil Matrix potential
-      Supercool[i] = this->smcmax* pow((smp/this->satpsi), lam); // SMCMAX = porsity
-      Supercool[i] = Supercool[i]*soil_dz[i]* prop.wdensity_;    // [kg/m2]
-    }
+  // long columns: the diffusion matrix is factorized by the partitioned solver (generic kernels); the
+  // factorization in the workspace belongs to the previous solver
+  this->partitioned_solver = this->kernel_cells == 0 && this->partitioned_solver_cells > 0
+    && this->ncells >= this->partitioned_solver_cells;
+  if (this->partitioned_solver)
+    tridiagonal.SetThreads(this->partitioned_solver_threads);
+  this->coefficients.factorized = false;
+
+  return this->kernel_cells;
+}
+
+/*
+  SolveDiffusionEquation(bool) for N cells. The operations (and their order) are the same as in the generic
+  kernel, so the results are bitwise identical. Coefficients and the factorization (lambda, A, B, C, P and
+  pivots) stay in the workspace to be reused by the next timestep, the other scratch arrays are on the stack.
+*/
+template <int N>
+void soilfreezethaw::SoilFreezeThaw::
+SolveDiffusionEquationN(bool reuse_factorization)
+{
+  double thermal_flux[N];
+  double dsoilT_dz[N];
+  double RHS[N];
+  double Q[N];
+  double X[N];
+
+  double *lambda = work.lambda.data();
+  double *AI     = work.AI.data();
+  double *BI     = work.BI.data();
+  double *CI     = work.CI.data();
+  double *P      = work.P.data();
+  double *pivot  = work.pivot.data();
+
+  const double *T = soil_temperature;
+  const double *k = thermal_conductivity;
+
+  UpdateInvariants();
+  const double *h1          = invariants.h1.data();
+  const double *h2          = invariants.h2.data();
+  const double *denominator = invariants.denominator.data();
+
+  reuse_factorization = reuse_factorization && coefficients.factorized;
+
+  if (!reuse_factorization) {
+    for (int i=0; i<N; i++)
+      lambda[i] = dt/(h1[i] * heat_capacity[i]);
   }
 
+  // fluxes: top cell, interior cells, bottom cell
+  this->ground_heat_flux = this->GroundHeatFlux(T[0]);
+  dsoilT_dz[0]    = 2.0 * (T[1] - T[0])/ h2[0];
+  thermal_flux[0] = k[0] * dsoilT_dz[0] + this->ground_heat_flux;
 
-  /*------------------------------------------------------------------- */
-  // ****** get layer freezing/melting index ************
-  for (int i=0; i<nz;i++) {
-    if (MassIce_L[i] > 0 && soil_temperature[i] > prop.tfrez_) //Melting condition
-      IndexMelt[i] = 1;
-    else if (MassLiq_L[i] > Supercool[i] && soil_temperature[i] <= prop.tfrez_)// freezing condition in NoahMP
-      IndexMelt[i] = 2;
+  for (int i=1; i<N-1; i++) {
+    dsoilT_dz[i]    = 2.0 * (T[i+1] - T[i])/ h2[i];
+    thermal_flux[i] = k[i] * dsoilT_dz[i] - k[i-1] * dsoilT_dz[i-1];
   }
-  
-  /*------------------------------------------------------------------- */
-  // ****** get excess or deficit of energy during phase change (use Hm) ********
-  //  HC = volumetic heat capacity [J/m3/K]
-  // Heat Energy = (T- Tref) * HC * DZ /Dt = K * J/(m3 * K) * m * 1/s = (J/s)*m/m3 = W/m2
-  //if HeatEnergy < 0 --> freezing energy otherwise melting energy
-  
-  for (int i=0; i<nz;i++) {
-    
-    if (IndexMelt[i] > 0) {
-      HeatEnergy_L[i] = (soil_temperature[i] - prop.tfrez_) * (heat_capacity[i] * soil_dz[i]) / dt; // q = m * c * delta_T
-      soil_temperature[i] = prop.tfrez_; // Note the temperature does not go below 0 until there is mixture of water and ice
 
-      this->energy_consumed += HeatEnergy_L[i]; // track total energy used/lost during the phase change (for energy balance check)
-    }
-    
-    if (IndexMelt[i] == 1 && HeatEnergy_L[i] <0) {
-      HeatEnergy_L[i] = 0;
-      IndexMelt[i] = 0;
+  double bottomflux = 0.0;
+  if (this->option_bottom_boundary == 1)
+    bottomflux = - k[N-1] * (2 * (T[N-1] - bottom_boundary_temp_const) / h1[N-1]);
+
+  thermal_flux[N-1]      = bottomflux - k[N-2] * dsoilT_dz[N-2];
+  this->bottom_heat_flux = bottomflux;
+
+  if (!reuse_factorization) {
+    AI[0] = 0;
+    CI[0] = -lambda[0] * k[0] * denominator[0];
+    BI[0] = 1 - CI[0];
+
+    for (int i=1; i<N-1; i++) {
+      AI[i] = -lambda[i] * k[i-1] * denominator[i-1];
+      CI[i] = -lambda[i] * k[i] * denominator[i];
+      BI[i] = 1 - AI[i] - CI[i];
     }
-    
-    if (IndexMelt[i] == 2 && HeatEnergy_L[i] > 0) {
-      HeatEnergy_L[i] = 0;
-      IndexMelt[i] = 0;
+
+    AI[N-1] = -lambda[N-1] * k[N-2] * denominator[N-2];
+    CI[N-1] = 0;
+    BI[N-1] = 1 - AI[N-1];
+
+    // factorization, see FactorTDMA
+    bool ok = true;
+    pivot[0] = BI[0];
+    P[0]     = -CI[0]/BI[0];
+
+    for (int i=1; i<N && ok; i++) {
+      double den = BI[i] + AI[i] * P[i-1];
+      ok = std::abs(den) >= 1e-20;
+      pivot[i] = den;
+      P[i]     = -CI[i]/den;
     }
-    
-    /* compute the amount of melting or freezing water [kg/m2]. That is, how much water needs to be melted
-       or freezed for the given energy change: MPC = MassPhaseChange */
-    MassPhaseChange_L[i] = HeatEnergy_L[i] * dt / latent_heat_fusion;
+
+    coefficients.factorization_ok = ok;
+    coefficients.factorized = true;
+    this->stats.factorizations++;
+  }
+  else {
+    this->stats.factorization_reuses++;
   }
 
-  
-  /*------------------------------------------------------------------- */
-  // The rate of melting and freezing for snow and soil
-  // mass partition between ice and water and the corresponding adjustment for the next timestep
-  for (int i=0; i<nz;i++) {
-    if (IndexMelt[i] >0 && std::abs(HeatEnergy_L[i]) >0) {
-      if (MassPhaseChange_L[i] >0)      //melting
-	MassIce_L[i] = std::max(0., MassIce_c[i]-MassPhaseChange_L[i]);
-      else if (MassPhaseChange_L[i] <0) { //freezing
-	if (soil_moisture_content_c[i] < Supercool[i])
-	  MassIce_L[i] = 0;
-	else {
-	  MassIce_L[i] = std::min(soil_moisture_content_c[i] - Supercool[i], MassIce_c[i] - MassPhaseChange_L[i]);
-	  MassIce_L[i] = std::max(MassIce_L[i],0.0);
-	}
-      }
-    
-      // compute heat residual
-      // total energy available - energy consumed by phase change (ice_old - ice_new). The residual becomes sensible heat
-      double HEATR = HeatEnergy_L[i] - latent_heat_fusion * (MassIce_c[i]-MassIce_L[i]) / dt; // [W/m2] Energy Residual, last part is the energy due to change in ice mass
-      MassLiq_L[i] = std::max(0.,soil_moisture_content_c[i] - MassIce_L[i]);
-
-      // Temperature correction
-      this->energy_consumed -= HEATR;
-      if (std::abs(HEATR)>0) {
-	double f = dt/(heat_capacity[i] * soil_dz[i]);       // [m2 K/W]
-	soil_temperature[i] = soil_temperature[i] + f * HEATR; /* [K] , this is computed from HeatMass = (T_n+1-T_n) * Heat_capacity * DZ/ DT
-								  convert sensible heat to temperature and add to the soil temp. */
-      }
+  for (int i=0; i<N; i++)
+    RHS[i] = lambda[i] * thermal_flux[i];
 
-	       
-    }
+  // substitution, see SubstituteTDMA; X is zero if the system is singular
+  if (coefficients.factorization_ok) {
+    Q[0] = RHS[0]/pivot[0];
+    for (int i=1; i<N; i++)
+      Q[i] = (RHS[i] - AI[i] * Q[i-1])/pivot[i];
+
+    X[N-1] = Q[N-1];
+    for (int i=N-2; i>=0; i--)
+      X[i] = P[i] * X[i+1] + Q[i];
   }
-  
-  for (int i=0; i<nz;i++) {
-    soil_liquid_content[i] =  MassLiq_L[i] / (prop.wdensity_ * soil_dz[i]);                   // [-]
-    soil_moisture_content[i]  = (MassLiq_L[i] + MassIce_L[i]) / (prop.wdensity_ * soil_dz[i]); // [-]
-    soil_ice_content[i] = std::max(soil_moisture_content[i] - soil_liquid_content[i],0.);
+  else {
+    for (int i=0; i<N; i++)
+      X[i] = 0.0;
   }
+
+  // Update soil temperature
+  for (int i=0; i<N; i++)
+    this->soil_temperature[i] += X[i];
 }
 
+/*
+  PhaseChange() for N cells with stack-resident scratch, bitwise identical to the generic kernel
+  (same operations, same order of the energy_consumed accumulation)
+*/
+template <int N>
+void soilfreezethaw::SoilFreezeThaw::
+PhaseChangeN()
+{
+  Properties prop;
+  double HeatEnergy_L[N];   // energy to bring the cells to the freezing point [W/m2]
+  double HeatResidual_L[N]; // energy residual after the phase change [W/m2]
+
+  UpdateInvariants();
+  const double lam = invariants.lam; // -1/b
+  const ConstitutiveTables *tables = invariants.tables.get();
+
+  const double tfrez  = prop.tfrez_;
+  const double grav   = prop.grav_;
+  const double lhf    = this->latent_heat_fusion;
+  const double smcmax = this->smcmax;
+  const double satpsi = this->satpsi;
+
+  if (tables) {
+    auto supercool = [tables, tfrez](double T) { return tables->supercool(tfrez - T); };
+    SFT_SIMD_CALL(simd_path, PhaseChangeCells, N, soil_temperature, soil_moisture_content, soil_liquid_content,
+		  soil_ice_content, heat_capacity, soil_dz, dt, lhf, tfrez, prop.wdensity_, supercool, HeatEnergy_L,
+		  HeatResidual_L);
+  }
+  else {
+    auto supercool = [=](double T) {
+      double smp = lhf /(grav*T) * (tfrez - T); // [m] Soil Matrix potential
+      return smcmax* math::PowPositive((smp/satpsi), lam);
+    };
+    SFT_SIMD_CALL(simd_path, PhaseChangeCells, N, soil_temperature, soil_moisture_content, soil_liquid_content,
+		  soil_ice_content, heat_capacity, soil_dz, dt, lhf, tfrez, prop.wdensity_, supercool, HeatEnergy_L,
+		  HeatResidual_L);
+  }
+
+  this->energy_consumed = 0.0;
+  for (int i=0; i<N; i++)
+    this->energy_consumed += HeatEnergy_L[i];
+  for (int i=0; i<N; i++)
+    this->energy_consumed -= HeatResidual_L[i];
+}
 
 /*
   Module computes the energy balance (locally and globally)
@@ -878,21 +2774,15 @@ EnergyBalanceCheck()
   
   double energy_current  = 0.0;
   double energy_previous = 0.0;
-  double energy_residual = 0.0;
-  double tolerance       = 1.0E-4;
-  double Tref            = 273.15; // reference temperature [K]
-    
-  for (int i=0;i<ncells; i++) {
-    //energy_temp += heat_capacity[i] * (soil_temperature[i] - soil_temperature_prev[i]) * soil_dz[i] / dt; // W/m^2
-    energy_previous += heat_capacity[i] * (soil_temperature_prev[i] - Tref) * soil_dz[i] / dt; // W/m^2
-    energy_current  += heat_capacity[i] * (soil_temperature[i] - Tref) * soil_dz[i] / dt;       // W/m^2
-  }
-  
-  energy_residual = energy_current - energy_previous;
+  double tolerance       = energy_balance_tolerance;
+
+  double energy_balance_timestep = EnergyBalanceTimestep(energy_previous, energy_current);
 
-  double energy_balance_timestep = (energy_residual + this->energy_consumed) - net_flux;
+  // adaptive sub-steps: local balance averaged over the sub-steps (energy_previous/current of the last sub-step)
+  if (this->adaptive_timestep)
+    energy_balance_timestep = this->energy_balance_substeps;
 
-  this->energy_balance += energy_balance_timestep;
+  CompensatedSum(this->energy_balance, this->energy_balance_compensation, energy_balance_timestep);
   
   if (verbosity.compare("high") == 0 || fabs(energy_balance) >  tolerance) {
     
@@ -913,6 +2803,30 @@ EnergyBalanceCheck()
   
 }
 
+/*
+  Returns the local energy balance error [W/m2] of the last step (or sub-step) of size dt, the energy
+  stored in the column before and after the step are returned in energy_previous and energy_current
+*/
+double soilfreezethaw::SoilFreezeThaw::
+EnergyBalanceTimestep(double &energy_previous, double &energy_current)
+{
+  double net_flux = this->ground_heat_flux + this->bottom_heat_flux;
+  double Tref     = 273.15; // reference temperature [K]
+
+  energy_current  = 0.0;
+  energy_previous = 0.0;
+
+  for (int i=0;i<ncells; i++) {
+    //energy_temp += heat_capacity[i] * (soil_temperature[i] - soil_temperature_prev[i]) * soil_dz[i] / dt; // W/m^2
+    energy_previous += heat_capacity[i] * (soil_temperature_prev[i] - Tref) * soil_dz[i] / dt; // W/m^2
+    energy_current  += heat_capacity[i] * (soil_temperature[i] - Tref) * soil_dz[i] / dt;       // W/m^2
+  }
+  
+  double energy_residual = energy_current - energy_previous;
+
+  return (energy_residual + this->energy_consumed) - net_flux;
+}
+
 
 /*
   class containing some of the static variables used by several modules
@@ -0,0 +1,985 @@
+#ifndef SFT_BATCH_CXX_INCLUDED
+#define SFT_BATCH_CXX_INCLUDED
+
+#include <cmath>
+#include <algorithm>
+#include <stdexcept>
+#include <sstream>
+#include "../include/soil_freeze_thaw_batch.hxx"
+#include "../include/soil_freeze_thaw_math.hxx"
+
+
+template <typename Real, typename State>
+soilfreezethaw::SoilFreezeThawBatchT<Real,State>::
+SoilFreezeThawBatchT(const std::vector<SoilFreezeThaw*> &columns)
+{
+  if (columns.empty())
+    throw std::runtime_error("SoilFreezeThawBatch: at least one column is required!");
+
+  const SoilFreezeThaw &first = *columns[0];
+
+  if (first.soil_dz == NULL || first.soil_temperature_prev == NULL)
+    throw std::runtime_error("SoilFreezeThawBatch: columns must be initialized from a config file!");
+
+  this->ncolumns = columns.size();
+  this->ncells   = first.ncells;
+  this->dt       = first.dt;
+  this->time     = first.time;
+  this->thawed_steps = 0;
+  this->factorizations = 0;
+  this->factorization_reuses = 0;
+  this->fused_assembly = true;
+  this->simd_path = SelectSimdPath("auto");
+  this->latent_heat_fusion = first.latent_heat_fusion;
+
+  if (this->ncells < 2)
+    throw std::runtime_error("SoilFreezeThawBatch: soil columns must have at least two cells!");
+
+  this->soil_z.assign(first.soil_z, first.soil_z + ncells);
+  this->soil_dz.assign(first.soil_dz, first.soil_dz + ncells);
+
+  const int n = ncells * ncolumns;
+
+  soil_temperature.resize(n);
+  soil_temperature_prev.resize(n);
+  heat_capacity.resize(n);
+  thermal_conductivity.resize(n);
+  soil_moisture_content.resize(n);
+  soil_liquid_content.resize(n);
+  soil_ice_content.resize(n);
+
+  thermal_flux.resize(n);
+  dsoilT_dz.resize(n);
+  AI.resize(n);
+  BI.resize(n);
+  CI.resize(n);
+  RHS.resize(n);
+  P.resize(n);
+  Q.resize(n);
+  pivot.resize(n);
+  lambda.resize(n);
+  cache_moisture.resize(n);
+  cache_liquid.resize(n);
+  heat_energy.resize(n);
+  heat_residual.resize(n);
+  if (sizeof(Real) < sizeof(double)) {
+    rhs.resize(n);
+    increment.resize(n);
+  }
+  tdma_failed.resize(ncolumns);
+  column_a.resize(ncolumns);
+  column_b.resize(ncolumns);
+  column_c.resize(ncolumns);
+
+  smcmax.resize(ncolumns);
+  b.resize(ncolumns);
+  satpsi.resize(ncolumns);
+  quartz.resize(ncolumns);
+  tc_solid.resize(ncolumns);
+  tc_solid_sat.resize(ncolumns);
+  tc_dry.resize(ncolumns);
+  cache_smcmax.resize(ncolumns);
+  cache_b.resize(ncolumns);
+  cache_satpsi.resize(ncolumns);
+  cache_quartz.resize(ncolumns);
+  ground_temp.resize(ncolumns);
+  top_boundary_temp_const.resize(ncolumns);
+  bottom_boundary_temp_const.resize(ncolumns);
+  option_top_boundary.resize(ncolumns);
+  option_bottom_boundary.resize(ncolumns);
+  ice_fraction_scheme_bmi.resize(ncolumns);
+  is_soil_moisture_bmi_set.resize(ncolumns);
+  ground_heat_flux.resize(ncolumns);
+  bottom_heat_flux.resize(ncolumns);
+  energy_consumed.resize(ncolumns);
+  energy_balance.resize(ncolumns);
+  energy_balance_compensation.assign(ncolumns, 0.0);
+  ice_fraction_schaake.resize(ncolumns);
+  ice_fraction_xinanjiang.resize(ncolumns);
+  soil_ice_fraction.resize(ncolumns);
+
+  for (int c=0; c<ncolumns; c++) {
+    const SoilFreezeThaw &model = *columns[c];
+
+    if (model.ncells != ncells || model.dt != dt)
+      throw std::runtime_error("SoilFreezeThawBatch: all columns must have the same number of cells and timestep!");
+
+    if (model.adaptive_timestep)
+      throw std::runtime_error("SoilFreezeThawBatch: adaptive sub-stepping (adaptive_timestep) is not supported by the batch!");
+    if (model.constitutive_tables)
+      throw std::runtime_error("SoilFreezeThawBatch: constitutive tables (constitutive_tables) are not supported by the batch!");
+
+    if (model.phase_change_scheme != "split")
+      throw std::runtime_error("SoilFreezeThawBatch: only the split phase change scheme is supported by the batch!");
+
+    for (int i=0; i<ncells; i++) {
+      if (model.soil_z[i] != soil_z[i])
+	throw std::runtime_error("SoilFreezeThawBatch: all columns must have the same soil discretization (soil_z)!");
+    }
+
+    SetColumnState(c, model);
+  }
+
+  // column-invariant grid terms, see SoilFreezeThaw::SolveDiffusionEquation
+  h1.resize(ncells);
+  denominator.assign(ncells, 0.0);
+
+  h1[0] = soil_z[0];
+  denominator[0] = 2.0/soil_z[1];
+  for (int i=1; i<ncells-1; i++) {
+    h1[i] = soil_z[i] - soil_z[i-1];
+    denominator[i] = 2.0/(soil_z[i+1] - soil_z[i-1]);
+  }
+  h1[ncells-1] = soil_z[ncells-1] - soil_z[ncells-2];
+
+  // column constants of the soil parameters, the coefficients are computed by the first timestep
+  ThermalConductivityConstants();
+  this->cache_dt = dt;
+  this->coefficients_cached = false;
+  this->factorized = false;
+}
+
+
+template <typename Real, typename State>
+void soilfreezethaw::SoilFreezeThawBatchT<Real,State>::
+SetColumnState(int c, const SoilFreezeThaw &model)
+{
+  for (int i=0; i<ncells; i++) {
+    const int k = Index(i,c);
+    soil_temperature[k]      = model.soil_temperature[i];
+    soil_temperature_prev[k] = model.soil_temperature_prev[i];
+    heat_capacity[k]         = model.heat_capacity[i];
+    thermal_conductivity[k]  = model.thermal_conductivity[i];
+    soil_moisture_content[k] = model.soil_moisture_content[i];
+    soil_liquid_content[k]   = model.soil_liquid_content[i];
+    soil_ice_content[k]      = model.soil_ice_content[i];
+  }
+
+  smcmax[c]                     = model.smcmax;
+  b[c]                          = model.b;
+  satpsi[c]                     = model.satpsi;
+  quartz[c]                     = model.quartz;
+  ground_temp[c]                = model.ground_temp;
+  top_boundary_temp_const[c]    = model.top_boundary_temp_const;
+  bottom_boundary_temp_const[c] = model.bottom_boundary_temp_const;
+  option_top_boundary[c]        = model.option_top_boundary;
+  option_bottom_boundary[c]     = model.option_bottom_boundary;
+  is_soil_moisture_bmi_set[c]   = model.is_soil_moisture_bmi_set;
+  ground_heat_flux[c]           = model.ground_heat_flux;
+  bottom_heat_flux[c]           = model.bottom_heat_flux;
+  energy_consumed[c]            = model.energy_consumed;
+  energy_balance[c]             = model.energy_balance;
+  energy_balance_compensation[c] = model.energy_balance_compensation;
+  ice_fraction_schaake[c]       = model.ice_fraction_schaake;
+  ice_fraction_xinanjiang[c]    = model.ice_fraction_xinanjiang;
+  soil_ice_fraction[c]          = model.soil_ice_fraction;
+
+  // the coefficients of the column are those of the model, they are recomputed by the next timestep
+  coefficients_cached = false;
+  factorized = false;
+
+  if (model.ice_fraction_scheme == "Schaake")
+    ice_fraction_scheme_bmi[c] = SoilFreezeThaw::Schaake;
+  else if (model.ice_fraction_scheme == "Xinanjiang")
+    ice_fraction_scheme_bmi[c] = SoilFreezeThaw::Xinanjiang;
+  else
+    ice_fraction_scheme_bmi[c] = model.ice_fraction_scheme_bmi;
+}
+
+
+template <typename Real, typename State>
+void soilfreezethaw::SoilFreezeThawBatchT<Real,State>::
+GetColumnState(int c, SoilFreezeThaw &model) const
+{
+  for (int i=0; i<ncells; i++) {
+    const int k = Index(i,c);
+    model.soil_temperature[i]      = soil_temperature[k];
+    model.soil_temperature_prev[i] = soil_temperature_prev[k];
+    model.heat_capacity[i]         = heat_capacity[k];
+    model.thermal_conductivity[i]  = thermal_conductivity[k];
+    model.soil_moisture_content[i] = soil_moisture_content[k];
+    model.soil_liquid_content[i]   = soil_liquid_content[k];
+    model.soil_ice_content[i]      = soil_ice_content[k];
+  }
+
+  model.time                    = time;
+  model.ground_temp             = ground_temp[c];
+  model.ground_heat_flux        = ground_heat_flux[c];
+  model.bottom_heat_flux        = bottom_heat_flux[c];
+  model.energy_consumed         = energy_consumed[c];
+  model.energy_balance          = energy_balance[c];
+  model.energy_balance_compensation = energy_balance_compensation[c];
+  model.ice_fraction_schaake    = ice_fraction_schaake[c];
+  model.ice_fraction_xinanjiang = ice_fraction_xinanjiang[c];
+  model.soil_ice_fraction       = soil_ice_fraction[c];
+}
+
+
+/*
+  Advance all columns by one timestep, same sequence of operations as SoilFreezeThaw::Advance
+*/
+template <typename Real, typename State>
+void soilfreezethaw::SoilFreezeThawBatchT<Real,State>::
+Advance()
+{
+  // store the current state, update the liquid content (BMI) and check whether the coefficients and the
+  // factorization of the previous timestep can be reused
+  bool coefficients_unchanged = BeginTimestep();
+
+  if (fused_assembly) {
+    // coefficients and the tridiagonal solve in one sweep over the cells
+    SolveDiffusionEquationFused(coefficients_unchanged);
+  }
+  else {
+    if (!coefficients_unchanged) {
+      ThermalConductivity();
+
+      SoilHeatCapacity();
+    }
+    coefficients_cached = true;
+
+    // the matrices are assembled and factorized, the fused sweep does not reuse them
+    SolveDiffusionEquation();
+    factorized = false;
+    factorizations++;
+  }
+
+  // if every column is thawed (see SoilFreezeThaw::IsThawedColumn) the phase change reduces to the mass conversions
+  bool thawed = IsThawed();
+
+  if (thawed)
+    ThawedUpdate();
+  else
+    PhaseChange();
+
+  this->time += this->dt;
+
+  if (thawed)
+    this->thawed_steps++;
+  else
+    ComputeIceFraction();
+
+  EnergyBalanceCheck();
+}
+
+
+/*
+  Column constants of the thermal conductivity: thermal conductivity of solids, its saturated contribution
+  and the dry thermal conductivity; the soil parameters they are computed from are cached (see BeginTimestep)
+*/
+template <typename Real, typename State>
+void soilfreezethaw::SoilFreezeThawBatchT<Real,State>::
+ThermalConductivityConstants()
+{
+  const double tcquartz = 7.7;   // thermal_conductivity of Quartz [W/(mK)]
+
+  for (int c=0; c<ncolumns; c++) {
+    cache_smcmax[c] = smcmax[c];
+    cache_b[c]      = b[c];
+    cache_satpsi[c] = satpsi[c];
+    cache_quartz[c] = quartz[c];
+
+    double tcmineral = quartz[c] > 0.2 ? 2.0 : 3.0;
+    tc_solid[c] = pow(tcquartz,quartz[c]) * pow(tcmineral, (1. - quartz[c]));
+    tc_solid_sat[c] = pow(tc_solid[c],(1. - smcmax[c]));
+
+    double gammd = (1. - smcmax[c])*2700.; // dry density
+    tc_dry[c] = (0.135* gammd+ 64.7)/ (2700. - 0.947* gammd);
+  }
+}
+
+
+/*
+  Peters-Lidard thermal conductivity of cell k of column c, see SoilFreezeThaw::ThermalConductivity;
+  requires the column constants (ThermalConductivityConstants)
+*/
+template <typename Real, typename State>
+inline double soilfreezethaw::SoilFreezeThawBatchT<Real,State>::
+CellThermalConductivity(int k, int c) const
+{
+  const double tcwater  = 0.57;  // thermal_conductivity of water  [W/(mK)]
+  const double tcice    = 2.2;   // thermal conductiviyt of ice    [W/(mK)]
+
+  const double smc = soil_moisture_content[k];
+  const double slc = soil_liquid_content[k];
+
+  double sat_ratio  = smc / smcmax[c];
+  double x_unfrozen = slc / (smc > 0 ? smc : 1.0);
+  x_unfrozen        = smc > 0 ? x_unfrozen : 1.0;
+  double xu         = x_unfrozen * smcmax[c];
+  double tc_sat     = tc_solid_sat[c] * math::Pow(tcice, (smcmax[c] - xu)) * math::Pow(tcwater,xu);
+
+  // Kersten Number, selects instead of branches so the loop over columns is vectorized
+  double log_sat = math::Log10(sat_ratio);
+  double KN = sat_ratio > 0.05 ? 0.7 * log_sat + 1. : 0.0;
+  KN = sat_ratio > 0.1 ? log_sat + 1. : KN;
+  KN = (slc + 0.0005) < smc ? sat_ratio : KN; // for frozen soil
+
+  return KN * (tc_sat - tc_dry[c]) + tc_dry[c];
+}
+
+
+/*
+  Volumetric heat capacity of cell k of column c, see SoilFreezeThaw::SoilHeatCapacity
+*/
+template <typename Real, typename State>
+inline double soilfreezethaw::SoilFreezeThawBatchT<Real,State>::
+CellHeatCapacity(int k, int c, const Properties &prop) const
+{
+  double sice = soil_moisture_content[k] - soil_liquid_content[k];
+  return soil_liquid_content[k]*prop.hcwater_ + sice*prop.hcice_ + (1.0-smcmax[c])*prop.hcsoil_
+    + (smcmax[c]-soil_moisture_content[k])*prop.hcair_;
+}
+
+
+/*
+  Peters-Lidard thermal conductivity, see SoilFreezeThaw::ThermalConductivity
+*/
+template <typename Real, typename State>
+void soilfreezethaw::SoilFreezeThawBatchT<Real,State>::
+ThermalConductivity()
+{
+  for (int i=0; i<ncells; i++) {
+    for (int c=0; c<ncolumns; c++) {
+      const int k = Index(i,c);
+      thermal_conductivity[k] = CellThermalConductivity(k, c);
+    }
+  }
+}
+
+
+/*
+  Volumetric heat capacity, see SoilFreezeThaw::SoilHeatCapacity
+*/
+template <typename Real, typename State>
+void soilfreezethaw::SoilFreezeThawBatchT<Real,State>::
+SoilHeatCapacity()
+{
+  Properties prop;
+
+  for (int i=0; i<ncells; i++) {
+    for (int c=0; c<ncolumns; c++) {
+      const int k = Index(i,c);
+      heat_capacity[k] = CellHeatCapacity(k, c, prop);
+    }
+  }
+}
+
+
+/*
+  Assembles and solves the diffusion equation of all columns, see SoilFreezeThaw::SolveDiffusionEquation
+*/
+template <typename Real, typename State>
+void soilfreezethaw::SoilFreezeThawBatchT<Real,State>::
+SolveDiffusionEquation()
+{
+  const int N = ncolumns;
+  const int last = ncells-1;
+
+  // top cell
+  for (int c=0; c<N; c++) {
+    const int k = c;
+    double surface_temp = option_top_boundary[c] == 1 ? top_boundary_temp_const[c] : ground_temp[c];
+    double lambda = dt / (h1[0] * heat_capacity[k]);
+
+    ground_heat_flux[c] = - thermal_conductivity[k] * (soil_temperature[k]  - surface_temp) / (0.5*soil_z[0]);
+    dsoilT_dz[k] = 2.0 * (soil_temperature[k+N] - soil_temperature[k])/ soil_z[1];
+    thermal_flux[k] = thermal_conductivity[k] * dsoilT_dz[k] + ground_heat_flux[c];
+
+    AI[k]  = 0;
+    CI[k]  = -lambda * thermal_conductivity[k] * denominator[0];
+    BI[k]  = 1 - CI[k];
+    RHS[k] = lambda * thermal_flux[k];
+  }
+
+  // interior cells
+  for (int i=1; i<last; i++) {
+    const double h2 = soil_z[i+1] - soil_z[i-1];
+    for (int c=0; c<N; c++) {
+      const int k = Index(i,c);
+      double lambda = dt/(h1[i] * heat_capacity[k]);
+
+      dsoilT_dz[k] = 2.0 * (soil_temperature[k+N] - soil_temperature[k])/ h2;
+      thermal_flux[k] = thermal_conductivity[k] * dsoilT_dz[k] - thermal_conductivity[k-N] * dsoilT_dz[k-N];
+
+      AI[k]  = -lambda * thermal_conductivity[k-N] * denominator[i-1];
+      CI[k]  = -lambda * thermal_conductivity[k] * denominator[i];
+      BI[k]  = 1 - AI[k] - CI[k];
+      RHS[k] = lambda * thermal_flux[k];
+    }
+  }
+
+  // bottom cell
+  for (int c=0; c<N; c++) {
+    const int k = Index(last,c);
+    double lambda = dt/(h1[last] * heat_capacity[k]);
+    double bottomflux = 0.;
+
+    if (option_bottom_boundary[c] == 1) {
+      double dzdt = 2 * (soil_temperature[k] - bottom_boundary_temp_const[c]) / h1[last];
+      bottomflux = - thermal_conductivity[k] * dzdt;
+    }
+
+    thermal_flux[k] = bottomflux - thermal_conductivity[k-N] * dsoilT_dz[k-N];
+    bottom_heat_flux[c] = bottomflux;
+
+    AI[k]  = -lambda * thermal_conductivity[k-N] * denominator[last-1];
+    CI[k]  = 0;
+    BI[k]  = 1 - AI[k];
+    RHS[k] = lambda * thermal_flux[k];
+  }
+
+  if (sizeof(Real) < sizeof(double)) {
+    SolverRefined();
+    return;
+  }
+
+  SolverTDMA();
+
+  // Update soil temperature, the solution is returned in RHS
+  for (int k=0; k<ncells*N; k++)
+    soil_temperature[k] += RHS[k];
+}
+
+
+/*
+  Start of the timestep, one pass over the cells, see SoilFreezeThaw::BeginTimestep: stores the current
+  temperatures, updates the liquid content of the columns coupled to SoilMoistureProfiles based on the previous
+  ice content, and tracks the inputs of the coefficients. The thermal conductivity, heat capacity and the
+  matrices depend only on the moisture and liquid contents, the soil parameters and dt; returns true if none of
+  them changed in any column since the coefficients were computed, otherwise records the current inputs and
+  returns false. Recomputing the coefficients of an unchanged column gives the same values, so a batch reuses
+  them only if all of its columns are unchanged. The column constants are rebuilt when a soil parameter changes.
+*/
+template <typename Real, typename State>
+bool soilfreezethaw::SoilFreezeThawBatchT<Real,State>::
+BeginTimestep()
+{
+  bool parameters_changed = dt != cache_dt;
+  for (int c=0; c<ncolumns; c++)
+    parameters_changed |= (smcmax[c] != cache_smcmax[c]) | (b[c] != cache_b[c]) | (satpsi[c] != cache_satpsi[c])
+      | (quartz[c] != cache_quartz[c]);
+
+  if (parameters_changed) {
+    ThermalConductivityConstants();
+    cache_dt = dt;
+  }
+
+  int changed = 0;
+  for (int i=0; i<ncells; i++) {
+    for (int c=0; c<ncolumns; c++) {
+      const int k = Index(i,c);
+      soil_temperature_prev[k] = soil_temperature[k];
+      if (is_soil_moisture_bmi_set[c])
+	soil_liquid_content[k] = std::max(soil_moisture_content[k] - soil_ice_content[k], State(0));
+      changed |= (cache_moisture[k] != soil_moisture_content[k]) | (cache_liquid[k] != soil_liquid_content[k]);
+    }
+  }
+
+  bool unchanged = coefficients_cached && !parameters_changed && !changed;
+
+  if (!unchanged) {
+    std::copy(soil_moisture_content.begin(), soil_moisture_content.end(), cache_moisture.begin());
+    std::copy(soil_liquid_content.begin(), soil_liquid_content.end(), cache_liquid.begin());
+    coefficients_cached = false;
+    factorized = false;
+  }
+
+  return unchanged;
+}
+
+
+/*
+  Fused timestep assembly: one sweep over the rows of cells (all columns of a cell depth) computes the thermal
+  conductivity and heat capacity of the row, then the fluxes and matrix rows and, in double precision, the
+  forward elimination of the Thomas algorithm while the row is in cache; a second sweep does the
+  backward substitution and the temperature update. The unfused sequence (Advance with fused_assembly = false)
+  streams the per-cell arrays through eight passes. The flux gradient of the previous cell is kept in a
+  column-sized buffer and the boundary cells are peeled. In single precision the assembled systems are
+  solved by SolverRefined. Same operations as the unfused sequence, so the results are bitwise identical.
+  reuse_factorization = true (see BeginTimestep): lambda, A and the pivots and multipliers of the elimination
+  (double precision) or A, B and C (single precision) of the previous timestep are still valid; the sweep only
+  computes the fluxes, the right-hand sides and the forward substitution.
+*/
+template <typename Real, typename State>
+void soilfreezethaw::SoilFreezeThawBatchT<Real,State>::
+SolveDiffusionEquationFused(bool reuse_factorization)
+{
+  Properties prop;
+  const int N = ncolumns;
+  const int last = ncells-1;
+  const bool eliminate = sizeof(Real) == sizeof(double); // forward elimination in the sweep
+  std::vector<double> &gradient = column_c;              // dsoilT_dz of the previous cell
+
+  reuse_factorization = reuse_factorization && factorized;
+  const bool assemble = !reuse_factorization;
+
+  // coefficients of the cells of row i, in a loop of their own so that it is vectorized
+  auto row_coefficients = [&](int i) {
+    for (int c=0; c<N; c++) {
+      const int k = Index(i,c);
+      thermal_conductivity[k] = CellThermalConductivity(k, c);
+      heat_capacity[k] = CellHeatCapacity(k, c, prop);
+      lambda[k] = dt/(h1[i] * heat_capacity[k]);
+    }
+  };
+
+  // top cell
+  if (assemble)
+    row_coefficients(0);
+  for (int c=0; c<N; c++) {
+    const int k = c;
+    double surface_temp = option_top_boundary[c] == 1 ? top_boundary_temp_const[c] : ground_temp[c];
+
+    ground_heat_flux[c] = - thermal_conductivity[k] * (soil_temperature[k]  - surface_temp) / (0.5*soil_z[0]);
+    gradient[c] = 2.0 * (soil_temperature[k+N] - soil_temperature[k])/ soil_z[1];
+    double flux = thermal_conductivity[k] * gradient[c] + ground_heat_flux[c];
+    Real rhs = lambda[k] * flux;
+
+    if (assemble) {
+      Real ci = -lambda[k] * thermal_conductivity[k] * denominator[0];
+      Real bi = 1 - ci;
+      AI[k] = 0;
+      if (eliminate) {
+	pivot[k] = bi;
+	P[k] = -ci/bi;
+	tdma_failed[c] = 0;
+      }
+      else {
+	BI[k] = bi; CI[k] = ci;
+      }
+    }
+
+    if (eliminate) {
+      Q[k] = rhs/pivot[k];
+    }
+    else {
+      thermal_flux[k] = flux;
+      RHS[k] = rhs;
+    }
+  }
+
+  // interior cells
+  for (int i=1; i<last; i++) {
+    const double h2 = soil_z[i+1] - soil_z[i-1];
+    if (assemble)
+      row_coefficients(i);
+    for (int c=0; c<N; c++) {
+      const int k = Index(i,c);
+
+      double dsoilT_dz_k = 2.0 * (soil_temperature[k+N] - soil_temperature[k])/ h2;
+      double flux = thermal_conductivity[k] * dsoilT_dz_k - thermal_conductivity[k-N] * gradient[c];
+      gradient[c] = dsoilT_dz_k;
+      Real rhs = lambda[k] * flux;
+
+      if (assemble) {
+	Real ai = -lambda[k] * thermal_conductivity[k-N] * denominator[i-1];
+	Real ci = -lambda[k] * thermal_conductivity[k] * denominator[i];
+	Real bi = 1 - ai - ci;
+	AI[k] = ai;
+	if (eliminate) {
+	  Real den = bi + ai * P[k-N];
+	  tdma_failed[c] |= std::abs(den) < 1e-20;
+	  pivot[k] = den;
+	  P[k] = -ci/den;
+	}
+	else {
+	  BI[k] = bi; CI[k] = ci;
+	}
+      }
+
+      if (eliminate) {
+	Q[k] = (rhs - AI[k] * Q[k-N])/pivot[k];
+      }
+      else {
+	thermal_flux[k] = flux;
+	RHS[k] = rhs;
+      }
+    }
+  }
+
+  // bottom cell
+  if (assemble)
+    row_coefficients(last);
+  for (int c=0; c<N; c++) {
+    const int k = Index(last,c);
+    double bottomflux = 0.;
+
+    if (option_bottom_boundary[c] == 1) {
+      double dzdt = 2 * (soil_temperature[k] - bottom_boundary_temp_const[c]) / h1[last];
+      bottomflux = - thermal_conductivity[k] * dzdt;
+    }
+
+    double flux = bottomflux - thermal_conductivity[k-N] * gradient[c];
+    bottom_heat_flux[c] = bottomflux;
+    Real rhs = lambda[k] * flux;
+
+    if (assemble) {
+      Real ai = -lambda[k] * thermal_conductivity[k-N] * denominator[last-1];
+      Real ci = 0;
+      Real bi = 1 - ai;
+      AI[k] = ai;
+      if (eliminate) {
+	Real den = bi + ai * P[k-N];
+	tdma_failed[c] |= std::abs(den) < 1e-20;
+	pivot[k] = den;
+	P[k] = -ci/den;
+      }
+      else {
+	BI[k] = bi; CI[k] = ci;
+      }
+    }
+
+    if (eliminate) {
+      Q[k] = (rhs - AI[k] * Q[k-N])/pivot[k];
+    }
+    else {
+      thermal_flux[k] = flux;
+      RHS[k] = rhs;
+    }
+  }
+
+  if (assemble) {
+    coefficients_cached = true;
+    factorized = true;
+    factorizations++;
+  }
+  else {
+    factorization_reuses++;
+  }
+
+  if (!eliminate) {
+    SolverRefined();
+    return;
+  }
+
+  // backward substitution (the solution overwrites Q) and temperature update, columns with a singular
+  // system are not updated
+  for (int c=0; c<N; c++) {
+    const int k = Index(last,c);
+    soil_temperature[k] += tdma_failed[c] ? Real(0) : Q[k];
+  }
+
+  for (int i=last-1; i>=0; i--) {
+    for (int c=0; c<N; c++) {
+      const int k = Index(i,c);
+      Q[k] = P[k] * Q[k+N] + Q[k];
+      soil_temperature[k] += tdma_failed[c] ? Real(0) : Q[k];
+    }
+  }
+}
+
+
+/*
+  Mixed precision solve: the tridiagonal systems are solved in single precision (SolverTDMA) and the
+  solution is corrected by iterative refinement, the residuals and the temperature increments are computed
+  in double. The residual of cell k is evaluated from the fluxes between the cells, x - lambda (K[k-1] (x[k-1] - x)
+  + K[k] (x[k+1] - x)) with the coefficients recomputed in double, so the increments conserve energy up to
+  double rounding (AI, BI and CI rounded to single precision do not).
+*/
+template <typename Real, typename State>
+void soilfreezethaw::SoilFreezeThawBatchT<Real,State>::
+SolverRefined()
+{
+  const int N = ncolumns;
+  const int n = ncells * N;
+  const int nrefinements = 1;
+
+  for (int i=0; i<ncells; i++) {
+    for (int c=0; c<N; c++) {
+      const int k = Index(i,c);
+      rhs[k] = dt / (h1[i] * heat_capacity[k]) * thermal_flux[k];
+      increment[k] = 0.0;
+    }
+  }
+
+  for (int r=0; r<=nrefinements; r++) {
+    // residual of the current increments, the first pass solves for the right-hand side
+    for (int i=0; i<ncells; i++) {
+      for (int c=0; c<N; c++) {
+	const int k = Index(i,c);
+	double lambda = dt / (h1[i] * heat_capacity[k]);
+	double x = increment[k];
+	double flux = 0.0;
+	if (i > 0)
+	  flux += thermal_conductivity[k-N] * denominator[i-1] * (increment[k-N] - x);
+	if (i < ncells-1)
+	  flux += thermal_conductivity[k] * denominator[i] * (increment[k+N] - x);
+	RHS[k] = rhs[k] - x + lambda * flux;
+      }
+    }
+
+    SolverTDMA();
+
+    for (int k=0; k<n; k++)
+      increment[k] += RHS[k];
+  }
+
+  for (int k=0; k<n; k++)
+    soil_temperature[k] += increment[k];
+}
+
+
+/*
+  Thomas algorithm applied to all columns at once (interleaved systems, one column per SIMD lane of the
+  simd_path code path, see SolveTridiagonalBatch), the solution overwrites RHS.
+  Columns with a singular system are not updated, same as SoilFreezeThaw::SolverTDMA
+*/
+template <typename Real, typename State>
+void soilfreezethaw::SoilFreezeThawBatchT<Real,State>::
+SolverTDMA()
+{
+  SolveTridiagonalBatch(ncells, ncolumns, AI.data(), BI.data(), CI.data(), RHS.data(), RHS.data(), P.data(), Q.data(),
+			tdma_failed.data(), simd_path);
+}
+
+
+/*
+  Freezing-point depression phase change, see SoilFreezeThaw::PhaseChange
+  Each cell is handled independently; the energy consumed by the phase change is accumulated per column
+  in the same order as the single-column model (first the available energy of all cells, then the residuals).
+*/
+template <typename Real, typename State>
+void soilfreezethaw::SoilFreezeThawBatchT<Real,State>::
+PhaseChange()
+{
+  Properties prop;
+  const int N = ncolumns;
+
+  // scratch: energy of each cell available for and left after the phase change [W/m2]
+  std::vector<double> &HeatEnergy = heat_energy;
+  std::vector<double> &HeatResidual = heat_residual;
+
+  for (int i=0; i<ncells; i++) {
+    const double dz = soil_dz[i];
+
+    for (int c=0; c<N; c++) {
+      const int k = Index(i,c);
+      double T = soil_temperature[k];
+
+      double MassIce = (soil_moisture_content[k] - soil_liquid_content[k]) * dz * prop.wdensity_; // [kg/m2]
+      double MassLiq = soil_liquid_content[k] * dz * prop.wdensity_;
+      const double MassIce_c = MassIce;
+      const double soil_moisture_content_c = MassIce + MassLiq;
+
+      // SUPERCOOL is the maximum liquid water that can exist below (T - TFRZ) freezing point
+      double Supercool = 0.0;
+      if (T < prop.tfrez_) {
+	double smp = latent_heat_fusion /(prop.grav_*T) * (prop.tfrez_ - T); // [m] Soil Matrix potential
+	Supercool = smcmax[c] * math::Pow((smp/satpsi[c]), -1./b[c]);
+	Supercool = Supercool * dz * prop.wdensity_;                          // [kg/m2]
+      }
+
+      // layer freezing/melting index
+      int IndexMelt = 0;
+      if (MassIce > 0 && T > prop.tfrez_)
+	IndexMelt = 1;
+      else if (MassLiq > Supercool && T <= prop.tfrez_)
+	IndexMelt = 2;
+
+      double HE = 0.0;
+      if (IndexMelt > 0) {
+	HE = (T - prop.tfrez_) * (heat_capacity[k] * dz) / dt;
+	T  = prop.tfrez_;
+      }
+      HeatEnergy[k] = HE;
+
+      if ((IndexMelt == 1 && HE < 0) || (IndexMelt == 2 && HE > 0)) {
+	HE = 0;
+	IndexMelt = 0;
+      }
+
+      double MassPhaseChange = HE * dt / latent_heat_fusion;
+      double HEATR = 0.0;
+
+      if (IndexMelt > 0 && std::abs(HE) > 0) {
+	if (MassPhaseChange > 0)      //melting
+	  MassIce = std::max(0., MassIce_c - MassPhaseChange);
+	else if (MassPhaseChange < 0) { //freezing
+	  if (soil_moisture_content_c < Supercool)
+	    MassIce = 0;
+	  else {
+	    MassIce = std::min(soil_moisture_content_c - Supercool, MassIce_c - MassPhaseChange);
+	    MassIce = std::max(MassIce, 0.0);
+	  }
+	}
+
+	HEATR = HE - latent_heat_fusion * (MassIce_c - MassIce) / dt;
+	MassLiq = std::max(0., soil_moisture_content_c - MassIce);
+
+	if (std::abs(HEATR) > 0) {
+	  double f = dt/(heat_capacity[k] * dz);
+	  T = T + f * HEATR;
+	}
+      }
+      HeatResidual[k] = HEATR;
+
+      soil_temperature[k]      = T;
+      soil_liquid_content[k]   = MassLiq / (prop.wdensity_ * dz);
+      soil_moisture_content[k] = (MassLiq + MassIce) / (prop.wdensity_ * dz);
+      soil_ice_content[k]      = std::max(soil_moisture_content[k] - soil_liquid_content[k], State(0));
+    }
+  }
+
+  for (int c=0; c<N; c++)
+    energy_consumed[c] = 0.0;
+
+  for (int i=0; i<ncells; i++)
+    for (int c=0; c<N; c++)
+      energy_consumed[c] += HeatEnergy[Index(i,c)];
+
+  for (int i=0; i<ncells; i++)
+    for (int c=0; c<N; c++)
+      energy_consumed[c] -= HeatResidual[Index(i,c)];
+}
+
+
+/*
+  True if no cell of any column holds ice and all cells are above the freezing point, see SoilFreezeThaw::IsThawedColumn
+*/
+template <typename Real, typename State>
+bool soilfreezethaw::SoilFreezeThawBatchT<Real,State>::
+IsThawed()
+{
+  Properties prop;
+  const int n = ncells * ncolumns;
+
+  for (int c=0; c<ncolumns; c++) {
+    if (ice_fraction_scheme_bmi[c] != SoilFreezeThaw::Schaake && ice_fraction_scheme_bmi[c] != SoilFreezeThaw::Xinanjiang)
+      return false;
+  }
+
+  int thawed = 1;
+  for (int k=0; k<n; k++)
+    thawed &= (soil_temperature[k] > prop.tfrez_) & (soil_moisture_content[k] <= soil_liquid_content[k]);
+
+  return thawed;
+}
+
+/*
+  Phase change and ice fractions of a batch of thawed columns, see SoilFreezeThaw::ThawedColumnUpdate
+*/
+template <typename Real, typename State>
+void soilfreezethaw::SoilFreezeThawBatchT<Real,State>::
+ThawedUpdate()
+{
+  Properties prop;
+
+  for (int i=0; i<ncells; i++) {
+    const double dz = soil_dz[i];
+    for (int c=0; c<ncolumns; c++) {
+      const int k = Index(i,c);
+      double MassIce = (soil_moisture_content[k] - soil_liquid_content[k]) * dz * prop.wdensity_; // [kg/m2]
+      double MassLiq = soil_liquid_content[k] * dz * prop.wdensity_;
+
+      soil_liquid_content[k]   = MassLiq / (prop.wdensity_ * dz);
+      soil_moisture_content[k] = (MassLiq + MassIce) / (prop.wdensity_ * dz);
+      soil_ice_content[k]      = std::max(soil_moisture_content[k] - soil_liquid_content[k], State(0));
+    }
+  }
+
+  for (int c=0; c<ncolumns; c++) {
+    energy_consumed[c]         = 0.0;
+    ice_fraction_schaake[c]    = 0.0;
+    ice_fraction_xinanjiang[c] = 0.0;
+    soil_ice_fraction[c]       = 0.0;
+  }
+}
+
+
+/*
+  Surface runoff scheme based ice fractions, see SoilFreezeThaw::ComputeIceFraction
+*/
+template <typename Real, typename State>
+void soilfreezethaw::SoilFreezeThawBatchT<Real,State>::
+ComputeIceFraction()
+{
+  const int N = ncolumns;
+  std::vector<double> &ice_v      = column_a;
+  std::vector<double> &moisture_v = column_b;
+
+  for (int c=0; c<N; c++) {
+    ice_v[c]      = 0.0;
+    moisture_v[c] = 0.0;
+  }
+
+  for (int i=0; i<ncells; i++) {
+    for (int c=0; c<N; c++) {
+      const int k = Index(i,c);
+      moisture_v[c] += soil_moisture_content[k] * soil_dz[i];
+      ice_v[c]      += soil_ice_content[k] * soil_dz[i];
+    }
+  }
+
+  for (int c=0; c<N; c++) {
+    ice_fraction_schaake[c]    = 0.0;
+    ice_fraction_xinanjiang[c] = 0.0;
+    soil_ice_fraction[c]       = 0.0;
+
+    if (ice_fraction_scheme_bmi[c] == SoilFreezeThaw::Schaake) {
+      ice_fraction_schaake[c] = ice_v[c];
+    }
+    else if (ice_fraction_scheme_bmi[c] == SoilFreezeThaw::Xinanjiang) {
+      double fice = std::min(1.0, soil_ice_content[c]/smcmax[c]);
+      double A = 4.0; // taken from NWM SOILWATER subroutine
+      double fcr = std::max(0.0, std::exp(-A*(1.0-fice)) - std::exp(-A)) / (1.0 - std::exp(-A));
+      ice_fraction_xinanjiang[c] = fcr;
+    }
+    else {
+      throw std::runtime_error("Ice Fraction Scheme not specified either in the config file nor set by CFE BMI. Options: Schaake or Xinanjiang!");
+    }
+
+    if (moisture_v[c] > 0 && ice_v[c] > 1E-6)
+      soil_ice_fraction[c] = ice_v[c]/moisture_v[c];
+  }
+}
+
+
+/*
+  Per-column energy balance, see SoilFreezeThaw::EnergyBalanceCheck
+*/
+template <typename Real, typename State>
+void soilfreezethaw::SoilFreezeThawBatchT<Real,State>::
+EnergyBalanceCheck()
+{
+  const int N = ncolumns;
+  const double tolerance = energy_balance_tolerance;
+  const double Tref      = 273.15; // reference temperature [K]
+
+  std::vector<double> &energy_current  = column_a;
+  std::vector<double> &energy_previous = column_b;
+
+  for (int c=0; c<N; c++) {
+    energy_current[c]  = 0.0;
+    energy_previous[c] = 0.0;
+  }
+
+  for (int i=0; i<ncells; i++) {
+    for (int c=0; c<N; c++) {
+      const int k = Index(i,c);
+      energy_previous[c] += heat_capacity[k] * (soil_temperature_prev[k] - Tref) * soil_dz[i] / dt; // W/m^2
+      energy_current[c]  += heat_capacity[k] * (soil_temperature[k] - Tref) * soil_dz[i] / dt;      // W/m^2
+    }
+  }
+
+  for (int c=0; c<N; c++) {
+    double net_flux = ground_heat_flux[c] + bottom_heat_flux[c];
+    double energy_residual = energy_current[c] - energy_previous[c];
+    double energy_balance_timestep = (energy_residual + energy_consumed[c]) - net_flux;
+
+    CompensatedSum(energy_balance[c], energy_balance_compensation[c], energy_balance_timestep);
+
+    if (fabs(energy_balance[c]) > tolerance) {
+      std::stringstream errMsg;
+      errMsg << "Soil energy balance error in column " << c << ": " << energy_balance[c] << " [W/m^2]";
+      throw std::runtime_error(errMsg.str());
+    }
+  }
+}
+
+// precisions of the per-cell arrays, see soil_freeze_thaw_batch.hxx
+template class soilfreezethaw::SoilFreezeThawBatchT<double,double>;
+template class soilfreezethaw::SoilFreezeThawBatchT<float,double>;
+template class soilfreezethaw::SoilFreezeThawBatchT<float,float>;
+
+#endif
@@ -0,0 +1,312 @@
+#ifndef SFT_CHECKPOINT_STORE_CXX_INCLUDED
+#define SFT_CHECKPOINT_STORE_CXX_INCLUDED
+
+#include <cstring>
+#include <algorithm>
+#include <stdexcept>
+#include <sstream>
+#include <streambuf>
+#ifdef _WIN32
+#include <fstream>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+#include "../include/soil_freeze_thaw_checkpoint_store.hxx"
+
+namespace {
+
+  const char store_magic[8] = {'S','F','T','S','T','O','R','E'};
+  const uint32_t store_byte_order = 0x01020304;
+  const size_t header_size = 32;           // magic, byte order mark, version, entries, index offset
+  const size_t entry_min_size = 32;        // index entry with an empty id: id size, offsets, sizes, codec
+
+  // input stream over a block of memory (a mapped record), without copying it
+  struct MemoryBuffer : public std::streambuf {
+    MemoryBuffer(const char *begin, size_t size)
+    {
+      char *p = const_cast<char*>(begin);
+      setg(p, p, p + size);
+    }
+  };
+
+  template <typename T> void Put(std::string &out, const T &value)
+  {
+    out.append(reinterpret_cast<const char*>(&value), sizeof(T));
+  }
+
+  // reads a value at data + pos and advances pos, throws past the end of the index
+  template <typename T> T Get(const char *data, size_t end, size_t &pos)
+  {
+    if (pos > end || sizeof(T) > end - pos)
+      throw std::runtime_error("CheckpointStore: the index is truncated.");
+    T value;
+    std::memcpy(&value, data + pos, sizeof(T));
+    pos += sizeof(T);
+    return value;
+  }
+
+  bool EntryLess(const soilfreezethaw::CheckpointStoreEntry &a, const soilfreezethaw::CheckpointStoreEntry &b)
+  {
+    return a.id < b.id;
+  }
+
+}
+
+/*
+  Compressed record: the checkpoint as doubles XORed with the previous double (the neighbouring cell of a
+  field), coded by the number of leading zero bytes of the XOR (a 4-bit code, two per byte, for all the doubles
+  first) followed by its remaining low-order bytes; the bytes after the last whole double are copied.
+*/
+void soilfreezethaw::
+EncodeCheckpoint(const std::string &checkpoint, std::string &record)
+{
+  const size_t n = checkpoint.size();
+  const size_t nwords = n / 8;
+  const size_t ncodes = (nwords + 1) / 2;
+
+  record.assign(ncodes, '\0');
+  record.reserve(n + ncodes);
+  uint64_t previous = 0;
+  for (size_t k=0; k<nwords; k++) {
+    uint64_t word;
+    std::memcpy(&word, checkpoint.data() + 8*k, sizeof(word));
+    uint64_t delta = word ^ previous;
+    previous = word;
+
+    int zeros = 0;
+    while (zeros < 8 && (delta >> (56 - 8*zeros)) == 0)
+      zeros++;
+    record[k/2] |= char(zeros << (4 * (k%2)));
+    for (int j=0; j<8-zeros; j++)
+      record.push_back(char(delta >> (8*j)));
+  }
+  record.append(checkpoint, 8*nwords, n - 8*nwords);
+}
+
+void soilfreezethaw::
+DecodeCheckpoint(const char *record, size_t record_size, size_t size, std::string &checkpoint)
+{
+  const size_t nwords = size / 8;
+  const size_t ncodes = (nwords + 1) / 2;
+  if (record_size < ncodes)
+    throw std::runtime_error("CheckpointStore: compressed record is corrupted.");
+
+  checkpoint.resize(size);
+  size_t pos = ncodes;
+  uint64_t previous = 0;
+  for (size_t k=0; k<nwords; k++) {
+    int zeros = ((unsigned char)record[k/2] >> (4 * (k%2))) & 0xf;
+    if (zeros > 8 || pos + 8 - zeros > record_size)
+      throw std::runtime_error("CheckpointStore: compressed record is corrupted.");
+    uint64_t delta = 0;
+    for (int j=0; j<8-zeros; j++)
+      delta |= uint64_t((unsigned char)record[pos++]) << (8*j);
+    previous ^= delta;
+    std::memcpy(&checkpoint[8*k], &previous, sizeof(previous));
+  }
+  if (record_size - pos != size - 8*nwords)
+    throw std::runtime_error("CheckpointStore: compressed record is corrupted.");
+  std::copy(record + pos, record + record_size, checkpoint.begin() + 8*nwords);
+}
+
+/*
+  Writer: the header is written with no entries and completed by Close, after the index
+*/
+soilfreezethaw::CheckpointStoreWriter::
+CheckpointStoreWriter(const std::string &file, bool compress)
+  : file(file), compress(compress), end(header_size)
+{
+  this->os.open(file, std::ios::binary | std::ios::trunc);
+  if (!this->os)
+    throw std::runtime_error("CheckpointStore: " + file + " could not be created.");
+  const char header[header_size] = {};
+  this->os.write(header, header_size);
+}
+
+soilfreezethaw::CheckpointStoreWriter::
+~CheckpointStoreWriter()
+{
+  try {
+    Close();
+  }
+  catch (const std::exception &e) {}
+}
+
+void soilfreezethaw::CheckpointStoreWriter::
+Add(const std::string &id, SoilFreezeThaw &model)
+{
+  // serialization and compression by the calling thread
+  std::ostringstream checkpoint_os;
+  model.SaveCheckpoint(checkpoint_os);
+  const std::string checkpoint = checkpoint_os.str();
+
+  std::string encoded;
+  if (this->compress)
+    EncodeCheckpoint(checkpoint, encoded);
+  const bool compressed = this->compress && encoded.size() < checkpoint.size();
+  const std::string &record = compressed ? encoded : checkpoint;
+
+  std::lock_guard<std::mutex> lock(this->mutex);
+  if (!this->os.is_open())
+    throw std::runtime_error("CheckpointStore: " + this->file + " is closed.");
+  if (!this->ids.insert(id).second)
+    throw std::runtime_error("CheckpointStore: id " + id + " was already added to " + this->file + ".");
+
+  this->os.write(record.data(), record.size());
+  if (!this->os)
+    throw std::runtime_error("CheckpointStore: " + this->file + " could not be written.");
+  this->entries.push_back({id, this->end, record.size(), checkpoint.size(), int32_t(compressed)});
+  this->end += record.size();
+}
+
+void soilfreezethaw::CheckpointStoreWriter::
+Close()
+{
+  std::lock_guard<std::mutex> lock(this->mutex);
+  if (!this->os.is_open())
+    return;
+
+  std::sort(this->entries.begin(), this->entries.end(), EntryLess);
+  std::string index;
+  for (const CheckpointStoreEntry &entry : this->entries) {
+    Put(index, int32_t(entry.id.size()));
+    index.append(entry.id);
+    Put(index, entry.offset);
+    Put(index, entry.stored_size);
+    Put(index, entry.size);
+    Put(index, entry.compressed);
+  }
+  this->os.write(index.data(), index.size());
+
+  std::string header(store_magic, sizeof(store_magic));
+  Put(header, store_byte_order);
+  Put(header, int32_t(checkpoint_store_version));
+  Put(header, uint64_t(this->entries.size()));
+  Put(header, this->end);
+  this->os.seekp(0);
+  this->os.write(header.data(), header.size());
+  this->os.close();
+  if (!this->os)
+    throw std::runtime_error("CheckpointStore: " + this->file + " could not be written.");
+}
+
+/*
+  Reader: maps the file (reads it into memory on Windows), reads the header and the index (checked against the
+  size of the file)
+*/
+soilfreezethaw::CheckpointStoreReader::
+CheckpointStoreReader(const std::string &file)
+  : data(NULL), length(0)
+{
+#ifdef _WIN32
+  std::ifstream is(file, std::ios::binary);
+  if (!is)
+    throw std::runtime_error("CheckpointStore: " + file + " could not be opened.");
+  this->contents.assign(std::istreambuf_iterator<char>(is), std::istreambuf_iterator<char>());
+  if (is.bad() || this->contents.size() < header_size)
+    throw std::runtime_error("CheckpointStore: " + file + " is not a checkpoint store.");
+  this->length = this->contents.size();
+  this->data = this->contents.data();
+#else
+  int fd = open(file.c_str(), O_RDONLY);
+  if (fd < 0)
+    throw std::runtime_error("CheckpointStore: " + file + " could not be opened.");
+  struct stat st;
+  if (fstat(fd, &st) != 0 || size_t(st.st_size) < header_size) {
+    close(fd);
+    throw std::runtime_error("CheckpointStore: " + file + " is not a checkpoint store.");
+  }
+  this->length = st.st_size;
+  void *mapping = mmap(NULL, this->length, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (mapping == MAP_FAILED)
+    throw std::runtime_error("CheckpointStore: " + file + " could not be mapped.");
+  this->data = static_cast<const char*>(mapping);
+#endif
+
+  try {
+    size_t pos = sizeof(store_magic);
+    if (std::memcmp(this->data, store_magic, sizeof(store_magic)) != 0)
+      throw std::runtime_error("CheckpointStore: " + file + " is not a checkpoint store.");
+    if (Get<uint32_t>(this->data, this->length, pos) != store_byte_order)
+      throw std::runtime_error("CheckpointStore: " + file + " was written on a machine of different byte order.");
+    int32_t version = Get<int32_t>(this->data, this->length, pos);
+    if (version != checkpoint_store_version)
+      throw std::runtime_error("CheckpointStore: version " + std::to_string(version) + " of " + file
+			       + " is not supported.");
+    uint64_t count = Get<uint64_t>(this->data, this->length, pos);
+    pos = Get<uint64_t>(this->data, this->length, pos);
+    if (pos < header_size)
+      throw std::runtime_error("CheckpointStore: " + file + " was not closed (no index).");
+    if (pos > this->length || count > (this->length - pos) / entry_min_size)
+      throw std::runtime_error("CheckpointStore: the index is truncated.");
+
+    this->entries.resize(count);
+    for (CheckpointStoreEntry &entry : this->entries) {
+      int32_t id_size = Get<int32_t>(this->data, this->length, pos);
+      if (id_size < 0 || size_t(id_size) > this->length - pos)
+	throw std::runtime_error("CheckpointStore: the index is truncated.");
+      entry.id.assign(this->data + pos, id_size);
+      pos += id_size;
+      entry.offset      = Get<uint64_t>(this->data, this->length, pos);
+      entry.stored_size = Get<uint64_t>(this->data, this->length, pos);
+      entry.size        = Get<uint64_t>(this->data, this->length, pos);
+      entry.compressed  = Get<int32_t>(this->data, this->length, pos);
+      if (entry.offset < header_size || entry.offset > this->length
+	  || entry.stored_size > this->length - entry.offset || (!entry.compressed && entry.stored_size != entry.size))
+	throw std::runtime_error("CheckpointStore: record " + entry.id + " is outside of " + file + ".");
+    }
+  }
+  catch (...) {
+#ifndef _WIN32
+    munmap(const_cast<char*>(this->data), this->length);
+#endif
+    throw;
+  }
+}
+
+soilfreezethaw::CheckpointStoreReader::
+~CheckpointStoreReader()
+{
+#ifndef _WIN32
+  munmap(const_cast<char*>(this->data), this->length);
+#endif
+}
+
+const soilfreezethaw::CheckpointStoreEntry* soilfreezethaw::CheckpointStoreReader::
+Find(const std::string &id) const
+{
+  CheckpointStoreEntry key;
+  key.id = id;
+  auto it = std::lower_bound(this->entries.begin(), this->entries.end(), key, EntryLess);
+  return it != this->entries.end() && it->id == id ? &*it : NULL;
+}
+
+bool soilfreezethaw::CheckpointStoreReader::
+Contains(const std::string &id) const
+{
+  return Find(id) != NULL;
+}
+
+void soilfreezethaw::CheckpointStoreReader::
+Restore(const std::string &id, SoilFreezeThaw &model) const
+{
+  const CheckpointStoreEntry *entry = Find(id);
+  if (entry == NULL)
+    throw std::runtime_error("CheckpointStore: id " + id + " is not in the store.");
+
+  const char *record = this->data + entry->offset;
+  std::string decoded;
+  if (entry->compressed) {
+    DecodeCheckpoint(record, entry->stored_size, entry->size, decoded);
+    record = decoded.data();
+  }
+  MemoryBuffer buffer(record, entry->size);
+  std::istream is(&buffer);
+  model.RestoreCheckpoint(is);
+}
+
+#endif
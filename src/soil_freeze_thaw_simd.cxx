@@ -0,0 +1,68 @@
+#ifndef SFT_SIMD_CXX_INCLUDED
+#define SFT_SIMD_CXX_INCLUDED
+
+#include <cstdlib>
+#include <stdexcept>
+#include <string>
+#include "../include/soil_freeze_thaw_simd.hxx"
+
+const char *soilfreezethaw::
+SimdPathName(SimdPath path)
+{
+  switch (path) {
+  case SimdPath::SSE2:   return "sse2";
+  case SimdPath::AVX2:   return "avx2";
+  case SimdPath::AVX512: return "avx512";
+  default:               return "scalar";
+  }
+}
+
+bool soilfreezethaw::
+IsSupported(SimdPath path)
+{
+#ifdef SFT_X86_SIMD
+  switch (path) {
+  case SimdPath::SSE2:   return __builtin_cpu_supports("sse2");
+  case SimdPath::AVX2:   return __builtin_cpu_supports("avx2");
+  case SimdPath::AVX512: return __builtin_cpu_supports("avx512f");
+  default:               return true;
+  }
+#else
+  return path == SimdPath::Scalar;
+#endif
+}
+
+soilfreezethaw::SimdPath soilfreezethaw::
+BestSimdPath()
+{
+  static const SimdPath best = IsSupported(SimdPath::AVX512) ? SimdPath::AVX512
+                             : IsSupported(SimdPath::AVX2)   ? SimdPath::AVX2
+                             : IsSupported(SimdPath::SSE2)   ? SimdPath::SSE2 : SimdPath::Scalar;
+  return best;
+}
+
+soilfreezethaw::SimdPath soilfreezethaw::
+ParseSimdPath(const std::string &name)
+{
+  if (name == "auto")
+    return BestSimdPath();
+
+  const SimdPath paths[4] = {SimdPath::Scalar, SimdPath::SSE2, SimdPath::AVX2, SimdPath::AVX512};
+  for (SimdPath path : paths) {
+    if (name != SimdPathName(path))
+      continue;
+    if (!IsSupported(path))
+      throw std::runtime_error("simd_path: " + name + " is not supported by this CPU!");
+    return path;
+  }
+  throw std::runtime_error("simd_path should be auto, scalar, sse2, avx2 or avx512, provided: " + name);
+}
+
+soilfreezethaw::SimdPath soilfreezethaw::
+SelectSimdPath(const std::string &requested)
+{
+  const char *forced = std::getenv("SFT_SIMD_PATH");
+  return ParseSimdPath(forced != NULL && forced[0] != '\0' ? std::string(forced) : requested);
+}
+
+#endif
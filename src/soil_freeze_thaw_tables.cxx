@@ -0,0 +1,234 @@
+#ifndef SFT_TABLES_CXX_INCLUDED
+#define SFT_TABLES_CXX_INCLUDED
+
+#include <cstring>
+#include <cmath>
+#include <map>
+#include <mutex>
+#include <tuple>
+#include <algorithm>
+#include <stdexcept>
+#include "../include/soil_freeze_thaw.hxx"
+#include "../include/soil_freeze_thaw_tables.hxx"
+#include "../include/soil_freeze_thaw_math.hxx"
+
+namespace {
+
+  using soilfreezethaw::ConstitutiveTables;
+
+  uint64_t Bits(double x)     { uint64_t u; std::memcpy(&u, &x, sizeof(u)); return u; }
+  double   Double(uint64_t u) { double x; std::memcpy(&x, &u, sizeof(x)); return x; }
+
+  /* samples f on the nodes of an octave table covering [x_first, x_end] with resolution nodes per octave */
+  template <typename F>
+  int BuildOctaveTable(ConstitutiveTables::OctaveTable &t, double x_first, double x_end, int resolution, F f)
+  {
+    int m = 0;
+    while ((1 << m) < resolution)
+      m++;
+    t.shift = 52 - m;
+
+    const uint64_t mask = (1ULL << t.shift) - 1;
+    uint64_t first = Bits(x_first) & ~mask;           // first node at or below x_first
+    uint64_t end   = (Bits(x_end) + mask) & ~mask;    // last node at or above x_end
+    int n = (int)((end - first) >> t.shift);
+
+    t.base    = first;
+    t.x_first = Double(first);
+    t.x_last  = Double(end - 1);
+    t.coef.assign(2 * n, 0.0);
+
+    double x0 = Double(first), y0 = f(x0);
+    for (int j=0; j<n; j++) {
+      double x1 = Double(first + ((uint64_t)(j+1) << t.shift));
+      double y1 = f(x1);
+      t.coef[2*j]   = y0;
+      t.coef[2*j+1] = (y1 - y0) / (x1 - x0);
+      x0 = x1;
+      y0 = y1;
+    }
+    return n;
+  }
+
+  /* samples f on n uniform intervals of [x_first, x_end] */
+  template <typename F>
+  int BuildUniformTable(ConstitutiveTables::UniformTable &t, double x_first, double x_end, int n, F f)
+  {
+    t.x_first = x_first;
+    t.x_last  = x_end;
+    t.h       = (x_end - x_first) / n;
+    t.inv_h   = 1.0 / t.h;
+    t.n       = n;
+    t.coef.assign(2 * n, 0.0);
+
+    double x0 = x_first, y0 = f(x0);
+    for (int j=0; j<n; j++) {
+      double x1 = x_first + (j+1) * t.h;
+      double y1 = f(x1);
+      t.coef[2*j]   = y0;
+      t.coef[2*j+1] = (y1 - y0) / (x1 - x0);
+      x0 = x1;
+      y0 = y1;
+    }
+    return n;
+  }
+
+  /* largest error of the table t against f over [x_lo, x_hi], 8 samples per interval of the grid nodes */
+  template <typename T, typename F>
+  double MaxError(const T &t, const std::vector<double> &nodes, double x_lo, double x_hi, F f)
+  {
+    double error = 0.0;
+    for (size_t j=0; j+1<nodes.size(); j++) {
+      for (int k=0; k<8; k++) {
+	double x = nodes[j] + (nodes[j+1] - nodes[j]) * k / 8.0;
+	if (x >= x_lo && x <= x_hi)
+	  error = std::max(error, std::fabs(t(x) - f(x)));
+      }
+    }
+    return error;
+  }
+
+  std::vector<double> Nodes(const ConstitutiveTables::OctaveTable &t)
+  {
+    std::vector<double> nodes(t.coef.size()/2 + 1);
+    for (size_t j=0; j<nodes.size(); j++)
+      nodes[j] = Double(t.base + ((uint64_t)j << t.shift));
+    return nodes;
+  }
+
+  std::vector<double> Nodes(const ConstitutiveTables::UniformTable &t)
+  {
+    std::vector<double> nodes(t.n + 1);
+    for (int j=0; j<=t.n; j++)
+      nodes[j] = t.x_first + j * t.h;
+    return nodes;
+  }
+
+  /* registry of the tables in use, one entry per parameter set */
+  std::mutex &RegistryMutex()
+  {
+    static std::mutex registry_mutex;
+    return registry_mutex;
+  }
+
+  std::map<ConstitutiveTables::Key, std::weak_ptr<const ConstitutiveTables> > &Registry()
+  {
+    static std::map<ConstitutiveTables::Key, std::weak_ptr<const ConstitutiveTables> > registry;
+    return registry;
+  }
+
+  long registry_builds = 0;                // tables built by Get, guarded by RegistryMutex
+}
+
+
+bool soilfreezethaw::ConstitutiveTables::Key::
+operator<(const Key &k) const
+{
+  return std::tie(smcmax, b, satpsi, quartz, latent_heat_fusion, resolution)
+    < std::tie(k.smcmax, k.b, k.satpsi, k.quartz, k.latent_heat_fusion, k.resolution);
+}
+
+bool soilfreezethaw::ConstitutiveTables::
+IsValidResolution(int resolution)
+{
+  return resolution >= 8 && resolution <= 4096 && (resolution & (resolution - 1)) == 0;
+}
+
+/*
+  Builds the tables from the analytic curves of PhaseChange() and ThermalConductivity() and measures their
+  largest errors
+*/
+soilfreezethaw::ConstitutiveTables::
+ConstitutiveTables(const Key &key)
+{
+  if (!IsValidResolution(key.resolution))
+    throw std::runtime_error("constitutive_table_resolution should be a power of two between 8 and 4096!");
+
+  Properties prop;
+  this->key = key;
+
+  const double tfrez  = prop.tfrez_;
+  const double grav   = prop.grav_;
+  const double smcmax = key.smcmax;
+  const double satpsi = key.satpsi;
+  const double lam    = -1./key.b;
+  const double lhf    = key.latent_heat_fusion;
+
+  // supercooled liquid water vs the supercooling, from the supercooling where it equals smcmax (the soil
+  // matric potential equals satpsi) down to T = 17 K
+  auto supercool_f = [=](double supercooling) {
+    double T = tfrez - supercooling;
+    double smp = lhf /(grav*T) * supercooling;
+    return smcmax * math::Pow(smp/satpsi, lam);
+  };
+  double supercooling_first = satpsi * grav * tfrez / (lhf + satpsi * grav);
+  BuildOctaveTable(supercool, supercooling_first, 256.0, key.resolution, supercool_f);
+
+  // saturated thermal conductivity vs the unfrozen volume, solids part as in UpdateInvariants
+  const double tcwater   = 0.57;
+  const double tcice     = 2.2;
+  const double tcmineral = key.quartz > 0.2 ? 2.0 : 3.0;
+  const double tc_solid  = pow(7.7, key.quartz) * pow(tcmineral, (1. - key.quartz));
+  const double tc_solid_sat = pow(tc_solid, (1. - smcmax));
+  auto tc_sat_f = [=](double xu) {
+    return tc_solid_sat * math::Pow(tcice, (smcmax - xu)) * math::Pow(tcwater, xu);
+  };
+  BuildUniformTable(tc_sat, 0.0, smcmax, key.resolution, tc_sat_f);
+
+  // log10 of the saturation ratio, the Kersten number is zero below 0.05
+  auto log_sat_f = [](double sat_ratio) { return math::Log10(sat_ratio); };
+  BuildOctaveTable(log_sat, 0.03125, 2.0, key.resolution, log_sat_f);
+
+  error_supercool = MaxError(supercool, Nodes(supercool), 0.0, 100.0, supercool_f);
+  error_tc_sat    = MaxError(tc_sat, Nodes(tc_sat), 0.0, smcmax, tc_sat_f);
+  error_log_sat   = MaxError(log_sat, Nodes(log_sat), 0.05, 1.0, log_sat_f);
+}
+
+std::shared_ptr<const soilfreezethaw::ConstitutiveTables> soilfreezethaw::ConstitutiveTables::
+Get(const Key &key, std::ostream *report)
+{
+  std::lock_guard<std::mutex> lock(RegistryMutex());
+
+  std::weak_ptr<const ConstitutiveTables> &entry = Registry()[key];
+  std::shared_ptr<const ConstitutiveTables> tables = entry.lock();
+  if (tables)
+    return tables;
+
+  tables = std::make_shared<const ConstitutiveTables>(key);
+  entry = tables;
+  registry_builds++;
+
+  if (report) {
+    *report<<"Constitutive tables (smcmax = "<<key.smcmax<<", b = "<<key.b<<", satpsi = "<<key.satpsi
+	   <<", quartz = "<<key.quartz<<", resolution = "<<key.resolution<<"): "
+	   <<tables->supercool.coef.size()/2 + tables->tc_sat.coef.size()/2 + tables->log_sat.coef.size()/2
+	   <<" intervals, max error supercooled water [-] = "<<tables->error_supercool
+	   <<", saturated thermal conductivity [W/(mK)] = "<<tables->error_tc_sat
+	   <<", Kersten number [-] = "<<tables->error_log_sat<<"\n";
+  }
+  return tables;
+}
+
+long soilfreezethaw::ConstitutiveTables::
+BuildCount()
+{
+  std::lock_guard<std::mutex> lock(RegistryMutex());
+  return registry_builds;
+}
+
+int soilfreezethaw::ConstitutiveTables::
+RegistrySize()
+{
+  std::lock_guard<std::mutex> lock(RegistryMutex());
+
+  auto &registry = Registry();
+  for (auto it = registry.begin(); it != registry.end(); ) {
+    if (it->second.expired())
+      it = registry.erase(it);
+    else
+      ++it;
+  }
+  return (int)registry.size();
+}
+
+#endif
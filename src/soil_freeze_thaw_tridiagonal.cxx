@@ -0,0 +1,569 @@
+#ifndef SFT_TRIDIAGONAL_CXX_INCLUDED
+#define SFT_TRIDIAGONAL_CXX_INCLUDED
+
+#include <cmath>
+#include <algorithm>
+#include <functional>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include "../include/soil_freeze_thaw_tridiagonal.hxx"
+
+/*
+  Threads of the partitioned solves: workers wait for a task, the calling thread runs its share (t = 0) and
+  waits for the workers to finish theirs
+*/
+struct soilfreezethaw::PartitionedTridiagonal::Team {
+  std::vector<std::thread> workers;
+  std::mutex mutex;
+  std::condition_variable start, done;
+  std::function<void(int)> task;
+  unsigned long generation;
+  int  pending;
+  bool quit;
+
+  explicit Team(int nworkers) : generation(0), pending(0), quit(false)
+  {
+    for (int t=1; t<=nworkers; t++)
+      workers.emplace_back([this, t]() { Work(t); });
+  }
+
+  ~Team()
+  {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      quit = true;
+    }
+    start.notify_all();
+    for (auto &w : workers)
+      w.join();
+  }
+
+  void Work(int t)
+  {
+    unsigned long seen = 0;
+    std::unique_lock<std::mutex> lock(mutex);
+    while (true) {
+      start.wait(lock, [&]() { return quit || generation != seen; });
+      if (quit)
+	return;
+      seen = generation;
+      lock.unlock();
+      task(t);
+      lock.lock();
+      if (--pending == 0)
+	done.notify_one();
+    }
+  }
+
+  void Run(const std::function<void(int)> &f)
+  {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      task    = f;
+      pending = (int)workers.size();
+      generation++;
+    }
+    start.notify_all();
+    f(0);
+    std::unique_lock<std::mutex> lock(mutex);
+    done.wait(lock, [&]() { return pending == 0; });
+  }
+};
+
+soilfreezethaw::PartitionedTridiagonal::
+PartitionedTridiagonal() : n(0), partitions(0), rows(0), threads(1), simd_path(BestSimdPath())
+{}
+
+soilfreezethaw::PartitionedTridiagonal::
+~PartitionedTridiagonal()
+{}
+
+void soilfreezethaw::PartitionedTridiagonal::
+SetThreads(int threads)
+{
+  if (threads < 1)
+    throw std::runtime_error("partitioned_solver_threads should be at least 1!");
+
+  if (threads != this->threads)
+    team.reset(threads > 1 ? new Team(threads - 1) : NULL);
+  this->threads = threads;
+  this->n = 0; // the partitions depend on the number of threads, factorize again
+}
+
+void soilfreezethaw::PartitionedTridiagonal::
+SetSimdPath(SimdPath path)
+{
+  if (!IsSupported(path))
+    throw std::runtime_error(std::string("partitioned tridiagonal solver: ") + SimdPathName(path)
+			     + " is not supported by this CPU!");
+  this->simd_path = path;
+}
+
+/*
+  Runs task(j0, j1) on the partitions [j0, j1) of each thread; the shares are multiples of lanes
+*/
+template <typename Task>
+void soilfreezethaw::PartitionedTridiagonal::
+Run(const Task &task)
+{
+  const int p = partitions;
+  if (!team || p < 2 * lanes) {
+    task(0, p);
+    return;
+  }
+
+  int share = ((p + threads - 1) / threads + lanes - 1) / lanes * lanes;
+  team->Run([&](int t) {
+    int j0 = std::min(p, t * share);
+    int j1 = std::min(p, j0 + share);
+    if (j0 < j1)
+      task(j0, j1);
+  });
+}
+
+/*
+  Forward elimination of the interiors of partitions [j0, j1) and their spikes, pivot_ok[j] is cleared if
+  partition j is singular; rows past n are identity rows
+*/
+SFT_ALWAYS_INLINE void soilfreezethaw::PartitionedTridiagonal::
+FactorLoops(int j0, int j1, const double *a, const double *b, const double *c)
+{
+  const int p = partitions;
+  const int s = rows;
+  const int m = s - 1;
+
+  auto coef_a = [&](int g) { return g > 0 && g < n ? a[g] : 0.0; };
+  auto coef_b = [&](int g) { return g < n ? b[g] : 1.0; };
+  auto coef_c = [&](int g) { return g < n-1 ? c[g] : 0.0; };
+
+  // row r of partition j; spikes: T v = -a_first e_1 (V_prev = 1 carries -a_first into the first row),
+  // T w = -c_last e_m
+  auto row = [&](int r, int j, double a_g, double b_g, double c_g) {
+    const int k = r * p + j;
+    const double P_prev = r > 0 ? P[k-p] : 0.0;
+    const double V_prev = r > 0 ? V[k-p] : 1.0;
+    const double den = b_g + a_g * P_prev;
+    pivot_ok[j] &= !(std::abs(den) < 1e-20);
+    A[k] = a_g;
+    inv_pivot[k] = 1.0 / den;
+    P[k] = -c_g * inv_pivot[k];
+    V[k] = -a_g * V_prev * inv_pivot[k];
+    W[k] = r == m-1 ? P[k] : 0.0;
+  };
+
+  // the first row of the system and the rows of the last partition (rows past n) are checked, the other
+  // rows are read directly
+  const int j_inner = std::min(j1, p - 1);
+  for (int r=0; r<m; r++) {
+    for (int j=j0; j<j_inner; j++) {
+      const int g = j * s + r;
+      row(r, j, g > 0 ? a[g] : 0.0, b[g], c[g]);
+    }
+    if (j1 == p)
+      row(r, p-1, coef_a((p-1) * s + r), coef_b((p-1) * s + r), coef_c((p-1) * s + r));
+  }
+
+  for (int r=m-2; r>=0; r--) {
+    for (int j=j0; j<j1; j++) {
+      const int k = r * p + j;
+      V[k] += P[k] * V[k+p];
+      W[k]  = P[k] * W[k+p];
+    }
+  }
+
+  for (int j=j0; j<j1; j++) {
+    const int g = j * s + m;
+    a_z[j] = coef_a(g);
+    b_z[j] = coef_b(g);
+    c_z[j] = coef_c(g);
+  }
+}
+
+/*
+  Forward and backward substitution of the interiors of partitions [j0, j1): Y = T_j^-1 d_j
+*/
+SFT_ALWAYS_INLINE void soilfreezethaw::PartitionedTridiagonal::
+SubstituteLoops(int j0, int j1, const double *d)
+{
+  const int p = partitions;
+  const int s = rows;
+  const int m = s - 1;
+
+  for (int j=j0; j<j1; j++)
+    Y[j] = d[j * s] * inv_pivot[j];
+
+  for (int r=1; r<m; r++) {
+    const double *dr = d + r;
+    double *y = Y.data() + r * p;
+    const double *a = A.data() + r * p;
+    const double *inv = inv_pivot.data() + r * p;
+    for (int j=j0; j<j1; j++)
+      y[j] = (dr[j * s] - a[j] * y[j-p]) * inv[j];
+  }
+
+  for (int r=m-2; r>=0; r--) {
+    double *y = Y.data() + r * p;
+    const double *P_r = P.data() + r * p;
+    for (int j=j0; j<j1; j++)
+      y[j] += P_r[j] * y[j+p];
+  }
+}
+
+/*
+  Solution of partitions [j0, j1) from the interface unknowns, x = y + z_j-1 v + z_j w, written to x (p*s rows)
+*/
+SFT_ALWAYS_INLINE void soilfreezethaw::PartitionedTridiagonal::
+UpdateLoops(int j0, int j1, double *x)
+{
+  const int p = partitions;
+  const int s = rows;
+  const int m = s - 1;
+
+  for (int r=0; r<m; r++) {
+    const double *y = Y.data() + r * p;
+    const double *v = V.data() + r * p;
+    const double *w = W.data() + r * p;
+    double *xr = x + r;
+    for (int j=j0; j<j1; j++)
+      xr[j * s] = y[j] + v[j] * z[j] + w[j] * z[j+1];
+  }
+  for (int j=j0; j<j1; j++)
+    x[j * s + m] = z[j+1];
+}
+
+/*
+  Variants of the loops over the partitions: the baseline build, and the AVX2 and AVX-512 builds of the same
+  loops (see soil_freeze_thaw_simd.hxx)
+*/
+template <soilfreezethaw::SimdPath Path>
+void soilfreezethaw::PartitionedTridiagonal::
+FactorPartitions(int j0, int j1, const double *a, const double *b, const double *c)
+{
+  FactorLoops(j0, j1, a, b, c);
+}
+
+template <soilfreezethaw::SimdPath Path>
+void soilfreezethaw::PartitionedTridiagonal::
+SubstitutePartitions(int j0, int j1, const double *d)
+{
+  SubstituteLoops(j0, j1, d);
+}
+
+template <soilfreezethaw::SimdPath Path>
+void soilfreezethaw::PartitionedTridiagonal::
+UpdatePartitions(int j0, int j1, double *X)
+{
+  UpdateLoops(j0, j1, X);
+}
+
+#ifdef SFT_X86_SIMD
+#define SFT_PARTITION_LOOPS(Path, isa)							\
+  template <> SFT_TARGET(isa) void soilfreezethaw::PartitionedTridiagonal::			\
+  FactorPartitions<soilfreezethaw::SimdPath::Path>(int j0, int j1, const double *a, const double *b, const double *c) \
+  {											\
+    FactorLoops(j0, j1, a, b, c);							\
+  }											\
+  template <> SFT_TARGET(isa) void soilfreezethaw::PartitionedTridiagonal::			\
+  SubstitutePartitions<soilfreezethaw::SimdPath::Path>(int j0, int j1, const double *d)	\
+  {											\
+    SubstituteLoops(j0, j1, d);								\
+  }											\
+  template <> SFT_TARGET(isa) void soilfreezethaw::PartitionedTridiagonal::			\
+  UpdatePartitions<soilfreezethaw::SimdPath::Path>(int j0, int j1, double *X)		\
+  {											\
+    UpdateLoops(j0, j1, X);								\
+  }
+
+SFT_PARTITION_LOOPS(AVX2,   "avx2")
+SFT_PARTITION_LOOPS(AVX512, "avx512f")
+#undef SFT_PARTITION_LOOPS
+#endif
+
+/*
+  Run for the variant of simd_path: task(path, j0, j1), path is a std::integral_constant of the SimdPath
+*/
+template <typename Task>
+void soilfreezethaw::PartitionedTridiagonal::
+RunPartitions(const Task &task)
+{
+  switch (simd_path) {
+#ifdef SFT_X86_SIMD
+  case SimdPath::AVX512:
+    Run([&](int j0, int j1) { task(std::integral_constant<SimdPath, SimdPath::AVX512>(), j0, j1); });
+    break;
+  case SimdPath::AVX2:
+    Run([&](int j0, int j1) { task(std::integral_constant<SimdPath, SimdPath::AVX2>(), j0, j1); });
+    break;
+#endif
+  default:
+    Run([&](int j0, int j1) { task(std::integral_constant<SimdPath, SimdPath::Scalar>(), j0, j1); });
+  }
+}
+
+bool soilfreezethaw::PartitionedTridiagonal::
+Factor(int n, const double *a, const double *b, const double *c)
+{
+  // partitions: 2 * lanes per thread (independent chains to overlap in each SIMD lane), fewer for short
+  // systems (at least min_rows rows each), more for long systems (at most max_rows rows each, the strided
+  // accesses to the right-hand side stay within the L1 cache)
+  int p = 2 * lanes * threads;
+  int p_max = n / min_rows;
+  int p_min = ((n + max_rows - 1) / max_rows + lanes - 1) / lanes * lanes;
+  if (p > p_max)
+    p = p_max >= lanes ? p_max / lanes * lanes : std::max(p_max, 1);
+  else if (p < p_min)
+    p = p_min;
+
+  // rows per partition, then the partitions that cover n: with s rounded up, p partitions of s rows may reach
+  // past n by more than one partition (e.g. n = 1281, p = 40, s = 33), only the last partition is padded
+  const int s = std::max((n + p - 1) / p, 2);
+  const int m = s - 1;
+  p = (n + s - 1) / s;
+
+  this->n = n;
+  this->partitions = p;
+  this->rows = s;
+
+  A.resize(m * p);
+  inv_pivot.resize(m * p);
+  P.resize(m * p);
+  V.resize(m * p);
+  W.resize(m * p);
+  Y.resize(m * p);
+  D.resize(p * s);
+  a_z.resize(p);
+  b_z.resize(p);
+  c_z.resize(p);
+  ra.resize(p);
+  rP.resize(p);
+  r_inv_pivot.resize(p);
+  z.assign(p + 1, 0.0);
+  pivot_ok.assign(p, 1);
+
+  RunPartitions([&](auto path, int j0, int j1) { FactorPartitions<decltype(path)::value>(j0, j1, a, b, c); });
+  bool ok = std::find(pivot_ok.begin(), pivot_ok.end(), 0) == pivot_ok.end();
+
+  // reduced system of the interface rows: x at the neighbours of row j*s+m are expressed with the spikes
+  //   (a_z v_m-1,j) z_j-1 + (b_z + a_z w_m-1,j + c_z v_0,j+1) z_j + (c_z w_0,j+1) z_j+1 = rhs_j
+  double P_prev = 0.0;
+  for (int j=0; j<p; j++) {
+    const int last = (m - 1) * p + j;
+    double rb = b_z[j] + a_z[j] * W[last] + (j < p-1 ? c_z[j] * V[j+1] : 0.0);
+    double rc = j < p-1 ? c_z[j] * W[j+1] : 0.0;
+    ra[j] = a_z[j] * V[last];
+
+    double den = rb + ra[j] * P_prev;
+    ok &= !(std::abs(den) < 1e-20);
+    r_inv_pivot[j] = 1.0 / den;
+    rP[j] = -rc / den;
+    P_prev = rP[j];
+  }
+
+  return ok;
+}
+
+/*
+  Solves the partitions, the reduced system (calling thread) and updates the partitions
+*/
+void soilfreezethaw::PartitionedTridiagonal::
+Solve(const double *d, double *X)
+{
+  const int p = partitions;
+  const int s = rows;
+  const int m = s - 1;
+
+  // right-hand side padded to p*s rows, overwritten by the solution
+  std::copy(d, d + n, D.begin());
+  std::fill(D.begin() + n, D.end(), 0.0);
+
+  RunPartitions([&](auto path, int j0, int j1) { SubstitutePartitions<decltype(path)::value>(j0, j1, D.data()); });
+
+  // reduced system of the interface unknowns, Thomas algorithm
+  double q = 0.0;
+  for (int j=0; j<p; j++) {
+    double rhs = D[j * s + m] - a_z[j] * Y[(m-1) * p + j] - (j < p-1 ? c_z[j] * Y[j+1] : 0.0);
+    q = (rhs - ra[j] * q) * r_inv_pivot[j];
+    z[j+1] = q;
+  }
+  for (int j=p-2; j>=0; j--)
+    z[j+1] += rP[j] * z[j+2];
+
+  RunPartitions([&](auto path, int j0, int j1) { UpdatePartitions<decltype(path)::value>(j0, j1, D.data()); });
+  std::copy(D.begin(), D.begin() + n, X);
+}
+
+/*
+  Batched Thomas algorithm, see SolveTridiagonalBatch
+*/
+namespace {
+
+  /* smallest magnitude of a regular pivot: |den| < 1e-20 (in double) is singular; in single precision the
+     comparison with the next float above float(1e-20) gives the same result as with the double 1e-20 */
+  inline double TinyPivot(double) { return 1.0e-20; }
+  inline float  TinyPivot(float)  { return std::nextafter(1.0e-20f, 1.0f); }
+
+  /* systems [c0, c1) of the batch, one system after the other */
+  template <typename Real>
+  int ThomasScalar(int n, int N, int c0, int c1, const Real *a, const Real *b, const Real *c, const Real *d,
+		   Real *X, Real *P, Real *Q, int *failed)
+  {
+    const Real tiny = TinyPivot(Real());
+    int nfailed = 0;
+
+    for (int s=c0; s<c1; s++) {
+      Real den = b[s];
+      P[s] = -c[s]/den;
+      Q[s] = d[s]/den;
+      int fail = 0;
+
+      for (int i=1; i<n; i++) {
+	const int k = i * N + s;
+	den = b[k] + a[k] * P[k-N];
+	fail |= (den < tiny) & (den > -tiny);
+	P[k] = -c[k]/den;
+	Q[k] = (d[k] - a[k] * Q[k-N])/den;
+      }
+
+      X[(n-1) * N + s] = Q[(n-1) * N + s];
+      for (int i=n-2; i>=0; i--) {
+	const int k = i * N + s;
+	X[k] = P[k] * X[k+N] + Q[k];
+      }
+
+      if (fail) {
+	for (int i=0; i<n; i++)
+	  X[i * N + s] = Real(0);
+      }
+      failed[s] = fail;
+      nfailed += fail;
+    }
+    return nfailed;
+  }
+
+#ifdef SFT_X86_SIMD
+  /* vector of W values (GCC vector extensions, unaligned loads/stores) and the mask of its comparisons */
+  template <typename Real, int W> struct Lanes;
+  template <int W> struct Lanes<double,W> {
+    typedef double    V __attribute__((vector_size(8*W), aligned(8), may_alias));
+    typedef long long M __attribute__((vector_size(8*W), aligned(8), may_alias));
+  };
+  template <int W> struct Lanes<float,W> {
+    typedef float V __attribute__((vector_size(4*W), aligned(4), may_alias));
+    typedef int   M __attribute__((vector_size(4*W), aligned(4), may_alias));
+  };
+
+  /* Thomas algorithm of the systems [c0, c0+W), the operations of ThomasScalar on vectors. Inlined into the
+     entry points of the paths below, where it is compiled for their instruction set. */
+  template <typename Real, int W>
+  SFT_ALWAYS_INLINE int ThomasLanes(int n, int N, int c0, const Real *a, const Real *b, const Real *c,
+				    const Real *d, Real *X, Real *P, Real *Q, int *failed)
+  {
+    typedef typename Lanes<Real,W>::V V;
+    typedef typename Lanes<Real,W>::M M;
+    const Real tiny = TinyPivot(Real());
+
+    V den = *(const V*)(b + c0);
+    V p   = -*(const V*)(c + c0)/den;
+    V q   = *(const V*)(d + c0)/den;
+    M fail = M();       // all lanes false
+    *(V*)(P + c0) = p;
+    *(V*)(Q + c0) = q;
+
+    for (int i=1; i<n; i++) {
+      const int k = i * N + c0;
+      const V ak = *(const V*)(a + k);
+      den  = *(const V*)(b + k) + ak * p;
+      fail |= (den < tiny) & (den > -tiny);
+      p = -*(const V*)(c + k)/den;
+      q = (*(const V*)(d + k) - ak * q)/den;
+      *(V*)(P + k) = p;
+      *(V*)(Q + k) = q;
+    }
+
+    V x = q;
+    *(V*)(X + (n-1) * N + c0) = x;
+    for (int i=n-2; i>=0; i--) {
+      const int k = i * N + c0;
+      x = *(const V*)(P + k) * x + *(const V*)(Q + k);
+      *(V*)(X + k) = x;
+    }
+
+    int nfailed = 0;
+    for (int l=0; l<W; l++) {
+      failed[c0 + l] = fail[l] != 0;
+      nfailed += fail[l] != 0;
+    }
+    if (nfailed > 0) {
+      for (int i=0; i<n; i++) {
+	M *xi = (M*)(X + i * N + c0);
+	*xi &= ~fail;
+      }
+    }
+    return nfailed;
+  }
+
+  /* entry points of the vector paths: W lanes per vector, the remaining systems with the scalar loop */
+#define SFT_THOMAS_PATH(name, isa, Real, W)						\
+  SFT_TARGET(isa)								\
+  int name(int n, int N, const Real *a, const Real *b, const Real *c, const Real *d, Real *X, Real *P, Real *Q, \
+	   int *failed)									\
+  {											\
+    int nfailed = 0;									\
+    int c0 = 0;										\
+    for (; c0+W<=N; c0+=W)								\
+      nfailed += ThomasLanes<Real,W>(n, N, c0, a, b, c, d, X, P, Q, failed);		\
+    return nfailed + ThomasScalar<Real>(n, N, c0, N, a, b, c, d, X, P, Q, failed);	\
+  }
+
+  SFT_THOMAS_PATH(ThomasSSE2,   "sse2",    double, 2)
+  SFT_THOMAS_PATH(ThomasSSE2,   "sse2",    float,  4)
+  SFT_THOMAS_PATH(ThomasAVX2,   "avx2",    double, 4)
+  SFT_THOMAS_PATH(ThomasAVX2,   "avx2",    float,  8)
+  SFT_THOMAS_PATH(ThomasAVX512, "avx512f", double, 8)
+  SFT_THOMAS_PATH(ThomasAVX512, "avx512f", float,  16)
+#undef SFT_THOMAS_PATH
+#endif
+
+  template <typename Real>
+  int SolveBatch(int n, int N, const Real *a, const Real *b, const Real *c, const Real *d, Real *X, Real *P,
+		 Real *Q, int *failed, soilfreezethaw::SimdPath path)
+  {
+    using soilfreezethaw::SimdPath;
+    if (!soilfreezethaw::IsSupported(path))
+      throw std::runtime_error(std::string("tridiagonal solver: ") + soilfreezethaw::SimdPathName(path)
+			       + " is not supported by this CPU!");
+
+    switch (path) {
+#ifdef SFT_X86_SIMD
+    case SimdPath::SSE2:
+      return ThomasSSE2(n, N, a, b, c, d, X, P, Q, failed);
+    case SimdPath::AVX2:
+      return ThomasAVX2(n, N, a, b, c, d, X, P, Q, failed);
+    case SimdPath::AVX512:
+      return ThomasAVX512(n, N, a, b, c, d, X, P, Q, failed);
+#endif
+    default:
+      return ThomasScalar<Real>(n, N, 0, N, a, b, c, d, X, P, Q, failed);
+    }
+  }
+}
+
+int soilfreezethaw::
+SolveTridiagonalBatch(int n, int nsystems, const double *a, const double *b, const double *c, const double *d,
+		      double *X, double *P, double *Q, int *failed, SimdPath path)
+{
+  return SolveBatch(n, nsystems, a, b, c, d, X, P, Q, failed, path);
+}
+
+int soilfreezethaw::
+SolveTridiagonalBatch(int n, int nsystems, const float *a, const float *b, const float *c, const float *d,
+		      float *X, float *P, float *Q, int *failed, SimdPath path)
+{
+  return SolveBatch(n, nsystems, a, b, c, d, X, P, Q, failed, path);
+}
+
+#endif
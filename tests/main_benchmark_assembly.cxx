@@ -0,0 +1,178 @@
+/*
+  Benchmark of the fused timestep assembly (see SolveDiffusionEquationFused): advances columns with the fused
+  and with the unfused sequence (state copy, liquid content, thermal conductivity, heat capacity, assembly,
+  Thomas algorithm and temperature update as separate passes over the cells), checks that the results are
+  bitwise identical and reports the time per cell and timestep of both.
+  - single columns with 64 to 4096 cells (generic kernels), where the per-cell arrays outgrow the L1/L2 caches
+  - batches of columns (SoilFreezeThawBatch, and the mixed precision batch, where only the assembly is fused)
+  The 4-cell column is read from the config file, the larger columns refine its soil discretization.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <cmath>
+#include <chrono>
+#include "../include/soil_freeze_thaw.hxx"
+#include "../include/soil_freeze_thaw_batch.hxx"
+
+#define BLUE  "\033[34m"
+#define RESET "\033[0m"
+
+using namespace soilfreezethaw;
+
+// writes a copy of the config file with ncells cells down to 2 m, 0.1 m top and bottom cells (the boundary fluxes
+// are explicit in the temperatures of these cells) and uniform cells in between
+static std::string RefineConfig(const std::string &config_file, int ncells)
+{
+  std::ifstream fp(config_file);
+  std::string out_file = "assembly_" + std::to_string(ncells) + "cells.txt";
+  std::ofstream out(out_file);
+  std::string line;
+
+  std::stringstream z, temp, moisture;
+  for (int i=0; i<ncells; i++) {
+    std::string sep = i < ncells-1 ? "," : "";
+    z << (i < ncells-1 ? 0.1 + 1.8 * i / (ncells-2) : 2.0) << sep;
+    temp << 280.15 << sep;
+    moisture << (i < ncells/4 ? 0.389 : 0.397) << sep;
+  }
+
+  while (std::getline(fp, line)) {
+    std::string key = line.substr(0, line.find("="));
+    if (key == "soil_z")
+      out << "soil_z=" << z.str() << "[m]\n";
+    else if (key == "soil_temperature")
+      out << "soil_temperature=" << temp.str() << "[K]\n";
+    else if (key == "soil_moisture_content" || key == "soil_liquid_content")
+      out << key << "=" << moisture.str() << "[]\n";
+
+    else
+      out << line << "\n";
+  }
+  return out_file;
+}
+
+// ground temperature cycling between 278 K and 288 K over 10 days, the soil stays thawed so the timestep
+// cost is that of the passes over the cells (the phase change check is a comparison per cell)
+static double GroundTemperature(int n)
+{
+  return 283.15 + 5.0 * std::sin(2.0 * M_PI * n / 240.0);
+}
+
+// seconds per timestep
+static double Run(SoilFreezeThaw &model, int nsteps)
+{
+  auto t0 = std::chrono::steady_clock::now();
+  for (int n=0; n<nsteps; n++) {
+    model.ground_temp = GroundTemperature(n);
+    model.Advance();
+  }
+  auto t1 = std::chrono::steady_clock::now();
+  return std::chrono::duration<double>(t1 - t0).count() / nsteps;
+}
+
+template <typename Batch>
+static double Run(Batch &batch, int nsteps)
+{
+  auto t0 = std::chrono::steady_clock::now();
+  for (int n=0; n<nsteps; n++) {
+    for (int c=0; c<batch.ncolumns; c++)
+      batch.ground_temp[c] = GroundTemperature(n) + 0.1 * (c % 8);
+    batch.Advance();
+  }
+  auto t1 = std::chrono::steady_clock::now();
+  return std::chrono::duration<double>(t1 - t0).count() / nsteps;
+}
+
+// fused vs unfused batch of ncolumns columns of the config file, returns true if bitwise identical
+template <typename Batch>
+static bool CompareBatch(const char *name, const std::string &config_file, int ncolumns, int nsteps)
+{
+  std::vector<SoilFreezeThaw*> columns;
+  for (int c=0; c<ncolumns; c++)
+    columns.push_back(new SoilFreezeThaw(config_file));
+
+  Batch fused(columns);
+  Batch unfused(columns);
+  unfused.fused_assembly = false;
+
+  double sec_unfused = Run(unfused, nsteps);
+  double sec_fused   = Run(fused, nsteps);
+
+  bool identical = true;
+  for (size_t k=0; k<fused.soil_temperature.size(); k++)
+    identical &= fused.soil_temperature[k] == unfused.soil_temperature[k]
+      && fused.soil_ice_content[k] == unfused.soil_ice_content[k];
+  for (int c=0; c<ncolumns; c++)
+    identical &= fused.energy_balance[c] == unfused.energy_balance[c];
+
+  double cells = (double)fused.ncells * ncolumns;
+  std::cout<<name<<", "<<ncolumns<<" x "<<fused.ncells<<" cells: unfused = "<<1.0e9 * sec_unfused / cells
+	   <<" ns/cell-step, fused = "<<1.0e9 * sec_fused / cells<<" ns/cell-step, speedup = "
+	   <<sec_unfused / sec_fused<<", identical = "<<(identical ? "Yes" : "No")<<"\n";
+
+  for (int c=0; c<ncolumns; c++)
+    delete columns[c];
+  return identical;
+}
+
+int main(int argc, char *argv[])
+{
+  if (argc != 2) {
+    printf("Usage: ./run_unittest.sh \n\n");
+    return 1;
+  }
+
+  std::cout<<"\n**************** BEGIN SoilFreezeThaw FUSED ASSEMBLY BENCHMARK *******************\n";
+
+  const int sizes[4] = {64, 256, 1024, 4096};
+  bool test_status = true;
+
+  std::cout<<BLUE<<"\n";
+  std::cout<<"*********************************************************\n";
+  std::cout<<"*************** Summary of the Assembly Benchmark *******\n";
+  std::cout<<"*********************************************************\n";
+
+  // single columns
+  for (int s=0; s<4; s++) {
+    int ncells = sizes[s];
+    std::string config_file = RefineConfig(argv[1], ncells);
+
+    SoilFreezeThaw fused(config_file);
+    SoilFreezeThaw unfused(config_file);
+    remove(config_file.c_str());
+    fused.partitioned_solver_cells = unfused.partitioned_solver_cells = 0; // Thomas algorithm
+    fused.SelectKernels(false, true);
+    unfused.SelectKernels(false, false);
+
+    const int nsteps = 400000 / ncells;
+    double sec_unfused = Run(unfused, nsteps);
+    double sec_fused   = Run(fused, nsteps);
+
+    bool identical = fused.energy_balance == unfused.energy_balance;
+    for (int i=0; i<ncells; i++)
+      identical &= fused.soil_temperature[i] == unfused.soil_temperature[i]
+	&& fused.soil_ice_content[i] == unfused.soil_ice_content[i];
+
+    test_status &= identical;
+
+    std::cout<<"Column, "<<ncells<<" cells: unfused = "<<1.0e9 * sec_unfused / ncells<<" ns/cell-step, fused = "
+	     <<1.0e9 * sec_fused / ncells<<" ns/cell-step, speedup = "<<sec_unfused / sec_fused
+	     <<", identical = "<<(identical ? "Yes" : "No")<<"\n";
+  }
+
+  // batches of 4-cell columns, and of 64-cell columns
+  std::string config_64 = RefineConfig(argv[1], 64);
+  test_status &= CompareBatch<SoilFreezeThawBatch>("Batch", argv[1], 4096, 240);
+  test_status &= CompareBatch<SoilFreezeThawBatch>("Batch", config_64, 256, 240);
+  test_status &= CompareBatch<SoilFreezeThawBatchMixed>("Mixed precision batch", argv[1], 4096, 240);
+  remove(config_64.c_str());
+
+  std::cout<<"Assembly benchmark passed? "<< (test_status ? "Yes" : "No") <<"\n";
+  std::cout<<RESET<<"\n";
+
+  return test_status ? 0 : 1;
+}
@@ -0,0 +1,92 @@
+/*
+  Benchmark of the batched (multi-column) engine: columns-per-second throughput of sequential
+  SoilFreezeThaw::Advance() calls and of one batched SoilFreezeThawBatch::Advance() per timestep, for a thawed
+  ground temperature ramp (coefficients and factorization reused, phase change bypassed) and a ramp into
+  freezing (coefficients recomputed and phase change every timestep). The speedup is reported only, the
+  benchmark fails if the batched columns are not bitwise identical to the sequential ones.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <iostream>
+#include <vector>
+#include <chrono>
+#include "../include/soil_freeze_thaw.hxx"
+#include "../include/soil_freeze_thaw_batch.hxx"
+
+#define BLUE  "\033[34m"
+#define RESET "\033[0m"
+
+using namespace soilfreezethaw;
+
+int main(int argc, char *argv[])
+{
+  if (argc != 2) {
+    printf("Usage: ./run_unittest.sh \n\n");
+    return 1;
+  }
+
+  std::cout<<"\n**************** BEGIN SoilFreezeThaw BATCH BENCHMARK *******************\n";
+
+  const int ncolumns = 1024;
+  const int nsteps = 240;
+  const char *names[2] = {"thawed", "freezing"};
+  const double rates[2] = {0.02, 0.1}; // [K/h], 278.15 K to 273.35 K and to 254.15 K
+  bool test_status = true;
+
+  std::cout<<BLUE<<"\n";
+  std::cout<<"*********************************************************\n";
+  std::cout<<"*************** Summary of the Batch Benchmark **********\n";
+  std::cout<<"*********************************************************\n";
+
+  for (int r=0; r<2; r++) {
+    std::vector<SoilFreezeThaw*> columns, batch_columns;
+    for (int c=0; c<ncolumns; c++) {
+      columns.push_back(new SoilFreezeThaw(argv[1]));
+      batch_columns.push_back(new SoilFreezeThaw(argv[1]));
+    }
+    SoilFreezeThawBatch batch(columns);
+
+    auto t0 = std::chrono::steady_clock::now();
+    for (int n=0; n<nsteps; n++) {
+      for (int c=0; c<ncolumns; c++) {
+	columns[c]->ground_temp = 278.15 - rates[r] * n;
+	columns[c]->Advance();
+      }
+    }
+    auto t1 = std::chrono::steady_clock::now();
+    for (int n=0; n<nsteps; n++) {
+      for (int c=0; c<ncolumns; c++)
+	batch.ground_temp[c] = 278.15 - rates[r] * n;
+      batch.Advance();
+    }
+    auto t2 = std::chrono::steady_clock::now();
+
+    bool identical = true;
+    for (int c=0; c<ncolumns; c++) {
+      batch.GetColumnState(c, *batch_columns[c]);
+      for (int i=0; i<columns[c]->ncells; i++)
+	identical &= columns[c]->soil_temperature[i] == batch_columns[c]->soil_temperature[i]
+	  && columns[c]->soil_ice_content[i] == batch_columns[c]->soil_ice_content[i];
+      identical &= columns[c]->energy_balance == batch_columns[c]->energy_balance;
+    }
+    test_status &= identical;
+
+    double throughput_seq   = ncolumns * nsteps / std::chrono::duration<double>(t1 - t0).count();
+    double throughput_batch = ncolumns * nsteps / std::chrono::duration<double>(t2 - t1).count();
+    std::cout<<"Sequential columns-steps per second ("<<names[r]<<") = "<<throughput_seq<<"\n";
+    std::cout<<"Batched columns-steps per second    ("<<names[r]<<") = "<<throughput_batch
+	     <<" (factorization reuses = "<<batch.factorization_reuses<<" of "<<nsteps<<"), speedup = "
+	     <<throughput_batch / throughput_seq<<", identical = "<<(identical ? "Yes" : "No")<<"\n";
+
+    for (int c=0; c<ncolumns; c++) {
+      delete columns[c];
+      delete batch_columns[c];
+    }
+  }
+
+  std::cout<<"Batch benchmark passed? "<< (test_status ? "Yes" : "No") <<"\n";
+  std::cout<<RESET<<"\n";
+
+  return test_status ? 0 : 1;
+}
@@ -0,0 +1,266 @@
+/*
+  Microbenchmark of the BMI variable access (registry of bmi_soil_freeze_thaw.cxx): checks the metadata of
+  every variable (grid, type, item size, units, location, bytes) against the expected values, the get/set round
+  trip and the errors of an unknown name, and reports the time per call of GetValue, SetValue, GetValuePtr and
+  the metadata functions. The chain of name comparisons the registry replaced (GetVarGrid) is timed as the
+  reference.
+  Variable handles (GetVarHandle and the C interface bmi_sft_*): get/set and gather/scatter by handle must
+  give the values of the functions taking the name, unknown names, invalid handles and NULL pointers must fail;
+  the time per call of both is reported.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <iostream>
+#include <vector>
+#include <chrono>
+#include <stdexcept>
+#include "../bmi/bmi.hxx"
+#include "../include/bmi_soil_freeze_thaw.hxx"
+#include "../include/soil_freeze_thaw.hxx"
+
+#define BLUE  "\033[34m"
+#define RESET "\033[0m"
+
+struct Expected {
+  std::string name;
+  int         grid;
+  std::string type;
+  std::string units;
+  std::string location;
+};
+
+// expected metadata of the variables
+static const std::vector<Expected> expected = {
+  {"ground_temperature",       1, "double", "K",     "node"},
+  {"soil_moisture_profile",    2, "double", "none",  "node"},
+  {"ice_fraction_schaake",     1, "double", "m",     "node"},
+  {"ice_fraction_xinanjiang",  1, "double", "none",  "node"},
+  {"num_cells",                0, "int",    "none",  "node"},
+  {"soil_temperature_profile", 2, "double", "K",     "node"},
+  {"soil_ice_fraction",        1, "double", "none",  "node"},
+  {"ground_heat_flux",         1, "double", "W m-2", "node"},
+  {"ice_fraction_scheme_bmi",  0, "int",    "none",  ""},
+  {"smcmax",                   1, "double", "none",  ""},
+  {"b",                        1, "double", "none",  ""},
+  {"satpsi",                   1, "double", "none",  ""}
+};
+
+// the dispatch of GetVarGrid before the registry: a chain of name comparisons
+static int CompareChainGrid(std::string name)
+{
+  if (name.compare("num_cells") == 0 || name.compare("ice_fraction_scheme_bmi") == 0)
+    return 0;
+  else if (name.compare("ground_temperature") == 0 || name.compare("ice_fraction_schaake") == 0
+	   || name.compare("ice_fraction_xinanjiang") == 0 || name.compare("soil_ice_fraction") == 0
+	   || name.compare("ground_heat_flux") == 0 || name.compare("smcmax") == 0
+	   || name.compare("b") == 0 || name.compare("satpsi") == 0)
+    return 1;
+  else if (name.compare("soil_moisture_profile") == 0 || name.compare("soil_temperature_profile") == 0)
+    return 2;
+  else
+    return -1;
+}
+
+// nanoseconds per call of f over all the variables (names or handles)
+template <typename T, typename F>
+static double Time(const std::vector<T> &variables, F f)
+{
+  const int nrepeat = 20000;
+  auto t0 = std::chrono::steady_clock::now();
+  for (int r=0; r<nrepeat; r++) {
+    for (const T &variable : variables)
+      f(variable);
+  }
+  auto t1 = std::chrono::steady_clock::now();
+  return 1.0e9 * std::chrono::duration<double>(t1 - t0).count() / (nrepeat * variables.size());
+}
+
+int main(int argc, char *argv[])
+{
+  if (argc != 2) {
+    printf("Usage: ./run_unittest.sh \n\n");
+    return 1;
+  }
+
+  std::cout<<"\n**************** BEGIN SoilFreezeThaw BMI VARIABLE BENCHMARK *******************\n";
+
+  BmiSoilFreezeThaw model;
+  model.Initialize(argv[1]);
+
+  int ncells;
+  model.GetValue("num_cells", &ncells);
+
+  bool test_status = true;
+
+  std::cout<<BLUE<<"\n";
+  std::cout<<"*********************************************************\n";
+  std::cout<<"*************** Summary of the BMI Variable Benchmark ***\n";
+  std::cout<<"*********************************************************\n";
+
+  // metadata and get/set round trip of every variable
+  bool metadata = true, roundtrip = true;
+  for (const Expected &e : expected) {
+    const int itemsize = e.grid == 0 ? sizeof(int) : sizeof(double);
+    const int nitems = e.grid == 2 ? ncells : 1;
+    metadata &= model.GetVarGrid(e.name) == e.grid && model.GetVarType(e.name) == e.type;
+    metadata &= model.GetVarItemsize(e.name) == itemsize && model.GetVarNbytes(e.name) == itemsize * nitems;
+    metadata &= model.GetVarUnits(e.name) == e.units && model.GetVarLocation(e.name) == e.location;
+
+    if (e.name == "num_cells" || e.name == "ice_fraction_scheme_bmi")
+      continue;
+    std::vector<double> value(nitems), saved(nitems), back(nitems);
+    model.GetValue(e.name, saved.data());
+    for (int i=0; i<nitems; i++)
+      value[i] = saved[i] + 0.25 * (i + 1);
+    model.SetValue(e.name, value.data());
+    model.GetValue(e.name, back.data());
+    roundtrip &= back == value && ((double*)model.GetValuePtr(e.name))[nitems-1] == value[nitems-1];
+    int last = nitems - 1;
+    double at_index;
+    model.GetValueAtIndices(e.name, &at_index, &last, 1);
+    roundtrip &= at_index == value[last];
+    model.SetValue(e.name, saved.data());
+  }
+  std::cout<<"Metadata of the "<<expected.size()<<" variables               = "<<(metadata ? "Yes" : "No")<<"\n";
+  std::cout<<"Get/set round trip                         = "<<(roundtrip ? "Yes" : "No")<<"\n";
+  test_status &= metadata && roundtrip;
+
+  // unknown name: no metadata, the value functions throw
+  bool unknown = model.GetVarGrid("soil_temp") == -1 && model.GetVarType("soil_temp") == ""
+    && model.GetVarItemsize("soil_temp") == 0 && model.GetVarNbytes("soil_temp") == 0;
+  double value = 0.0;
+  try {
+    model.SetValue("soil_temp", &value);
+    unknown = false;
+  }
+  catch (const std::runtime_error &e) {}
+  try {
+    model.GetValue("zzz", &value);
+    unknown = false;
+  }
+  catch (const std::runtime_error &e) {}
+  std::cout<<"Unknown variable rejected                  = "<<(unknown ? "Yes" : "No")<<"\n";
+  test_status &= unknown;
+
+  // variable handles against the functions taking the name
+  bool handles = true;
+  {
+    const int h_temp = model.GetVarHandle("soil_temperature_profile");
+    const int h_ground = model.GetVarHandle("ground_temperature");
+    const int h_cells = model.GetVarHandle("num_cells");
+    int c_handle = -1;
+    handles &= bmi_sft_get_var_handle(&model, "soil_temperature_profile", &c_handle) == 0 && c_handle == h_temp;
+
+    std::vector<double> by_name(ncells), by_handle(ncells), by_c(ncells);
+    model.GetValue("soil_temperature_profile", by_name.data());
+    model.GetValueByHandle(h_temp, by_handle.data());
+    handles &= bmi_sft_get_value(&model, h_temp, by_c.data()) == 0;
+    handles &= by_name == by_handle && by_name == by_c;
+
+    int cells = 0;
+    model.GetValueByHandle(h_cells, &cells);
+    handles &= cells == ncells;
+
+    // reversed order gather, scatter of shifted values, then gather through the name
+    std::vector<int> inds(ncells);
+    std::vector<double> gathered(ncells), shifted(ncells), back(ncells);
+    for (int i=0; i<ncells; i++)
+      inds[i] = ncells - 1 - i;
+    handles &= bmi_sft_get_value_at_indices(&model, h_temp, gathered.data(), inds.data(), ncells) == 0;
+    for (int i=0; i<ncells; i++) {
+      handles &= gathered[i] == by_name[ncells - 1 - i];
+      shifted[i] = gathered[i] + 1.0;
+    }
+    model.SetValueAtIndicesByHandle(h_temp, inds.data(), ncells, shifted.data());
+    model.GetValueAtIndices("soil_temperature_profile", back.data(), inds.data(), ncells);
+    handles &= back == shifted;
+    handles &= bmi_sft_set_value(&model, h_temp, by_name.data()) == 0;
+    void *ptr = NULL;
+    handles &= bmi_sft_get_value_ptr(&model, h_temp, &ptr) == 0 && ptr == model.GetValuePtr("soil_temperature_profile");
+    handles &= ((double*)ptr)[0] == by_name[0];
+
+    double ground_temp = 268.15, ground_back = 0.0;
+    handles &= bmi_sft_set_value_at_indices(&model, h_ground, inds.data() + ncells - 1, 1, &ground_temp) == 0;
+    model.GetValue("ground_temperature", &ground_back);
+    handles &= ground_back == ground_temp;
+
+    // failures
+    int h_bad = -1;
+    handles &= bmi_sft_get_var_handle(&model, "soil_temp", &h_bad) == 1 && h_bad == -1;
+    handles &= bmi_sft_get_var_handle(&model, NULL, &h_bad) == 1;
+    handles &= bmi_sft_get_value(&model, 12, by_c.data()) == 1 && bmi_sft_set_value(&model, -1, by_c.data()) == 1;
+    handles &= bmi_sft_get_var_handle(NULL, "soil_temperature_profile", &h_bad) == 1 && h_bad == -1
+      && bmi_sft_get_var_handle(&model, "soil_temperature_profile", NULL) == 1;
+    handles &= bmi_sft_get_value(NULL, h_temp, by_c.data()) == 1 && bmi_sft_get_value(&model, h_temp, NULL) == 1
+      && bmi_sft_set_value(NULL, h_temp, by_c.data()) == 1 && bmi_sft_set_value(&model, h_temp, NULL) == 1
+      && bmi_sft_get_value_ptr(NULL, h_temp, &ptr) == 1 && bmi_sft_get_value_ptr(&model, h_temp, NULL) == 1;
+    handles &= bmi_sft_get_value_at_indices(&model, h_temp, gathered.data(), NULL, ncells) == 1
+      && bmi_sft_set_value_at_indices(NULL, h_ground, inds.data(), 1, &ground_temp) == 1;
+    try {
+      model.GetVarHandle("soil_temp");
+      handles = false;
+    }
+    catch (const std::runtime_error &e) {}
+  }
+  std::cout<<"Variable handles (C++ and C)               = "<<(handles ? "Yes" : "No")<<"\n";
+  test_status &= handles;
+
+  // time per call over all the variables
+  std::vector<std::string> names;
+  for (const Expected &e : expected)
+    names.push_back(e.name);
+
+  std::vector<double> buffer(ncells);
+  volatile long sink = 0;
+  double ns_chain = Time(names, [&](const std::string &name) { sink += CompareChainGrid(name); });
+  double ns_grid  = Time(names, [&](const std::string &name) { sink += model.GetVarGrid(name); });
+  double ns_meta  = Time(names, [&](const std::string &name) {
+      sink += model.GetVarType(name).size() + model.GetVarUnits(name).size() + model.GetVarNbytes(name); });
+  double ns_ptr   = Time(names, [&](const std::string &name) { sink += (long)model.GetValuePtr(name); });
+  double ns_get   = Time(names, [&](const std::string &name) { model.GetValue(name, buffer.data()); });
+
+  std::vector<std::string> inputs = {"ground_temperature", "soil_moisture_profile"};
+  std::vector<double> moisture(ncells);
+  model.GetValue("soil_moisture_profile", moisture.data());
+  double ground_temp = 272.15;
+  double ns_set   = Time(inputs, [&](const std::string &name) {
+      model.SetValue(name, name == "ground_temperature" ? &ground_temp : moisture.data()); });
+
+  // by handle
+  std::vector<int> handles_of_names;
+  for (const std::string &name : names)
+    handles_of_names.push_back(model.GetVarHandle(name));
+  double ns_get_handle = Time(handles_of_names, [&](int handle) { model.GetValueByHandle(handle, buffer.data()); });
+
+  std::vector<int> inds(ncells);
+  for (int i=0; i<ncells; i++)
+    inds[i] = ncells - 1 - i;
+  const int h_temp = model.GetVarHandle("soil_temperature_profile");
+  std::vector<std::string> profile = {"soil_temperature_profile"};
+  std::vector<int> profile_handle = {h_temp};
+  double ns_gather_name = Time(profile, [&](const std::string &name) {
+      model.GetValueAtIndices(name, buffer.data(), inds.data(), ncells); });
+  double ns_gather_handle = Time(profile_handle, [&](int handle) {
+      model.GetValueAtIndicesByHandle(handle, buffer.data(), inds.data(), ncells); });
+
+  printf("GetVarGrid, name comparison chain (before)  : %7.2f ns/call\n", ns_chain);
+  printf("GetVarGrid                                  : %7.2f ns/call, speedup = %5.2f\n", ns_grid,
+	 ns_chain / ns_grid);
+  printf("GetVarType + GetVarUnits + GetVarNbytes     : %7.2f ns/call\n", ns_meta);
+  printf("GetValuePtr                                 : %7.2f ns/call\n", ns_ptr);
+  printf("GetValue                                    : %7.2f ns/call\n", ns_get);
+  printf("SetValue (inputs)                           : %7.2f ns/call\n", ns_set);
+  printf("GetValueByHandle                            : %7.2f ns/call, speedup = %5.2f\n", ns_get_handle,
+	 ns_get / ns_get_handle);
+  printf("GetValueAtIndices, %2d cells                 : %7.2f ns/call\n", ncells, ns_gather_name);
+  printf("GetValueAtIndicesByHandle, %2d cells         : %7.2f ns/call, speedup = %5.2f\n", ncells, ns_gather_handle,
+	 ns_gather_name / ns_gather_handle);
+
+  std::cout<<"BMI variable benchmark passed? "<< (test_status ? "Yes" : "No") <<"\n";
+  std::cout<<RESET<<"\n";
+
+  model.Finalize();
+
+  return test_status ? 0 : 1;
+}
@@ -0,0 +1,132 @@
+/*
+  Microbenchmark of the column kernels specialized for a fixed number of cells (see SelectKernels): advances
+  a column with the kernels selected by SelectKernels and with the generic fused kernel through freeze/thaw
+  cycles, checks that the results are bitwise identical and reports the time per timestep of both (best of
+  many short interleaved runs) and the median speedup of the paired runs. Fails only if the results differ;
+  the speedup is reported (it depends on the machine and its load). The 4-cell column is read from the config file, the 8, 16 and 32-cell columns refine its soil
+  discretization (generic kernel, no specialization is dispatched).
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <cmath>
+#include <chrono>
+#include <algorithm>
+#include <vector>
+#include "../include/soil_freeze_thaw.hxx"
+
+#define BLUE  "\033[34m"
+#define RESET "\033[0m"
+
+using namespace soilfreezethaw;
+
+// writes a copy of the config file with a uniform soil discretization of ncells down to 2 m
+static std::string RefineConfig(const std::string &config_file, int ncells)
+{
+  std::ifstream fp(config_file);
+  std::string out_file = "kernels_" + std::to_string(ncells) + "cells.txt";
+  std::ofstream out(out_file);
+  std::string line;
+
+  std::stringstream z, temp, moisture;
+  for (int i=0; i<ncells; i++) {
+    std::string sep = i < ncells-1 ? "," : "";
+    z << 2.0 * (i+1) / ncells << sep;
+    temp << 280.15 << sep;
+    moisture << (i < ncells/4 ? 0.389 : 0.397) << sep;
+  }
+
+  while (std::getline(fp, line)) {
+    std::string key = line.substr(0, line.find("="));
+    if (key == "soil_z")
+      out << "soil_z=" << z.str() << "[m]\n";
+    else if (key == "soil_temperature")
+      out << "soil_temperature=" << temp.str() << "[K]\n";
+    else if (key == "soil_moisture_content" || key == "soil_liquid_content")
+      out << key << "=" << moisture.str() << "[]\n";
+    else
+      out << line << "\n";
+  }
+  return out_file;
+}
+
+// seconds per timestep, ground temperature cycles between 263 K and 283 K over 10 days
+static double Run(SoilFreezeThaw &model, int nsteps)
+{
+  auto t0 = std::chrono::steady_clock::now();
+  for (int n=0; n<nsteps; n++) {
+    model.ground_temp = 273.15 + 10.0 * std::sin(2.0 * M_PI * n / 240.0);
+    model.Advance();
+  }
+  auto t1 = std::chrono::steady_clock::now();
+  return std::chrono::duration<double>(t1 - t0).count() / nsteps;
+}
+
+int main(int argc, char *argv[])
+{
+  if (argc != 2) {
+    printf("Usage: ./run_unittest.sh \n\n");
+    return 1;
+  }
+
+  std::cout<<"\n**************** BEGIN SoilFreezeThaw COLUMN KERNELS BENCHMARK *******************\n";
+
+  const int sizes[4] = {4, 8, 16, 32};
+  const int nruns = 301;
+  bool test_status = true;
+
+  std::cout<<BLUE<<"\n";
+  std::cout<<"*********************************************************\n";
+  std::cout<<"*************** Summary of the Kernels Benchmark ********\n";
+  std::cout<<"*********************************************************\n";
+
+  for (int s=0; s<4; s++) {
+    int ncells = sizes[s];
+    std::string config_file = ncells == 4 ? std::string(argv[1]) : RefineConfig(argv[1], ncells);
+
+    SoilFreezeThaw selected(config_file);
+    SoilFreezeThaw generic(config_file);
+    generic.SelectKernels(false);
+
+    if (ncells != 4)
+      remove(config_file.c_str());
+
+    // many short interleaved runs (one freeze/thaw cycle each, both columns continue the same cycles): the times
+    // are the best runs, the comparison is the median of the ratios of the paired runs, so the load of the machine
+    // during a run (the same for both kernels of a pair) does not decide it
+    const int nsteps = 240;
+    double sec_generic = 1.0e30, sec_selected = 1.0e30;
+    std::vector<double> ratios(nruns);
+    for (int r=0; r<nruns; r++) {
+      double sec_g = Run(generic, nsteps), sec_s = Run(selected, nsteps);
+      sec_generic  = std::min(sec_generic, sec_g);
+      sec_selected = std::min(sec_selected, sec_s);
+      ratios[r] = sec_s / sec_g;
+    }
+    std::nth_element(ratios.begin(), ratios.begin() + nruns/2, ratios.end());
+    double speedup = 1.0 / ratios[nruns/2];
+
+    bool identical = selected.ncells == ncells && selected.energy_balance == generic.energy_balance;
+    for (int i=0; i<ncells; i++)
+      identical &= selected.soil_temperature[i] == generic.soil_temperature[i]
+	&& selected.soil_ice_content[i] == generic.soil_ice_content[i];
+
+    bool specialized = selected.kernel_cells == ncells;
+    test_status &= identical;
+
+    std::cout<<ncells<<" cells: generic = "<<1.0e9 * sec_generic<<" ns/step, ";
+    if (specialized)
+      std::cout<<"specialized = "<<1.0e9 * sec_selected<<" ns/step, speedup (median) = "<<speedup;
+    else
+      std::cout<<"no specialization dispatched";
+    std::cout<<", identical = "<<(identical ? "Yes" : "No")<<"\n";
+  }
+
+  std::cout<<"Kernels benchmark passed? "<< (test_status ? "Yes" : "No") <<"\n";
+  std::cout<<RESET<<"\n";
+
+  return test_status ? 0 : 1;
+}
@@ -0,0 +1,165 @@
+/*
+  Benchmark of the partitioned tridiagonal solver (PartitionedTridiagonal, see SelectKernels): advances columns
+  of 32 to 4096 cells with the Thomas algorithm (fused generic kernel) and with the partitioned solver, and
+  reports the time per cell and timestep of both. The threshold partitioned_solver_cells_default is the
+  crossover measured here: the smallest column from which the partitioned solver is faster at all sizes.
+  - warm forcing, the soil stays thawed: the timestep cost is the diffusion solve (factorization reused)
+  - freezing forcing (1024 cells, frost front in the fine cells), the factorization is rebuilt every timestep
+  - partitioned solver with 2 threads (4096 cells)
+  The solvers differ by rounding only: the temperatures and ice contents must stay within 1e-8 of the Thomas
+  algorithm, and the energy balance check must pass.
+  The 4-cell column is read from the config file, the larger columns refine its soil discretization.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <cmath>
+#include <chrono>
+#include <stdexcept>
+#include "../include/soil_freeze_thaw.hxx"
+
+#define BLUE  "\033[34m"
+#define RESET "\033[0m"
+
+using namespace soilfreezethaw;
+
+static const double difference_bound = 1.0E-8; // [K], [-]
+
+// writes a copy of the config file with ncells cells down to 2 m, 0.1 m top and bottom cells (the boundary fluxes
+// are explicit in the temperatures of these cells) and uniform cells in between
+static std::string RefineConfig(const std::string &config_file, int ncells)
+{
+  std::ifstream fp(config_file);
+  std::string out_file = "tridiagonal_" + std::to_string(ncells) + "cells.txt";
+  std::ofstream out(out_file);
+  std::string line;
+
+  std::stringstream z, temp, moisture;
+  for (int i=0; i<ncells; i++) {
+    std::string sep = i < ncells-1 ? "," : "";
+    z << (i < ncells-1 ? 0.1 + 1.8 * i / (ncells-2) : 2.0) << sep;
+    temp << 280.15 << sep;
+    moisture << (i < ncells/4 ? 0.389 : 0.397) << sep;
+  }
+
+  while (std::getline(fp, line)) {
+    std::string key = line.substr(0, line.find("="));
+    if (key == "soil_z")
+      out << "soil_z=" << z.str() << "[m]\n";
+    else if (key == "soil_temperature")
+      out << "soil_temperature=" << temp.str() << "[K]\n";
+    else if (key == "soil_moisture_content" || key == "soil_liquid_content")
+      out << key << "=" << moisture.str() << "[]\n";
+    else
+      out << line << "\n";
+  }
+  return out_file;
+}
+
+// ground temperature cycling over 10 days, between 278 K and 288 K (warm) or 263 K and 283 K (freezing)
+static double GroundTemperature(int n, bool freezing)
+{
+  return freezing ? 273.15 + 10.0 * std::sin(2.0 * M_PI * n / 240.0)
+                  : 283.15 + 5.0 * std::sin(2.0 * M_PI * n / 240.0);
+}
+
+// seconds per timestep (the fastest of 4 segments of the run, against the noise of the machine), -1 if the
+// energy balance check fails
+static double Run(SoilFreezeThaw &model, int nsteps, bool freezing)
+{
+  double seconds = 1.0e30;
+  try {
+    for (int segment=0; segment<4; segment++) {
+      auto t0 = std::chrono::steady_clock::now();
+      for (int n=segment*nsteps/4; n<(segment+1)*nsteps/4; n++) {
+	model.ground_temp = GroundTemperature(n, freezing);
+	model.Advance();
+      }
+      auto t1 = std::chrono::steady_clock::now();
+      seconds = std::min(seconds, std::chrono::duration<double>(t1 - t0).count() / (nsteps/4));
+    }
+  }
+  catch (const std::runtime_error &e) {
+    std::cout<<"  "<<e.what()<<"\n";
+    return -1.0;
+  }
+  return seconds;
+}
+
+// Thomas algorithm vs the partitioned solver with threads, returns the speedup (0 if the results differ)
+static double Compare(const std::string &config_file, int ncells, int threads, bool freezing)
+{
+  std::string config = RefineConfig(config_file, ncells);
+  SoilFreezeThaw thomas(config);
+  SoilFreezeThaw partitioned(config);
+  remove(config.c_str());
+
+  thomas.partitioned_solver_cells = 0;
+  thomas.SelectKernels(false);
+  partitioned.partitioned_solver_cells = 1;
+  partitioned.partitioned_solver_threads = threads;
+  partitioned.SelectKernels(false);
+
+  const int nsteps = std::max(240, 1600000 / ncells);
+  double sec_thomas      = Run(thomas, nsteps, freezing);
+  double sec_partitioned = Run(partitioned, nsteps, freezing);
+
+  double difference = 0.0;
+  double max_ice = 0.0;
+  for (int i=0; i<ncells; i++) {
+    difference = std::max(difference, std::fabs(thomas.soil_temperature[i] - partitioned.soil_temperature[i]));
+    difference = std::max(difference, std::fabs(thomas.soil_ice_content[i] - partitioned.soil_ice_content[i]));
+    max_ice = std::max(max_ice, thomas.soil_ice_content[i]);
+  }
+  bool matched = sec_thomas > 0 && sec_partitioned > 0 && difference < difference_bound && (!freezing || max_ice > 0);
+
+  std::cout<<"Column, "<<ncells<<" cells"<<(freezing ? " (freezing)" : "")<<", threads = "<<threads
+	   <<": Thomas = "<<1.0e9 * sec_thomas / ncells<<" ns/cell-step, partitioned = "
+	   <<1.0e9 * sec_partitioned / ncells<<" ns/cell-step, speedup = "<<sec_thomas / sec_partitioned
+	   <<", max difference = "<<difference<<", passed = "<<(matched ? "Yes" : "No")<<"\n";
+
+  return matched ? sec_thomas / sec_partitioned : 0.0;
+}
+
+int main(int argc, char *argv[])
+{
+  if (argc != 2) {
+    printf("Usage: ./run_unittest.sh \n\n");
+    return 1;
+  }
+
+  std::cout<<"\n**************** BEGIN SoilFreezeThaw PARTITIONED TRIDIAGONAL BENCHMARK *******************\n";
+
+  const int nsizes = 8;
+  const int sizes[nsizes] = {32, 64, 128, 256, 512, 1024, 2048, 4096};
+  bool test_status = true;
+
+  std::cout<<BLUE<<"\n";
+  std::cout<<"*********************************************************\n";
+  std::cout<<"*************** Summary of the Tridiagonal Benchmark ****\n";
+  std::cout<<"*********************************************************\n";
+
+  // crossover: the smallest size from which the partitioned solver is faster
+  int crossover = 0;
+  for (int s=0; s<nsizes; s++) {
+    double speedup = Compare(argv[1], sizes[s], 1, false);
+    test_status &= speedup > 0;
+    if (speedup <= 1.0)
+      crossover = 0;
+    else if (crossover == 0)
+      crossover = sizes[s];
+  }
+
+  test_status &= Compare(argv[1], 1024, 1, true) > 0;
+  test_status &= Compare(argv[1], 4096, 2, false) > 0;
+
+  std::cout<<"Measured crossover (partitioned_solver_cells) = "<<(crossover > 0 ? std::to_string(crossover) : "none")
+	   <<", default = "<<partitioned_solver_cells_default<<"\n";
+  std::cout<<"Tridiagonal benchmark passed? "<< (test_status ? "Yes" : "No") <<"\n";
+  std::cout<<RESET<<"\n";
+
+  return test_status ? 0 : 1;
+}
@@ -28,7 +28,7 @@ int main(int argc, char *argv[])
   if (argc != 2) {
     printf("Usage: ./run_unittest.sh \n\n");
     printf("Run the frozensoilcxx model through its BMI with a configuration file.\n");
-    return FAILURE;
+    return 1;
   }
 
   std::cout<<"\n**************** BEGIN SoilFreezeThaw BMI UNIT TEST *******************\n";
@@ -172,7 +172,7 @@ int main(int argc, char *argv[])
     //++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
     // Test get_var_location()
     location = model.GetVarLocation(var_name);
-    if ( location == "") return FAILURE;
+    if ( location == "") return 1;
     if (VERBOSITY)
       std::cout<<" location: "<< location<<"\n";
     if (location == "")
@@ -199,7 +199,7 @@ int main(int argc, char *argv[])
     //++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
     // get_var_nbytes()
     nbytes = model.GetVarNbytes(var_name);
-    if (nbytes == 0) return FAILURE;
+    if (nbytes == 0) return 1;
     if (VERBOSITY)
       std::cout<<" nbytes: "<< nbytes <<"\n";
 
@@ -246,7 +246,7 @@ int main(int argc, char *argv[])
     //++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
     // Test get_var_itemsize()
     itemsize = model.GetVarItemsize(var_name);
-    if (itemsize == 0) return FAILURE;
+    if (itemsize == 0) return 1;
     if (VERBOSITY)
       std::cout<<"Itemsize: "<< itemsize <<"\n";
 
@@ -258,7 +258,7 @@ int main(int argc, char *argv[])
     //++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
     // Test get_var_location()
     location = model.GetVarLocation(var_name);
-    if ( location == "") return FAILURE;
+    if ( location == "") return 1;
     if (VERBOSITY)
       std::cout<<" location:"<< location<<"\n";
 
@@ -276,14 +276,14 @@ int main(int argc, char *argv[])
     //++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
     // Test get_var_type()
     vartype = model.GetVarType(var_name);
-    if (vartype == "") return FAILURE;
+    if (vartype == "") return 1;
     if (VERBOSITY)
       std::cout<<" type: "<< vartype <<"\n";
     
     //++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
     // get_var_nbytes()
     nbytes = model.GetVarNbytes(var_name);
-    if (nbytes == 0) return FAILURE;
+    if (nbytes == 0) return 1;
     if (VERBOSITY)
       std::cout<<" nbytes: "<< nbytes<<"\n";
 
@@ -322,7 +322,7 @@ int main(int argc, char *argv[])
     //++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
     // Test get_grid_rank()
     grid_rank = model.GetGridRank(grid_id[i]);
-    if (grid_rank == FAILURE) return FAILURE;
+    if (grid_rank == FAILURE) return 1;
     if (VERBOSITY)
       std::cout<<" rank: "<<grid_rank<<"\n";
 
@@ -649,5 +649,5 @@ int main(int argc, char *argv[])
     model_calib.Update();
   }
   
-  return FAILURE;
+  return test_status ? 0 : 1;
 }
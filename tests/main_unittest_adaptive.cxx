@@ -0,0 +1,100 @@
+/*
+  Unit test for the adaptive sub-stepping (adaptive_timestep): a fine soil grid is advanced with a daily
+  timestep through a freeze and thaw cycle. The fixed daily timestep is unstable on this grid (the run is
+  expected to abort on the energy balance check or diverge), the adaptive run must complete and stay within
+  1.5 K (top cell temperature at the end of each day) and 5 mm (ice) of a 5-minute reference.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <iostream>
+#include <cmath>
+#include <stdexcept>
+#include "../include/soil_freeze_thaw.hxx"
+
+#define BLUE  "\033[34m"
+#define RESET "\033[0m"
+
+using namespace soilfreezethaw;
+
+// daily ground temperature: seasonal cooling below the freezing point and warming back, with a weekly oscillation
+static double GroundTemperature(int day)
+{
+  double seasonal = day < 30 ? 278.15 - 0.5 * day : 263.15 + 0.5 * (day - 30);
+  return seasonal + 4.0 * std::sin(2.0 * M_PI * day / 7.0);
+}
+
+int main(int argc, char *argv[])
+{
+  if (argc != 2) {
+    printf("Usage: ./run_unittest.sh \n\n");
+    return 1;
+  }
+
+  std::cout<<"\n**************** BEGIN SoilFreezeThaw ADAPTIVE TIMESTEP UNIT TEST *******************\n";
+
+  SoilFreezeThaw adaptive(argv[1]);
+  SoilFreezeThaw fixed(argv[1]);
+  SoilFreezeThaw reference(argv[1]);
+
+  fixed.adaptive_timestep = false;
+  reference.adaptive_timestep = false;
+  reference.dt = 300.0;
+
+  const int ndays = int(adaptive.endtime / 86400.0 + 0.5);
+  const int nsteps_day = int(86400.0 / reference.dt + 0.5);
+
+  bool fixed_failed = false;
+  bool adaptive_failed = false;
+  double max_temp_error = 0.0;
+  double max_ice_error  = 0.0; // [mm]
+  double max_fixed_error = 0.0;
+
+  for (int d=0; d<ndays; d++) {
+    double ground_temp = GroundTemperature(d);
+
+    reference.ground_temp = ground_temp;
+    for (int n=0; n<nsteps_day; n++)
+      reference.Advance();
+
+    adaptive.ground_temp = ground_temp;
+    try {
+      adaptive.Advance();
+    }
+    catch (const std::runtime_error &e) {
+      adaptive_failed = true;
+      break;
+    }
+
+    if (!fixed_failed) {
+      fixed.ground_temp = ground_temp;
+      try {
+	fixed.Advance();
+	max_fixed_error = std::max(max_fixed_error, fabs(fixed.soil_temperature[0] - reference.soil_temperature[0]));
+      }
+      catch (const std::runtime_error &e) {
+	fixed_failed = true;
+      }
+    }
+
+    max_temp_error = std::max(max_temp_error, fabs(adaptive.soil_temperature[0] - reference.soil_temperature[0]));
+    max_ice_error  = std::max(max_ice_error, fabs(adaptive.ice_fraction_schaake - reference.ice_fraction_schaake) * 1000.0);
+  }
+
+  bool test_status = !adaptive_failed && max_temp_error < 1.5 && max_ice_error < 5.0
+    && adaptive.stats.substeps < reference.stats.steps;
+
+  std::cout<<BLUE<<"\n";
+  std::cout<<"*********************************************************\n";
+  std::cout<<"*************** Summary of the Adaptive Timestep Test ***\n";
+  std::cout<<"*********************************************************\n";
+  std::cout<<"Fixed daily timestep aborted?             = "<< (fixed_failed ? "Yes" : "No") <<", max top cell error [K] = "<< max_fixed_error <<"\n";
+  std::cout<<"Reference (5 minutes) timesteps           = "<< reference.stats.steps <<"\n";
+  std::cout<<"Adaptive sub-steps (accepted, rejected)   = "<< adaptive.stats.substeps <<", "<< adaptive.stats.rejected_substeps <<"\n";
+  std::cout<<"Adaptive max top cell temp. error [K]     = "<< max_temp_error <<"\n";
+  std::cout<<"Adaptive max ice (Schaake) error [mm]     = "<< max_ice_error <<"\n";
+  std::cout<<"Adaptive timestep test passed? "<< (test_status ? "Yes" : "No") <<"\n";
+  std::cout<<RESET<<"\n";
+
+  return test_status ? 0 : 1;
+}
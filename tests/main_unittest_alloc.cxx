@@ -0,0 +1,98 @@
+/*
+  Unit test for heap allocations in the timestep: counts the calls to the global operator new during
+  BMI Update() and fails if any timestep allocates. The ground temperature drives the column through
+  freezing and thawing (same forcing as main_unittest.cxx) so all phase change branches are covered.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <iostream>
+#include <new>
+#include "../bmi/bmi.hxx"
+#include "../include/bmi_soil_freeze_thaw.hxx"
+#include "../include/soil_freeze_thaw.hxx"
+
+#define BLUE  "\033[34m"
+#define RESET "\033[0m"
+
+static long allocation_count = 0;
+
+void* operator new(std::size_t size)
+{
+  allocation_count++;
+  void *ptr = malloc(size > 0 ? size : 1);
+  if (!ptr)
+    throw std::bad_alloc();
+  return ptr;
+}
+
+void* operator new[](std::size_t size)
+{
+  return operator new(size);
+}
+
+void* operator new(std::size_t size, const std::nothrow_t&) noexcept
+{
+  allocation_count++;
+  return malloc(size > 0 ? size : 1);
+}
+
+void* operator new[](std::size_t size, const std::nothrow_t&) noexcept
+{
+  return operator new(size, std::nothrow);
+}
+
+void operator delete(void *ptr) noexcept { free(ptr); }
+void operator delete[](void *ptr) noexcept { free(ptr); }
+void operator delete(void *ptr, std::size_t) noexcept { free(ptr); }
+void operator delete[](void *ptr, std::size_t) noexcept { free(ptr); }
+
+
+int main(int argc, char *argv[])
+{
+  if (argc != 2) {
+    printf("Usage: ./run_unittest.sh \n\n");
+    return 1;
+  }
+
+  std::cout<<"\n**************** BEGIN SoilFreezeThaw ALLOCATION UNIT TEST *******************\n";
+
+  BmiSoilFreezeThaw model;
+  model.Initialize(argv[1]);
+
+  const int nstep = 480;
+  double ground_temp = 280.15;
+  long update_allocations = 0;
+  int  allocating_steps = 0;
+
+  for (int n=0; n<nstep; n++) {
+    ground_temp += n < 200 ? -0.5 : 0.5;
+    model.SetValue("ground_temperature", &ground_temp);
+
+    long count_before = allocation_count;
+    model.Update();
+    long count_step = allocation_count - count_before;
+
+    update_allocations += count_step;
+    if (count_step > 0)
+      allocating_steps++;
+  }
+
+  double soil_ice_fraction = 0.0;
+  model.GetValue("soil_ice_fraction", &soil_ice_fraction);
+
+  bool test_status = update_allocations == 0;
+
+  std::cout<<BLUE<<"\n";
+  std::cout<<"*********************************************************\n";
+  std::cout<<"*************** Summary of the Allocation Unit Test *****\n";
+  std::cout<<"*********************************************************\n";
+  std::cout<<"Timesteps                     = "<< nstep <<"\n";
+  std::cout<<"Allocations in Update()       = "<< update_allocations <<"\n";
+  std::cout<<"Timesteps with allocations    = "<< allocating_steps <<"\n";
+  std::cout<<"Soil ice fraction (final) [-] = "<< soil_ice_fraction <<"\n";
+  std::cout<<"Allocation test passed? "<< (test_status ? "Yes" : "No") <<"\n";
+  std::cout<<RESET<<"\n";
+
+  return test_status ? 0 : 1;
+}
@@ -0,0 +1,97 @@
+/*
+  Unit test for the batched (multi-column) engine: advances a batch of columns with different
+  forcings and soil parameters and compares the states against independent single-column models
+  (results must be bitwise identical). The throughput of both is measured by main_benchmark_batch.cxx.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <iostream>
+#include <cmath>
+#include "../include/soil_freeze_thaw.hxx"
+#include "../include/soil_freeze_thaw_batch.hxx"
+
+#define GREEN "\033[32m"
+#define RED   "\033[31m"
+#define BLUE  "\033[34m"
+#define RESET "\033[0m"
+
+using namespace soilfreezethaw;
+
+int main(int argc, char *argv[])
+{
+  if (argc != 2) {
+    printf("Usage: ./run_unittest.sh \n\n");
+    return 1;
+  }
+
+  std::cout<<"\n**************** BEGIN SoilFreezeThaw BATCH UNIT TEST *******************\n";
+
+  const int ncolumns = 16;
+  const int nsteps   = 480;
+  bool test_status   = true;
+
+  std::vector<SoilFreezeThaw*> columns;
+  std::vector<SoilFreezeThaw*> batch_columns;
+
+  for (int c=0; c<ncolumns; c++) {
+    SoilFreezeThaw *model = new SoilFreezeThaw(argv[1]);
+    model->smcmax += 0.002 * (c % 5);
+    model->b      += 0.05 * (c % 3);
+    if (c % 2 == 1)
+      model->ice_fraction_scheme = "Xinanjiang";
+    columns.push_back(model);
+  }
+
+  for (int c=0; c<ncolumns; c++)
+    batch_columns.push_back(new SoilFreezeThaw(argv[1]));
+
+  SoilFreezeThawBatch batch(columns);
+
+  // ground temperature: cooling for 200 hours then warming (see main_unittest.cxx), different rates per column
+  std::vector<double> ground_temp(ncolumns);
+  for (int c=0; c<ncolumns; c++)
+    ground_temp[c] = 280.15 + 0.25 * (c % 4);
+
+  for (int n=0; n<nsteps; n++) {
+    for (int c=0; c<ncolumns; c++) {
+      double rate = 0.5 - 0.02 * (c % 8);
+      ground_temp[c] += n < 200 ? -rate : rate;
+
+      columns[c]->ground_temp = ground_temp[c];
+      columns[c]->Advance();
+      batch.ground_temp[c] = ground_temp[c];
+    }
+    batch.Advance();
+  }
+
+  int nmismatch = 0;
+  for (int c=0; c<ncolumns; c++) {
+    batch.GetColumnState(c, *batch_columns[c]);
+    const SoilFreezeThaw &m = *columns[c];
+    const SoilFreezeThaw &s = *batch_columns[c];
+
+    for (int i=0; i<m.ncells; i++) {
+      if (m.soil_temperature[i] != s.soil_temperature[i] || m.soil_ice_content[i] != s.soil_ice_content[i]
+	  || m.soil_liquid_content[i] != s.soil_liquid_content[i])
+	nmismatch++;
+    }
+    if (m.ice_fraction_schaake != s.ice_fraction_schaake || m.ice_fraction_xinanjiang != s.ice_fraction_xinanjiang
+	|| m.soil_ice_fraction != s.soil_ice_fraction || m.energy_balance != s.energy_balance)
+      nmismatch++;
+  }
+
+  test_status &= nmismatch == 0;
+
+  std::cout<<"Columns = "<<ncolumns<<", timesteps = "<<nsteps<<", mismatches = "<<nmismatch<<"\n";
+  std::cout<<"Soil ice fraction (column 0) [-] = "<<batch.soil_ice_fraction[0]<<"\n";
+
+  std::cout<<BLUE<<"\n";
+  std::cout<<"*********************************************************\n";
+  std::cout<<"*************** Summary of the Batch Unit Test **********\n";
+  std::cout<<"*********************************************************\n";
+  std::cout<<"Batch test passed? "<< (test_status ? "Yes" : "No") <<"\n";
+  std::cout<<RESET<<"\n";
+
+  return test_status ? 0 : 1;
+}
@@ -0,0 +1,240 @@
+/*
+  Unit test of the binary checkpoints (SoilFreezeThaw::SaveCheckpoint/RestoreCheckpoint):
+  - a model saved in the middle of a freezing and thawing cycle and restored into a model constructed from the
+    same config continues bitwise identically to the uninterrupted model, for the split and enthalpy phase change
+    schemes, the adaptive timestep and the constitutive tables
+  - the same through the BMI wrapper and its C interface, with a checkpoint file
+  - checkpoints of version 1 (configuration stored in another order) are migrated
+  - checkpoints of another configuration (scheme, number of cells), of another version, or truncated are rejected
+    and leave the model unchanged
+  - size of the checkpoint and time of save + restore against re-simulating the steps before the checkpoint
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <iostream>
+#include <sstream>
+#include <vector>
+#include <cmath>
+#include <chrono>
+#include <stdexcept>
+#include <cstring>
+#include "../bmi/bmi.hxx"
+#include "../include/bmi_soil_freeze_thaw.hxx"
+#include "../include/soil_freeze_thaw.hxx"
+
+#define BLUE  "\033[34m"
+#define RESET "\033[0m"
+
+using namespace soilfreezethaw;
+
+// ground temperature cycling between 263 K and 283 K, period steps per cycle
+static double GroundTemperature(int n, int period)
+{
+  return 273.15 + 10.0 * std::sin(2.0 * M_PI * n / period);
+}
+
+static bool Identical(const SoilFreezeThaw &a, const SoilFreezeThaw &b)
+{
+  bool identical = a.time == b.time && a.energy_balance == b.energy_balance && a.energy_consumed == b.energy_consumed
+    && a.energy_balance_compensation == b.energy_balance_compensation && a.ground_heat_flux == b.ground_heat_flux
+    && a.ice_fraction_schaake == b.ice_fraction_schaake && a.ice_fraction_xinanjiang == b.ice_fraction_xinanjiang
+    && a.soil_ice_fraction == b.soil_ice_fraction;
+  for (int i=0; i<a.ncells; i++) {
+    identical &= a.soil_temperature[i] == b.soil_temperature[i];
+    identical &= a.soil_moisture_content[i] == b.soil_moisture_content[i];
+    identical &= a.soil_liquid_content[i] == b.soil_liquid_content[i];
+    identical &= a.soil_ice_content[i] == b.soil_ice_content[i];
+    identical &= a.thermal_conductivity[i] == b.thermal_conductivity[i];
+  }
+  return identical;
+}
+
+// runs nsteps uninterrupted and, in a second model, restarts from a checkpoint taken after nsave steps
+static bool CompareRestart(const std::string &config, const std::string &name, const std::string &scheme,
+			   int nsteps, int nsave, int period)
+{
+  SoilFreezeThaw uninterrupted(config), saved(config), restored(config);
+  for (SoilFreezeThaw *model : {&uninterrupted, &saved, &restored})
+    model->phase_change_scheme = scheme;
+
+  double max_ice = 0.0;
+  auto t0 = std::chrono::steady_clock::now();
+  for (int n=0; n<nsave; n++) {
+    saved.ground_temp = GroundTemperature(n, period);
+    saved.Advance();
+  }
+  auto t1 = std::chrono::steady_clock::now();
+  for (int n=0; n<nsteps; n++) {
+    uninterrupted.ground_temp = GroundTemperature(n, period);
+    uninterrupted.Advance();
+    max_ice = std::max(max_ice, uninterrupted.soil_ice_content[0]);
+  }
+
+  std::stringstream checkpoint;
+  auto t2 = std::chrono::steady_clock::now();
+  saved.SaveCheckpoint(checkpoint);
+  restored.RestoreCheckpoint(checkpoint);
+  auto t3 = std::chrono::steady_clock::now();
+  bool identical = Identical(saved, restored);
+
+  for (int n=nsave; n<nsteps; n++) {
+    restored.ground_temp = GroundTemperature(n, period);
+    restored.Advance();
+  }
+  identical &= Identical(uninterrupted, restored) && max_ice > 0.0;
+
+  double us_simulate = 1.0e6 * std::chrono::duration<double>(t1 - t0).count();
+  double us_restart = 1.0e6 * std::chrono::duration<double>(t3 - t2).count();
+  printf("%-22s: restarted run identical = %s, checkpoint %zu bytes, save + restore %7.2f us "
+	 "(%d steps %9.2f us)\n", name.c_str(), identical ? "Yes" : "No", checkpoint.str().size(), us_restart, nsave,
+	 us_simulate);
+  return identical;
+}
+
+// the version 1 layout of a checkpoint: dt, soil_z and the length-prefixed phase change scheme precede the
+// configuration integers
+static std::string Version1(const std::string &checkpoint, int ncells, const std::string &scheme)
+{
+  const size_t header = 20, integers = 12, name = 16, grid = 8 * (ncells + 1);
+  std::string integers_v1 = checkpoint.substr(header, integers);
+  std::string grid_v1 = checkpoint.substr(header + integers + name, grid);
+  int32_t version = 1, size = scheme.size();
+  std::string v1 = checkpoint.substr(0, header);
+  std::memcpy(&v1[12], &version, sizeof(version));
+  v1 += grid_v1 + std::string(reinterpret_cast<const char*>(&size), sizeof(size)) + scheme + integers_v1;
+  return v1 + checkpoint.substr(header + integers + name + grid);
+}
+
+// true if restoring the checkpoint into the model throws and leaves the model unchanged
+static bool Rejected(SoilFreezeThaw &model, const std::string &checkpoint)
+{
+  double time = model.time, temperature = model.soil_temperature[0];
+  std::stringstream is(checkpoint);
+  try {
+    model.RestoreCheckpoint(is);
+  }
+  catch (const std::runtime_error &e) {
+    return model.time == time && model.soil_temperature[0] == temperature;
+  }
+  return false;
+}
+
+int main(int argc, char *argv[])
+{
+  if (argc != 2) {
+    printf("Usage: ./run_unittest.sh \n\n");
+    return 1;
+  }
+
+  std::cout<<"\n**************** BEGIN SoilFreezeThaw CHECKPOINT UNIT TEST *******************\n";
+
+  const std::string config = argv[1];
+  const std::string configs_dir = config.substr(0, config.find_last_of('/') + 1);
+  bool test_status = true;
+
+  std::cout<<BLUE<<"\n";
+  std::cout<<"*********************************************************\n";
+  std::cout<<"*************** Summary of the Checkpoint Unit Test *****\n";
+  std::cout<<"*********************************************************\n";
+
+  test_status &= CompareRestart(config, "split", "split", 960, 500, 480);
+  test_status &= CompareRestart(config, "enthalpy", "enthalpy", 960, 500, 480);
+  test_status &= CompareRestart(configs_dir + "unittest_adaptive.txt", "adaptive timestep", "split", 60, 25, 40);
+  test_status &= CompareRestart(configs_dir + "unittest_tables.txt", "constitutive tables", "split", 960, 500,
+				480);
+
+  // BMI wrapper and C interface, checkpoint file
+  {
+    BmiSoilFreezeThaw uninterrupted, saved, restored;
+    uninterrupted.Initialize(config);
+    saved.Initialize(config);
+    restored.Initialize(config);
+    int ncells;
+    uninterrupted.GetValue("num_cells", &ncells);
+
+    for (int n=0; n<300; n++) {
+      double ground_temp = GroundTemperature(n, 480);
+      uninterrupted.SetValue("ground_temperature", &ground_temp);
+      uninterrupted.Update();
+      if (n < 200) {
+	saved.SetValue("ground_temperature", &ground_temp);
+	saved.Update();
+      }
+      if (n == 199) {
+	bool restarted = bmi_sft_save_checkpoint(&saved, "checkpoint_unittest.bin") == 0 &&
+	  bmi_sft_restore_checkpoint(&restored, "checkpoint_unittest.bin") == 0;
+	test_status &= restarted;
+      }
+      if (n >= 200) {
+	restored.SetValue("ground_temperature", &ground_temp);
+	restored.Update();
+      }
+    }
+    std::vector<double> ta(ncells), tb(ncells);
+    uninterrupted.GetValue("soil_temperature_profile", ta.data());
+    restored.GetValue("soil_temperature_profile", tb.data());
+    double ice_a, ice_b;
+    uninterrupted.GetValue("soil_ice_fraction", &ice_a);
+    restored.GetValue("soil_ice_fraction", &ice_b);
+    bool identical = ta == tb && ice_a == ice_b && ice_a > 0.0
+      && uninterrupted.GetCurrentTime() == restored.GetCurrentTime();
+    identical &= bmi_sft_restore_checkpoint(&restored, "checkpoint_missing.bin") == 1
+      && bmi_sft_restore_checkpoint(&restored, NULL) == 1 && bmi_sft_restore_checkpoint(NULL, "checkpoint.bin") == 1
+      && bmi_sft_save_checkpoint(&saved, NULL) == 1 && bmi_sft_save_checkpoint(NULL, "checkpoint.bin") == 1;
+    printf("%-22s: restarted run identical = %s\n", "BMI (checkpoint file)", identical ? "Yes" : "No");
+    test_status &= identical;
+    remove("checkpoint_unittest.bin");
+    uninterrupted.Finalize();
+    saved.Finalize();
+    restored.Finalize();
+  }
+
+  // checkpoints that do not match the model
+  {
+    SoilFreezeThaw split(config), enthalpy(config), adaptive(configs_dir + "unittest_adaptive.txt");
+    enthalpy.phase_change_scheme = "enthalpy";
+    split.ground_temp = GroundTemperature(100, 480);
+    split.Advance();
+    std::stringstream os;
+    split.SaveCheckpoint(os);
+    const std::string checkpoint = os.str();
+
+    std::string version = checkpoint, truncated = checkpoint.substr(0, checkpoint.size() - 8);
+    version[12]++;                                      // version follows the magic and the byte order mark
+    SoilFreezeThaw model(config);
+    bool rejected = Rejected(enthalpy, checkpoint) && Rejected(adaptive, checkpoint) && Rejected(model, version)
+      && Rejected(model, truncated) && Rejected(model, "SFT");
+    printf("%-22s: rejected = %s\n", "mismatched checkpoints", rejected ? "Yes" : "No");
+    test_status &= rejected;
+  }
+
+  // version 1 checkpoints are migrated
+  {
+    SoilFreezeThaw saved(config), restored(config);
+    saved.phase_change_scheme = restored.phase_change_scheme = "enthalpy";
+    for (int n=0; n<100; n++) {
+      saved.ground_temp = GroundTemperature(n, 48);
+      saved.Advance();
+    }
+    std::stringstream os;
+    saved.SaveCheckpoint(os);
+    std::stringstream is(Version1(os.str(), saved.ncells, saved.phase_change_scheme));
+    bool migrated = true;
+    try {
+      restored.RestoreCheckpoint(is);
+      migrated = Identical(saved, restored) && saved.soil_ice_content[0] > 0.0;
+    }
+    catch (const std::runtime_error &e) {
+      std::cout<<e.what()<<"\n";
+      migrated = false;
+    }
+    printf("%-22s: migrated = %s\n", "version 1 checkpoint", migrated ? "Yes" : "No");
+    test_status &= migrated;
+  }
+
+  std::cout<<"Checkpoint test passed? "<< (test_status ? "Yes" : "No") <<"\n";
+  std::cout<<RESET<<"\n";
+
+  return test_status ? 0 : 1;
+}
@@ -0,0 +1,247 @@
+/*
+  Unit test of the checkpoint store (CheckpointStoreWriter/CheckpointStoreReader, soil_freeze_thaw_checkpoint_store.hxx):
+  - the checkpoints of many columns, forced by ground temperatures of different phases, are written by 4 threads
+    into one store, with and without compression
+  - a shard of the ids is restored from the mapped store by 4 threads into models constructed from the config:
+    the restored models hold the saved state and continue bitwise identically to the saved ones
+  - the codec round trip of arbitrary data, corrupted compressed records, duplicate and missing ids, stores
+    that were not closed, and corrupted indexes (count of entries, record offset past the end of the file) are errors
+  - size of the stores and time of writing and restoring, against one checkpoint file per column
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <iostream>
+#include <sstream>
+#include <vector>
+#include <string>
+#include <cmath>
+#include <chrono>
+#include <thread>
+#include <stdexcept>
+#include <fstream>
+#include <iterator>
+#include <cstring>
+#include <cstdint>
+#include "../include/soil_freeze_thaw.hxx"
+#include "../include/soil_freeze_thaw_checkpoint_store.hxx"
+
+#define BLUE  "\033[34m"
+#define RESET "\033[0m"
+
+using namespace soilfreezethaw;
+
+const int ncolumns = 2000;
+const int nthreads = 4;
+const int nshards  = 4;
+
+static std::string Id(int c)
+{
+  return "cat-" + std::to_string(c);
+}
+
+// ground temperature cycling between 263 K and 283 K over 20 days, phase of column c
+static double GroundTemperature(int n, int c)
+{
+  return 273.15 + 10.0 * std::sin(2.0 * M_PI * (n + 7 * c) / 480.0);
+}
+
+static std::string Checkpoint(SoilFreezeThaw &model)
+{
+  std::ostringstream os;
+  model.SaveCheckpoint(os);
+  return os.str();
+}
+
+// runs task(c) for the columns c of thread t (c % nthreads == t) on nthreads threads
+template <typename Task> void Parallel(const Task &task)
+{
+  std::vector<std::thread> threads;
+  for (int t=0; t<nthreads; t++)
+    threads.emplace_back([&task, t]() {
+	for (int c=t; c<ncolumns; c+=nthreads)
+	  task(c);
+      });
+  for (std::thread &thread : threads)
+    thread.join();
+}
+
+// copy of the store with the 8 bytes at pos replaced by value
+static void CorruptStore(const std::string &store, const std::string &corrupted, size_t pos, uint64_t value)
+{
+  std::ifstream is(store, std::ios::binary);
+  std::string data((std::istreambuf_iterator<char>(is)), std::istreambuf_iterator<char>());
+  std::memcpy(&data[pos], &value, sizeof(value));
+  std::ofstream os(corrupted, std::ios::binary);
+  os.write(data.data(), data.size());
+}
+
+template <typename Function> bool Throws(const Function &function)
+{
+  try {
+    function();
+  }
+  catch (const std::runtime_error &e) {
+    return true;
+  }
+  return false;
+}
+
+// writes the store with nthreads writers, restores shard 1 of nshards and compares with the saved models
+static bool WriteAndRestore(const std::string &config, std::vector<SoilFreezeThaw*> &columns, bool compress)
+{
+  const std::string file = compress ? "checkpoint_store_compressed.bin" : "checkpoint_store.bin";
+  auto t0 = std::chrono::steady_clock::now();
+  {
+    CheckpointStoreWriter writer(file, compress);
+    Parallel([&](int c) { writer.Add(Id(c), *columns[c]); });
+    writer.Close();
+  }
+  auto t1 = std::chrono::steady_clock::now();
+
+  CheckpointStoreReader reader(file);
+  const std::vector<CheckpointStoreEntry> &entries = reader.Entries();
+  size_t stored = 0, size = 0;
+  for (const CheckpointStoreEntry &entry : entries) {
+    stored += entry.stored_size;
+    size += entry.size;
+  }
+  bool status = int(entries.size()) == ncolumns && reader.Contains(Id(ncolumns-1)) && !reader.Contains("cat-x");
+
+  // the models of shard 1 are constructed and restored by the threads
+  std::vector<SoilFreezeThaw*> restored(ncolumns, NULL);
+  auto t2 = std::chrono::steady_clock::now();
+  Parallel([&](int c) {
+      if (c % nshards == 1) {
+	restored[c] = new SoilFreezeThaw(config);
+	reader.Restore(Id(c), *restored[c]);
+      }
+    });
+  auto t3 = std::chrono::steady_clock::now();
+
+  int nrestored = 0;
+  for (int c=1; c<ncolumns; c+=nshards) {
+    status &= Checkpoint(*restored[c]) == Checkpoint(*columns[c]);
+    nrestored++;
+  }
+  // the restored models continue as the saved ones
+  for (int c=1; c<ncolumns; c+=nshards*16) {
+    SoilFreezeThaw saved(config);
+    reader.Restore(Id(c), saved);
+    for (int n=960; n<1200; n++) {
+      saved.ground_temp = restored[c]->ground_temp = GroundTemperature(n, c);
+      saved.Advance();
+      restored[c]->Advance();
+    }
+    status &= Checkpoint(saved) == Checkpoint(*restored[c]) && saved.time == restored[c]->time;
+  }
+  for (SoilFreezeThaw *model : restored)
+    delete model;
+
+  printf("%-12s: %d columns, %8zu bytes (%.2f of the checkpoints), write %7.2f ms, restore of %d columns "
+	 "%7.2f ms, restored = %s\n", compress ? "compressed" : "uncompressed", ncolumns, stored, double(stored) / size,
+	 1.0e3 * std::chrono::duration<double>(t1 - t0).count(), nrestored,
+	 1.0e3 * std::chrono::duration<double>(t3 - t2).count(), status ? "Yes" : "No");
+  remove(file.c_str());
+  return status;
+}
+
+int main(int argc, char *argv[])
+{
+  if (argc != 2) {
+    printf("Usage: ./run_unittest.sh \n\n");
+    return 1;
+  }
+
+  std::cout<<"\n**************** BEGIN SoilFreezeThaw CHECKPOINT STORE UNIT TEST *******************\n";
+
+  const std::string config = argv[1];
+  bool test_status = true;
+
+  // columns in different stages of a freezing and thawing cycle
+  std::vector<SoilFreezeThaw*> columns(ncolumns);
+  for (int c=0; c<ncolumns; c++)
+    columns[c] = new SoilFreezeThaw(config);
+  Parallel([&](int c) {
+      for (int n=0; n<960; n++) {
+	columns[c]->ground_temp = GroundTemperature(n, c);
+	columns[c]->Advance();
+      }
+    });
+
+  std::cout<<BLUE<<"\n";
+  std::cout<<"*********************************************************\n";
+  std::cout<<"*************** Summary of the Checkpoint Store Unit Test \n";
+  std::cout<<"*********************************************************\n";
+
+  test_status &= WriteAndRestore(config, columns, false);
+  test_status &= WriteAndRestore(config, columns, true);
+
+  // one checkpoint file per column
+  {
+    auto t0 = std::chrono::steady_clock::now();
+    for (int c=0; c<ncolumns; c++)
+      columns[c]->SaveCheckpoint("checkpoint_" + Id(c) + ".bin");
+    auto t1 = std::chrono::steady_clock::now();
+    for (int c=0; c<ncolumns; c++)
+      remove(("checkpoint_" + Id(c) + ".bin").c_str());
+    printf("%-12s: %d files, write %7.2f ms\n", "per column", ncolumns,
+	   1.0e3 * std::chrono::duration<double>(t1 - t0).count());
+  }
+
+  // codec round trip of data that is not a multiple of 8 bytes, with long zero runs and random bytes
+  {
+    std::string data(100003, '\0'), record, decoded;
+    srand(1);
+    for (size_t i=50000; i<data.size(); i++)
+      data[i] = char(rand());
+    EncodeCheckpoint(data, record);
+    DecodeCheckpoint(record.data(), record.size(), data.size(), decoded);
+    bool codec = decoded == data;
+    codec &= Throws([&]() { DecodeCheckpoint(record.data(), record.size() - 1, data.size(), decoded); });
+    codec &= Throws([&]() { DecodeCheckpoint(record.data(), record.size(), data.size() - 1, decoded); });
+    printf("%-12s: round trip and corrupted records = %s\n", "codec", codec ? "Yes" : "No");
+    test_status &= codec;
+  }
+
+  // duplicate and missing ids, store not closed, not a store
+  {
+    bool errors;
+    {
+      CheckpointStoreWriter writer("checkpoint_store_errors.bin");
+      writer.Add("cat-1", *columns[1]);
+      errors = Throws([&]() { writer.Add("cat-1", *columns[2]); });
+      errors &= Throws([&]() { CheckpointStoreReader reader("checkpoint_store_errors.bin"); });
+      writer.Close();
+      errors &= Throws([&]() { writer.Add("cat-2", *columns[2]); });
+    }
+    CheckpointStoreReader reader("checkpoint_store_errors.bin");
+    SoilFreezeThaw model(config);
+    errors &= reader.Entries().size() == 1 && Throws([&]() { reader.Restore("cat-2", model); });
+    errors &= Throws([&]() { CheckpointStoreReader missing("checkpoint_store_missing.bin"); });
+    errors &= Throws([&]() { CheckpointStoreReader config_file(config); });
+
+    // the count of entries (header) and the offset of the record of "cat-1" (index, after the id size and id)
+    uint64_t index;
+    std::ifstream is("checkpoint_store_errors.bin", std::ios::binary);
+    is.seekg(24);
+    is.read(reinterpret_cast<char*>(&index), sizeof(index));
+    is.close();
+    CorruptStore("checkpoint_store_errors.bin", "checkpoint_store_corrupted.bin", 16, uint64_t(1) << 60);
+    errors &= Throws([&]() { CheckpointStoreReader corrupted("checkpoint_store_corrupted.bin"); });
+    CorruptStore("checkpoint_store_errors.bin", "checkpoint_store_corrupted.bin", index + 4 + 5, UINT64_MAX - 8);
+    errors &= Throws([&]() { CheckpointStoreReader corrupted("checkpoint_store_corrupted.bin"); });
+    remove("checkpoint_store_corrupted.bin");
+    remove("checkpoint_store_errors.bin");
+    printf("%-12s: rejected = %s\n", "errors", errors ? "Yes" : "No");
+    test_status &= errors;
+  }
+
+  for (SoilFreezeThaw *model : columns)
+    delete model;
+
+  std::cout<<"Checkpoint store test passed? "<< (test_status ? "Yes" : "No") <<"\n";
+  std::cout<<RESET<<"\n";
+
+  return test_status ? 0 : 1;
+}
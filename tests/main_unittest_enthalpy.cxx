@@ -0,0 +1,87 @@
+/*
+  Unit test for the enthalpy phase change solver (phase_change_scheme = enthalpy): a freeze and thaw cycle
+  driven by a daily ground temperature is run with a daily and with an hourly timestep. The daily run must
+  match the hourly run at the end of each day within the stated tolerances: 1 K RMS of the top cell
+  temperature and 5% of the peak ice content (Schaake ice fraction) for the maximum ice error.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <iostream>
+#include <cmath>
+#include <stdexcept>
+#include "../include/soil_freeze_thaw.hxx"
+
+#define BLUE  "\033[34m"
+#define RESET "\033[0m"
+
+using namespace soilfreezethaw;
+
+// daily ground temperature: seasonal cooling below the freezing point and warming back, with a weekly oscillation
+static double GroundTemperature(int day)
+{
+  double seasonal = day < 45 ? 278.15 - 0.4 * day : 260.15 + 0.4 * (day - 45);
+  return seasonal + 3.0 * std::sin(2.0 * M_PI * day / 7.0);
+}
+
+int main(int argc, char *argv[])
+{
+  if (argc != 2) {
+    printf("Usage: ./run_unittest.sh \n\n");
+    return 1;
+  }
+
+  std::cout<<"\n**************** BEGIN SoilFreezeThaw ENTHALPY SOLVER UNIT TEST *******************\n";
+
+  SoilFreezeThaw daily(argv[1]);
+  SoilFreezeThaw hourly(argv[1]);
+
+  daily.phase_change_scheme  = "enthalpy";
+  hourly.phase_change_scheme = "enthalpy";
+  daily.dt  = 86400.0;
+  hourly.dt = 3600.0;
+
+  const int ndays = 90;
+  bool test_status = true;
+  double temp_error = 0.0;     // [K^2], sum of squares
+  double max_ice_error = 0.0;  // [mm]
+  double peak_ice = 0.0;       // [mm]
+
+  try {
+    for (int d=0; d<ndays; d++) {
+      daily.ground_temp  = GroundTemperature(d);
+      hourly.ground_temp = GroundTemperature(d);
+
+      daily.Advance();
+      for (int n=0; n<24; n++)
+	hourly.Advance();
+
+      double dT = daily.soil_temperature[0] - hourly.soil_temperature[0];
+      temp_error   += dT * dT;
+      max_ice_error = std::max(max_ice_error, fabs(daily.ice_fraction_schaake - hourly.ice_fraction_schaake) * 1000.0);
+      peak_ice      = std::max(peak_ice, hourly.ice_fraction_schaake * 1000.0);
+    }
+  }
+  catch (const std::runtime_error &e) {
+    std::cout<<e.what()<<"\n";
+    test_status = false;
+  }
+
+  double rms_temp_error = sqrt(temp_error / ndays);
+
+  test_status &= rms_temp_error < 1.0 && max_ice_error < 0.05 * peak_ice && peak_ice > 0.0;
+
+  std::cout<<BLUE<<"\n";
+  std::cout<<"*********************************************************\n";
+  std::cout<<"*************** Summary of the Enthalpy Solver Test *****\n";
+  std::cout<<"*********************************************************\n";
+  std::cout<<"Timesteps (daily, hourly)                 = "<< daily.stats.steps <<", "<< hourly.stats.steps <<"\n";
+  std::cout<<"Newton iterations per timestep (daily)    = "<< double(daily.stats.newton_iterations) / daily.stats.steps <<"\n";
+  std::cout<<"Top cell temp. RMS error [K]              = "<< rms_temp_error <<"\n";
+  std::cout<<"Max ice (Schaake) error, peak ice [mm]    = "<< max_ice_error <<", "<< peak_ice <<"\n";
+  std::cout<<"Energy balance (daily, hourly) [W/m2]     = "<< daily.energy_balance <<", "<< hourly.energy_balance <<"\n";
+  std::cout<<"Enthalpy solver test passed? "<< (test_status ? "Yes" : "No") <<"\n";
+  std::cout<<RESET<<"\n";
+
+  return test_status ? 0 : 1;
+}
@@ -0,0 +1,139 @@
+/*
+  Exactness test of the vectorizable elementary functions (include/soil_freeze_thaw_math.hxx) against the
+  libm functions and a long double reference. The arguments are sampled over the ranges used by the model
+  with the soil parameters of examples/configs (sft/cat-20521.txt and the soil types of
+  nom/parameters/SOILPARM.TBL): b in [2.79, 11.55], smcmax in [0.2, 0.484], satpsi in [0.036, 0.955] and
+  soil temperatures down to 223.15 K. The errors in ULP must stay below the bounds documented in the header.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <iostream>
+#include <cmath>
+#include <random>
+#include "../include/soil_freeze_thaw_math.hxx"
+
+#define BLUE  "\033[34m"
+#define RESET "\033[0m"
+
+using namespace soilfreezethaw;
+
+struct ErrorStats {
+  double max_ulp      = 0.0; // against the long double reference
+  double max_ulp_libm = 0.0; // against libm
+  double bound        = 0.0; // largest documented bound over the samples
+  bool   bounded      = true;
+
+  void Add(double value, long double reference, double libm, double bound_sample)
+  {
+    double r = (double)reference;
+    double ulp = std::nextafter(std::fabs(r), INFINITY) - std::fabs(r);
+    double ulp_libm = std::nextafter(std::fabs(libm), INFINITY) - std::fabs(libm);
+    double err = (double)(std::fabs((long double)value - reference) / ulp);
+    double err_libm = std::fabs(value - libm) / ulp_libm;
+
+    max_ulp      = std::max(max_ulp, err);
+    max_ulp_libm = std::max(max_ulp_libm, err_libm);
+    bound        = std::max(bound, bound_sample);
+    // libm is within 2 ULP of the reference (log10 of glibc, the other functions are within 1 ULP)
+    bounded &= err < bound_sample && err_libm <= bound_sample + 2.0;
+  }
+};
+
+static bool Report(const char *name, const ErrorStats &s)
+{
+  printf("%-36s: max error [ULP] = %6.3f (libm: %6.3f), bound = %6.3f, passed = %s\n", name, s.max_ulp,
+	 s.max_ulp_libm, s.bound, s.bounded ? "Yes" : "No");
+  return s.bounded;
+}
+
+int main(int argc, char *argv[])
+{
+  std::cout<<"\n**************** BEGIN SoilFreezeThaw MATH UNIT TEST *******************\n";
+
+#ifdef SFT_LIBM_MATH
+  std::cout<<"Built with SFT_LIBM_MATH (libm functions), nothing to test\n";
+  std::cout<<"Math functions test passed? Yes\n";
+  return 0;
+#endif
+
+  const int nsamples = 1000000;
+  const double tcice   = 2.2;
+  const double tcwater = 0.57;
+  const double tfrez   = 273.15;
+  const double latent_heat_fusion = 0.3336E06;
+  const double grav    = 9.86;
+
+  std::mt19937_64 gen(20240901);
+  auto uniform = [&gen](double a, double b) { return std::uniform_real_distribution<double>(a, b)(gen); };
+
+  bool test_status = true;
+
+  // generic ranges
+  ErrorStats log_stats, exp_stats, log10_stats;
+  for (int n=0; n<nsamples; n++) {
+    double x = std::exp(uniform(-700.0, 700.0));
+    log_stats.Add(math::Log(x), logl((long double)x), log(x), 1.0);
+    log10_stats.Add(math::Log10(x), log10l((long double)x), log10(x), 1.0);
+
+    double y = uniform(-700.0, 700.0);
+    exp_stats.Add(math::Exp(y), expl((long double)y), exp(y), 1.0);
+  }
+  test_status &= Report("Log(x), x in [e^-700, e^700]", log_stats);
+  test_status &= Report("Log10(x), x in [e^-700, e^700]", log10_stats);
+  test_status &= Report("Exp(x), x in [-700, 700]", exp_stats);
+
+  // Peters-Lidard saturated thermal conductivity: tcice^(smcmax - xu), tcwater^xu
+  ErrorStats tc_stats;
+  for (int n=0; n<nsamples; n++) {
+    double smcmax = uniform(0.2, 0.484);
+    double xu = uniform(0.0, 1.0) * smcmax;
+    double y = smcmax - xu;
+    tc_stats.Add(math::Pow(tcice, y), powl(tcice, y), pow(tcice, y), 1.0 + 0.2 * std::fabs(y * log(tcice)));
+    tc_stats.Add(math::Pow(tcwater, xu), powl(tcwater, xu), pow(tcwater, xu), 1.0 + 0.2 * std::fabs(xu * log(tcwater)));
+  }
+  test_status &= Report("Pow(tcice|tcwater, fraction)", tc_stats);
+
+  // Kersten number: log10(sat_ratio), sat_ratio in (0.05, 1]
+  ErrorStats kn_stats;
+  for (int n=0; n<nsamples; n++) {
+    double sat_ratio = uniform(0.05, 1.0);
+    kn_stats.Add(math::Log10(sat_ratio), log10l(sat_ratio), log10(sat_ratio), 1.0);
+  }
+  test_status &= Report("Log10(sat_ratio)", kn_stats);
+
+  // supercooled liquid water: (smp/satpsi)^(-1/b), smp from the freezing-point depression
+  ErrorStats sc_stats;
+  bool positive_identical = true; // PowPositive (phase change kernel) is Pow without the special cases
+  for (int n=0; n<nsamples; n++) {
+    double b      = uniform(2.79, 11.55);
+    double satpsi = uniform(0.036, 0.955);
+    double T      = tfrez - std::exp(uniform(std::log(1.0e-6), std::log(50.0)));
+    double smp    = latent_heat_fusion / (grav * T) * (tfrez - T);
+    double x      = smp / satpsi;
+    double lam    = -1.0 / b;
+    sc_stats.Add(math::Pow(x, lam), powl(x, lam), pow(x, lam), 1.0 + 0.2 * std::fabs(lam * log(x)));
+    positive_identical &= math::PowPositive(x, lam) == math::Pow(x, lam);
+  }
+  test_status &= Report("Pow(smp/satpsi, -1/b)", sc_stats);
+  printf("%-36s: passed = %s\n", "PowPositive(smp/satpsi, -1/b) == Pow", positive_identical ? "Yes" : "No");
+  test_status &= positive_identical;
+
+  // special values
+  bool special = std::isinf(math::Log(0.0)) && std::isnan(math::Log(-1.0)) && math::Log(1.0) == 0.0
+    && math::Exp(0.0) == 1.0 && math::Exp(-800.0) == 0.0 && std::isinf(math::Exp(800.0))
+    && math::Pow(2.0, 0.0) == 1.0 && math::Pow(1.0, 3.5) == 1.0 && math::Pow(0.0, 2.0) == 0.0
+    && std::isinf(math::Pow(0.0, -2.0)) && std::isnan(math::Pow(-2.0, 0.5)) && math::Log10(1000.0) == 3.0;
+  printf("%-36s: passed = %s\n", "Special values", special ? "Yes" : "No");
+  test_status &= special;
+
+  std::cout<<BLUE<<"\n";
+  std::cout<<"*********************************************************\n";
+  std::cout<<"*************** Summary of the Math Unit Test ***********\n";
+  std::cout<<"*********************************************************\n";
+  std::cout<<"Samples per function = "<< nsamples <<"\n";
+  std::cout<<"Math functions test passed? "<< (test_status ? "Yes" : "No") <<"\n";
+  std::cout<<RESET<<"\n";
+
+  return test_status ? 0 : 1;
+}
@@ -0,0 +1,179 @@
+/*
+  Validation of the single- and mixed-precision batch engines: runs the Laramie standalone case (hourly
+  ground temperature forcing, ~1024 days) with SoilFreezeThawBatch (double), SoilFreezeThawBatchMixed
+  (float solver, double states) and SoilFreezeThawBatchSingle (float solver and moisture states) and compares the
+  hourly ice_fraction_schaake against the double precision golden output (tests/file_golden.csv).
+  The test fails if the drift exceeds the bounds below or if the energy balance check throws (the cumulative
+  energy balance tolerance is the same in all precisions).
+  Built with -DSFT_LIBM_MATH (libm elementary functions), the double precision run must reproduce the golden output
+  exactly as it was written (default stream precision); the vectorizable functions of soil_freeze_thaw_math.hxx
+  (default build) are within 1 ULP of libm and drift within the bounds only.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <cmath>
+#include <chrono>
+#include "../include/soil_freeze_thaw.hxx"
+#include "../include/soil_freeze_thaw_batch.hxx"
+
+#define BLUE  "\033[34m"
+#define RESET "\033[0m"
+
+using namespace soilfreezethaw;
+
+// drift bounds of ice_fraction_schaake [m] relative to the golden output (peak ice fraction is ~0.49 m)
+static const double max_error_bound = 5.0E-3;
+static const double rms_error_bound = 1.0E-4;
+
+static std::vector<double> ReadGroundTemperature(const char *filename)
+{
+  std::ifstream infile(filename);
+  if (!infile)
+    throw std::runtime_error("Can't open the forcing file " + std::string(filename));
+
+  std::vector<double> ground_temp;
+  std::string line;
+  std::getline(infile, line); // header
+
+  while (std::getline(infile, line)) {
+    size_t pos = line.find_last_of(',');
+    if (pos != std::string::npos)
+      ground_temp.push_back(atof(line.substr(pos + 1).c_str()));
+  }
+  return ground_temp;
+}
+
+static std::vector<double> ReadGolden(const char *filename)
+{
+  std::ifstream infile(filename);
+  if (!infile)
+    throw std::runtime_error("Can't open the golden file " + std::string(filename));
+
+  std::vector<double> ice_fraction;
+  std::string line;
+  int a;
+  double b;
+  char c;
+  std::getline(infile, line); // header
+
+  while ((infile >> a >> c >> b) && (c == ','))
+    ice_fraction.push_back(b);
+  return ice_fraction;
+}
+
+/* the value as written to the golden file by sft_standalone (default stream precision) */
+static double Written(double value)
+{
+  std::ostringstream out;
+  out << value;
+  return atof(out.str().c_str());
+}
+
+/* runs the column through a batch of type Batch and returns the hourly ice_fraction_schaake */
+template <typename Batch>
+static bool Run(const char *config_file, const std::vector<double> &ground_temp, int nsteps,
+		std::vector<double> &ice_fraction, double &energy_balance, double &seconds)
+{
+  SoilFreezeThaw model(config_file);
+  std::vector<SoilFreezeThaw*> columns(1, &model);
+  Batch batch(columns);
+
+  ice_fraction.assign(nsteps, 0.0);
+  energy_balance = 0.0;
+  auto t0 = std::chrono::steady_clock::now();
+  try {
+    for (int n=0; n<nsteps; n++) {
+      batch.ground_temp[0] = ground_temp[n];
+      batch.Advance();
+      ice_fraction[n] = batch.ice_fraction_schaake[0];
+      energy_balance  = std::max(energy_balance, fabs(batch.energy_balance[0]));
+    }
+  }
+  catch (const std::runtime_error &e) {
+    std::cout<<"  "<<e.what()<<"\n";
+    return false;
+  }
+  seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+  return true;
+}
+
+static bool Compare(const char *name, bool completed, const std::vector<double> &ice_fraction,
+		    const std::vector<double> &golden, double energy_balance, double seconds)
+{
+  double max_error = 0.0;
+  double sum_error = 0.0;
+  for (size_t n=0; n<golden.size(); n++) {
+    double error = fabs(ice_fraction[n] - golden[n]);
+    max_error  = std::max(max_error, error);
+    sum_error += error * error;
+  }
+  double rms_error = sqrt(sum_error / golden.size());
+  bool status = completed && max_error < max_error_bound && rms_error < rms_error_bound;
+
+  printf("%-8s : max error [m] = %9.3e, RMS error [m] = %9.3e, max |energy balance| [W/m2] = %9.3e, "
+	 "time [s] = %6.3f, passed = %s\n", name, max_error, rms_error, energy_balance, seconds, status ? "Yes" : "No");
+  return status;
+}
+
+/* true if the run writes the golden output exactly */
+static bool CompareExact(const char *name, const std::vector<double> &ice_fraction, const std::vector<double> &golden)
+{
+  int ndiff = 0;
+  for (size_t n=0; n<golden.size(); n++)
+    ndiff += Written(ice_fraction[n]) != golden[n];
+
+  printf("%-8s : timesteps differing from the golden output = %d, passed = %s\n", name, ndiff, ndiff == 0 ? "Yes" : "No");
+  return ndiff == 0;
+}
+
+int main(int argc, char *argv[])
+{
+  if (argc != 4) {
+    printf("Usage: ./run_unittest.sh \n\n");
+    return 1;
+  }
+
+  std::cout<<"\n**************** BEGIN SoilFreezeThaw PRECISION UNIT TEST *******************\n";
+
+  std::vector<double> ground_temp = ReadGroundTemperature(argv[2]);
+  std::vector<double> golden      = ReadGolden(argv[3]);
+  int nsteps = std::min(golden.size(), ground_temp.size());
+  golden.resize(nsteps);
+
+  std::vector<double> ice_fraction;
+  double energy_balance = 0.0;
+  double seconds = 0.0;
+  bool test_status = true;
+  bool completed;
+
+  completed = Run<SoilFreezeThawBatch>(argv[1], ground_temp, nsteps, ice_fraction, energy_balance, seconds);
+  test_status &= Compare("double", completed, ice_fraction, golden, energy_balance, seconds);
+#ifdef SFT_LIBM_MATH
+  test_status &= completed && CompareExact("double", ice_fraction, golden);
+#endif
+
+  completed = Run<SoilFreezeThawBatchMixed>(argv[1], ground_temp, nsteps, ice_fraction, energy_balance, seconds);
+  test_status &= Compare("mixed", completed, ice_fraction, golden, energy_balance, seconds);
+
+  completed = Run<SoilFreezeThawBatchSingle>(argv[1], ground_temp, nsteps, ice_fraction, energy_balance, seconds);
+  test_status &= Compare("single", completed, ice_fraction, golden, energy_balance, seconds);
+
+  std::cout<<BLUE<<"\n";
+  std::cout<<"*********************************************************\n";
+  std::cout<<"*************** Summary of the Precision Unit Test ******\n";
+  std::cout<<"*********************************************************\n";
+  std::cout<<"Timesteps                        = "<< nsteps <<"\n";
+  std::cout<<"Ice fraction drift bounds [m]    = "<< max_error_bound <<" (max), "<< rms_error_bound <<" (RMS)\n";
+#ifdef SFT_LIBM_MATH
+  std::cout<<"Elementary functions             = libm, double reproduces the golden output exactly\n";
+#endif
+  std::cout<<"Precision test passed? "<< (test_status ? "Yes" : "No") <<"\n";
+  std::cout<<RESET<<"\n";
+
+  return test_status ? 0 : 1;
+}
@@ -0,0 +1,148 @@
+/*
+  Unit test of the bulk forcing (BmiSoilFreezeThaw::SetForcingSeries) and of UpdateUntil:
+  - a ground temperature and soil moisture series run by one UpdateUntil gives outputs and a final state bitwise
+    identical to SetValue + Update at every step, and the recorded outputs equal the values after each step
+  - UpdateUntil a whole number of timesteps ahead takes no fractional step, a fractional target ends at the
+    target time, a target in the past does nothing
+  - after the series is exhausted the steps keep the last forcing and are not recorded
+  - time per step of both drivers
+  The ground temperature drives the column through freezing and thawing (as main_unittest_alloc.cxx).
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <iostream>
+#include <vector>
+#include <cmath>
+#include <chrono>
+#include "../bmi/bmi.hxx"
+#include "../include/bmi_soil_freeze_thaw.hxx"
+#include "../include/soil_freeze_thaw.hxx"
+
+#define BLUE  "\033[34m"
+#define RESET "\033[0m"
+
+const int nsteps = 480;
+
+static double GroundTemperature(int n)
+{
+  return 280.15 + (n < 200 ? -0.5 * n : -100.0 + 0.5 * (n - 200));
+}
+
+static bool Identical(BmiSoilFreezeThaw &a, BmiSoilFreezeThaw &b, int ncells)
+{
+  std::vector<double> ta(ncells), tb(ncells);
+  a.GetValue("soil_temperature_profile", ta.data());
+  b.GetValue("soil_temperature_profile", tb.data());
+  bool identical = ta == tb && a.GetCurrentTime() == b.GetCurrentTime();
+  for (const char *name : {"ice_fraction_schaake", "ice_fraction_xinanjiang", "soil_ice_fraction",
+			   "ground_heat_flux"}) {
+    double va, vb;
+    a.GetValue(name, &va);
+    b.GetValue(name, &vb);
+    identical &= va == vb;
+  }
+  return identical;
+}
+
+int main(int argc, char *argv[])
+{
+  if (argc != 2) {
+    printf("Usage: ./run_unittest.sh \n\n");
+    return 1;
+  }
+
+  std::cout<<"\n**************** BEGIN SoilFreezeThaw BULK FORCING UNIT TEST *******************\n";
+
+  BmiSoilFreezeThaw stepped, bulk;
+  stepped.Initialize(argv[1]);
+  bulk.Initialize(argv[1]);
+
+  int ncells;
+  stepped.GetValue("num_cells", &ncells);
+  const double dt = stepped.GetTimeStep();
+
+  // forcing: ground temperature, and soil moisture drying by 0.01 % per step
+  std::vector<double> ground_temp(nsteps), moisture(nsteps * ncells), initial_moisture(ncells);
+  stepped.GetValue("soil_moisture_profile", initial_moisture.data());
+  for (int n=0; n<nsteps; n++) {
+    ground_temp[n] = GroundTemperature(n);
+    for (int i=0; i<ncells; i++)
+      moisture[n * ncells + i] = initial_moisture[i] * (1.0 - 1.0e-4 * n);
+  }
+
+  bool test_status = true;
+
+  std::cout<<BLUE<<"\n";
+  std::cout<<"*********************************************************\n";
+  std::cout<<"*************** Summary of the Bulk Forcing Unit Test ***\n";
+  std::cout<<"*********************************************************\n";
+
+  // per-step round trips, outputs of each step
+  std::vector<double> ice_schaake(nsteps), profiles(nsteps * ncells);
+  auto t0 = std::chrono::steady_clock::now();
+  for (int n=0; n<nsteps; n++) {
+    stepped.SetValue("ground_temperature", &ground_temp[n]);
+    stepped.SetValue("soil_moisture_profile", &moisture[n * ncells]);
+    stepped.Update();
+    stepped.GetValue("ice_fraction_schaake", &ice_schaake[n]);
+    stepped.GetValue("soil_temperature_profile", &profiles[n * ncells]);
+  }
+  auto t1 = std::chrono::steady_clock::now();
+
+  // the series at once
+  bulk.SetForcingSeries(ground_temp.data(), nsteps, moisture.data());
+  auto t2 = std::chrono::steady_clock::now();
+  bulk.UpdateUntil(nsteps * dt);
+  auto t3 = std::chrono::steady_clock::now();
+
+  const double *bulk_schaake = bulk.GetOutputSeries("ice_fraction_schaake");
+  const double *bulk_profiles = bulk.GetOutputSeries("soil_temperature_profile");
+  bool identical = bulk.GetSeriesStepCount() == nsteps && Identical(stepped, bulk, ncells);
+  double max_ice = 0.0;
+  for (int n=0; n<nsteps; n++) {
+    identical &= bulk_schaake[n] == ice_schaake[n];
+    max_ice = std::max(max_ice, ice_schaake[n]);
+  }
+  for (int k=0; k<nsteps * ncells; k++)
+    identical &= bulk_profiles[k] == profiles[k];
+  identical &= max_ice > 0.0;
+
+  double us_stepped = 1.0e6 * std::chrono::duration<double>(t1 - t0).count() / nsteps;
+  double us_bulk = 1.0e6 * std::chrono::duration<double>(t3 - t2).count() / nsteps;
+  printf("Series of %d steps identical to per-step SetValue/Update = %s (max ice_fraction_schaake = %.4f)\n",
+	 nsteps, identical ? "Yes" : "No", max_ice);
+  printf("Per-step SetValue/Update/GetValue : %7.3f us/step\n", us_stepped);
+  printf("SetForcingSeries + UpdateUntil    : %7.3f us/step, speedup = %5.2f\n", us_bulk, us_stepped / us_bulk);
+  test_status &= identical;
+
+  // the series is exhausted: the steps keep the last forcing and are not recorded
+  stepped.Update();
+  bulk.UpdateUntil((nsteps + 1) * dt);
+  bool exhausted = bulk.GetSeriesStepCount() == nsteps && Identical(stepped, bulk, ncells);
+  printf("Steps after the series keep the last forcing = %s\n", exhausted ? "Yes" : "No");
+  test_status &= exhausted;
+
+  // UpdateUntil: whole steps take no fractional step, fractional targets end at the target, past targets
+  BmiSoilFreezeThaw model;
+  model.Initialize(argv[1]);
+  model.UpdateUntil(3 * dt);
+  bool until = model.GetCurrentTime() == 3 * dt;
+  model.UpdateUntil(4.5 * dt);
+  until &= std::fabs(model.GetCurrentTime() - 4.5 * dt) < 1.0e-6 && model.GetTimeStep() == dt;
+  model.UpdateUntil(2 * dt);
+  until &= std::fabs(model.GetCurrentTime() - 4.5 * dt) < 1.0e-6;
+  model.UpdateUntil(6.5 * dt);
+  until &= std::fabs(model.GetCurrentTime() - 6.5 * dt) < 1.0e-6;
+  printf("UpdateUntil ends at the target time          = %s\n", until ? "Yes" : "No");
+  test_status &= until;
+
+  std::cout<<"Bulk forcing test passed? "<< (test_status ? "Yes" : "No") <<"\n";
+  std::cout<<RESET<<"\n";
+
+  stepped.Finalize();
+  bulk.Finalize();
+  model.Finalize();
+
+  return test_status ? 0 : 1;
+}
@@ -0,0 +1,230 @@
+/*
+  Unit test of the runtime selection of the kernel instruction set (simd_path, see soil_freeze_thaw_simd.hxx):
+  - ParseSimdPath: auto is the widest supported path, unknown names and paths the CPU lacks are errors
+  - the environment variable SFT_SIMD_PATH takes precedence over the config key, an invalid value is an error of the
+    initialization from the config file (not of the default constructor)
+  - every path supported by the CPU gives results bitwise identical to the scalar path, for the specialized
+    kernels (4 cells), the fused generic kernel (64 cells, with and without constitutive tables), the unfused
+    kernels and the partitioned solver (512 cells), through a freezing and thawing cycle
+  - time per cell and timestep of each path (512 cells, freezing)
+  Built with -O3 by run_unittest.sh: the per-cell loops are vectorized by the compiler in optimized builds only.
+  The 4-cell column is read from the config file, the larger columns refine its soil discretization.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <cmath>
+#include <chrono>
+#include <stdexcept>
+#include "../include/soil_freeze_thaw.hxx"
+
+#define BLUE  "\033[34m"
+#define RESET "\033[0m"
+
+using namespace soilfreezethaw;
+
+const SimdPath paths[4] = {SimdPath::Scalar, SimdPath::SSE2, SimdPath::AVX2, SimdPath::AVX512};
+
+// writes a copy of the config file with ncells cells down to 2 m, 0.1 m top and bottom cells (the boundary fluxes
+// are explicit in the temperatures of these cells) and uniform cells in between, and the extra config lines
+static std::string RefineConfig(const std::string &config_file, int ncells, const std::string &extra)
+{
+  std::ifstream fp(config_file);
+  std::string out_file = "simd_" + std::to_string(ncells) + "cells.txt";
+  std::ofstream out(out_file);
+  std::string line;
+
+  std::stringstream z, temp, moisture;
+  for (int i=0; i<ncells; i++) {
+    std::string sep = i < ncells-1 ? "," : "";
+    z << (i < ncells-1 ? 0.1 + 1.8 * i / (ncells-2) : 2.0) << sep;
+    temp << 280.15 << sep;
+    moisture << (i < ncells/4 ? 0.389 : 0.397) << sep;
+  }
+
+  while (std::getline(fp, line)) {
+    std::string key = line.substr(0, line.find("="));
+    if (key == "soil_z" && ncells != 4)
+      out << "soil_z=" << z.str() << "[m]\n";
+    else if (key == "soil_temperature" && ncells != 4)
+      out << "soil_temperature=" << temp.str() << "[K]\n";
+    else if ((key == "soil_moisture_content" || key == "soil_liquid_content") && ncells != 4)
+      out << key << "=" << moisture.str() << "[]\n";
+    else
+      out << line << "\n";
+  }
+  out << extra;
+  return out_file;
+}
+
+// ground temperature cycling between 263 K and 283 K over 10 days
+static double GroundTemperature(int n)
+{
+  return 273.15 + 10.0 * std::sin(2.0 * M_PI * n / 240.0);
+}
+
+// seconds per timestep (the fastest of 4 segments of the run), -1 if the energy balance check fails
+static double Run(SoilFreezeThaw &model, int nsteps)
+{
+  double seconds = 1.0e30;
+  try {
+    for (int segment=0; segment<4; segment++) {
+      auto t0 = std::chrono::steady_clock::now();
+      for (int n=segment*nsteps/4; n<(segment+1)*nsteps/4; n++) {
+	model.ground_temp = GroundTemperature(n);
+	model.Advance();
+      }
+      auto t1 = std::chrono::steady_clock::now();
+      seconds = std::min(seconds, std::chrono::duration<double>(t1 - t0).count() / (nsteps/4));
+    }
+  }
+  catch (const std::runtime_error &e) {
+    std::cout<<"  "<<e.what()<<"\n";
+    return -1.0;
+  }
+  return seconds;
+}
+
+static bool Identical(const SoilFreezeThaw &a, const SoilFreezeThaw &b)
+{
+  bool identical = a.energy_consumed == b.energy_consumed && a.energy_balance == b.energy_balance;
+  for (int i=0; i<a.ncells; i++) {
+    identical &= a.soil_temperature[i] == b.soil_temperature[i];
+    identical &= a.soil_ice_content[i] == b.soil_ice_content[i];
+    identical &= a.soil_liquid_content[i] == b.soil_liquid_content[i];
+    identical &= a.thermal_conductivity[i] == b.thermal_conductivity[i];
+    identical &= a.heat_capacity[i] == b.heat_capacity[i];
+  }
+  return identical;
+}
+
+// all supported paths against the scalar path; the timing of each path is reported if timing is true
+static bool ComparePaths(const std::string &config_file, const std::string &name, int ncells, const std::string &extra,
+			 bool fused, int nsteps, bool timing)
+{
+  std::string config = RefineConfig(config_file, ncells, extra);
+  SoilFreezeThaw scalar(config);
+  scalar.simd_path_option = "scalar";
+  scalar.SelectKernels(true, fused);
+  double sec_scalar = Run(scalar, nsteps);
+
+  double max_ice = 0.0;
+  for (int i=0; i<ncells; i++)
+    max_ice = std::max(max_ice, scalar.soil_ice_content[i]);
+  bool status = sec_scalar > 0 && max_ice > 0;
+
+  for (int p=1; p<4; p++) {
+    if (!IsSupported(paths[p])) {
+      std::cout<<name<<", "<<SimdPathName(paths[p])<<": not supported by this CPU\n";
+      continue;
+    }
+    SoilFreezeThaw model(config);
+    model.simd_path_option = SimdPathName(paths[p]);
+    model.SelectKernels(true, fused);
+    double sec = Run(model, nsteps);
+    bool identical = sec > 0 && model.simd_path == paths[p] && Identical(scalar, model);
+
+    std::cout<<name<<", "<<SimdPathName(paths[p])<<": identical to scalar = "<<(identical ? "Yes" : "No");
+    if (timing)
+      std::cout<<", "<<1.0e9 * sec / ncells<<" ns/cell-step (scalar "<<1.0e9 * sec_scalar / ncells
+	       <<"), speedup = "<<sec_scalar / sec;
+    std::cout<<"\n";
+    status &= identical;
+  }
+  remove(config.c_str());
+  return status;
+}
+
+int main(int argc, char *argv[])
+{
+  if (argc != 2) {
+    printf("Usage: ./run_unittest.sh \n\n");
+    return 1;
+  }
+
+  std::cout<<"\n**************** BEGIN SoilFreezeThaw SIMD PATH UNIT TEST *******************\n";
+
+  bool test_status = true;
+
+  std::cout<<BLUE<<"\n";
+  std::cout<<"*********************************************************\n";
+  std::cout<<"*************** Summary of the SIMD Path Unit Test ******\n";
+  std::cout<<"*********************************************************\n";
+
+  // names of the paths
+  bool parsed = ParseSimdPath("auto") == BestSimdPath() && ParseSimdPath("scalar") == SimdPath::Scalar;
+  for (const char *name : {"avx3", ""}) {
+    try {
+      ParseSimdPath(name);
+      parsed = false;
+    }
+    catch (const std::runtime_error &e) {}
+  }
+  for (int p=1; p<4; p++) {
+    try {
+      parsed &= ParseSimdPath(SimdPathName(paths[p])) == paths[p] && IsSupported(paths[p]);
+    }
+    catch (const std::runtime_error &e) {
+      parsed &= !IsSupported(paths[p]);
+    }
+  }
+  std::cout<<"Widest supported path = "<<SimdPathName(BestSimdPath())<<", names parsed = "<<(parsed ? "Yes" : "No")
+	   <<"\n";
+  test_status &= parsed;
+
+  // SFT_SIMD_PATH overrides the config key
+  {
+    std::string config = RefineConfig(argv[1], 4, "simd_path=" + std::string(SimdPathName(BestSimdPath())) + "\n");
+    SoilFreezeThaw model(config);
+    bool selected = model.simd_path == BestSimdPath();
+    setenv("SFT_SIMD_PATH", "scalar", 1);
+    model.SelectKernels();
+    selected &= model.simd_path == SimdPath::Scalar;
+    unsetenv("SFT_SIMD_PATH");
+    model.SelectKernels();
+    selected &= model.simd_path == BestSimdPath();
+    remove(config.c_str());
+    std::cout<<"SFT_SIMD_PATH overrides simd_path = "<<(selected ? "Yes" : "No")<<"\n";
+    test_status &= selected;
+  }
+
+  // an invalid SFT_SIMD_PATH is reported when the model is initialized from its config file, not by the default
+  // constructor (BMI object creation)
+  {
+    std::string config = RefineConfig(argv[1], 4, "");
+    setenv("SFT_SIMD_PATH", "sse5", 1);
+    bool deferred = true;
+    try {
+      SoilFreezeThaw model;
+      deferred &= model.ncells == 0 && model.kernel_cells == 0 && model.simd_path == SimdPath::Scalar;
+    }
+    catch (const std::runtime_error &e) {
+      deferred = false;
+    }
+    try {
+      SoilFreezeThaw model(config);
+      deferred = false;
+    }
+    catch (const std::runtime_error &e) {}
+    unsetenv("SFT_SIMD_PATH");
+    remove(config.c_str());
+    std::cout<<"Invalid SFT_SIMD_PATH reported at initialization = "<<(deferred ? "Yes" : "No")<<"\n";
+    test_status &= deferred;
+  }
+
+  test_status &= ComparePaths(argv[1], "4 cells (specialized kernels)", 4, "", true, 960, false);
+  test_status &= ComparePaths(argv[1], "64 cells (fused)", 64, "", true, 960, false);
+  test_status &= ComparePaths(argv[1], "64 cells (unfused)", 64, "", false, 960, false);
+  test_status &= ComparePaths(argv[1], "64 cells (tables)", 64, "constitutive_tables=true\n", true, 960, false);
+  test_status &= ComparePaths(argv[1], "512 cells (partitioned)", 512, "partitioned_solver_cells=256\n", true, 960,
+			      true);
+  test_status &= ComparePaths(argv[1], "512 cells (Thomas)", 512, "partitioned_solver_cells=0\n", true, 960, true);
+
+  std::cout<<"SIMD path test passed? "<< (test_status ? "Yes" : "No") <<"\n";
+  std::cout<<RESET<<"\n";
+
+  return test_status ? 0 : 1;
+}
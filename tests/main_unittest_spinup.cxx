@@ -0,0 +1,294 @@
+/*
+  Unit test of the spin-up and its cache (SoilFreezeThaw::Spinup, config keys spinup_*):
+  - the spin-up equals running the forcing window spinup_cycles times from the initial state, with the clock and
+    the cumulative energy balance restarted
+  - the first spin-up with spinup_cache_dir is a miss and stores the state, the second one is a hit: the restored
+    state and the following run are bitwise identical to the spun-up ones
+  - BMI Initialize spins up (and uses the cache) transparently
+  - another forcing window, soil parameter, initial profile or model version changes the fingerprint (miss); a
+    truncated cache file is ignored and replaced; a cache directory that cannot be created is an error
+  - time of the spin-up with a miss and with a hit
+  - spin-up to periodic equilibrium (spinup_tolerance, enthalpy scheme): plain cycling and Anderson mixing both
+    converge to the same periodic state, Anderson mixing in less than a quarter of the cycles; one more cycle of the
+    window changes the spun-up state less than the tolerances; a spin-up that reaches spinup_cycles first reports
+    that it did not converge; with the split scheme (specialized phase change kernel) both converge as well
+  The forcing file (ground temperature cycling through freezing and thawing) and the configs are written by the
+  test from the config file.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <vector>
+#include <cmath>
+#include <chrono>
+#include <stdexcept>
+#include <unistd.h>
+#include "../bmi/bmi.hxx"
+#include "../include/bmi_soil_freeze_thaw.hxx"
+#include "../include/soil_freeze_thaw.hxx"
+
+#define BLUE  "\033[34m"
+#define RESET "\033[0m"
+
+using namespace soilfreezethaw;
+
+const std::string cache_dir    = "spinup_cache_unittest";
+const std::string forcing_file = "spinup_forcing_unittest.csv";
+const int nforcing = 2400;
+
+// ground temperature cycling between 263 K and 283 K over 20 days
+static double GroundTemperature(int n)
+{
+  return 273.15 + 10.0 * std::sin(2.0 * M_PI * n / 480.0);
+}
+
+// copy of the config file with the spin-up keys and the extra lines (replacing the keys they set)
+static std::string SpinupConfig(const std::string &config_file, const std::string &name, const std::string &extra)
+{
+  std::ifstream fp(config_file);
+  std::string out_file = "spinup_" + name + ".txt";
+  std::ofstream out(out_file);
+  std::string line;
+  while (std::getline(fp, line)) {
+    std::string key = line.substr(0, line.find("="));
+    if (extra.find(key + "=") == std::string::npos)
+      out << line << "\n";
+  }
+  out << "spinup_forcing_file=" << forcing_file << "\nspinup_cycles=2\nspinup_cache_dir=" << cache_dir << "\n" << extra;
+  return out_file;
+}
+
+static std::string Checkpoint(SoilFreezeThaw &model)
+{
+  std::ostringstream os;
+  model.SaveCheckpoint(os);
+  return os.str();
+}
+
+// spins up a model of the config, returns the cache result
+static std::string Spinup(const std::string &config, std::string &checkpoint, double &ms)
+{
+  SoilFreezeThaw model(config);
+  auto t0 = std::chrono::steady_clock::now();
+  model.Spinup();
+  ms = 1.0e3 * std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+  checkpoint = Checkpoint(model);
+  return model.spinup_cache_result;
+}
+
+int main(int argc, char *argv[])
+{
+  if (argc != 2) {
+    printf("Usage: ./run_unittest.sh \n\n");
+    return 1;
+  }
+
+  std::cout<<"\n**************** BEGIN SoilFreezeThaw SPIN-UP CACHE UNIT TEST *******************\n";
+
+  if (system(("rm -rf " + cache_dir).c_str()) != 0)
+    return 1;
+  {
+    std::ofstream out(forcing_file);
+    out << "time,TMP_2maboveground,TMP_ground_surface\n";
+    for (int n=0; n<nforcing; n++)
+      out << n << ",270.0," << GroundTemperature(n) << "\n";
+  }
+  const std::string config = SpinupConfig(argv[1], "base", "");
+  bool test_status = true;
+
+  std::cout<<BLUE<<"\n";
+  std::cout<<"*********************************************************\n";
+  std::cout<<"*************** Summary of the Spin-up Cache Unit Test **\n";
+  std::cout<<"*********************************************************\n";
+
+  // the spin-up against the forcing window run by hand
+  std::string spun_up, cached;
+  double ms_miss, ms_hit;
+  {
+    SoilFreezeThaw reference(argv[1]);
+    std::vector<double> forcing = ReadGroundTemperatureForcing(forcing_file);
+    for (int cycle=0; cycle<2; cycle++) {
+      for (double temperature : forcing) {
+	reference.ground_temp = temperature;
+	reference.Advance();
+      }
+    }
+    reference.time = 0.0;
+    reference.energy_balance = 0.0;
+    reference.energy_balance_compensation = 0.0;
+
+    bool miss = Spinup(config, spun_up, ms_miss) == "miss" && int(forcing.size()) == nforcing;
+    bool equal = miss && spun_up == Checkpoint(reference);
+    double max_ice = 0.0;
+    for (int i=0; i<reference.ncells; i++)
+      max_ice = std::max(max_ice, reference.soil_ice_content[i]);
+    equal &= max_ice > 0.0;
+    printf("First spin-up is a miss and equals the forcing run by hand = %s (%.2f ms)\n", equal ? "Yes" : "No",
+	   ms_miss);
+    test_status &= equal;
+  }
+
+  // second spin-up of the same config: hit, identical state and run
+  {
+    bool hit = Spinup(config, cached, ms_hit) == "hit" && cached == spun_up;
+    SoilFreezeThaw a(config), b(config);
+    a.spinup_cache_dir = "";
+    a.Spinup();
+    b.Spinup();
+    hit &= a.spinup_cache_result == "off" && b.spinup_cache_result == "hit";
+    for (int n=0; n<480; n++) {
+      a.ground_temp = b.ground_temp = GroundTemperature(n + 100);
+      a.Advance();
+      b.Advance();
+    }
+    hit &= Checkpoint(a) == Checkpoint(b);
+    printf("Second spin-up is a hit, state and run identical        = %s (%.2f ms, speedup = %.0f)\n",
+	   hit ? "Yes" : "No", ms_hit, ms_miss / ms_hit);
+    test_status &= hit;
+  }
+
+  // BMI Initialize spins up
+  {
+    BmiSoilFreezeThaw model;
+    model.Initialize(config);
+    SoilFreezeThaw reference(config);
+    reference.Spinup();
+    std::vector<double> temperature(reference.ncells);
+    model.GetValue("soil_temperature_profile", temperature.data());
+    bool bmi = model.GetCurrentTime() == 0.0;
+    for (int i=0; i<reference.ncells; i++)
+      bmi &= temperature[i] == reference.soil_temperature[i];
+    printf("BMI Initialize spins up                                 = %s\n", bmi ? "Yes" : "No");
+    test_status &= bmi;
+    model.Finalize();
+  }
+
+  // fingerprints: forcing window, soil parameter, initial profile, model version
+  {
+    std::string checkpoint;
+    double ms;
+    bool invalidated = Spinup(SpinupConfig(argv[1], "window", "spinup_steps=2000\n"), checkpoint, ms) == "miss";
+    invalidated &= Spinup(SpinupConfig(argv[1], "quartz", "soil_params.quartz=0.5[]\n"), checkpoint, ms) == "miss";
+    invalidated &= Spinup(SpinupConfig(argv[1], "profile", "soil_temperature=280.15,280.15,280.15,280.16[K]\n"),
+			  checkpoint, ms) == "miss";
+    invalidated &= Spinup(SpinupConfig(argv[1], "window", "spinup_steps=2000\n"), checkpoint, ms) == "hit";
+    SoilFreezeThaw model(config);
+    std::vector<double> forcing = ReadGroundTemperatureForcing(forcing_file);
+    invalidated &= model.SpinupFingerprint(forcing) != model.SpinupFingerprint(forcing, "0.0.0");
+    printf("Fingerprint changes with the forcing window, soil parameters, profiles and version = %s\n",
+	   invalidated ? "Yes" : "No");
+    test_status &= invalidated;
+  }
+
+  // a truncated cache file is ignored and replaced
+  {
+    SoilFreezeThaw model(config);
+    model.Spinup();
+    std::string file = model.spinup_cache_file;
+    bool replaced = truncate(file.c_str(), 100) == 0;
+    std::string checkpoint;
+    double ms;
+    replaced &= Spinup(config, checkpoint, ms) == "miss" && checkpoint == spun_up;
+    replaced &= Spinup(config, checkpoint, ms) == "hit" && checkpoint == spun_up;
+    printf("Truncated cache file replaced                           = %s\n", replaced ? "Yes" : "No");
+    test_status &= replaced;
+  }
+
+  // the cache directory cannot be created (its parent is a file): the spin-up reports it
+  {
+    SoilFreezeThaw model(config);
+    model.spinup_cache_dir = forcing_file + "/cache";
+    bool reported = false;
+    try {
+      model.Spinup();
+    }
+    catch (const std::runtime_error &e) {
+      reported = std::string(e.what()).find(model.spinup_cache_dir) != std::string::npos;
+    }
+    printf("Cache directory that cannot be created reported         = %s\n", reported ? "Yes" : "No");
+    test_status &= reported;
+  }
+
+  // periodic equilibrium of a window of one forcing period, plain cycling and Anderson mixing
+  {
+    const std::string equilibrium = "phase_change_scheme=enthalpy\nspinup_steps=480\nspinup_cycles=500\n"
+      "spinup_tolerance=1.0e-4\n";
+    SoilFreezeThaw plain(SpinupConfig(argv[1], "plain", equilibrium + "spinup_anderson_depth=0\n"));
+    SoilFreezeThaw anderson(SpinupConfig(argv[1], "anderson", equilibrium + "spinup_anderson_depth=5\n"));
+    auto t0 = std::chrono::steady_clock::now();
+    plain.Spinup();
+    auto t1 = std::chrono::steady_clock::now();
+    anderson.Spinup();
+    auto t2 = std::chrono::steady_clock::now();
+
+    // the mixed start states are put on the freezing curve of the enthalpy scheme (RepartitionEnthalpy), the
+    // mixing then needs less than a quarter of the cycles
+    bool converged = plain.spinup_converged && anderson.spinup_converged
+      && 4 * anderson.spinup_cycles_used < plain.spinup_cycles_used;
+    double difference = 0.0;
+    for (int i=0; i<plain.ncells; i++)
+      difference = std::max(difference, fabs(plain.soil_temperature[i] - anderson.soil_temperature[i]));
+    converged &= difference < 0.01;
+
+    // one more cycle by hand
+    std::vector<double> temperature(anderson.soil_temperature, anderson.soil_temperature + anderson.ncells);
+    std::vector<double> ice(anderson.soil_ice_content, anderson.soil_ice_content + anderson.ncells);
+    for (int n=0; n<480; n++) {
+      anderson.ground_temp = GroundTemperature(n);
+      anderson.Advance();
+    }
+    for (int i=0; i<anderson.ncells; i++) {
+      converged &= fabs(anderson.soil_temperature[i] - temperature[i]) < anderson.spinup_tolerance;
+      converged &= fabs(anderson.soil_ice_content[i] - ice[i]) < anderson.spinup_ice_tolerance;
+    }
+
+    // too few cycles
+    SoilFreezeThaw limited(SpinupConfig(argv[1], "limited", equilibrium + "spinup_cycles=2\n"));
+    limited.Spinup();
+    converged &= !limited.spinup_converged && limited.spinup_cycles_used == 2;
+    printf("Periodic equilibrium, plain cycling %d cycles (%.2f ms), Anderson mixing %d cycles (%.2f ms) = %s\n",
+	   plain.spinup_cycles_used, 1.0e3 * std::chrono::duration<double>(t1 - t0).count(),
+	   anderson.spinup_cycles_used, 1.0e3 * std::chrono::duration<double>(t2 - t1).count(), converged ? "Yes" : "No");
+    test_status &= converged;
+  }
+
+  // Anderson mixing with the split scheme: the mixed start states are partitioned by the phase change kernel
+  // selected for the column (4 cells)
+  {
+    const std::string equilibrium = "phase_change_scheme=split\nspinup_steps=480\nspinup_cycles=500\n"
+      "spinup_tolerance=1.0e-4\n";
+    SoilFreezeThaw plain(SpinupConfig(argv[1], "split_plain", equilibrium + "spinup_anderson_depth=0\n"));
+    SoilFreezeThaw anderson(SpinupConfig(argv[1], "split_anderson", equilibrium + "spinup_anderson_depth=5\n"));
+    plain.Spinup();
+    anderson.Spinup();
+    bool converged = plain.spinup_converged && anderson.spinup_converged && anderson.kernel_cells == anderson.ncells
+      && anderson.spinup_cycles_used <= plain.spinup_cycles_used;
+    printf("Split scheme, plain cycling %d cycles, Anderson mixing %d cycles = %s\n", plain.spinup_cycles_used,
+	   anderson.spinup_cycles_used, converged ? "Yes" : "No");
+    test_status &= converged;
+  }
+
+  // without the soil moisture of the config there is nothing to spin up
+  {
+    SoilFreezeThaw model(SpinupConfig(argv[1], "bmi", "soil_moisture_bmi=1\n"));
+    bool rejected = false;
+    try {
+      model.Spinup();
+    }
+    catch (const std::runtime_error &e) {
+      rejected = true;
+    }
+    printf("Spin-up with soil_moisture_bmi rejected                 = %s\n", rejected ? "Yes" : "No");
+    test_status &= rejected;
+  }
+
+  test_status &= system(("rm -rf " + cache_dir + " spinup_*.txt " + forcing_file).c_str()) == 0;
+
+  std::cout<<"Spin-up cache test passed? "<< (test_status ? "Yes" : "No") <<"\n";
+  std::cout<<RESET<<"\n";
+
+  return test_status ? 0 : 1;
+}
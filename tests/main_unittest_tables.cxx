@@ -0,0 +1,203 @@
+/*
+  Unit test for the tabulated constitutive relations (constitutive_tables, config configs/unittest_tables.txt):
+  - models of the same soil type share one set of tables, a different soil type gets its own tables and the
+    tables are released with the last model using them
+  - the errors against the analytic curves measured at build time stay below the bounds below and decrease
+    as O(1/resolution^2), the tabulated curves are monotone
+  - an adaptive run (sub-steps of varying dt) of the only model of its soil type builds its tables once
+  - the Laramie case (hourly ground temperature forcing, ~1024 days) with the tables stays close to the run
+    with the analytic curves (ice_fraction_schaake, same drift bounds as the precision test: the ice fraction
+    reacts to small differences in a freezing cell with isolated spikes of a few mm) and passes the energy
+    balance check
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <cmath>
+#include <chrono>
+#include <memory>
+#include <stdexcept>
+#include "../include/soil_freeze_thaw.hxx"
+
+#define BLUE  "\033[34m"
+#define RESET "\033[0m"
+
+using namespace soilfreezethaw;
+
+// bounds of the table errors at resolution 64 and of the ice fraction drift
+static const double supercool_error_bound = 1.0E-4; // [-]
+static const double tc_sat_error_bound    = 1.0E-4; // [W/(mK)]
+static const double log_sat_error_bound   = 1.0E-4; // [-]
+static const double max_error_bound       = 5.0E-3; // [m]
+static const double rms_error_bound       = 1.0E-4; // [m]
+
+static std::vector<double> ReadGroundTemperature(const char *filename)
+{
+  std::ifstream infile(filename);
+  if (!infile)
+    throw std::runtime_error("Can't open the forcing file " + std::string(filename));
+
+  std::vector<double> ground_temp;
+  std::string line;
+  std::getline(infile, line); // header
+
+  while (std::getline(infile, line)) {
+    size_t pos = line.find_last_of(',');
+    if (pos != std::string::npos)
+      ground_temp.push_back(atof(line.substr(pos + 1).c_str()));
+  }
+  return ground_temp;
+}
+
+/* advances the model through the forcing, returns false if the energy balance check fails */
+static bool Run(SoilFreezeThaw &model, const std::vector<double> &ground_temp, std::vector<double> &ice_fraction,
+		double &seconds)
+{
+  ice_fraction.assign(ground_temp.size(), 0.0);
+  auto t0 = std::chrono::steady_clock::now();
+  try {
+    for (size_t n=0; n<ground_temp.size(); n++) {
+      model.ground_temp = ground_temp[n];
+      model.Advance();
+      ice_fraction[n] = model.ice_fraction_schaake;
+    }
+  }
+  catch (const std::runtime_error &e) {
+    std::cout<<"  "<<e.what()<<"\n";
+    return false;
+  }
+  seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+  return true;
+}
+
+int main(int argc, char *argv[])
+{
+  if (argc != 3) {
+    printf("Usage: ./run_unittest.sh \n\n");
+    return 1;
+  }
+
+  std::cout<<"\n**************** BEGIN SoilFreezeThaw CONSTITUTIVE TABLES UNIT TEST *******************\n";
+
+  bool test_status = true;
+
+  // sharing: same soil type, same tables
+  SoilFreezeThaw model(argv[1]);
+  SoilFreezeThaw model_same(argv[1]);
+  const ConstitutiveTables *tables = model.GetConstitutiveTables();
+  bool shared = tables != NULL && tables == model_same.GetConstitutiveTables() && ConstitutiveTables::RegistrySize() == 1;
+  {
+    SoilFreezeThaw model_other(argv[1]);
+    model_other.smcmax = 0.3;
+    model_other.InvalidateInvariants();
+    shared &= model_other.GetConstitutiveTables() != tables && ConstitutiveTables::RegistrySize() == 2;
+  }
+  shared &= ConstitutiveTables::RegistrySize() == 1;
+  printf("%-44s: passed = %s\n", "Tables shared by soil type", shared ? "Yes" : "No");
+  test_status &= shared;
+
+  // adaptive sub-steps change dt, the tables of the soil type are built once
+  {
+    const std::string config = argv[1];
+    SoilFreezeThaw adaptive(config.substr(0, config.find_last_of('/') + 1) + "unittest_adaptive.txt");
+    adaptive.constitutive_tables = true;
+    adaptive.constitutive_table_resolution = 64;
+    adaptive.quartz = 0.5; // soil type of no other model
+    adaptive.InvalidateInvariants();
+    long builds = ConstitutiveTables::BuildCount();
+    auto t0 = std::chrono::steady_clock::now();
+    for (int n=0; n<200; n++) {
+      adaptive.ground_temp = 273.15 + 10.0 * std::sin(2.0 * M_PI * n / 60.0);
+      adaptive.Advance();
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+    builds = ConstitutiveTables::BuildCount() - builds;
+    bool once = builds == 1 && adaptive.GetConstitutiveTables() != NULL;
+    printf("%-44s: tables built = %ld, time [s] = %6.3f, passed = %s\n", "Adaptive timestep, 200 steps", builds,
+	   seconds, once ? "Yes" : "No");
+    test_status &= once;
+  }
+
+  // errors measured at build time, and their convergence
+  bool bounded = tables->error_supercool < supercool_error_bound && tables->error_tc_sat < tc_sat_error_bound
+    && tables->error_log_sat < log_sat_error_bound;
+  printf("%-44s: supercooled water = %9.3e, tc_sat = %9.3e, Kersten = %9.3e, passed = %s\n",
+	 "Max errors (resolution 64)", tables->error_supercool, tables->error_tc_sat, tables->error_log_sat,
+	 bounded ? "Yes" : "No");
+  test_status &= bounded;
+
+  ConstitutiveTables::Key key = tables->key;
+  key.resolution = 256;
+  std::shared_ptr<const ConstitutiveTables> fine = ConstitutiveTables::Get(key, NULL);
+  bool converged = fine->error_supercool < tables->error_supercool / 8.0 && fine->error_tc_sat < tables->error_tc_sat / 8.0
+    && fine->error_log_sat < tables->error_log_sat / 8.0;
+  printf("%-44s: supercooled water = %9.3e, tc_sat = %9.3e, Kersten = %9.3e, passed = %s\n",
+	 "Max errors (resolution 256)", fine->error_supercool, fine->error_tc_sat, fine->error_log_sat,
+	 converged ? "Yes" : "No");
+  test_status &= converged;
+
+  // monotone tabulated curves
+  bool monotone = true;
+  double previous = tables->supercool(1.0E-6);
+  for (int n=1; n<=200000; n++) {
+    double value = tables->supercool(1.0E-6 * std::pow(1.0E8, n / 200000.0)); // supercooling up to 100 K
+    monotone &= value <= previous;
+    previous = value;
+  }
+  previous = tables->tc_sat(0.0);
+  for (int n=1; n<=100000; n++) {
+    double value = tables->tc_sat(key.smcmax * n / 100000.0);
+    monotone &= value <= previous;
+    previous = value;
+  }
+  previous = tables->log_sat(0.05);
+  for (int n=1; n<=100000; n++) {
+    double value = tables->log_sat(0.05 + 0.95 * n / 100000.0);
+    monotone &= value >= previous;
+    previous = value;
+  }
+  printf("%-44s: passed = %s\n", "Monotone tabulated curves", monotone ? "Yes" : "No");
+  test_status &= monotone;
+
+  // Laramie case, tables against the analytic curves
+  std::vector<double> ground_temp = ReadGroundTemperature(argv[2]);
+  int nsteps = std::min((int)ground_temp.size(), int(model.endtime / model.dt + 0.5));
+  ground_temp.resize(nsteps);
+
+  SoilFreezeThaw analytic(argv[1]);
+  analytic.constitutive_tables = false;
+  analytic.InvalidateInvariants();
+
+  std::vector<double> ice_fraction, ice_fraction_analytic;
+  double seconds = 0.0, seconds_analytic = 0.0;
+  bool completed = Run(model, ground_temp, ice_fraction, seconds);
+  completed &= Run(analytic, ground_temp, ice_fraction_analytic, seconds_analytic);
+
+  double max_error = 0.0;
+  double sum_error = 0.0;
+  double max_ice_fraction = 0.0;
+  for (int n=0; n<nsteps; n++) {
+    double error = fabs(ice_fraction[n] - ice_fraction_analytic[n]);
+    max_error  = std::max(max_error, error);
+    sum_error += error * error;
+    max_ice_fraction = std::max(max_ice_fraction, ice_fraction_analytic[n]);
+  }
+  double rms_error = sqrt(sum_error / nsteps);
+  bool matched = completed && max_error < max_error_bound && rms_error < rms_error_bound && max_ice_fraction > 0.1;
+  printf("%-44s: max error [m] = %9.3e, RMS error [m] = %9.3e, time [s] = %6.3f (analytic: %6.3f), passed = %s\n",
+	 "Laramie ice_fraction_schaake", max_error, rms_error, seconds, seconds_analytic, matched ? "Yes" : "No");
+  test_status &= matched;
+
+  std::cout<<BLUE<<"\n";
+  std::cout<<"*********************************************************\n";
+  std::cout<<"*************** Summary of the Tables Unit Test *********\n";
+  std::cout<<"*********************************************************\n";
+  model.PrintStatistics(std::cout);
+  std::cout<<"Constitutive tables test passed? "<< (test_status ? "Yes" : "No") <<"\n";
+  std::cout<<RESET<<"\n";
+
+  return test_status ? 0 : 1;
+}
@@ -0,0 +1,210 @@
+/*
+  Unit test of the batched tridiagonal kernel (SolveTridiagonalBatch): batches of diagonally dominant systems in
+  interleaved layout, in double and single precision, with a few singular systems
+  - every code path supported by the CPU (scalar, SSE2, AVX2, AVX-512) gives bitwise identical solutions and
+    reports exactly the singular systems (failed lanes, zero solutions)
+  - a system of the batch is bitwise identical to SoilFreezeThaw::SolverTDMA
+  - throughput of the paths (ns per row and system), batch of 4096 systems of 4 and 32 rows
+  The number of systems is not a multiple of the vector widths (remaining systems of the scalar loop).
+  Partitioned solver (PartitionedTridiagonal): systems of sizes that are not multiples of the partition count
+  (e.g. 1281 rows with 4 threads, where the rounded-up rows per partition cover n with fewer partitions) and
+  1 to 4 threads agree with SoilFreezeThaw::SolverTDMA, and only the last partition reaches past n.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <iostream>
+#include <vector>
+#include <cmath>
+#include <chrono>
+#include <random>
+#include "../include/soil_freeze_thaw.hxx"
+
+#define BLUE  "\033[34m"
+#define RESET "\033[0m"
+
+using namespace soilfreezethaw;
+
+const SimdPath paths[4] = {SimdPath::Scalar, SimdPath::SSE2, SimdPath::AVX2, SimdPath::AVX512};
+
+template <typename Real>
+struct Batch {
+  int n, N;
+  std::vector<Real> a, b, c, d;
+  std::vector<int>  singular;
+
+  // random systems, b = 1 - a - c as the diffusion matrix; the pivot of row 2 of the singular systems is zero
+  Batch(int n, int N, unsigned seed) : n(n), N(N), a(n*N), b(n*N), c(n*N), d(n*N), singular(N, 0)
+  {
+    std::mt19937 rng(seed);
+    std::uniform_real_distribution<double> u(0.0, 1.0);
+    for (int i=0; i<n; i++) {
+      for (int s=0; s<N; s++) {
+	const int k = i * N + s;
+	a[k] = i > 0 ? -u(rng) : 0.0;
+	c[k] = i < n-1 ? -u(rng) : 0.0;
+	b[k] = 1 - a[k] - c[k];
+	d[k] = u(rng) - 0.5;
+      }
+    }
+    const int zero[3] = {3, 17, N-1};
+    for (int z=0; z<3; z++) {
+      singular[zero[z]] = 1;
+      a[2 * N + zero[z]] = 0;
+      b[2 * N + zero[z]] = 0;
+    }
+  }
+
+  int Solve(SimdPath path, std::vector<Real> &X, std::vector<int> &failed)
+  {
+    std::vector<Real> P(n*N), Q(n*N);
+    X.assign(n*N, Real(1));
+    failed.assign(N, -1);
+    return SolveTridiagonalBatch(n, N, a.data(), b.data(), c.data(), d.data(), X.data(), P.data(), Q.data(),
+				 failed.data(), path);
+  }
+};
+
+// all supported paths against the scalar path
+template <typename Real>
+static bool TestPaths(const char *name, int n, int N)
+{
+  Batch<Real> batch(n, N, 7);
+  std::vector<Real> X_scalar, X;
+  std::vector<int> failed_scalar, failed;
+  int nfailed_scalar = batch.Solve(SimdPath::Scalar, X_scalar, failed_scalar);
+
+  bool status = nfailed_scalar == 3 && failed_scalar == batch.singular;
+  for (int s=0; s<N; s++) {
+    if (batch.singular[s]) {
+      for (int i=0; i<n; i++)
+	status &= X_scalar[i * N + s] == Real(0);
+    }
+  }
+
+  for (int p=1; p<4; p++) {
+    if (!IsSupported(paths[p])) {
+      printf("%-8s %3d rows x %4d systems, %-6s : not supported by this CPU\n", name, n, N, SimdPathName(paths[p]));
+      continue;
+    }
+    int nfailed = batch.Solve(paths[p], X, failed);
+    bool identical = nfailed == nfailed_scalar && failed == failed_scalar && X == X_scalar;
+    printf("%-8s %3d rows x %4d systems, %-6s : failed systems = %d, identical to scalar = %s\n", name, n, N,
+	   SimdPathName(paths[p]), nfailed, identical ? "Yes" : "No");
+    status &= identical;
+  }
+  return status;
+}
+
+// throughput of the paths, ns per row and system
+template <typename Real>
+static void Throughput(const char *name, int n, int N)
+{
+  Batch<Real> batch(n, N, 11);
+  std::vector<Real> X(n*N), P(n*N), Q(n*N);
+  std::vector<int> failed(N);
+  const int nsolves = std::max(10, 40000000 / (n * N));
+
+  double ns_scalar = 0.0;
+  for (int p=0; p<4; p++) {
+    if (!IsSupported(paths[p]))
+      continue;
+    auto t0 = std::chrono::steady_clock::now();
+    for (int r=0; r<nsolves; r++)
+      SolveTridiagonalBatch(n, N, batch.a.data(), batch.b.data(), batch.c.data(), batch.d.data(), X.data(), P.data(),
+			    Q.data(), failed.data(), paths[p]);
+    auto t1 = std::chrono::steady_clock::now();
+    double ns = 1.0e9 * std::chrono::duration<double>(t1 - t0).count() / nsolves / (n * N);
+    if (p == 0)
+      ns_scalar = ns;
+    printf("%-8s %3d rows x %4d systems, %-6s : %6.3f ns/row-system, speedup = %5.2f\n", name, n, N,
+	   SimdPathName(paths[p]), ns, ns_scalar / ns);
+  }
+}
+
+// partitioned solver against the Thomas algorithm, diagonally dominant system of n rows
+static bool TestPartitioned(SoilFreezeThaw &model, int n, int threads)
+{
+  std::mt19937 rng(n + threads);
+  std::uniform_real_distribution<double> offdiag(-1.0, 0.0), rhs(-1.0, 1.0);
+  std::vector<double> a(n), b(n), c(n), d(n), X_tdma, X(n);
+  for (int i=0; i<n; i++) {
+    a[i] = offdiag(rng);
+    c[i] = offdiag(rng);
+    b[i] = 2.5 - a[i] - c[i];
+    d[i] = rhs(rng);
+  }
+  model.SolverTDMA(a, b, c, d, X_tdma);
+
+  PartitionedTridiagonal solver;
+  solver.SetThreads(threads);
+  bool status = solver.Factor(n, a.data(), b.data(), c.data());
+  status &= (solver.partitions - 1) * solver.rows < n && solver.partitions * solver.rows >= n;
+  solver.Solve(d.data(), X.data());
+  double max_error = 0.0;
+  for (int i=0; i<n; i++)
+    max_error = std::max(max_error, std::abs(X[i] - X_tdma[i]));
+  status &= max_error < 1.0e-12;
+  printf("Partitioned %5d rows, %d threads (%4d partitions x %3d rows): max error = %.2e, passed = %s\n", n, threads,
+	 solver.partitions, solver.rows, max_error, status ? "Yes" : "No");
+  return status;
+}
+
+int main(int argc, char *argv[])
+{
+  if (argc != 2) {
+    printf("Usage: ./run_unittest.sh \n\n");
+    return 1;
+  }
+
+  std::cout<<"\n**************** BEGIN SoilFreezeThaw BATCHED TRIDIAGONAL UNIT TEST *******************\n";
+
+  bool test_status = true;
+
+  std::cout<<BLUE<<"\n";
+  std::cout<<"*********************************************************\n";
+  std::cout<<"*************** Summary of the Tridiagonal Unit Test ****\n";
+  std::cout<<"*********************************************************\n";
+  std::cout<<"Widest supported path: "<<SimdPathName(BestSimdPath())<<"\n";
+
+  test_status &= TestPaths<double>("double", 4, 1003);
+  test_status &= TestPaths<double>("double", 32, 37);
+  test_status &= TestPaths<float>("float", 4, 1003);
+  test_status &= TestPaths<float>("float", 32, 37);
+
+  // one system of the batch against the single-column solver
+  SoilFreezeThaw model(argv[1]);
+  Batch<double> batch(32, 37, 5);
+  std::vector<double> X_batch;
+  std::vector<int> failed;
+  batch.Solve(BestSimdPath(), X_batch, failed);
+
+  const int s = 20;
+  std::vector<double> a(32), b(32), c(32), d(32), X;
+  for (int i=0; i<32; i++) {
+    a[i] = batch.a[i * 37 + s];
+    b[i] = batch.b[i * 37 + s];
+    c[i] = batch.c[i * 37 + s];
+    d[i] = batch.d[i * 37 + s];
+  }
+  bool identical = model.SolverTDMA(a, b, c, d, X);
+  for (int i=0; i<32; i++)
+    identical &= X[i] == X_batch[i * 37 + s];
+  printf("%-44s: passed = %s\n", "Batch system == SoilFreezeThaw::SolverTDMA", identical ? "Yes" : "No");
+  test_status &= identical;
+
+  for (int n : {3, 17, 1000, 1281, 4097, 63489}) {
+    for (int threads=1; threads<=4; threads++)
+      test_status &= TestPartitioned(model, n, threads);
+  }
+
+  Throughput<double>("double", 4, 4096);
+  Throughput<double>("double", 32, 4096);
+  Throughput<float>("float", 4, 4096);
+  Throughput<float>("float", 32, 4096);
+
+  std::cout<<"Batched tridiagonal test passed? "<< (test_status ? "Yes" : "No") <<"\n";
+  std::cout<<RESET<<"\n";
+
+  return test_status ? 0 : 1;
+}
@@ -1,5 +1,46 @@
 #!/bin/bash
-${CXX} -lm -Wall -O -g ./main_unittest.cxx ../src/bmi_soil_freeze_thaw.cxx ../src/soil_freeze_thaw.cxx -o run_sft
-./run_sft configs/unittest.txt
-rm -f run_sft
-rm -rf run_sft.dSYM
+# every test is built and run; the exit status is 1 if any build or test failed
+status=0
+${CXX} -lm -Wall -O -g ./main_unittest.cxx ../src/bmi_soil_freeze_thaw.cxx ../src/soil_freeze_thaw.cxx ../src/soil_freeze_thaw_tridiagonal.cxx ../src/soil_freeze_thaw_simd.cxx ../src/soil_freeze_thaw_tables.cxx -o run_sft || status=1
+./run_sft configs/unittest.txt || status=1
+${CXX} -lm -Wall -O -g ./main_unittest_batch.cxx ../src/soil_freeze_thaw_batch.cxx ../src/soil_freeze_thaw.cxx ../src/soil_freeze_thaw_tridiagonal.cxx ../src/soil_freeze_thaw_simd.cxx ../src/soil_freeze_thaw_tables.cxx -o run_sft_batch || status=1
+./run_sft_batch configs/unittest.txt || status=1
+${CXX} -lm -Wall -O -g ./main_benchmark_batch.cxx ../src/soil_freeze_thaw_batch.cxx ../src/soil_freeze_thaw.cxx ../src/soil_freeze_thaw_tridiagonal.cxx ../src/soil_freeze_thaw_simd.cxx ../src/soil_freeze_thaw_tables.cxx -o run_sft_batch_bench || status=1
+./run_sft_batch_bench configs/unittest.txt || status=1
+${CXX} -lm -Wall -O -g ./main_unittest_alloc.cxx ../src/bmi_soil_freeze_thaw.cxx ../src/soil_freeze_thaw.cxx ../src/soil_freeze_thaw_tridiagonal.cxx ../src/soil_freeze_thaw_simd.cxx ../src/soil_freeze_thaw_tables.cxx -o run_sft_alloc || status=1
+./run_sft_alloc configs/unittest.txt || status=1
+${CXX} -lm -Wall -O -g ./main_unittest_adaptive.cxx ../src/soil_freeze_thaw.cxx ../src/soil_freeze_thaw_tridiagonal.cxx ../src/soil_freeze_thaw_simd.cxx ../src/soil_freeze_thaw_tables.cxx -o run_sft_adaptive || status=1
+./run_sft_adaptive configs/unittest_adaptive.txt || status=1
+${CXX} -lm -Wall -O -g ./main_unittest_enthalpy.cxx ../src/soil_freeze_thaw.cxx ../src/soil_freeze_thaw_tridiagonal.cxx ../src/soil_freeze_thaw_simd.cxx ../src/soil_freeze_thaw_tables.cxx -o run_sft_enthalpy || status=1
+./run_sft_enthalpy configs/unittest.txt || status=1
+${CXX} -lm -Wall -O -g ./main_benchmark_kernels.cxx ../src/soil_freeze_thaw.cxx ../src/soil_freeze_thaw_tridiagonal.cxx ../src/soil_freeze_thaw_simd.cxx ../src/soil_freeze_thaw_tables.cxx -o run_sft_kernels || status=1
+./run_sft_kernels configs/unittest.txt || status=1
+${CXX} -lm -Wall -O -g ./main_unittest_precision.cxx ../src/soil_freeze_thaw_batch.cxx ../src/soil_freeze_thaw.cxx ../src/soil_freeze_thaw_tridiagonal.cxx ../src/soil_freeze_thaw_simd.cxx ../src/soil_freeze_thaw_tables.cxx -o run_sft_precision || status=1
+./run_sft_precision ../configs/laramie_config_standalone.txt ../forcings/Laramie_14Jun09_to_15Apr12.csv file_golden.csv || status=1
+${CXX} -DSFT_LIBM_MATH -lm -Wall -O -g ./main_unittest_precision.cxx ../src/soil_freeze_thaw_batch.cxx ../src/soil_freeze_thaw.cxx ../src/soil_freeze_thaw_tridiagonal.cxx ../src/soil_freeze_thaw_simd.cxx ../src/soil_freeze_thaw_tables.cxx -o run_sft_precision_libm || status=1
+./run_sft_precision_libm ../configs/laramie_config_standalone.txt ../forcings/Laramie_14Jun09_to_15Apr12.csv file_golden.csv || status=1
+${CXX} -lm -Wall -O -g ./main_unittest_math.cxx -o run_sft_math || status=1
+./run_sft_math || status=1
+${CXX} -lm -Wall -O -g ./main_unittest_tables.cxx ../src/soil_freeze_thaw.cxx ../src/soil_freeze_thaw_tridiagonal.cxx ../src/soil_freeze_thaw_simd.cxx ../src/soil_freeze_thaw_tables.cxx -o run_sft_tables || status=1
+./run_sft_tables configs/unittest_tables.txt ../forcings/Laramie_14Jun09_to_15Apr12.csv || status=1
+${CXX} -lm -Wall -O -g ./main_benchmark_assembly.cxx ../src/soil_freeze_thaw_batch.cxx ../src/soil_freeze_thaw.cxx ../src/soil_freeze_thaw_tridiagonal.cxx ../src/soil_freeze_thaw_simd.cxx ../src/soil_freeze_thaw_tables.cxx -o run_sft_assembly || status=1
+./run_sft_assembly configs/unittest.txt || status=1
+${CXX} -lm -Wall -O -g ./main_benchmark_tridiagonal.cxx ../src/soil_freeze_thaw.cxx ../src/soil_freeze_thaw_tridiagonal.cxx ../src/soil_freeze_thaw_simd.cxx ../src/soil_freeze_thaw_tables.cxx -o run_sft_tridiagonal || status=1
+./run_sft_tridiagonal configs/unittest.txt || status=1
+${CXX} -lm -Wall -O -g ./main_unittest_tridiagonal.cxx ../src/soil_freeze_thaw.cxx ../src/soil_freeze_thaw_tridiagonal.cxx ../src/soil_freeze_thaw_simd.cxx ../src/soil_freeze_thaw_tables.cxx -o run_sft_batch_tdma || status=1
+./run_sft_batch_tdma configs/unittest.txt || status=1
+${CXX} -lm -Wall -O3 -fno-trapping-math -g ./main_unittest_simd.cxx ../src/soil_freeze_thaw.cxx ../src/soil_freeze_thaw_tridiagonal.cxx ../src/soil_freeze_thaw_simd.cxx ../src/soil_freeze_thaw_tables.cxx -o run_sft_simd || status=1
+./run_sft_simd configs/unittest.txt || status=1
+${CXX} -lm -Wall -O -g ./main_benchmark_bmi.cxx ../src/bmi_soil_freeze_thaw.cxx ../src/soil_freeze_thaw.cxx ../src/soil_freeze_thaw_tridiagonal.cxx ../src/soil_freeze_thaw_simd.cxx ../src/soil_freeze_thaw_tables.cxx -o run_sft_bmi || status=1
+./run_sft_bmi configs/unittest.txt || status=1
+${CXX} -lm -Wall -O -g ./main_unittest_series.cxx ../src/bmi_soil_freeze_thaw.cxx ../src/soil_freeze_thaw.cxx ../src/soil_freeze_thaw_tridiagonal.cxx ../src/soil_freeze_thaw_simd.cxx ../src/soil_freeze_thaw_tables.cxx -o run_sft_series || status=1
+./run_sft_series configs/unittest.txt || status=1
+${CXX} -lm -Wall -O -g ./main_unittest_checkpoint.cxx ../src/bmi_soil_freeze_thaw.cxx ../src/soil_freeze_thaw.cxx ../src/soil_freeze_thaw_tridiagonal.cxx ../src/soil_freeze_thaw_simd.cxx ../src/soil_freeze_thaw_tables.cxx -o run_sft_checkpoint || status=1
+./run_sft_checkpoint configs/unittest.txt || status=1
+${CXX} -lm -Wall -O -g ./main_unittest_checkpoint_store.cxx ../src/soil_freeze_thaw_checkpoint_store.cxx ../src/soil_freeze_thaw.cxx ../src/soil_freeze_thaw_tridiagonal.cxx ../src/soil_freeze_thaw_simd.cxx ../src/soil_freeze_thaw_tables.cxx -o run_sft_checkpoint_store || status=1
+./run_sft_checkpoint_store configs/unittest.txt || status=1
+${CXX} -lm -Wall -O -g ./main_unittest_spinup.cxx ../src/bmi_soil_freeze_thaw.cxx ../src/soil_freeze_thaw.cxx ../src/soil_freeze_thaw_tridiagonal.cxx ../src/soil_freeze_thaw_simd.cxx ../src/soil_freeze_thaw_tables.cxx -o run_sft_spinup || status=1
+./run_sft_spinup configs/unittest.txt || status=1
+rm -f run_sft run_sft_batch run_sft_batch_bench run_sft_alloc run_sft_adaptive run_sft_enthalpy run_sft_kernels run_sft_precision run_sft_precision_libm run_sft_math run_sft_tables run_sft_assembly run_sft_tridiagonal run_sft_batch_tdma run_sft_simd run_sft_bmi run_sft_series run_sft_checkpoint run_sft_checkpoint_store run_sft_spinup
+rm -rf run_sft.dSYM run_sft_batch.dSYM run_sft_batch_bench.dSYM run_sft_alloc.dSYM run_sft_adaptive.dSYM run_sft_enthalpy.dSYM run_sft_kernels.dSYM run_sft_precision.dSYM run_sft_precision_libm.dSYM run_sft_math.dSYM run_sft_tables.dSYM run_sft_assembly.dSYM run_sft_tridiagonal.dSYM run_sft_batch_tdma.dSYM run_sft_simd.dSYM run_sft_bmi.dSYM run_sft_series.dSYM run_sft_checkpoint.dSYM run_sft_checkpoint_store.dSYM run_sft_spinup.dSYM
+exit $status